@@ -2,6 +2,7 @@
 #include <mcp_can.h>
 
 #include <cantt.h>
+#include <cantt_ring.h>
 
 #include <EthernetUdp.h>
 #include <Ethernet.h>
@@ -18,13 +19,26 @@ EthernetUDP UDP;
 #define CAN0_INT 2                                            // Set INT to pin 2
 
 void callback(uint32_t, uint8_t *topic, uint16_t topic_len, uint8_t *payload, uint16_t payload_len);
-uint8_t canAvailable();
-uint8_t canRead(CANMessage &msg);
 uint8_t canSend(const CANMessage &msg);
+uint8_t canFilter(uint8_t index, uint32_t id, uint32_t mask, bool extended);
+
+/*
+ * The UNO has 2 KB of SRAM for the ring, the Ethernet and Serial buffers
+ * and CANTT. This node only forwards what it receives, so it reassembles
+ * two messages at a time and queues a single one to send, about 650 bytes
+ * instead of the 1.1 KB of the default CANTT. Building the library with
+ * CANTT_SUBSCRIPTIONS, CANTT_ALIASES or CANTT_STATS_HISTOGRAMS adds to it.
+ */
+typedef BasicCANTT<CANTT_MAX_RECV_BUFFER, 2, 1> BridgeCANTT;
+
+#if defined(__AVR__)
+static_assert(sizeof(BridgeCANTT) <= 700,
+              "CANTT leaves too little SRAM for the UNO");
+#endif
 
 MCP_CAN CAN0(10);                                             // Set CS to pin 10
-CANTransport CANTR(canAvailable, canRead, canSend);
-CANTT cantt(DEVICE_ID, CANTR, callback);
+CANRingTransport CANTR(canSend);                              // Filled by canISR()
+BridgeCANTT cantt(DEVICE_ID, CANTR, callback);
 
 void callback(uint32_t addr, uint8_t *topic, uint16_t topic_len, uint8_t *payload, uint16_t payload_len) {
   if(!payload_len) {
@@ -61,16 +75,12 @@ void callback(uint32_t addr, uint8_t *topic, uint16_t topic_len, uint8_t *payloa
   Serial.print("\n");
 }
 
-/*
- * Return 1 if there is data to read
- */
-uint8_t canAvailable() {
-  return !digitalRead(CAN0_INT);
-}
-
 uint8_t canRead(CANMessage &msg) {
   uint8_t ret = CAN0.readMsgBuf(&msg.id, &msg.len, msg.data);
 
+  msg.extended = false;
+  msg.rtr = false;
+
   if(msg.id & 0x80000000) {
     msg.extended = true;
     msg.id &= 0x7fffffff;
@@ -84,6 +94,29 @@ uint8_t canRead(CANMessage &msg) {
   return ret;
 }
 
+/*
+ * The MCP2515 pulls INT low while a frame waits in one of its two receive
+ * buffers. Empty both into the ring right away, so frames survive however
+ * long loop() is busy; when the ring is full they are counted in
+ * CANTR.ring.overruns and dropped.
+ */
+void canISR() {
+  CANMessage *msg;
+  CANMessage dropped;
+
+  while(!digitalRead(CAN0_INT)) {
+    msg = CANTR.ring.claim();
+
+    if(msg == NULL) {
+      canRead(dropped);
+      continue;
+    }
+
+    canRead(*msg);
+    CANTR.ring.commit();
+  }
+}
+
 uint8_t canSend(const CANMessage &msg) {
   uint32_t id = msg.id;
 
@@ -98,10 +131,36 @@ uint8_t canSend(const CANMessage &msg) {
   return CAN0.sendMsgBuf(id, msg.len, (uint8_t *)msg.data);
 }
 
+/*
+ * The MCP2515 has two masks: mask 0 belongs to filters 0-1 and mask 1 to
+ * filters 2-5, so it can hold two independent id/mask pairs.
+ */
+uint8_t canFilter(uint8_t index, uint32_t id, uint32_t mask, bool extended) {
+  uint8_t first = index == 0 ? 0 : 2;
+  uint8_t last = index == 0 ? 1 : 5;
+
+  if(!extended) {
+    id <<= 16; // CAN_MCP_lib keeps standard ids in the upper bits
+    mask <<= 16;
+  }
+
+  if(CAN0.init_Mask(index, extended, mask) != CAN_OK) {
+    return 1;
+  }
+
+  for(uint8_t f = first; f <= last; f++) {
+    if(CAN0.init_Filt(f, extended, id) != CAN_OK) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
 void setup() {
   Serial.begin(115200);
 
-  if (CAN0.begin(MCP_ANY, CAN_125KBPS, MCP_16MHZ) == CAN_OK) {
+  if (CAN0.begin(MCP_STDEXT, CAN_125KBPS, MCP_16MHZ) == CAN_OK) {
     CAN0.setMode(MCP_NORMAL);
   }
   Ethernet.begin(mac, ip);
@@ -110,8 +169,21 @@ void setup() {
   // Blinky LED
   pinMode(8, OUTPUT);
 
-  // ISO-TP
+  // ISO-TP, each loop() takes every frame waiting in the ring
   cantt.begin();
+  cantt.setBudget(CANTT_RING_SIZE, 8);
+
+  // Only bridge the sensor nodes 0x100-0x17F, the rest is dropped by the
+  // MCP2515 before it raises an interrupt
+  CANTR.setFilterHook(canFilter, 2);
+  cantt.acceptRange(0x100, 0x17F);
+
+  // The interrupt talks SPI too: every SPI transaction in loop(), CAN or
+  // Ethernet, holds it off until the transaction is done. Level triggered,
+  // INT may already be low by now.
+  pinMode(CAN0_INT, INPUT);
+  SPI.usingInterrupt(digitalPinToInterrupt(CAN0_INT));
+  attachInterrupt(digitalPinToInterrupt(CAN0_INT), canISR, LOW);
 }
 
 void loop() {
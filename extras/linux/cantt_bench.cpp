@@ -0,0 +1,266 @@
+/**
+    CANTT Library
+    cantt_bench.cpp
+    Purpose: Throughput and latency benchmark for CANTT over SocketCAN.
+
+    Drives several CANTT instances on one interface (vcan0 by default).
+    Node 0 publishes (or all nodes with -a), every other node receives.
+    Each payload carries the publish timestamp so the receiving callback
+    can measure publish-to-callback latency.
+
+    Usage: cantt_bench [-i ifname] [-n nodes] [-c count] [-s payload size]
+                       [-w window] [-b budget] [-a] [-1] [-e] [-f]
+*/
+
+#include "cantt.h"
+#include "cantt_platform.h"
+#include "cantt_poller.h"
+#include "cantt_socketcan.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#define BENCH_TOPIC "bench"
+#define BENCH_STALL_TIMEOUT 2000
+#define BENCH_MAX_MESSAGE 1024
+#define BENCH_POLL_WAIT 100
+
+// Large enough for any -s the benchmark accepts
+typedef BasicCANTT<BENCH_MAX_MESSAGE, CANTT_RX_SLOTS, CANTT_TX_QUEUE_SIZE>
+    BenchCANTT;
+
+static std::vector<uint32_t> latencies;
+static uint32_t delivered = 0;
+
+static void callback(uint32_t addr, CANTTspan topic, CANTTspan payload) {
+    uint32_t stamp;
+
+    if (payload.len < sizeof(stamp)) {
+        return;
+    }
+
+    memcpy(&stamp, payload.data, sizeof(stamp));
+    latencies.push_back(cantt_micros() - stamp);
+    delivered++;
+}
+
+static uint32_t percentile(const std::vector<uint32_t> &v, double p) {
+    if (v.empty()) {
+        return 0;
+    }
+
+    return v[(size_t)(p * (v.size() - 1))];
+}
+
+// Adds the durations of one histogram to another
+static void merge(struct CANTThistogram &into,
+                  const struct CANTThistogram &from) {
+    for (int i = 0; i < CANTT_STATS_BUCKETS; i++) {
+        into.buckets[i] += from.buckets[i];
+    }
+    into.count += from.count;
+    into.max = from.max > into.max ? from.max : into.max;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-i ifname] [-n nodes] [-c count] [-s payload size] "
+            "[-w window] [-b budget] [-a] [-1] [-e] [-f]\n",
+            name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    const char *ifname = "vcan0";
+    int nodes = 2;
+    uint32_t count = 1000;
+    uint16_t size = 16;
+    uint32_t window = 1;
+    uint16_t budget = 0;
+    bool allSend = false;
+    bool batched = true;
+    bool polled = false;
+    bool fd = false;
+    CANTTPoller poller;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:n:c:s:w:b:a1ef")) != -1) {
+        switch (opt) {
+        case 'i':
+            ifname = optarg;
+            break;
+        case 'n':
+            nodes = atoi(optarg);
+            break;
+        case 'c':
+            count = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            size = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            window = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            budget = strtoul(optarg, NULL, 0);
+            break;
+        case 'a':
+            allSend = true;
+            break;
+        case '1':
+            batched = false;
+            break;
+        case 'e':
+            polled = true;
+            break;
+        case 'f':
+            fd = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (nodes < 2 || window < 1 || size < sizeof(uint32_t) ||
+        size + sizeof(BENCH_TOPIC) - 1 + 5 > BENCH_MAX_MESSAGE) {
+        usage(argv[0]);
+    }
+
+    if (polled && (nodes > CANTT_POLLER_MAX_BUSES || poller.open() != 0)) {
+        fprintf(stderr, "can not poll %d nodes\n", nodes);
+        return 1;
+    }
+
+    std::vector<SocketCANTransport *> transports;
+    std::vector<BenchCANTT *> instances;
+
+    for (int i = 0; i < nodes; i++) {
+        SocketCANTransport *tr = new SocketCANTransport();
+
+        if (tr->open(ifname, fd) != 0) {
+            perror(ifname);
+            return 1;
+        }
+        tr->batched = batched;
+
+        transports.push_back(tr);
+        instances.push_back(new BenchCANTT(0x100 + i, *tr, callback));
+        instances.back()->setFD(fd);
+        instances.back()->begin();
+        instances.back()->setBudget(budget, budget);
+
+        if (polled && poller.add(*instances.back(), *tr) != 0) {
+            perror("epoll");
+            return 1;
+        }
+    }
+
+    // Every message is delivered to each node except its sender
+    uint32_t expected = count * (nodes - 1);
+    std::vector<uint8_t> payload(size, 0xA5);
+    uint32_t published = 0;
+    uint32_t lastProgress = cantt_millis();
+    uint32_t lastDelivered = 0;
+
+    latencies.reserve(expected);
+
+    uint32_t start = cantt_micros();
+
+    while (delivered < expected) {
+        bool room = published < count &&
+                    published * (nodes - 1) - delivered < window * (nodes - 1);
+
+        if (room) {
+            int sender = allSend ? published % nodes : 0;
+            uint32_t stamp = cantt_micros();
+
+            memcpy(&payload[0], &stamp, sizeof(stamp));
+            if (instances[sender]->publish(
+                    (uint8_t *)BENCH_TOPIC, sizeof(BENCH_TOPIC) - 1,
+                    &payload[0], size) == CANTT_OK) {
+                published++;
+            }
+        }
+
+        if (polled) {
+            // Sleep until the bus has work once the window is full
+            poller.poll(room ? 0 : BENCH_POLL_WAIT);
+        } else {
+            for (int i = 0; i < nodes; i++) {
+                instances[i]->loop();
+            }
+        }
+
+        if (delivered != lastDelivered) {
+            lastDelivered = delivered;
+            lastProgress = cantt_millis();
+        } else if (cantt_millis() - lastProgress > BENCH_STALL_TIMEOUT) {
+            fprintf(stderr, "stalled: %u of %u deliveries\n", delivered,
+                    expected);
+            break;
+        }
+    }
+
+    uint32_t elapsed = cantt_micros() - start;
+    double seconds = elapsed / 1e6;
+    uint32_t frames = 0;
+    uint32_t syscalls = 0;
+
+    struct CANTThistogram send, reassembly;
+    uint32_t collisions = 0;
+    uint32_t holdoffs = 0;
+
+    memset(&send, 0, sizeof(send));
+    memset(&reassembly, 0, sizeof(reassembly));
+
+    for (int i = 0; i < nodes; i++) {
+        const CANTTStats &stats = instances[i]->stats();
+
+        frames += transports[i]->framesSent;
+        syscalls += transports[i]->syscalls;
+        collisions += stats.collisions;
+        holdoffs += stats.holdoffs;
+        merge(send, stats.send);
+        merge(reassembly, stats.reassembly);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("nodes     %d on %s, payload %u bytes, window %u, budget %u\n",
+           nodes, ifname, size, window, polled ? CANTT_POLLER_BUDGET : budget);
+    printf("elapsed   %.3f s\n", seconds);
+    printf("messages  %u published, %u delivered, %.1f msg/s\n", published,
+           delivered, delivered / seconds);
+    printf("frames    %u sent, %.1f frames/s\n", frames, frames / seconds);
+    printf("syscalls  %u, %.2f per frame sent (%s I/O)\n", syscalls,
+           frames ? (double)syscalls / frames : 0.0,
+           batched ? "batched" : "single frame");
+    if (polled) {
+        printf("epoll     %u wakeups, %u loop() calls\n", poller.wakeups,
+               poller.loops);
+    }
+    printf("latency   p50 %u us, p90 %u us, p99 %u us, p99.9 %u us, max %u "
+           "us\n",
+           percentile(latencies, 0.50), percentile(latencies, 0.90),
+           percentile(latencies, 0.99), percentile(latencies, 0.999),
+           latencies.empty() ? 0 : latencies.back());
+    printf("send      p50 %u us, p99 %u us, max %u us (queued to sent, "
+           "bucketed)\n",
+           CANTTStats::percentile(send, 50), CANTTStats::percentile(send, 99),
+           send.max);
+    printf("reassembly p50 %u us, p99 %u us, max %u us\n",
+           CANTTStats::percentile(reassembly, 50),
+           CANTTStats::percentile(reassembly, 99), reassembly.max);
+    printf("bus       %u collisions, %u holdoffs\n", collisions, holdoffs);
+
+    for (int i = 0; i < nodes; i++) {
+        delete instances[i];
+        delete transports[i];
+    }
+
+    return delivered == expected ? 0 : 2;
+}
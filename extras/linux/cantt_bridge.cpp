@@ -0,0 +1,143 @@
+/**
+    CANTT Library
+    cantt_bridge.cpp
+    Purpose: CAN to MQTT bridge daemon.
+
+    Publishes the messages of a SocketCAN interface to an MQTT broker, and
+    the messages the broker delivers under the in prefix on the interface.
+    See cantt_mqtt.h for the topic mapping.
+
+    Usage: cantt_bridge [-a addr] [-b broker] [-p port] [-c id] [-k s]
+                        [-o prefix] [-i prefix] [-f] [-v] ifname
+*/
+
+#include "cantt.h"
+#include "cantt_mqtt.h"
+#include "cantt_socketcan.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BRIDGE_MAX_MESSAGE 1024
+
+// Room for bursts from the broker while the bus is busy
+typedef BasicCANTT<BRIDGE_MAX_MESSAGE, 8, 16> BridgeCANTT;
+
+static CANTTMqttBridge bridge;
+
+static void terminate(int sig) { bridge.stop(); }
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-a addr] [-b broker] [-p port] [-c id] [-k s] "
+            "[-o prefix] [-i prefix] [-f] [-v] ifname\n",
+            name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    uint32_t addr = 0x150;
+    const char *broker = "127.0.0.1";
+    uint16_t port = 1883;
+    const char *clientId = "cantt-bridge";
+    uint16_t keepAlive = 60;
+    const char *outPrefix = "cantt/bus/";
+    const char *inPrefix = "cantt/cmd/";
+    bool fd = false;
+    bool verbose = false;
+    struct sigaction sa;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:b:p:c:k:o:i:fv")) != -1) {
+        switch (opt) {
+        case 'a':
+            addr = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            broker = optarg;
+            break;
+        case 'p':
+            port = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            clientId = optarg;
+            break;
+        case 'k':
+            keepAlive = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            outPrefix = optarg;
+            break;
+        case 'i':
+            inPrefix = optarg;
+            break;
+        case 'f':
+            fd = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (argc - optind != 1 || addr == 0 || addr > CANTT_MAX_ADDR) {
+        usage(argv[0]);
+    }
+
+    if (bridge.setPrefixes(outPrefix, inPrefix) != 0) {
+        fprintf(stderr, "prefixes too long or overlapping\n");
+        return 1;
+    }
+
+    if (bridge.open(broker, port, clientId, keepAlive) != 0) {
+        fprintf(stderr, "%s: can not open\n", broker);
+        return 1;
+    }
+
+    SocketCANTransport *tr = new SocketCANTransport();
+    BridgeCANTT *cantt = new BridgeCANTT(
+        addr, *tr, (void (*)(uint32_t, CANTTspan, CANTTspan))NULL);
+
+    if (tr->open(argv[optind], fd) != 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    cantt->setFD(fd);
+    cantt->begin();
+
+    if (bridge.attach(*cantt, *tr) != 0) {
+        fprintf(stderr, "%s: can not attach\n", argv[optind]);
+        return 1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = terminate;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (bridge.run() != 0) {
+        perror("epoll");
+        return 1;
+    }
+
+    if (verbose) {
+        printf("can to mqtt  %u published, %u dropped, %u writes\n",
+               bridge.published, bridge.dropped, bridge.writes);
+        printf("mqtt to can  %u received, %u rejected, %u too large, %u "
+               "stalls\n",
+               bridge.received, bridge.rejected, bridge.oversize,
+               bridge.stalls);
+        printf("broker       %u connects, %u disconnects\n", bridge.connects,
+               bridge.disconnects);
+    }
+
+    bridge.close();
+
+    return 0;
+}
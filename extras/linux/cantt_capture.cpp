@@ -0,0 +1,565 @@
+/**
+    CANTT Library
+    cantt_capture.cpp
+    Purpose: Recording CAN traffic to candump logs or binary captures, and
+    replaying them into a CANTT instance.
+*/
+
+#include "cantt_capture.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+    Writes a value little-endian
+
+    @param buf where to write it
+    @param value the value
+    @param bytes size of the value
+*/
+static void putLE(uint8_t *buf, uint64_t value, uint8_t bytes) {
+    for (uint8_t i = 0; i < bytes; i++) {
+        buf[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+/**
+    Reads a little-endian value
+
+    @param buf where to read it
+    @param bytes size of the value
+    @return the value
+*/
+static uint64_t getLE(const char *buf, uint8_t bytes) {
+    uint64_t value = 0;
+
+    for (uint8_t i = bytes; i > 0; i--) {
+        value = value << 8 | (uint8_t)buf[i - 1];
+    }
+
+    return value;
+}
+
+/**
+    Value of a hex digit
+
+    @param c the character
+    @return 0 to 15, -1 if it is not a hex digit
+*/
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+
+    return -1;
+}
+
+/**
+    Constructor for the class object.
+
+    @param inner the transport whose frames are recorded
+*/
+CANTTCaptureTransport::CANTTCaptureTransport(CANTransport &inner) {
+    this->inner = &inner;
+    this->file = NULL;
+    this->fileFormat = CANTT_CAPTURE_CANDUMP;
+    this->ifname[0] = '\0';
+    this->framesRecorded = 0;
+    this->errors = 0;
+    this->recordSent = true;
+}
+
+CANTTCaptureTransport::~CANTTCaptureTransport() { this->close(); }
+
+/**
+    Starts recording to a file, replacing what it held
+
+    @param path the file
+    @param format CANTT_CAPTURE_CANDUMP or CANTT_CAPTURE_BINARY
+    @param ifname interface name written on candump lines
+    @return error code
+*/
+int CANTTCaptureTransport::open(const char *path, uint8_t format,
+                                const char *ifname) {
+    uint8_t header[CANTT_CAPTURE_HEADER];
+
+    this->close();
+
+    if (format != CANTT_CAPTURE_CANDUMP && format != CANTT_CAPTURE_BINARY) {
+        return -1;
+    }
+
+    this->file = fopen(path, "wb");
+    if (this->file == NULL) {
+        return -1;
+    }
+    setvbuf(this->file, NULL, _IOFBF, 1 << 16);
+
+    this->fileFormat = format;
+    strncpy(this->ifname, ifname, sizeof(this->ifname) - 1);
+    this->ifname[sizeof(this->ifname) - 1] = '\0';
+
+    if (format == CANTT_CAPTURE_BINARY) {
+        memcpy(header, CANTT_CAPTURE_MAGIC, 8);
+        putLE(&header[8], CANTT_CAPTURE_VERSION, 4);
+
+        if (fwrite(header, sizeof(header), 1, this->file) != 1) {
+            this->close();
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+    Writes out the frames recorded so far
+
+    @return error code
+*/
+int CANTTCaptureTransport::flush() {
+    if (this->file == NULL) {
+        return -1;
+    }
+
+    return fflush(this->file) == 0 ? 0 : -1;
+}
+
+/**
+    Stops recording and closes the file
+*/
+void CANTTCaptureTransport::close() {
+    if (this->file != NULL) {
+        fclose(this->file);
+    }
+    this->file = NULL;
+}
+
+/**
+    Writes a frame to the file
+
+    @param msg the frame
+    @param sent true for a frame sent by this node
+*/
+void CANTTCaptureTransport::record(const CANMessage &msg, bool sent) {
+    uint8_t buf[CANTT_CAPTURE_RECORD + CANTT_FRAME_DATASIZE];
+    struct timespec ts;
+    uint8_t len = msg.len > sizeof(msg.data) ? sizeof(msg.data) : msg.len;
+    int n;
+
+    if (this->file == NULL) {
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    if (this->fileFormat == CANTT_CAPTURE_CANDUMP) {
+        n = fprintf(this->file, msg.extended ? "(%lu.%06lu) %s %08X#"
+                                             : "(%lu.%06lu) %s %03X#",
+                    (unsigned long)ts.tv_sec,
+                    (unsigned long)(ts.tv_nsec / 1000), this->ifname,
+                    (unsigned int)msg.id);
+
+        if (msg.rtr) {
+            n = fprintf(this->file, "R\n");
+        } else {
+            // Longer than a classic frame: a CAN FD frame, no flags
+            if (len > CANTT_CAN_DATASIZE) {
+                fputs("#0", this->file);
+            }
+            for (uint8_t i = 0; i < len; i++) {
+                fprintf(this->file, "%02X", msg.data[i]);
+            }
+            n = fputc('\n', this->file);
+        }
+    } else {
+        putLE(&buf[0], (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000, 8);
+        putLE(&buf[8], msg.id, 4);
+        buf[12] = (msg.extended ? CANTT_CAPTURE_EXTENDED : 0) |
+                  (msg.rtr ? CANTT_CAPTURE_RTR : 0) |
+                  (sent ? CANTT_CAPTURE_SENT : 0);
+        buf[13] = len;
+        memcpy(&buf[CANTT_CAPTURE_RECORD], msg.data, len);
+
+        n = fwrite(buf, CANTT_CAPTURE_RECORD + len, 1, this->file) == 1 ? 1
+                                                                        : -1;
+    }
+
+    if (n < 0) {
+        this->errors++;
+        return;
+    }
+
+    this->framesRecorded++;
+}
+
+uint8_t CANTTCaptureTransport::available() { return this->inner->available(); }
+
+uint8_t CANTTCaptureTransport::receive(CANMessage &msg) {
+    uint8_t status = this->inner->receive(msg);
+
+    if (status == 0) {
+        this->record(msg, false);
+    }
+
+    return status;
+}
+
+uint8_t CANTTCaptureTransport::transmit(const CANMessage &msg) {
+    uint8_t status = this->inner->transmit(msg);
+
+    if (status == 0 && this->recordSent) {
+        this->record(msg, true);
+    }
+
+    return status;
+}
+
+uint8_t CANTTCaptureTransport::readBatch(CANMessage *msgs, uint8_t max) {
+    uint8_t count = this->inner->readBatch(msgs, max);
+
+    for (uint8_t i = 0; i < count; i++) {
+        this->record(msgs[i], false);
+    }
+
+    return count;
+}
+
+uint8_t CANTTCaptureTransport::sendBatch(const CANMessage *msgs,
+                                         uint8_t count) {
+    uint8_t sent = this->inner->sendBatch(msgs, count);
+
+    for (uint8_t i = 0; i < sent && this->recordSent; i++) {
+        this->record(msgs[i], true);
+    }
+
+    return sent;
+}
+
+uint8_t CANTTCaptureTransport::filters() { return this->inner->filters(); }
+
+uint8_t CANTTCaptureTransport::setFilter(uint8_t index, uint32_t id,
+                                         uint32_t mask, bool extended) {
+    return this->inner->setFilter(index, id, mask, extended);
+}
+
+CANTTReplayTransport::CANTTReplayTransport() {
+    this->map = NULL;
+    this->size = 0;
+    this->start = NULL;
+    this->pos = NULL;
+    this->end = NULL;
+    this->fileFormat = CANTT_CAPTURE_CANDUMP;
+    this->framesReceived = 0;
+    this->framesSent = 0;
+    this->malformed = 0;
+    this->timestamp = 0;
+}
+
+CANTTReplayTransport::~CANTTReplayTransport() { this->close(); }
+
+/**
+    Maps a candump log or binary capture, the format is told apart by the
+    magic of binary captures
+
+    @param path the file
+    @return error code, -1 as well for an empty file or an unknown version
+*/
+int CANTTReplayTransport::open(const char *path) {
+    struct stat st;
+    void *map;
+    int fd;
+
+    this->close();
+
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        ::close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    this->map = (const char *)map;
+    this->size = st.st_size;
+    this->start = this->map;
+    this->end = this->map + this->size;
+    this->fileFormat = CANTT_CAPTURE_CANDUMP;
+
+    if (this->size >= CANTT_CAPTURE_HEADER &&
+        memcmp(this->map, CANTT_CAPTURE_MAGIC, 8) == 0) {
+        if (getLE(&this->map[8], 4) != CANTT_CAPTURE_VERSION) {
+            this->close();
+            return -1;
+        }
+
+        this->fileFormat = CANTT_CAPTURE_BINARY;
+        this->start += CANTT_CAPTURE_HEADER;
+    }
+
+    this->rewind();
+
+    return 0;
+}
+
+/**
+    Unmaps the file
+*/
+void CANTTReplayTransport::close() {
+    if (this->map != NULL) {
+        munmap((void *)this->map, this->size);
+    }
+    this->map = NULL;
+    this->size = 0;
+    this->start = NULL;
+    this->pos = NULL;
+    this->end = NULL;
+}
+
+/**
+    Starts over at the first frame of the file
+*/
+void CANTTReplayTransport::rewind() { this->pos = this->start; }
+
+/**
+    Parses one line of a candump log, e.g.
+    "(1436509052.249713) can0 123#DEADBEEF", "12345678#R" for an extended
+    remote frame or "123##1DEADBEEF" for a CAN FD frame
+
+    @param line start of the line
+    @param eol end of the line
+    @param msg the frame to fill in
+    @return true if the line held a frame
+*/
+bool CANTTReplayTransport::parseLine(const char *line, const char *eol,
+                                     CANMessage &msg) {
+    const char *p = line;
+    uint64_t seconds = 0;
+    uint64_t us = 0;
+    uint8_t digits = 0;
+    bool fd = false;
+    int hi, lo;
+
+    if (p == eol || *p++ != '(') {
+        return false;
+    }
+
+    while (p < eol && *p >= '0' && *p <= '9') {
+        seconds = seconds * 10 + (*p++ - '0');
+    }
+    if (p < eol && *p == '.') {
+        p++;
+        while (p < eol && *p >= '0' && *p <= '9') {
+            if (digits++ < 6) {
+                us = us * 10 + (*p - '0');
+            }
+            p++;
+        }
+    }
+    for (; digits < 6; digits++) {
+        us *= 10;
+    }
+    if (p == eol || *p++ != ')') {
+        return false;
+    }
+
+    // Interface name
+    while (p < eol && *p == ' ') {
+        p++;
+    }
+    while (p < eol && *p != ' ') {
+        p++;
+    }
+    while (p < eol && *p == ' ') {
+        p++;
+    }
+
+    msg.id = 0;
+    digits = 0;
+    while (p < eol && (hi = hexValue(*p)) >= 0) {
+        msg.id = msg.id << 4 | hi;
+        digits++;
+        p++;
+    }
+    if (digits == 0 || digits > 8 || p == eol || *p++ != '#') {
+        return false;
+    }
+
+    // candump writes 3 digits for a base id and 8 for an extended one
+    msg.extended = digits > 3;
+    msg.rtr = false;
+    msg.len = 0;
+
+    if (p < eol && *p == '#') {
+        // CAN FD, flags digit
+        if (eol - p < 2 || hexValue(p[1]) < 0) {
+            return false;
+        }
+        fd = true;
+        p += 2;
+    } else if (p < eol && *p == 'R') {
+        msg.rtr = true;
+        p++;
+        if (p < eol && (lo = hexValue(*p)) >= 0 && lo <= CANTT_CAN_DATASIZE) {
+            msg.len = lo;
+            p++;
+        }
+    }
+
+    while (!msg.rtr && eol - p >= 2 && (hi = hexValue(p[0])) >= 0 &&
+           (lo = hexValue(p[1])) >= 0) {
+        if (msg.len >= sizeof(msg.data)) {
+            return false;
+        }
+        msg.data[msg.len++] = hi << 4 | lo;
+        p += 2;
+
+        if (p < eol && *p == '.') {
+            p++;
+        }
+    }
+
+    // Anything after the frame (a direction flag, a comment) is ignored
+    if ((p < eol && *p != ' ' && *p != '\r') ||
+        (!fd && msg.len > CANTT_CAN_DATASIZE)) {
+        return false;
+    }
+
+    this->timestamp = seconds * 1000000 + us;
+
+    return true;
+}
+
+/**
+    Parses one record of a binary capture
+
+    @param msg the frame to fill in
+    @return true if a whole record was read, a truncated one ends the file
+*/
+bool CANTTReplayTransport::parseRecord(CANMessage &msg) {
+    uint8_t flags;
+    uint8_t len;
+
+    if (this->end - this->pos < CANTT_CAPTURE_RECORD) {
+        this->malformed++;
+        this->pos = this->end;
+        return false;
+    }
+
+    flags = this->pos[12];
+    len = this->pos[13];
+    if (len > sizeof(msg.data) ||
+        this->end - this->pos < CANTT_CAPTURE_RECORD + len) {
+        this->malformed++;
+        this->pos = this->end;
+        return false;
+    }
+
+    this->timestamp = getLE(&this->pos[0], 8);
+    msg.id = getLE(&this->pos[8], 4);
+    msg.extended = (flags & CANTT_CAPTURE_EXTENDED) != 0;
+    msg.rtr = (flags & CANTT_CAPTURE_RTR) != 0;
+    msg.len = len;
+    memcpy(msg.data, &this->pos[CANTT_CAPTURE_RECORD], len);
+
+    this->pos += CANTT_CAPTURE_RECORD + len;
+
+    return true;
+}
+
+/**
+    Reads the next frame of the file, skipping what is not one
+
+    @param msg the frame to fill in
+    @return false at the end of the file
+*/
+bool CANTTReplayTransport::next(CANMessage &msg) {
+    const char *line;
+    const char *eol;
+
+    if (this->fileFormat == CANTT_CAPTURE_BINARY) {
+        return !this->done() && this->parseRecord(msg);
+    }
+
+    while (!this->done()) {
+        line = this->pos;
+        eol = (const char *)memchr(line, '\n', this->end - line);
+        if (eol == NULL) {
+            eol = this->end;
+        }
+        this->pos = eol < this->end ? eol + 1 : this->end;
+
+        // Blank lines and comments
+        if (line == eol || *line == '#' || *line == '\r') {
+            continue;
+        }
+
+        if (this->parseLine(line, eol, msg)) {
+            return true;
+        }
+        this->malformed++;
+    }
+
+    return false;
+}
+
+uint8_t CANTTReplayTransport::available() { return !this->done(); }
+
+uint8_t CANTTReplayTransport::receive(CANMessage &msg) {
+    if (!this->next(msg)) {
+        return 1;
+    }
+
+    this->framesReceived++;
+
+    return 0;
+}
+
+/**
+    Accepts a frame and throws it away
+
+    @param msg the frame
+    @return 0, always
+*/
+uint8_t CANTTReplayTransport::transmit(const CANMessage &msg) {
+    this->framesSent++;
+
+    return 0;
+}
+
+uint8_t CANTTReplayTransport::readBatch(CANMessage *msgs, uint8_t max) {
+    uint8_t count = 0;
+
+    while (count < max && this->next(msgs[count])) {
+        count++;
+    }
+    this->framesReceived += count;
+
+    return count;
+}
+
+uint8_t CANTTReplayTransport::sendBatch(const CANMessage *msgs,
+                                        uint8_t count) {
+    this->framesSent += count;
+
+    return count;
+}
@@ -0,0 +1,109 @@
+#ifndef __CANTT_CAPTURE_H__
+#define __CANTT_CAPTURE_H__
+
+#include <stdio.h>
+
+#include "cantt.h"
+
+/*
+ * Recording and replay of CAN traffic at the CANTransport layer.
+ *
+ * CANTTCaptureTransport sits between a CANTT instance and its real
+ * transport and writes every frame received and sent to a file, either as
+ * a candump log (readable, and understood by can-utils) or in a compact
+ * binary format.
+ *
+ * CANTTReplayTransport maps such a file and hands its frames to loop() as
+ * fast as they are asked for, without their timing, to profile reassembly
+ * and decoding on traffic from a real bus. Frames are parsed straight from
+ * the mapping, nothing is allocated per frame.
+ *
+ * The binary format is the magic "CANTTCAP" and a version (uint32_t), then
+ * one record per frame, all little-endian:
+ *
+ *     uint64_t  time, us since the epoch
+ *     uint32_t  CAN id
+ *     uint8_t   flags, CANTT_CAPTURE_EXTENDED/RTR/SENT
+ *     uint8_t   data length
+ *     uint8_t   data[length]
+ */
+
+#define CANTT_CAPTURE_CANDUMP 0
+#define CANTT_CAPTURE_BINARY 1
+
+#define CANTT_CAPTURE_MAGIC "CANTTCAP"
+#define CANTT_CAPTURE_VERSION 1
+#define CANTT_CAPTURE_HEADER 12 // magic and version
+#define CANTT_CAPTURE_RECORD 14 // record without its data
+
+#define CANTT_CAPTURE_EXTENDED 0x01
+#define CANTT_CAPTURE_RTR 0x02
+#define CANTT_CAPTURE_SENT 0x04 // sent by the node that recorded it
+
+class CANTTCaptureTransport : public CANTransport {
+  public:
+    CANTTCaptureTransport(CANTransport &inner);
+    ~CANTTCaptureTransport();
+
+    int open(const char *path, uint8_t format, const char *ifname = "can0");
+    int flush();
+    void close();
+
+    uint8_t available();
+    uint8_t receive(CANMessage &msg);
+    uint8_t transmit(const CANMessage &msg);
+    uint8_t readBatch(CANMessage *msgs, uint8_t max);
+    uint8_t sendBatch(const CANMessage *msgs, uint8_t count);
+    uint8_t filters();
+    uint8_t setFilter(uint8_t index, uint32_t id, uint32_t mask,
+                      bool extended);
+
+    uint32_t framesRecorded;
+    uint32_t errors; // frames that could not be written
+    bool recordSent; // false to record received frames only
+
+  private:
+    void record(const CANMessage &msg, bool sent);
+
+    CANTransport *inner;
+    FILE *file;
+    uint8_t fileFormat;
+    char ifname[16];
+};
+
+class CANTTReplayTransport : public CANTransport {
+  public:
+    CANTTReplayTransport();
+    ~CANTTReplayTransport();
+
+    int open(const char *path);
+    void close();
+    void rewind();
+    bool done() const { return this->pos >= this->end; }
+    uint8_t format() const { return this->fileFormat; }
+
+    uint8_t available();
+    uint8_t receive(CANMessage &msg);
+    uint8_t transmit(const CANMessage &msg);
+    uint8_t readBatch(CANMessage *msgs, uint8_t max);
+    uint8_t sendBatch(const CANMessage *msgs, uint8_t count);
+
+    uint32_t framesReceived;
+    uint32_t framesSent; // thrown away, a capture can not answer
+    uint32_t malformed;  // lines or records that were skipped
+    uint64_t timestamp;  // us, of the last frame received
+
+  private:
+    bool next(CANMessage &msg);
+    bool parseLine(const char *line, const char *eol, CANMessage &msg);
+    bool parseRecord(CANMessage &msg);
+
+    const char *map;
+    size_t size;
+    const char *start; // first frame
+    const char *pos;
+    const char *end;
+    uint8_t fileFormat;
+};
+
+#endif // cantt_capture.h
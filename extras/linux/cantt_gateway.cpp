@@ -0,0 +1,130 @@
+/**
+    CANTT Library
+    cantt_gateway.cpp
+    Purpose: CAN to UDP gateway daemon.
+
+    Forwards the messages published on one or more SocketCAN interfaces to
+    a UDP peer, and publishes the messages received on a UDP port on the
+    interfaces they name. See cantt_udp.h for the datagram format.
+
+    Usage: cantt_gateway [-a addr] [-l port] [-p peer] [-o port] [-f] [-v]
+                         ifname...
+*/
+
+#include "cantt.h"
+#include "cantt_socketcan.h"
+#include "cantt_udp.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define GATEWAY_MAX_MESSAGE 1024
+
+// Room for bursts from UDP while the bus is busy
+typedef BasicCANTT<GATEWAY_MAX_MESSAGE, 8, 16> GatewayCANTT;
+
+static CANTTUdpGateway gateway;
+
+static void terminate(int sig) { gateway.stop(); }
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-a addr] [-l port] [-p peer] [-o port] [-f] [-v] "
+            "ifname...\n",
+            name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    uint32_t addr = 0x150;
+    uint16_t port = 8888;
+    const char *peer = "127.0.0.1";
+    uint16_t peerPort = 8889;
+    bool fd = false;
+    bool verbose = false;
+    struct sigaction sa;
+    int buses;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:l:p:o:fv")) != -1) {
+        switch (opt) {
+        case 'a':
+            addr = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            port = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            peer = optarg;
+            break;
+        case 'o':
+            peerPort = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            fd = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    buses = argc - optind;
+    if (buses < 1 || buses > CANTT_POLLER_MAX_BUSES || addr == 0 ||
+        addr > CANTT_MAX_ADDR) {
+        usage(argv[0]);
+    }
+
+    if (gateway.open(port, peer, peerPort) != 0) {
+        perror("udp");
+        return 1;
+    }
+
+    for (int i = 0; i < buses; i++) {
+        const char *ifname = argv[optind + i];
+        SocketCANTransport *tr = new SocketCANTransport();
+        GatewayCANTT *cantt = new GatewayCANTT(
+            addr, *tr, (void (*)(uint32_t, CANTTspan, CANTTspan))NULL);
+
+        if (tr->open(ifname, fd) != 0) {
+            perror(ifname);
+            return 1;
+        }
+
+        cantt->setFD(fd);
+        cantt->begin();
+
+        if (gateway.addBus(*cantt, *tr) != 0) {
+            fprintf(stderr, "%s: can not add bus\n", ifname);
+            return 1;
+        }
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = terminate;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (gateway.run() != 0) {
+        perror("epoll");
+        return 1;
+    }
+
+    if (verbose) {
+        printf("can to udp  %u messages, %u datagrams, %u dropped, %u too "
+               "large\n",
+               gateway.messagesForwarded, gateway.datagramsSent,
+               gateway.datagramsDropped, gateway.oversize);
+        printf("udp to can  %u datagrams, %u messages, %u malformed, %u "
+               "rejected, %u stalls\n",
+               gateway.datagramsReceived, gateway.messagesInjected,
+               gateway.malformed, gateway.rejected, gateway.stalls);
+    }
+
+    return 0;
+}
@@ -0,0 +1,878 @@
+/**
+    CANTT Library
+    cantt_mqtt.cpp
+    Purpose: Bridge between a CANTT bus and an MQTT 3.1.1 broker, with
+    pipelined QoS 0 publishes.
+*/
+
+#include "cantt_mqtt.h"
+#include "cantt_platform.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_SUBSCRIBE 0x82 // reserved flags 0010
+#define MQTT_SUBACK 0x90
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+#define MQTT_DISCONNECT 0xE0
+
+#define MQTT_PROTOCOL_LEVEL 4 // 3.1.1
+#define MQTT_CLEAN_SESSION 0x02
+
+/**
+    Bytes the remaining length of a packet takes
+
+    @param length the remaining length
+    @return 1 to 4
+*/
+static uint8_t lengthSize(uint32_t length) {
+    uint8_t n = 1;
+
+    while (length >= 128) {
+        length >>= 7;
+        n++;
+    }
+
+    return n;
+}
+
+/**
+    Writes the remaining length of a packet
+
+    @param buf where to write it
+    @param length the remaining length
+    @return bytes written
+*/
+static uint8_t putLength(uint8_t *buf, uint32_t length) {
+    uint8_t n = 0;
+
+    do {
+        buf[n] = length & 0x7F;
+        length >>= 7;
+        if (length > 0) {
+            buf[n] |= 0x80;
+        }
+        n++;
+    } while (length > 0);
+
+    return n;
+}
+
+/**
+    Writes a string with its big-endian length in front
+
+    @param buf where to write it
+    @param data the string
+    @param len its length
+    @return bytes written
+*/
+static uint16_t putString(uint8_t *buf, const void *data, uint16_t len) {
+    buf[0] = len >> 8;
+    buf[1] = len & 0xFF;
+    memcpy(&buf[2], data, len);
+
+    return 2 + len;
+}
+
+/**
+    Checks that a CANTT topic can go into an MQTT topic name. MQTT 3.1.1
+    wants well-formed UTF-8 without U+0000, and no wildcards in a PUBLISH;
+    a broker closes the connection over anything else.
+
+    @param topic the topic
+    @param len its length
+    @return true if a broker takes it
+*/
+static bool validTopic(const uint8_t *topic, uint16_t len) {
+    uint16_t i = 0;
+
+    while (i < len) {
+        uint8_t c = topic[i];
+        uint32_t code;
+        uint8_t extra;
+
+        if (c == 0 || c == '+' || c == '#') {
+            return false;
+        }
+
+        if (c < 0x80) {
+            i++;
+            continue;
+        }
+
+        if (c >= 0xC2 && c <= 0xDF) {
+            extra = 1;
+            code = c & 0x1F;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            extra = 2;
+            code = c & 0x0F;
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            extra = 3;
+            code = c & 0x07;
+        } else {
+            return false; // continuation byte, overlong lead or past U+10FFFF
+        }
+
+        if (len - i <= extra) {
+            return false;
+        }
+
+        for (uint8_t k = 1; k <= extra; k++) {
+            if ((topic[i + k] & 0xC0) != 0x80) {
+                return false;
+            }
+            code = code << 6 | (topic[i + k] & 0x3F);
+        }
+
+        // Overlong forms, surrogates and code points past U+10FFFF
+        if ((extra == 2 && code < 0x800) ||
+            (extra == 2 && code >= 0xD800 && code <= 0xDFFF) ||
+            (extra == 3 && (code < 0x10000 || code > 0x10FFFF))) {
+            return false;
+        }
+
+        i += 1 + extra;
+    }
+
+    return true;
+}
+
+CANTTMqttBridge::CANTTMqttBridge() {
+    this->cantt = NULL;
+    this->keepAlive = 0;
+    this->clientId[0] = '\0';
+    this->running = false;
+    this->sock = -1;
+    this->connection = CANTT_MQTT_CLOSED;
+    this->events = 0;
+    this->retryAt = 0;
+    this->pingSent = 0;
+    this->pingPending = false;
+    this->txStart = 0;
+    this->txEnd = 0;
+    this->rxLen = 0;
+    this->rxSkip = 0;
+    this->rxPaused = false;
+    this->published = 0;
+    this->dropped = 0;
+    this->writes = 0;
+    this->received = 0;
+    this->rejected = 0;
+    this->oversize = 0;
+    this->stalls = 0;
+    this->connects = 0;
+    this->disconnects = 0;
+    memset(&this->broker, 0, sizeof(this->broker));
+    this->setPrefixes("cantt/bus/", "cantt/cmd/");
+}
+
+CANTTMqttBridge::~CANTTMqttBridge() { this->close(); }
+
+/**
+    Sets the MQTT topic prefixes, before open()
+
+    @param out put in front of the topics of messages from the bus
+    @param in subscribed to with "#" appended, and taken off the topics of
+   messages to the bus
+    @return error code, -1 if a prefix is too long or one starts the other
+*/
+int CANTTMqttBridge::setPrefixes(const char *out, const char *in) {
+    size_t outLen = strlen(out);
+    size_t inLen = strlen(in);
+
+    if (outLen >= CANTT_MQTT_PREFIX_SIZE || inLen >= CANTT_MQTT_PREFIX_SIZE ||
+        strncmp(out, in, outLen < inLen ? outLen : inLen) == 0) {
+        return -1;
+    }
+
+    strcpy(this->outPrefix, out);
+    strcpy(this->inPrefix, in);
+
+    return 0;
+}
+
+/**
+    Opens the event loop and starts connecting to the broker. A broker
+    that is not up yet is tried again every CANTT_MQTT_RECONNECT ms.
+
+    @param host name or IPv4 address of the broker
+    @param port its port, 1883 usually
+    @param clientId MQTT client identifier
+    @param keepAlive s between two PINGREQs, 0 for none
+    @return error code, -1 as well if the host is unknown
+*/
+int CANTTMqttBridge::open(const char *host, uint16_t port,
+                          const char *clientId, uint16_t keepAlive) {
+    struct addrinfo hints;
+    struct addrinfo *result;
+
+    this->close();
+
+    if (strlen(clientId) >= CANTT_MQTT_CLIENT_ID_SIZE) {
+        return -1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &hints, &result) != 0) {
+        return -1;
+    }
+    memcpy(&this->broker, result->ai_addr, sizeof(this->broker));
+    this->broker.sin_port = htons(port);
+    freeaddrinfo(result);
+
+    strcpy(this->clientId, clientId);
+    this->keepAlive = keepAlive;
+
+    if (this->poller.open() != 0) {
+        return -1;
+    }
+
+    this->connect(cantt_millis());
+
+    return 0;
+}
+
+/**
+    Disconnects from the broker and closes the event loop, the bus has to
+    be attached again
+*/
+void CANTTMqttBridge::close() {
+    uint8_t *packet;
+
+    if (this->connection >= CANTT_MQTT_CONNECTED) {
+        packet = this->reserve(2);
+        if (packet != NULL) {
+            packet[0] = MQTT_DISCONNECT;
+            packet[1] = 0;
+            this->flush();
+        }
+    }
+
+    this->disconnect(cantt_millis());
+    this->poller.close();
+    this->cantt = NULL;
+}
+
+/**
+    Attaches the bus. The bridge becomes the handler of the instance, and
+    the instance runs in drain mode from now on.
+
+    @param cantt the instance, begin() called already
+    @param transport its transport, already open
+    @return error code, -1 as well if a bus is attached already
+*/
+int CANTTMqttBridge::attach(CANTTBase &cantt, SocketCANTransport &transport) {
+    if (this->cantt != NULL || this->poller.add(cantt, transport) != 0) {
+        return -1;
+    }
+
+    this->cantt = &cantt;
+    cantt.setHandler(CANTTMqttBridge::handler, this);
+
+    return 0;
+}
+
+void CANTTMqttBridge::handler(void *context, uint32_t addr, CANTTspan topic,
+                              CANTTspan payload) {
+    ((CANTTMqttBridge *)context)->forward(topic, payload);
+}
+
+void CANTTMqttBridge::ready(void *context, uint32_t events) {
+    CANTTMqttBridge *bridge = (CANTTMqttBridge *)context;
+    int error = 0;
+    socklen_t len = sizeof(error);
+
+    if (bridge->connection == CANTT_MQTT_CONNECTING) {
+        if (getsockopt(bridge->sock, SOL_SOCKET, SO_ERROR, &error, &len) < 0 ||
+            error != 0) {
+            bridge->disconnect(cantt_millis());
+        } else {
+            bridge->connected(cantt_millis());
+        }
+        return;
+    }
+
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        bridge->receive();
+    }
+
+    // epoll reports these even while watch() asks for nothing, and a
+    // paused receive() does not read far enough to see the socket close
+    if ((events & (EPOLLHUP | EPOLLERR)) && bridge->sock >= 0) {
+        bridge->disconnect(cantt_millis());
+        return;
+    }
+
+    if (events & EPOLLOUT) {
+        bridge->flush();
+    }
+}
+
+/**
+    Takes room at the end of the send buffer
+
+    @param length bytes needed
+    @return where to write them, NULL if the buffer is full
+*/
+uint8_t *CANTTMqttBridge::reserve(uint32_t length) {
+    uint8_t *buf;
+
+    if (CANTT_MQTT_TX_BUFFER - this->txEnd < length && this->txStart > 0) {
+        memmove(this->txBuf, &this->txBuf[this->txStart],
+                this->txEnd - this->txStart);
+        this->txEnd -= this->txStart;
+        this->txStart = 0;
+    }
+
+    if (CANTT_MQTT_TX_BUFFER - this->txEnd < length) {
+        return NULL;
+    }
+
+    buf = &this->txBuf[this->txEnd];
+    this->txEnd += length;
+
+    return buf;
+}
+
+/**
+    Encodes a message from the bus as a QoS 0 PUBLISH. It is sent with the
+    next flush(), together with everything else encoded until then.
+
+    @param topic the CANTT topic
+    @param payload the payload
+*/
+void CANTTMqttBridge::forward(CANTTspan topic, CANTTspan payload) {
+    uint16_t prefixLen = strlen(this->outPrefix);
+    uint32_t topicLen = prefixLen + topic.len;
+    uint32_t remaining;
+    uint8_t *packet;
+    uint32_t n;
+
+    if (this->connection < CANTT_MQTT_CONNECTED) {
+        this->dropped++;
+        return;
+    }
+
+    if (topicLen == 0 || topicLen > 0xFFFF ||
+        !validTopic(topic.data, topic.len)) {
+        this->rejected++;
+        return;
+    }
+
+    remaining = 2 + topicLen + payload.len;
+    packet = this->reserve(1 + lengthSize(remaining) + remaining);
+    if (packet == NULL) {
+        this->dropped++;
+        return;
+    }
+
+    packet[0] = MQTT_PUBLISH;
+    n = 1 + putLength(&packet[1], remaining);
+    packet[n++] = topicLen >> 8;
+    packet[n++] = topicLen & 0xFF;
+    memcpy(&packet[n], this->outPrefix, prefixLen);
+    memcpy(&packet[n + prefixLen], topic.data, topic.len);
+    memcpy(&packet[n + topicLen], payload.data, payload.len);
+
+    this->published++;
+}
+
+/**
+    Writes what the send buffer holds, with as few send() calls as the
+    socket allows
+
+    @return bytes sent, -1 if the connection was lost
+*/
+int CANTTMqttBridge::flush() {
+    uint32_t start = this->txStart;
+    ssize_t n;
+
+    if (this->connection < CANTT_MQTT_CONNECTED) {
+        return 0;
+    }
+
+    while (this->txStart < this->txEnd) {
+        n = send(this->sock, &this->txBuf[this->txStart],
+                 this->txEnd - this->txStart, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // The rest goes when the socket is writable, see watch()
+            break;
+        }
+        if (n < 0) {
+            this->disconnect(cantt_millis());
+            return -1;
+        }
+
+        this->txStart += n;
+        this->writes++;
+    }
+
+    n = this->txStart - start;
+    if (this->txStart == this->txEnd) {
+        this->txStart = 0;
+        this->txEnd = 0;
+    }
+
+    return n;
+}
+
+/**
+    Starts a TCP connection to the broker
+
+    @param now ms
+*/
+void CANTTMqttBridge::connect(uint32_t now) {
+    int enable = 1;
+
+    this->sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (this->sock < 0) {
+        this->retryAt = now + CANTT_MQTT_RECONNECT;
+        return;
+    }
+
+    // The publishes are coalesced here, Nagle would only delay them
+    setsockopt(this->sock, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    this->pingSent = now;
+    this->events = EPOLLOUT;
+
+    if (this->poller.addFd(this->sock, this->events, CANTTMqttBridge::ready,
+                           this) != 0) {
+        ::close(this->sock);
+        this->sock = -1;
+        this->retryAt = now + CANTT_MQTT_RECONNECT;
+        return;
+    }
+
+    if (::connect(this->sock, (struct sockaddr *)&this->broker,
+                  sizeof(this->broker)) == 0) {
+        this->connected(now);
+    } else if (errno == EINPROGRESS) {
+        this->connection = CANTT_MQTT_CONNECTING;
+    } else {
+        this->disconnect(now);
+    }
+}
+
+/**
+    Sends CONNECT and SUBSCRIBE once the TCP connection is up. Publishes
+    follow them right away, without waiting for CONNACK.
+
+    @param now ms
+*/
+void CANTTMqttBridge::connected(uint32_t now) {
+    uint16_t idLen = strlen(this->clientId);
+    uint16_t inLen = strlen(this->inPrefix);
+    uint8_t *packet;
+    uint32_t n;
+
+    this->connection = CANTT_MQTT_CONNECTED;
+    this->txStart = 0;
+    this->txEnd = 0;
+    this->pingSent = now;
+    this->pingPending = false;
+
+    packet = this->reserve(2 + 10 + 2 + idLen);
+    packet[0] = MQTT_CONNECT;
+    packet[1] = 10 + 2 + idLen;
+    n = 2 + putString(&packet[2], "MQTT", 4);
+    packet[n++] = MQTT_PROTOCOL_LEVEL;
+    packet[n++] = MQTT_CLEAN_SESSION;
+    packet[n++] = this->keepAlive >> 8;
+    packet[n++] = this->keepAlive & 0xFF;
+    putString(&packet[n], this->clientId, idLen);
+
+    // Packet id 1, "<in prefix>#" with QoS 0
+    packet = this->reserve(2 + 2 + 2 + inLen + 1 + 1);
+    packet[0] = MQTT_SUBSCRIBE;
+    packet[1] = 2 + 2 + inLen + 1 + 1;
+    packet[2] = 0;
+    packet[3] = 1;
+    packet[4] = 0;
+    packet[5] = inLen + 1;
+    memcpy(&packet[6], this->inPrefix, inLen);
+    packet[6 + inLen] = '#';
+    packet[7 + inLen] = 0;
+
+    this->flush();
+    this->watch();
+}
+
+/**
+    Drops the connection, the next attempt is CANTT_MQTT_RECONNECT ms later
+
+    @param now ms
+*/
+void CANTTMqttBridge::disconnect(uint32_t now) {
+    if (this->sock >= 0) {
+        this->poller.removeFd(this->sock);
+        ::close(this->sock);
+
+        this->disconnects++;
+    }
+
+    this->sock = -1;
+    this->connection = CANTT_MQTT_CLOSED;
+    this->events = 0;
+    this->retryAt = now + CANTT_MQTT_RECONNECT;
+    this->pingPending = false;
+    this->txStart = 0;
+    this->txEnd = 0;
+    this->rxLen = 0;
+    this->rxSkip = 0;
+    this->rxPaused = false;
+}
+
+/**
+    Reconnects, and keeps the connection alive with PINGREQs
+
+    @param now ms
+*/
+void CANTTMqttBridge::maintain(uint32_t now) {
+    uint8_t *packet;
+
+    switch (this->connection) {
+    case CANTT_MQTT_CLOSED:
+        if ((int32_t)(now - this->retryAt) >= 0) {
+            this->connect(now);
+        }
+        return;
+
+    case CANTT_MQTT_CONNECTING:
+        if (now - this->pingSent >= CANTT_MQTT_CONNECT_TIMEOUT) {
+            this->disconnect(now);
+        }
+        return;
+
+    default:
+        break;
+    }
+
+    if (this->keepAlive == 0) {
+        return;
+    }
+
+    // No PINGRESP, or no CONNACK, within the keep alive: the broker is gone
+    if (this->pingPending && now - this->pingSent >= this->keepAlive * 1000UL) {
+        this->disconnect(now);
+        return;
+    }
+
+    if (!this->pingPending && now - this->pingSent >= this->keepAlive * 500UL) {
+        packet = this->reserve(2);
+        if (packet != NULL) {
+            packet[0] = MQTT_PINGREQ;
+            packet[1] = 0;
+            this->pingPending = true;
+            this->pingSent = now;
+        }
+    }
+}
+
+/**
+    Time until maintain() has something to do
+
+    @param now ms
+    @return ms, -1 for nothing
+*/
+int CANTTMqttBridge::nextTimeout(uint32_t now) {
+    uint32_t due;
+
+    switch (this->connection) {
+    case CANTT_MQTT_CLOSED:
+        due = this->retryAt;
+        break;
+    case CANTT_MQTT_CONNECTING:
+        due = this->pingSent + CANTT_MQTT_CONNECT_TIMEOUT;
+        break;
+    default:
+        if (this->keepAlive == 0) {
+            return -1;
+        }
+        due = this->pingSent +
+              this->keepAlive * (this->pingPending ? 1000UL : 500UL);
+        break;
+    }
+
+    return (int32_t)(due - now) > 0 ? (int)(due - now) : 0;
+}
+
+/**
+    Reads from the broker and handles the packets that are complete
+*/
+void CANTTMqttBridge::receive() {
+    uint32_t skip;
+    ssize_t n;
+
+    if (this->rxPaused || this->sock < 0) {
+        return;
+    }
+
+    do {
+        n = recv(this->sock, &this->rxBuf[this->rxLen],
+                 CANTT_MQTT_RX_BUFFER - this->rxLen, MSG_DONTWAIT);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    if (n <= 0) {
+        this->disconnect(cantt_millis());
+        return;
+    }
+
+    // The end of an oversize packet, nothing else is buffered
+    if (this->rxSkip > 0) {
+        skip = (uint32_t)n < this->rxSkip ? n : this->rxSkip;
+        memmove(this->rxBuf, &this->rxBuf[skip], n - skip);
+        this->rxSkip -= skip;
+        n -= skip;
+    }
+    this->rxLen += n;
+
+    if (!this->parse()) {
+        this->rxPaused = true;
+        this->stalls++;
+    }
+}
+
+/**
+    Handles the complete packets in the receive buffer
+
+    @return false if a message could not be queued on the bus, it is tried
+   again by the next call
+*/
+bool CANTTMqttBridge::parse() {
+    uint32_t pos = 0;
+    bool done = true;
+
+    while (this->connection >= CANTT_MQTT_CONNECTED &&
+           this->rxLen - pos >= 2) {
+        uint32_t remaining = 0;
+        uint32_t total;
+        uint8_t header = 1;
+        int status;
+
+        // Remaining length, up to 4 bytes of 7 bits
+        do {
+            if (header > 4) {
+                this->disconnect(cantt_millis());
+                return true;
+            }
+            if (pos + header >= this->rxLen) {
+                break;
+            }
+            remaining |= (uint32_t)(this->rxBuf[pos + header] & 0x7F)
+                         << (7 * (header - 1));
+        } while (this->rxBuf[pos + header++] & 0x80);
+
+        if (pos + header > this->rxLen ||
+            (this->rxBuf[pos + header - 1] & 0x80)) {
+            break; // length not complete yet
+        }
+
+        total = header + remaining;
+        if (total > CANTT_MQTT_RX_BUFFER) {
+            this->oversize++;
+            this->rxSkip = total - (this->rxLen - pos);
+            pos = this->rxLen;
+            break;
+        }
+
+        if (this->rxLen - pos < total) {
+            break;
+        }
+
+        status = this->packet(this->rxBuf[pos], &this->rxBuf[pos + header],
+                              remaining);
+        if (status == CANTT_ERR_QUEUE_FULL) {
+            done = false;
+            break;
+        }
+        if (status < 0) {
+            this->disconnect(cantt_millis());
+            return true;
+        }
+
+        pos += total;
+    }
+
+    if (pos > 0) {
+        memmove(this->rxBuf, &this->rxBuf[pos], this->rxLen - pos);
+        this->rxLen -= pos;
+    }
+
+    return done;
+}
+
+/**
+    Handles one packet from the broker
+
+    @param type first byte of the packet
+    @param data the packet after its fixed header
+    @param length bytes of data
+    @return 0, CANTT_ERR_QUEUE_FULL to try again later, -1 to drop the
+   connection
+*/
+int CANTTMqttBridge::packet(uint8_t type, uint8_t *data, uint32_t length) {
+    uint16_t inLen = strlen(this->inPrefix);
+    uint16_t topicLen;
+    uint32_t offset;
+    int status;
+
+    switch (type & 0xF0) {
+    case MQTT_CONNACK:
+        if (length < 2 || data[1] != 0) {
+            // Refused: protocol level, client id, authorisation
+            return -1;
+        }
+        this->connection = CANTT_MQTT_READY;
+        this->connects++;
+        return 0;
+
+    case MQTT_PUBLISH:
+        if (length < 2) {
+            return -1;
+        }
+        topicLen = data[0] << 8 | data[1];
+        offset = 2 + topicLen;
+
+        // Only QoS 0 is subscribed to, so a packet id is not expected, but
+        // skip it if the broker sends one
+        if (type & 0x06) {
+            offset += 2;
+        }
+        if (offset > length) {
+            return -1;
+        }
+
+        if (topicLen <= inLen || memcmp(&data[2], this->inPrefix, inLen) != 0 ||
+            this->cantt == NULL) {
+            this->rejected++;
+            return 0;
+        }
+
+        status = this->cantt->publish(&data[2 + inLen], topicLen - inLen,
+                                      &data[offset], length - offset);
+        if (status == CANTT_ERR_QUEUE_FULL) {
+            return status;
+        }
+
+        if (status == CANTT_OK) {
+            this->received++;
+        } else {
+            this->rejected++;
+        }
+        return 0;
+
+    case MQTT_PINGRESP:
+        this->pingPending = false;
+        return 0;
+
+    default:
+        // SUBACK and anything else a QoS 0 client can ignore
+        return 0;
+    }
+}
+
+/**
+    Registers the events there is a reason to wait for: the end of a TCP
+    connection attempt, data unless reading is paused, writability while
+    the send buffer is not empty
+*/
+void CANTTMqttBridge::watch() {
+    uint32_t events;
+
+    if (this->sock < 0) {
+        return;
+    }
+
+    if (this->connection == CANTT_MQTT_CONNECTING) {
+        events = EPOLLOUT;
+    } else {
+        events = (this->rxPaused ? 0 : EPOLLIN) |
+                 (this->txStart < this->txEnd ? EPOLLOUT : 0);
+    }
+
+    if (events != this->events &&
+        this->poller.modifyFd(this->sock, events) == 0) {
+        this->events = events;
+    }
+}
+
+/**
+    Waits for work, runs the bus, keeps the connection up and sends what
+    was published meanwhile
+
+    @param maxWait longest time to wait in ms, -1 to wait for an event
+    @return number of frames received and sent, -1 on error
+*/
+int CANTTMqttBridge::poll(int maxWait) {
+    uint32_t now = cantt_millis();
+    int wait = this->nextTimeout(now);
+    int work;
+
+    if (wait < 0 || (maxWait >= 0 && maxWait < wait)) {
+        wait = maxWait;
+    }
+
+    this->watch();
+
+    work = this->poller.poll(wait);
+    if (work < 0) {
+        return -1;
+    }
+
+    this->maintain(cantt_millis());
+
+    // The bus sent frames, its queue may have room again
+    if (this->rxPaused && this->parse()) {
+        this->rxPaused = false;
+    }
+
+    this->flush();
+    this->watch();
+
+    return work;
+}
+
+/**
+    Runs the bridge until stop() is called
+
+    @return 0 when stopped, -1 on error
+*/
+int CANTTMqttBridge::run() {
+    this->running = true;
+
+    while (this->running) {
+        if (this->poll(-1) < 0) {
+            this->running = false;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+    Ends run(), from a handler, another thread or a signal handler
+*/
+void CANTTMqttBridge::stop() {
+    this->running = false;
+    this->poller.wake();
+}
@@ -0,0 +1,138 @@
+#ifndef __CANTT_MQTT_H__
+#define __CANTT_MQTT_H__
+
+#include <netinet/in.h>
+
+#include "cantt.h"
+#include "cantt_poller.h"
+#include "cantt_socketcan.h"
+
+/*
+ * Bridge between a CANTT bus and an MQTT 3.1.1 broker, over plain TCP.
+ *
+ * Messages published on the bus are published to the broker with QoS 0 as
+ * <out prefix><topic>. Messages the broker delivers on <in prefix># are
+ * published on the bus as <topic>, with the <in prefix> removed. The two
+ * prefixes must not overlap, MQTT 3.1.1 would send our own publishes back.
+ *
+ * Publishes are pipelined: they are encoded into a bounded buffer of
+ * CANTT_MQTT_TX_BUFFER bytes and written with one send() per wake-up of
+ * the event loop, without waiting for anything from the broker. A broker
+ * that does not keep up fills the buffer, and further messages are
+ * dropped and counted; loop() never waits for the broker. The other way,
+ * a full CANTT queue pauses reading from the broker until the bus caught
+ * up. The connection is opened again CANTT_MQTT_RECONNECT ms after it was
+ * lost; messages from the bus are dropped meanwhile.
+ */
+
+// Encoded PUBLISH packets waiting for the broker
+#ifndef CANTT_MQTT_TX_BUFFER
+#define CANTT_MQTT_TX_BUFFER 65536
+#endif
+
+// Largest packet taken from the broker, larger ones are skipped
+#ifndef CANTT_MQTT_RX_BUFFER
+#define CANTT_MQTT_RX_BUFFER 8192
+#endif
+
+#ifndef CANTT_MQTT_PREFIX_SIZE
+#define CANTT_MQTT_PREFIX_SIZE 64
+#endif
+
+#ifndef CANTT_MQTT_CLIENT_ID_SIZE
+#define CANTT_MQTT_CLIENT_ID_SIZE 24
+#endif
+
+// ms between two connection attempts
+#ifndef CANTT_MQTT_RECONNECT
+#define CANTT_MQTT_RECONNECT 1000
+#endif
+
+// ms a TCP connection may take to open
+#ifndef CANTT_MQTT_CONNECT_TIMEOUT
+#define CANTT_MQTT_CONNECT_TIMEOUT 5000
+#endif
+
+enum CANTTMqttState {
+    CANTT_MQTT_CLOSED = 0,
+    CANTT_MQTT_CONNECTING = 1, // TCP connection under way
+    CANTT_MQTT_CONNECTED = 2,  // CONNECT sent, publishes pipelined behind it
+    CANTT_MQTT_READY = 3       // CONNACK received
+};
+
+class CANTTMqttBridge {
+  public:
+    CANTTMqttBridge();
+    ~CANTTMqttBridge();
+
+    int open(const char *host, uint16_t port, const char *clientId,
+             uint16_t keepAlive);
+    void close();
+
+    int setPrefixes(const char *out, const char *in);
+    int attach(CANTTBase &cantt, SocketCANTransport &transport);
+
+    int poll(int maxWait);
+    int run();
+    void stop();
+    int flush();
+
+    enum CANTTMqttState state() const { return this->connection; }
+    bool paused() const { return this->rxPaused; }
+
+    uint32_t published;   // CAN to MQTT
+    uint32_t dropped;     // no connection, or the buffer was full
+    uint32_t writes;      // send() calls, publishes are coalesced
+    uint32_t received;    // MQTT to CAN
+    uint32_t rejected;    // topics one side can not carry, e.g. not UTF-8
+    uint32_t oversize;    // packets larger than CANTT_MQTT_RX_BUFFER
+    uint32_t stalls;      // reading paused for a full CANTT queue
+    uint32_t connects;    // CONNACKs accepted
+    uint32_t disconnects; // connections lost or refused
+
+  private:
+    static void handler(void *context, uint32_t addr, CANTTspan topic,
+                        CANTTspan payload);
+    static void ready(void *context, uint32_t events);
+
+    void forward(CANTTspan topic, CANTTspan payload);
+    uint8_t *reserve(uint32_t length);
+
+    void connect(uint32_t now);
+    void connected(uint32_t now);
+    void disconnect(uint32_t now);
+    void maintain(uint32_t now);
+    int nextTimeout(uint32_t now);
+
+    void receive();
+    bool parse();
+    int packet(uint8_t type, uint8_t *data, uint32_t length);
+    void watch();
+
+    CANTTPoller poller;
+    CANTTBase *cantt;
+    struct sockaddr_in broker;
+    char clientId[CANTT_MQTT_CLIENT_ID_SIZE];
+    uint16_t keepAlive; // s
+    char outPrefix[CANTT_MQTT_PREFIX_SIZE];
+    char inPrefix[CANTT_MQTT_PREFIX_SIZE];
+    volatile bool running;
+
+    int sock;
+    enum CANTTMqttState connection;
+    uint32_t events;     // epoll events registered for sock
+    uint32_t retryAt;    // ms, next connection attempt
+    uint32_t pingSent;   // ms, or when the connection was started
+    bool pingPending;    // PINGREQ without PINGRESP yet
+
+    uint8_t txBuf[CANTT_MQTT_TX_BUFFER];
+    uint32_t txStart; // first byte not sent
+    uint32_t txEnd;
+
+    uint8_t rxBuf[CANTT_MQTT_RX_BUFFER];
+    uint32_t rxLen;
+    uint32_t rxSkip; // bytes left of an oversize packet
+    bool rxPaused;
+};
+
+#endif // cantt_mqtt.h
@@ -0,0 +1,378 @@
+/**
+    CANTT Library
+    cantt_poller.cpp
+    Purpose: Drives CANTT instances on several SocketCAN buses from one
+    epoll event loop.
+*/
+
+#include "cantt_poller.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+CANTTPoller::CANTTPoller() {
+    this->epfd = -1;
+    this->wakefd = -1;
+    this->running = false;
+    this->wakeups = 0;
+    this->loops = 0;
+    memset(this->buses, 0, sizeof(this->buses));
+    memset(this->fds, 0, sizeof(this->fds));
+}
+
+CANTTPoller::~CANTTPoller() { this->close(); }
+
+/**
+    Creates the epoll instance
+
+    @return error code
+*/
+int CANTTPoller::open() {
+    struct epoll_event ev;
+
+    this->close();
+
+    this->epfd = epoll_create1(EPOLL_CLOEXEC);
+    this->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (this->epfd < 0 || this->wakefd < 0) {
+        this->close();
+        return -1;
+    }
+
+    // No bus, the event only ends epoll_wait()
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(this->epfd, EPOLL_CTL_ADD, this->wakefd, &ev) < 0) {
+        this->close();
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+    Closes the epoll instance, the buses and file descriptors have to be
+    added again
+*/
+void CANTTPoller::close() {
+    if (this->epfd >= 0) {
+        ::close(this->epfd);
+    }
+    if (this->wakefd >= 0) {
+        ::close(this->wakefd);
+    }
+    this->epfd = -1;
+    this->wakefd = -1;
+    memset(this->buses, 0, sizeof(this->buses));
+    memset(this->fds, 0, sizeof(this->fds));
+}
+
+/**
+    Registers or updates the socket of a bus with epoll
+
+    @param bus the bus
+    @param op EPOLL_CTL_ADD or EPOLL_CTL_MOD
+    @param writing also wait for the socket to become writable
+    @return error code
+*/
+int CANTTPoller::watch(struct CANTTPollerBus *bus, int op, bool writing) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | (writing ? EPOLLOUT : 0);
+    ev.data.ptr = bus;
+
+    if (epoll_ctl(this->epfd, op, bus->transport->fd(), &ev) < 0) {
+        return -1;
+    }
+
+    bus->writing = writing;
+
+    return 0;
+}
+
+/**
+    Adds a CANTT instance and the open transport it runs on. The instance
+    is switched to drain mode with a budget of CANTT_POLLER_BUDGET frames.
+
+    @param cantt the instance
+    @param transport its transport, already open
+    @return error code
+*/
+int CANTTPoller::add(CANTTBase &cantt, SocketCANTransport &transport) {
+    struct CANTTPollerBus *bus = NULL;
+
+    if (this->epfd < 0 || transport.fd() < 0) {
+        return -1;
+    }
+
+    for (uint8_t i = 0; i < CANTT_POLLER_MAX_BUSES; i++) {
+        if (this->buses[i].cantt == NULL) {
+            bus = &this->buses[i];
+            break;
+        }
+    }
+
+    if (bus == NULL) {
+        return -1;
+    }
+
+    bus->cantt = &cantt;
+    bus->transport = &transport;
+
+    if (this->watch(bus, EPOLL_CTL_ADD, false) != 0) {
+        bus->cantt = NULL;
+        return -1;
+    }
+
+    cantt.setBudget(CANTT_POLLER_BUDGET, CANTT_POLLER_BUDGET);
+
+    return 0;
+}
+
+/**
+    Removes a CANTT instance
+
+    @param cantt the instance
+    @return error code
+*/
+int CANTTPoller::remove(CANTTBase &cantt) {
+    for (uint8_t i = 0; i < CANTT_POLLER_MAX_BUSES; i++) {
+        struct CANTTPollerBus *bus = &this->buses[i];
+
+        if (bus->cantt == &cantt) {
+            epoll_ctl(this->epfd, EPOLL_CTL_DEL, bus->transport->fd(), NULL);
+            memset(bus, 0, sizeof(*bus));
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+    Watches another file descriptor. ready() is called from poll() when it
+    has any of the events, before the buses are run.
+
+    @param fd the file descriptor
+    @param events epoll events to wait for, e.g. EPOLLIN
+    @param ready called with the context and the events that occurred
+    @param context passed to ready()
+    @return error code
+*/
+int CANTTPoller::addFd(int fd, uint32_t events,
+                       void (*ready)(void *context, uint32_t events),
+                       void *context) {
+    struct CANTTPollerFd *entry = NULL;
+    struct epoll_event ev;
+
+    if (this->epfd < 0 || fd < 0 || ready == NULL) {
+        return -1;
+    }
+
+    for (uint8_t i = 0; i < CANTT_POLLER_MAX_FDS; i++) {
+        if (this->fds[i].ready == NULL) {
+            entry = &this->fds[i];
+            break;
+        }
+    }
+
+    if (entry == NULL) {
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = entry;
+    if (epoll_ctl(this->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        return -1;
+    }
+
+    entry->fd = fd;
+    entry->ready = ready;
+    entry->context = context;
+
+    return 0;
+}
+
+/**
+    Changes the events waited for on a file descriptor, 0 to ignore it for
+    a while
+
+    @param fd the file descriptor, added with addFd()
+    @param events epoll events to wait for
+    @return error code
+*/
+int CANTTPoller::modifyFd(int fd, uint32_t events) {
+    struct epoll_event ev;
+
+    for (uint8_t i = 0; i < CANTT_POLLER_MAX_FDS; i++) {
+        if (this->fds[i].ready != NULL && this->fds[i].fd == fd) {
+            memset(&ev, 0, sizeof(ev));
+            ev.events = events;
+            ev.data.ptr = &this->fds[i];
+
+            return epoll_ctl(this->epfd, EPOLL_CTL_MOD, fd, &ev) < 0 ? -1 : 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+    Stops watching a file descriptor
+
+    @param fd the file descriptor
+    @return error code
+*/
+int CANTTPoller::removeFd(int fd) {
+    for (uint8_t i = 0; i < CANTT_POLLER_MAX_FDS; i++) {
+        if (this->fds[i].ready != NULL && this->fds[i].fd == fd) {
+            epoll_ctl(this->epfd, EPOLL_CTL_DEL, fd, NULL);
+            memset(&this->fds[i], 0, sizeof(this->fds[i]));
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+    Waits for any bus to have work and runs the instances that have
+
+    @param maxWait longest time to wait in ms, -1 to wait for an event
+    @return number of frames received and sent, -1 on error
+*/
+int CANTTPoller::poll(int maxWait) {
+    struct epoll_event events[CANTT_POLLER_MAX_BUSES + CANTT_POLLER_MAX_FDS +
+                              1];
+    bool ready[CANTT_POLLER_MAX_BUSES];
+    int timeout = maxWait;
+    int work = 0;
+    int n;
+
+    for (uint8_t i = 0; i < CANTT_POLLER_MAX_BUSES; i++) {
+        struct CANTTPollerBus *bus = &this->buses[i];
+        uint32_t next;
+        bool writing;
+
+        if (bus->cantt == NULL) {
+            continue;
+        }
+
+        // A frame read ahead by the transport does not wake epoll
+        next = bus->transport->buffered() ? 0 : bus->cantt->nextTimeout();
+        if (next != CANTT_NO_TIMEOUT &&
+            (timeout < 0 || next < (uint32_t)timeout)) {
+            timeout = next;
+        }
+
+        // Only ask for EPOLLOUT while there is a frame to send, a writable
+        // socket would wake us all the time
+        writing = bus->cantt->txReady();
+        if (writing != bus->writing &&
+            this->watch(bus, EPOLL_CTL_MOD, writing) != 0) {
+            return -1;
+        }
+    }
+
+    do {
+        n = epoll_wait(this->epfd, events,
+                       CANTT_POLLER_MAX_BUSES + CANTT_POLLER_MAX_FDS + 1,
+                       timeout);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        return -1;
+    }
+    this->wakeups++;
+
+    memset(ready, 0, sizeof(ready));
+    for (int i = 0; i < n; i++) {
+        struct CANTTPollerFd *fd = (struct CANTTPollerFd *)events[i].data.ptr;
+
+        if (fd >= &this->fds[0] && fd < &this->fds[CANTT_POLLER_MAX_FDS]) {
+            if (fd->ready != NULL) {
+                fd->ready(fd->context, events[i].events);
+            }
+            continue;
+        }
+
+        if (events[i].data.ptr == NULL) {
+            uint64_t count;
+
+            // Woken up, reset the eventfd. EAGAIN: it was reset already.
+            if (read(this->wakefd, &count, sizeof(count)) < 0) {
+                count = 0;
+            }
+            continue;
+        }
+        ready[(struct CANTTPollerBus *)events[i].data.ptr - this->buses] = true;
+    }
+
+    for (uint8_t i = 0; i < CANTT_POLLER_MAX_BUSES; i++) {
+        struct CANTTPollerBus *bus = &this->buses[i];
+
+        if (bus->cantt == NULL) {
+            continue;
+        }
+
+        if (ready[i] || bus->transport->buffered() ||
+            bus->cantt->nextTimeout() == 0) {
+            work += bus->cantt->loop();
+            this->loops++;
+        }
+    }
+
+    return work;
+}
+
+/**
+    Makes a poll() that is waiting, or the next one, return right away
+
+    @return error code
+*/
+int CANTTPoller::wake() {
+    uint64_t one = 1;
+
+    if (this->wakefd < 0) {
+        return -1;
+    }
+
+    // EAGAIN: the counter is full, a wake-up is pending anyway
+    if (write(this->wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+    Ends run(), from a handler or from another thread
+*/
+void CANTTPoller::stop() {
+    this->running = false;
+    this->wake();
+}
+
+/**
+    Runs the event loop until stop() is called, e.g. from a handler
+
+    @return 0 when stopped, -1 on error
+*/
+int CANTTPoller::run() {
+    this->running = true;
+
+    while (this->running) {
+        if (this->poll(-1) < 0) {
+            this->running = false;
+            return -1;
+        }
+    }
+
+    return 0;
+}
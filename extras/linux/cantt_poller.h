@@ -0,0 +1,78 @@
+#ifndef __CANTT_POLLER_H__
+#define __CANTT_POLLER_H__
+
+#include "cantt.h"
+#include "cantt_socketcan.h"
+
+/*
+ * epoll based event loop for CANTT instances on several SocketCAN buses.
+ *
+ * Each registered instance is put in drain mode and only run when its
+ * socket is readable, when it has a frame to send and the socket is
+ * writable, or when its nextTimeout() runs out, so an idle gateway sleeps
+ * in epoll_wait() instead of spinning. wake() and stop() may be called
+ * from other threads. Other file descriptors, e.g. the UDP socket of a
+ * gateway, can be watched in the same epoll_wait() with addFd().
+ */
+
+#ifndef CANTT_POLLER_MAX_BUSES
+#define CANTT_POLLER_MAX_BUSES 16
+#endif
+
+// Frames received and sent per bus each time it is run
+#ifndef CANTT_POLLER_BUDGET
+#define CANTT_POLLER_BUDGET 64
+#endif
+
+// Other file descriptors watched along with the buses, see addFd()
+#ifndef CANTT_POLLER_MAX_FDS
+#define CANTT_POLLER_MAX_FDS 4
+#endif
+
+struct CANTTPollerBus {
+    CANTTBase *cantt;
+    SocketCANTransport *transport;
+    bool writing; // EPOLLOUT registered
+};
+
+struct CANTTPollerFd {
+    int fd;
+    void (*ready)(void *context, uint32_t events);
+    void *context;
+};
+
+class CANTTPoller {
+  public:
+    CANTTPoller();
+    ~CANTTPoller();
+
+    int open();
+    void close();
+
+    int add(CANTTBase &cantt, SocketCANTransport &transport);
+    int remove(CANTTBase &cantt);
+
+    int addFd(int fd, uint32_t events,
+              void (*ready)(void *context, uint32_t events), void *context);
+    int modifyFd(int fd, uint32_t events);
+    int removeFd(int fd);
+
+    int poll(int maxWait);
+    int run();
+    void stop();
+    int wake();
+
+    uint32_t wakeups; // returns from epoll_wait()
+    uint32_t loops;   // calls to loop() of the instances
+
+  private:
+    int watch(struct CANTTPollerBus *bus, int op, bool writing);
+
+    int epfd;
+    int wakefd; // eventfd, written by wake()
+    struct CANTTPollerBus buses[CANTT_POLLER_MAX_BUSES];
+    struct CANTTPollerFd fds[CANTT_POLLER_MAX_FDS];
+    volatile bool running;
+};
+
+#endif // cantt_poller.h
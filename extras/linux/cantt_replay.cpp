@@ -0,0 +1,236 @@
+/**
+    CANTT Library
+    cantt_replay.cpp
+    Purpose: Decode benchmark that replays a capture into CANTT.
+
+    Maps a candump log or binary capture (see cantt_capture.h) and feeds
+    its frames to one receiving CANTT instance as fast as loop() takes
+    them, ignoring their timing. Reports frames/s, messages/s and the
+    messages received per topic.
+
+    Usage: cantt_replay [-a addr] [-n passes] [-b budget] [-t topics] file
+*/
+
+#include "cantt.h"
+#include "cantt_capture.h"
+#include "cantt_platform.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Topics counted apart, the rest are counted as "(other)"
+#define REPLAY_MAX_TOPICS 1024
+#define REPLAY_TOPIC_SIZE 64
+
+// Receives messages of any size the protocol allows
+typedef BasicCANTT<CANTT_MAX_DATASIZE, 32, 1> ReplayCANTT;
+
+struct ReplayTopic {
+    uint32_t messages;
+    uint64_t bytes; // payload
+    uint16_t len;
+    char topic[REPLAY_TOPIC_SIZE];
+};
+
+// Open addressing, the table never holds more than half its entries
+static struct ReplayTopic topics[2 * REPLAY_MAX_TOPICS];
+static uint16_t topicCount = 0;
+static struct ReplayTopic other;
+static uint64_t payloadBytes = 0;
+
+/**
+    FNV-1a hash of a topic
+
+    @param data the topic
+    @param len its length
+    @return the hash
+*/
+static uint32_t hashTopic(const uint8_t *data, uint16_t len) {
+    uint32_t h = 2166136261u;
+
+    for (uint16_t i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 16777619u;
+    }
+
+    return h;
+}
+
+/**
+    Entry of a topic, added the first time it is seen
+
+    @param topic the topic
+    @return the entry, "(other)" if the topic is too long or the table full
+*/
+static struct ReplayTopic *lookup(CANTTspan topic) {
+    uint32_t i;
+
+    if (topic.len > REPLAY_TOPIC_SIZE) {
+        return &other;
+    }
+
+    i = hashTopic(topic.data, topic.len) & (2 * REPLAY_MAX_TOPICS - 1);
+    for (;;) {
+        struct ReplayTopic *t = &topics[i];
+
+        if (t->messages == 0) {
+            if (topicCount >= REPLAY_MAX_TOPICS) {
+                return &other;
+            }
+            topicCount++;
+            t->len = topic.len;
+            memcpy(t->topic, topic.data, topic.len);
+            return t;
+        }
+
+        if (t->len == topic.len &&
+            memcmp(t->topic, topic.data, topic.len) == 0) {
+            return t;
+        }
+
+        i = (i + 1) & (2 * REPLAY_MAX_TOPICS - 1);
+    }
+}
+
+static void handler(void *context, uint32_t addr, CANTTspan topic,
+                    CANTTspan payload) {
+    struct ReplayTopic *t = lookup(topic);
+
+    t->messages++;
+    t->bytes += payload.len;
+    payloadBytes += payload.len;
+}
+
+static bool byMessages(const struct ReplayTopic *a,
+                       const struct ReplayTopic *b) {
+    return a->messages > b->messages;
+}
+
+static uint64_t nanos() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-a addr] [-n passes] [-b budget] [-t topics] file\n",
+            name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    uint32_t addr = CANTT_MAX_ADDR;
+    uint32_t passes = 1;
+    uint16_t budget = 64;
+    uint32_t shown = 20;
+    CANTTReplayTransport replay;
+    ReplayCANTT *cantt;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:n:b:t:")) != -1) {
+        switch (opt) {
+        case 'a':
+            addr = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            passes = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            budget = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            shown = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1 || passes < 1) {
+        usage(argv[0]);
+    }
+
+    if (replay.open(argv[optind]) != 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    memcpy(other.topic, "(other)", 7);
+    other.len = 7;
+
+    // Large, and the storage of an instance lives in the object
+    cantt = new ReplayCANTT(addr, replay, handler, NULL);
+    cantt->begin();
+    cantt->setBudget(budget, budget);
+
+    uint64_t start = nanos();
+
+    for (uint32_t pass = 0; pass < passes; pass++) {
+        replay.rewind();
+
+        while (!replay.done()) {
+            cantt->loop();
+        }
+    }
+
+    // Let the last frames through the state machine
+    for (int i = 0; i < 16; i++) {
+        cantt->loop();
+    }
+
+    double seconds = (nanos() - start) / 1e9;
+    const CANTTStats &stats = cantt->stats();
+    const CANTTReassembly &rx = cantt->reassembly();
+    uint32_t frames = replay.framesReceived;
+
+    printf("capture   %s, %s, %u passes\n", argv[optind],
+           replay.format() == CANTT_CAPTURE_BINARY ? "binary" : "candump log",
+           passes);
+    printf("elapsed   %.3f s\n", seconds);
+    printf("frames    %u, %.0f frames/s, %.1f ns/frame, %u malformed\n",
+           frames, frames / seconds, frames ? seconds * 1e9 / frames : 0.0,
+           replay.malformed);
+    printf("messages  %u, %.0f msg/s, %.1f MB/s of payload\n",
+           stats.messagesReceived, stats.messagesReceived / seconds,
+           payloadBytes / seconds / 1e6);
+    printf("dropped   %u rejected, %u evicted, %u timed out, %u frames "
+           "without a transfer\n",
+           stats.rejected, rx.evictions, rx.timeouts, rx.misses);
+    printf("callback  p50 %u us, p99 %u us, max %u us\n",
+           CANTTStats::percentile(stats.callback, 50),
+           CANTTStats::percentile(stats.callback, 99), stats.callback.max);
+
+    struct ReplayTopic *sorted[REPLAY_MAX_TOPICS + 1];
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < 2 * REPLAY_MAX_TOPICS; i++) {
+        if (topics[i].messages > 0) {
+            sorted[count++] = &topics[i];
+        }
+    }
+    if (other.messages > 0) {
+        sorted[count++] = &other;
+    }
+    std::sort(sorted, sorted + count, byMessages);
+
+    printf("\n%u topics\n%10s %12s  topic\n", topicCount, "messages",
+           "bytes");
+    for (uint32_t i = 0; i < count && i < shown; i++) {
+        printf("%10u %12llu  %.*s\n", sorted[i]->messages,
+               (unsigned long long)sorted[i]->bytes, sorted[i]->len,
+               sorted[i]->topic);
+    }
+    if (count > shown) {
+        printf("%10s %12s  ... %u more\n", "", "", count - shown);
+    }
+
+    delete cantt;
+
+    return 0;
+}
@@ -0,0 +1,388 @@
+/**
+    CANTT Library
+    cantt_sim.cpp
+    Purpose: Simulated CAN bus with arbitration and bit-accurate frame
+    timing, on a simulated clock.
+*/
+
+#include "cantt_sim.h"
+#include "cantt_platform.h"
+
+#include <string.h>
+
+// The bus whose clock cantt_millis()/cantt_micros() return
+static CANTTSimBus *installed = NULL;
+
+CANTTSimTransport::CANTTSimTransport() {
+    this->bus = NULL;
+    this->txCount = 0;
+    this->rxHead = 0;
+    this->rxCount = 0;
+    this->framesReceived = 0;
+    this->framesSent = 0;
+    this->lost = 0;
+    this->refused = 0;
+    this->overruns = 0;
+}
+
+/**
+    Checks for a received frame
+
+    @return 1 if a frame is waiting, 0 otherwise
+*/
+uint8_t CANTTSimTransport::available() { return this->rxCount > 0; }
+
+/**
+    Takes the oldest received frame
+
+    @param msg the frame
+    @return 0 on success, 1 if no frame is waiting
+*/
+uint8_t CANTTSimTransport::receive(CANMessage &msg) {
+    if (this->rxCount == 0) {
+        return 1;
+    }
+
+    msg = this->rx[this->rxHead];
+    this->rxHead = (this->rxHead + 1) % CANTT_SIM_RX_BUFFERS;
+    this->rxCount--;
+    this->framesReceived++;
+
+    return 0;
+}
+
+/**
+    Puts a frame in a TX buffer, it is sent by a later transfer() of the bus
+
+    @param msg the frame
+    @return 0 on success, 1 if every TX buffer is in use
+*/
+uint8_t CANTTSimTransport::transmit(const CANMessage &msg) {
+    if (this->bus == NULL || this->txCount >= CANTT_SIM_TX_BUFFERS) {
+        this->refused++;
+        return 1;
+    }
+
+    this->tx[this->txCount++] = msg;
+
+    return 0;
+}
+
+/**
+    Constructor for the class object.
+
+    @param bitrate nominal bitrate in bit/s
+    @param dataBitrate bitrate of the data phase of CAN FD frames, 0 to
+   send them without bitrate switch
+*/
+CANTTSimBus::CANTTSimBus(uint32_t bitrate, uint32_t dataBitrate) {
+    this->nodeCount = 0;
+    this->clock = 0;
+    this->bitrate = bitrate;
+    this->dataBitrate = dataBitrate;
+    this->frames = 0;
+    this->busy = 0;
+    this->lost = 0;
+    this->conflicts = 0;
+}
+
+CANTTSimBus::~CANTTSimBus() { this->uninstall(); }
+
+/**
+    Connects a node to the bus
+
+    @param node its transport
+    @return error code, -1 if the bus has CANTT_SIM_MAX_NODES nodes
+*/
+int CANTTSimBus::attach(CANTTSimTransport &node) {
+    if (this->nodeCount >= CANTT_SIM_MAX_NODES) {
+        return -1;
+    }
+
+    node.bus = this;
+    this->nodes[this->nodeCount++] = &node;
+
+    return 0;
+}
+
+/**
+    Makes cantt_millis() and cantt_micros() return the clock of this bus.
+    Install it before the CANTT instances are constructed, they take the
+    time in their constructor.
+*/
+void CANTTSimBus::install() {
+    installed = this;
+    cantt_host_clock = CANTTSimBus::hostClock;
+}
+
+/**
+    Gives the host its own clock back
+*/
+void CANTTSimBus::uninstall() {
+    if (installed == this) {
+        installed = NULL;
+        cantt_host_clock = NULL;
+    }
+}
+
+uint64_t CANTTSimBus::hostClock() { return installed->clock / 1000; }
+
+/**
+    Lets time pass without a frame on the bus
+
+    @param ns the time in ns
+*/
+void CANTTSimBus::advance(uint64_t ns) { this->clock += ns; }
+
+/*
+ * Bits of a frame as they go on the wire. Counts the stuff bit that
+ * follows five bits of the same value, and runs the CRC-15 of classic
+ * frames over the unstuffed bits.
+ */
+struct CANTTSimBits {
+    uint16_t bits;
+    uint8_t last;
+    uint8_t run;
+    uint16_t crc;
+};
+
+static void putBit(struct CANTTSimBits &s, uint8_t bit) {
+    uint8_t next = bit ^ ((s.crc >> 14) & 1);
+
+    s.crc = (s.crc << 1) & 0x7FFF;
+    if (next) {
+        s.crc ^= 0x4599;
+    }
+
+    s.bits++;
+
+    if (s.run > 0 && bit == s.last) {
+        if (++s.run == 5) {
+            // Stuff bit of the opposite value, it starts a run of its own
+            s.bits++;
+            s.last = !bit;
+            s.run = 1;
+        }
+    } else {
+        s.last = bit;
+        s.run = 1;
+    }
+}
+
+static void putBits(struct CANTTSimBits &s, uint32_t value, uint8_t count) {
+    while (count > 0) {
+        count--;
+        putBit(s, (value >> count) & 1);
+    }
+}
+
+/**
+    Data length code of a frame length
+
+    @param len bytes of data, a length a DLC can express
+    @return the DLC
+*/
+static uint8_t dlcOf(uint8_t len) {
+    static const uint8_t lengths[] = {12, 16, 20, 24, 32, 48, 64};
+
+    if (len <= 8) {
+        return len;
+    }
+
+    for (uint8_t i = 0; i < sizeof(lengths); i++) {
+        if (len <= lengths[i]) {
+            return 9 + i;
+        }
+    }
+
+    return 15;
+}
+
+/**
+    Time a frame holds the bus, from start of frame to the end of the
+    intermission that follows it
+
+    @param msg the frame
+    @return time in ns
+*/
+uint64_t CANTTSimBus::frameTime(const CANMessage &msg) const {
+    struct CANTTSimBits s;
+    bool fd = msg.len > CANTT_CAN_DATASIZE;
+    bool brs =
+        fd && this->dataBitrate > 0 && this->dataBitrate != this->bitrate;
+    uint16_t nominal;
+    uint16_t data = 0;
+    uint8_t crcLen;
+
+    memset(&s, 0, sizeof(s));
+
+    putBit(s, 0); // SOF
+    if (msg.extended) {
+        putBits(s, msg.id >> 18, 11);
+        putBits(s, 0x3, 2); // SRR, IDE
+        putBits(s, msg.id & 0x3FFFF, 18);
+    } else {
+        putBits(s, msg.id, 11);
+    }
+
+    if (fd) {
+        // RRS, IDE of a base frame, FDF, res, BRS
+        if (msg.extended) {
+            putBits(s, 0x2, 3);
+        } else {
+            putBits(s, 0x2, 4);
+        }
+        putBit(s, brs);
+        nominal = s.bits;
+
+        putBit(s, 0); // ESI
+        putBits(s, dlcOf(msg.len), 4);
+        for (uint8_t i = 0; i < msg.len; i++) {
+            putBits(s, msg.data[i], 8);
+        }
+
+        // Stuff count and CRC-17/21 are not stuffed dynamically, they
+        // have a fixed stuff bit before them and after every 4 bits. Then
+        // the CRC delimiter.
+        crcLen = msg.len > 16 ? 21 : 17;
+        data = s.bits - nominal + 4 + crcLen + 1 + (4 + crcLen) / 4 + 1;
+    } else {
+        // RTR, IDE/r1, r0
+        putBit(s, msg.rtr);
+        putBits(s, 0, 2);
+        putBits(s, msg.len, 4);
+        if (!msg.rtr) {
+            for (uint8_t i = 0; i < msg.len; i++) {
+                putBits(s, msg.data[i], 8);
+            }
+        }
+
+        putBits(s, s.crc, 15);
+        nominal = s.bits + 1; // CRC delimiter
+    }
+
+    // ACK slot, ACK delimiter, EOF and intermission
+    nominal += 2 + 7 + 3;
+
+    if (!brs) {
+        return (uint64_t)(nominal + data) * 1000000000ULL / this->bitrate;
+    }
+
+    return (uint64_t)nominal * 1000000000ULL / this->bitrate +
+           (uint64_t)data * 1000000000ULL / this->dataBitrate;
+}
+
+/**
+    Arbitration order of a frame, lower wins. The identifier goes first; a
+    base frame wins over an extended frame with the same 11 bits, and a
+    data frame over a remote frame.
+
+    @param msg the frame
+    @return the bits sent up to the end of arbitration
+*/
+static uint32_t arbitrationKey(const CANMessage &msg) {
+    if (msg.extended) {
+        return (msg.id >> 18) << 21 | 0x3 << 19 | (msg.id & 0x3FFFF) << 1 |
+               msg.rtr;
+    }
+
+    return (msg.id & 0x7FF) << 21 | (msg.rtr ? 1 : 0) << 20;
+}
+
+/**
+    Puts one frame on the bus: the waiting frame with the lowest
+    identifier wins arbitration, the clock moves on by its length and
+    every other node receives it
+
+    @return false if no node had a frame waiting
+*/
+bool CANTTSimBus::transfer() {
+    CANTTSimTransport *winner = NULL;
+    uint8_t winnerIndex = 0;
+    uint32_t winnerKey = 0;
+    CANMessage frame;
+    uint64_t t;
+
+    for (uint8_t n = 0; n < this->nodeCount; n++) {
+        CANTTSimTransport *node = this->nodes[n];
+        uint8_t best = 0;
+        uint32_t bestKey;
+
+        if (node->txCount == 0) {
+            continue;
+        }
+
+        // The controller offers its most important buffer, the oldest one
+        // among equals
+        bestKey = arbitrationKey(node->tx[0]);
+        for (uint8_t i = 1; i < node->txCount; i++) {
+            uint32_t key = arbitrationKey(node->tx[i]);
+
+            if (key < bestKey) {
+                best = i;
+                bestKey = key;
+            }
+        }
+
+        if (winner == NULL || bestKey < winnerKey) {
+            winner = node;
+            winnerIndex = best;
+            winnerKey = bestKey;
+        }
+    }
+
+    if (winner == NULL) {
+        return false;
+    }
+
+    for (uint8_t n = 0; n < this->nodeCount; n++) {
+        CANTTSimTransport *node = this->nodes[n];
+
+        if (node == winner || node->txCount == 0) {
+            continue;
+        }
+
+        // Lost arbitration, tries again with the next frame
+        node->lost++;
+        this->lost++;
+
+        for (uint8_t i = 0; i < node->txCount; i++) {
+            if (arbitrationKey(node->tx[i]) == winnerKey) {
+                // Real controllers would both send, and raise errors if the
+                // data differs. Here the first node wins.
+                this->conflicts++;
+                break;
+            }
+        }
+    }
+
+    frame = winner->tx[winnerIndex];
+    memmove(&winner->tx[winnerIndex], &winner->tx[winnerIndex + 1],
+            (winner->txCount - winnerIndex - 1) * sizeof(CANMessage));
+    winner->txCount--;
+    winner->framesSent++;
+
+    t = this->frameTime(frame);
+    this->clock += t;
+    this->busy += t;
+    this->frames++;
+
+    for (uint8_t n = 0; n < this->nodeCount; n++) {
+        CANTTSimTransport *node = this->nodes[n];
+
+        if (node == winner) {
+            continue;
+        }
+
+        if (node->rxCount >= CANTT_SIM_RX_BUFFERS) {
+            node->overruns++;
+            continue;
+        }
+
+        node->rx[(node->rxHead + node->rxCount) % CANTT_SIM_RX_BUFFERS] =
+            frame;
+        node->rxCount++;
+    }
+
+    return true;
+}
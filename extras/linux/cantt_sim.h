@@ -0,0 +1,96 @@
+#ifndef __CANTT_SIM_H__
+#define __CANTT_SIM_H__
+
+#include "cantt.h"
+
+/*
+ * Simulated CAN bus, for benchmarks that need arbitration and frame timing
+ * without hardware.
+ *
+ * Every node talks to the bus through a CANTTSimTransport. A frame given
+ * to transmit() waits in one of the node's TX buffers until transfer()
+ * arbitrates: the pending frame with the lowest identifier wins, holds the
+ * bus for its length in bits, stuff bits included, and ends up in the RX
+ * buffers of every other node. The nodes that lost try again with the next
+ * transfer().
+ *
+ * Time is simulated. install() makes cantt_millis() and cantt_micros()
+ * return the clock of the bus, which only moves when a frame is sent or
+ * advance() lets idle time pass, so a run gives the same result on any
+ * host. Frames longer than 8 bytes are CAN FD frames; their data phase
+ * runs at the data bitrate.
+ */
+
+#ifndef CANTT_SIM_MAX_NODES
+#define CANTT_SIM_MAX_NODES 64
+#endif
+
+// Frames a node can have waiting for the bus, the MCP2515 has 3
+#ifndef CANTT_SIM_TX_BUFFERS
+#define CANTT_SIM_TX_BUFFERS 3
+#endif
+
+// Frames a node can hold before it overruns
+#ifndef CANTT_SIM_RX_BUFFERS
+#define CANTT_SIM_RX_BUFFERS 32
+#endif
+
+class CANTTSimBus;
+
+class CANTTSimTransport : public CANTransport {
+  public:
+    CANTTSimTransport();
+
+    virtual uint8_t available();
+    virtual uint8_t receive(CANMessage &msg);
+    virtual uint8_t transmit(const CANMessage &msg);
+
+    uint32_t framesReceived;
+    uint32_t framesSent;
+    uint32_t lost;     // arbitrations lost, the frame was sent again
+    uint32_t refused;  // transmit() with every TX buffer in use
+    uint32_t overruns; // frames lost with every RX buffer in use
+
+  private:
+    friend class CANTTSimBus;
+
+    CANTTSimBus *bus;
+    CANMessage tx[CANTT_SIM_TX_BUFFERS];
+    uint8_t txCount;
+    CANMessage rx[CANTT_SIM_RX_BUFFERS];
+    uint8_t rxHead;
+    uint8_t rxCount;
+};
+
+class CANTTSimBus {
+  public:
+    CANTTSimBus(uint32_t bitrate, uint32_t dataBitrate);
+    ~CANTTSimBus();
+
+    int attach(CANTTSimTransport &node);
+
+    void install();
+    void uninstall();
+
+    bool transfer();
+    void advance(uint64_t ns);
+    uint64_t now() const { return this->clock; }
+
+    uint64_t frameTime(const CANMessage &msg) const;
+
+    uint32_t frames;
+    uint64_t busy;      // ns the bus carried frames
+    uint32_t lost;      // arbitrations lost, by any node
+    uint32_t conflicts; // identical identifiers sent at the same time
+
+  private:
+    static uint64_t hostClock();
+
+    CANTTSimTransport *nodes[CANTT_SIM_MAX_NODES];
+    uint8_t nodeCount;
+    uint64_t clock; // ns
+    uint32_t bitrate;
+    uint32_t dataBitrate;
+};
+
+#endif // cantt_sim.h
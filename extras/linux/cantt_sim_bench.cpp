@@ -0,0 +1,360 @@
+/**
+    CANTT Library
+    cantt_sim_bench.cpp
+    Purpose: Arbitration and collision benchmark for CANTT on a simulated
+    CAN bus.
+
+    Runs a sweep of node counts and offered loads. Every node publishes
+    messages at random (Poisson) times, at a rate that adds up to the
+    offered share of the bus, and receives those of the others. The bus
+    arbitrates by identifier and takes the exact frame time, so the same
+    options always give the same report.
+
+    Usage: cantt_sim_bench [-r bitrate] [-d data bitrate] [-s payload size]
+                           [-t seconds] [-n nodes] [-l load %] [-x seed]
+                           [-e] [-v]
+*/
+
+#include "cantt.h"
+#include "cantt_platform.h"
+#include "cantt_sim.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#define SIM_TOPIC "sim"
+#define SIM_MAX_MESSAGE 512
+#define SIM_BUDGET 64
+
+// loop() rounds between two frames on the bus, at most
+#define SIM_ROUNDS 4
+
+// Largest node count, limited by the RX slots of a node
+#define SIM_MAX_NODES 16
+
+// An RX slot for every other node, so a transfer is never evicted because
+// of the node count alone
+typedef BasicCANTT<SIM_MAX_MESSAGE, SIM_MAX_NODES - 1, 8> SimCANTT;
+
+static const int sweepNodes[] = {2, 4, 8, 16};
+static const int sweepLoads[] = {10, 30, 50, 70, 90, 110};
+
+static std::vector<uint32_t> latencies;
+static uint64_t deliveredBytes = 0;
+
+// 29-bit ids, every node its own node number and the same priority
+static bool extendedIds = false;
+
+// Print the messages sent and pending of every node after each run
+static bool perNode = false;
+
+static void handler(void *context, uint32_t addr, CANTTspan topic,
+                    CANTTspan payload) {
+    uint32_t stamp;
+
+    if (payload.len < sizeof(stamp)) {
+        return;
+    }
+
+    memcpy(&stamp, payload.data, sizeof(stamp));
+    latencies.push_back(cantt_micros() - stamp);
+    deliveredBytes += payload.len;
+}
+
+static uint32_t percentile(const std::vector<uint32_t> &v, double p) {
+    if (v.empty()) {
+        return 0;
+    }
+
+    return v[(size_t)(p * (v.size() - 1))];
+}
+
+// Deterministic generator, the same seed gives the same run on any host
+static uint32_t rng = 1;
+
+static double uniform() {
+    rng = rng * 1103515245 + 12345;
+
+    return ((rng >> 8) + 0.5) / (double)(1 << 24);
+}
+
+// Time until the next event of a Poisson process
+static uint64_t exponential(double mean) {
+    return (uint64_t)(-log(uniform()) * mean);
+}
+
+/**
+    Time on the bus of one message, measured by sending it on a bus of its
+    own
+
+    @param bitrate nominal bitrate
+    @param dataBitrate CAN FD data bitrate, 0 for classic frames
+    @param size payload size
+    @return time in ns
+*/
+static uint64_t messageTime(uint32_t bitrate, uint32_t dataBitrate,
+                            uint16_t size) {
+    CANTTSimBus probe(bitrate, dataBitrate);
+    CANTTSimTransport sender, receiver;
+    std::vector<uint8_t> payload(size, 0xA5);
+    SimCANTT *node;
+
+    probe.attach(sender);
+    probe.attach(receiver);
+    probe.install();
+
+    node = new SimCANTT(0x100, sender, handler, NULL);
+    if (extendedIds) {
+        node->setAddr(CANTT_EXT_ADDR(0x100, 1), true, false);
+    }
+    node->setFD(dataBitrate > 0);
+    node->begin();
+    node->setBudget(SIM_BUDGET, SIM_BUDGET);
+    node->publish((uint8_t *)SIM_TOPIC, sizeof(SIM_TOPIC) - 1, &payload[0],
+                  size);
+
+    do {
+        node->loop();
+    } while (probe.transfer());
+
+    delete node;
+    probe.uninstall();
+
+    return probe.busy;
+}
+
+/**
+    Simulates one node count at one offered load and prints a line of the
+    report
+
+    @param bitrate nominal bitrate
+    @param dataBitrate CAN FD data bitrate, 0 for classic frames
+    @param size payload size
+    @param seconds simulated time
+    @param nodes number of nodes
+    @param load offered load in % of the bus
+    @param seed for the publish times
+    @param msgTime bus time of one message in ns
+*/
+static void simulate(uint32_t bitrate, uint32_t dataBitrate, uint16_t size,
+                     double seconds, int nodes, int load, uint32_t seed,
+                     uint64_t msgTime) {
+    CANTTSimBus bus(bitrate, dataBitrate);
+    std::vector<CANTTSimTransport *> transports;
+    std::vector<SimCANTT *> instances;
+    std::vector<uint64_t> next;
+    std::vector<uint32_t> nodeRefused(nodes, 0);
+    std::vector<uint8_t> payload(size, 0xA5);
+    uint64_t end = (uint64_t)(seconds * 1e9);
+    uint32_t attempts = 0;
+    uint32_t refused = 0;
+    uint32_t holdoffs = 0;
+    uint32_t evictions = 0;
+
+    // Mean time between two publishes of a node
+    double interval = msgTime * 100.0 * nodes / load;
+
+    bus.install();
+    latencies.clear();
+    deliveredBytes = 0;
+    rng = seed;
+
+    for (int i = 0; i < nodes; i++) {
+        CANTTSimTransport *tr = new CANTTSimTransport();
+
+        bus.attach(*tr);
+        transports.push_back(tr);
+        instances.push_back(new SimCANTT(0x100 + i, *tr, handler, NULL));
+        if (extendedIds) {
+            instances.back()->setAddr(CANTT_EXT_ADDR(0x100, i + 1), true,
+                                      false);
+        }
+        instances.back()->setFD(dataBitrate > 0);
+        instances.back()->begin();
+        instances.back()->setBudget(SIM_BUDGET, SIM_BUDGET);
+        next.push_back(exponential(interval));
+    }
+
+    while (bus.now() < end) {
+        uint64_t now = bus.now();
+        uint64_t wake = end;
+
+        for (int i = 0; i < nodes; i++) {
+            while (next[i] <= now) {
+                uint32_t stamp = cantt_micros();
+
+                memcpy(&payload[0], &stamp, sizeof(stamp));
+                attempts++;
+                if (instances[i]->publish((uint8_t *)SIM_TOPIC,
+                                          sizeof(SIM_TOPIC) - 1, &payload[0],
+                                          size) != CANTT_OK) {
+                    nodeRefused[i]++;
+                    refused++;
+                }
+                next[i] += exponential(interval);
+            }
+            wake = std::min(wake, next[i]);
+        }
+
+        // The CPUs are infinitely fast, every node catches up before the
+        // next frame
+        for (int round = 0; round < SIM_ROUNDS; round++) {
+            int work = 0;
+
+            for (int i = 0; i < nodes; i++) {
+                work += instances[i]->loop();
+            }
+            if (work == 0) {
+                break;
+            }
+        }
+
+        if (bus.transfer()) {
+            continue;
+        }
+
+        // Idle bus, sleep until the next publish or timer
+        for (int i = 0; i < nodes; i++) {
+            uint32_t t = instances[i]->nextTimeout();
+
+            if (t != CANTT_NO_TIMEOUT) {
+                wake = std::min(wake, now + (uint64_t)(t > 0 ? t : 1) * 1000000);
+            }
+        }
+        bus.advance(wake - now);
+    }
+
+    for (int i = 0; i < nodes; i++) {
+        holdoffs += instances[i]->stats().holdoffs;
+        evictions += instances[i]->reassembly().evictions;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    // Offered counts every publish attempt, refused ones included
+    printf("%5d %4d%% %9.1f %9.1f %9.1f %5.1f%% %7.3f %7u %7u %7u %7u %8u "
+           "%7u %7u\n",
+           nodes, load, attempts / seconds,
+           latencies.size() / (double)(nodes - 1) / seconds,
+           deliveredBytes * 8.0 / (nodes - 1) / seconds / 1000,
+           bus.busy * 100.0 / bus.now(),
+           bus.frames ? (double)bus.lost / bus.frames : 0.0, refused,
+           percentile(latencies, 0.50), percentile(latencies, 0.99),
+           percentile(latencies, 0.999),
+           latencies.empty() ? 0 : latencies.back(), holdoffs, evictions);
+
+    if (perNode) {
+        for (int i = 0; i < nodes; i++) {
+            printf("      node %-3d sent %7u  pending %2u  refused %7u\n",
+                   i, instances[i]->stats().messagesSent,
+                   instances[i]->pending(), nodeRefused[i]);
+        }
+    }
+
+    for (int i = 0; i < nodes; i++) {
+        delete instances[i];
+        delete transports[i];
+    }
+
+    bus.uninstall();
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-r bitrate] [-d data bitrate] [-s payload size] "
+            "[-t seconds] [-n nodes] [-l load %%] [-x seed] [-e] [-v]\n",
+            name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    uint32_t bitrate = 500000;
+    uint32_t dataBitrate = 0;
+    uint16_t size = 16;
+    double seconds = 2;
+    int nodes = 0;
+    int load = 0;
+    uint32_t seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:d:s:t:n:l:x:ev")) != -1) {
+        switch (opt) {
+        case 'r':
+            bitrate = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            dataBitrate = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            size = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'n':
+            nodes = atoi(optarg);
+            break;
+        case 'l':
+            load = atoi(optarg);
+            break;
+        case 'x':
+            seed = strtoul(optarg, NULL, 0);
+            break;
+        case 'e':
+            extendedIds = true;
+            break;
+        case 'v':
+            perNode = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (bitrate == 0 || seconds <= 0 || size < sizeof(uint32_t) ||
+        size + sizeof(SIM_TOPIC) - 1 + 5 > SIM_MAX_MESSAGE || nodes == 1 ||
+        nodes < 0 || nodes > SIM_MAX_NODES || load < 0) {
+        usage(argv[0]);
+    }
+
+    uint64_t msgTime = messageTime(bitrate, dataBitrate, size);
+
+    printf("bus       %u bit/s", bitrate);
+    if (dataBitrate > 0) {
+        printf(", CAN FD data phase %u bit/s", dataBitrate);
+    }
+    if (extendedIds) {
+        printf(", 29-bit ids");
+    }
+    printf("\nmessage   %u bytes payload, %.1f us on the bus, %.3f s "
+           "simulated per run\n\n",
+           size, msgTime / 1000.0, seconds);
+    printf("nodes  load   offered  delivered  goodput   bus  lost/fr "
+           "refused     p50     p99   p99.9      max holdoffs evicted\n");
+    printf("              msg/s     msg/s     kbit/s                 "
+           "            us      us      us       us\n");
+
+    for (size_t n = 0; n < sizeof(sweepNodes) / sizeof(sweepNodes[0]); n++) {
+        if (nodes > 0 && n > 0) {
+            break;
+        }
+
+        for (size_t l = 0; l < sizeof(sweepLoads) / sizeof(sweepLoads[0]);
+             l++) {
+            if (load > 0 && l > 0) {
+                break;
+            }
+
+            simulate(bitrate, dataBitrate, size, seconds,
+                     nodes > 0 ? nodes : sweepNodes[n],
+                     load > 0 ? load : sweepLoads[l], seed, msgTime);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,401 @@
+/**
+    CANTT Library
+    cantt_socketcan.cpp
+    Purpose: CANTransport backend for Linux SocketCAN interfaces.
+*/
+
+#include "cantt_socketcan.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+/**
+    Converts a kernel CAN frame to a CANMessage
+
+    @param frame the kernel frame
+    @param msg the message to fill in
+*/
+static void fromFrame(const struct canfd_frame &frame, CANMessage &msg) {
+    msg.extended = (frame.can_id & CAN_EFF_FLAG) != 0;
+    msg.rtr = (frame.can_id & CAN_RTR_FLAG) != 0;
+    msg.id = frame.can_id & (msg.extended ? CAN_EFF_MASK : CAN_SFF_MASK);
+    msg.len = frame.len > sizeof(msg.data) ? sizeof(msg.data) : frame.len;
+    memcpy(msg.data, frame.data, msg.len);
+}
+
+/**
+    Converts a CANMessage to a kernel CAN frame
+
+    @param msg the message
+    @param frame the kernel frame to fill in, a classic can_frame is the
+   first CAN_MTU bytes of it
+*/
+static void toFrame(const CANMessage &msg, struct canfd_frame &frame) {
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id = msg.id;
+    if (msg.extended) {
+        frame.can_id |= CAN_EFF_FLAG;
+    }
+    if (msg.rtr) {
+        frame.can_id |= CAN_RTR_FLAG;
+    }
+    frame.len = msg.len > sizeof(msg.data) ? sizeof(msg.data) : msg.len;
+    memcpy(frame.data, msg.data, frame.len);
+}
+
+SocketCANTransport::SocketCANTransport() {
+    this->sock = -1;
+    this->fdFrames = false;
+    this->pending = false;
+    this->framesReceived = 0;
+    this->framesSent = 0;
+    this->syscalls = 0;
+    this->batched = true;
+    this->filterCount = 0;
+}
+
+SocketCANTransport::~SocketCANTransport() { this->close(); }
+
+/**
+    Opens a raw CAN socket bound to an interface
+
+    @param ifname name of the interface, e.g. "can0" or "vcan0"
+    @param fd true to send and receive CAN FD frames
+    @return error code, -1 as well if the interface does not do CAN FD
+*/
+int SocketCANTransport::open(const char *ifname, bool fd) {
+    struct sockaddr_can addr;
+    struct ifreq ifr;
+
+    this->close();
+
+    this->sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (this->sock < 0) {
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    if (ioctl(this->sock, SIOCGIFINDEX, &ifr) < 0) {
+        this->close();
+        return -1;
+    }
+
+    if (fd) {
+#ifdef CANTT_CANFD
+        int enable = 1;
+
+        if (ioctl(this->sock, SIOCGIFMTU, &ifr) < 0 || ifr.ifr_mtu != CANFD_MTU ||
+            setsockopt(this->sock, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable,
+                       sizeof(enable)) < 0) {
+            this->close();
+            return -1;
+        }
+#else
+        this->close();
+        return -1;
+#endif
+    }
+    this->fdFrames = fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if (bind(this->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        this->close();
+        return -1;
+    }
+
+    fcntl(this->sock, F_SETFL, fcntl(this->sock, F_GETFL) | O_NONBLOCK);
+
+    return this->applyFilters();
+}
+
+/**
+    Takes over a socket opened elsewhere that carries one struct can_frame,
+    or struct canfd_frame with fd set, per datagram. The tests stand one end
+    of a socketpair() in for an interface this way when there is no vcan.
+
+    @param socket the socket, close() closes it
+    @param fd true to send and accept CAN FD frames
+    @return 0 if OK, -1 on error
+*/
+int SocketCANTransport::adopt(int socket, bool fd) {
+#ifndef CANTT_CANFD
+    if (fd) {
+        return -1;
+    }
+#endif
+
+    this->close();
+
+    this->sock = socket;
+    this->fdFrames = fd;
+
+    fcntl(this->sock, F_SETFL, fcntl(this->sock, F_GETFL) | O_NONBLOCK);
+
+    return this->applyFilters();
+}
+
+/**
+    Closes the socket
+*/
+void SocketCANTransport::close() {
+    if (this->sock >= 0) {
+        ::close(this->sock);
+    }
+    this->sock = -1;
+    this->fdFrames = false;
+    this->pending = false;
+}
+
+/**
+    Checks the size of a frame read from the socket
+
+    @param n bytes read
+    @param fd true on a CAN FD socket
+    @return true for a classic frame, or a CAN FD frame on an FD socket
+*/
+static bool validSize(ssize_t n, bool fd) {
+    return n == CAN_MTU || (fd && n == CANFD_MTU);
+}
+
+/**
+    Reads one frame from the socket into the lookahead buffer
+
+    @return error code
+*/
+int SocketCANTransport::readFrame() {
+    struct canfd_frame frame;
+    ssize_t n;
+
+    if (this->sock < 0) {
+        return 1;
+    }
+
+    do {
+        n = read(this->sock, &frame, sizeof(frame));
+        this->syscalls++;
+    } while (n < 0 && errno == EINTR);
+
+    if (!validSize(n, this->fdFrames)) {
+        return 1;
+    }
+
+    fromFrame(frame, this->lookahead);
+
+    this->pending = true;
+    this->framesReceived++;
+
+    return 0;
+}
+
+uint8_t SocketCANTransport::available() {
+    if (!this->pending) {
+        this->readFrame();
+    }
+
+    return this->pending ? 1 : 0;
+}
+
+uint8_t SocketCANTransport::receive(CANMessage &msg) {
+    if (!this->pending && this->readFrame() != 0) {
+        return 1;
+    }
+
+    msg = this->lookahead;
+    this->pending = false;
+
+    return 0;
+}
+
+uint8_t SocketCANTransport::transmit(const CANMessage &msg) {
+    struct canfd_frame frame;
+    size_t mtu = this->fdFrames ? CANFD_MTU : CAN_MTU;
+    ssize_t n;
+
+    if (this->sock < 0 || (!this->fdFrames && msg.len > CAN_MAX_DLEN)) {
+        return 1;
+    }
+
+    toFrame(msg, frame);
+
+    do {
+        n = write(this->sock, &frame, mtu);
+        this->syscalls++;
+    } while (n < 0 && errno == EINTR);
+
+    if (n != (ssize_t)mtu) {
+        // EAGAIN/ENOBUFS: the interface queue is full, CANTT retries later
+        return 1;
+    }
+
+    this->framesSent++;
+
+    return 0;
+}
+
+/**
+    Reads up to max frames with a single recvmmsg(), after the frame that
+    available() may have read ahead
+
+    @param msgs array of at least max frames to fill in
+    @param max number of frames to read at most
+    @return number of frames read
+*/
+uint8_t SocketCANTransport::readBatch(CANMessage *msgs, uint8_t max) {
+    struct canfd_frame frames[CANTT_IO_BATCH];
+    struct mmsghdr hdrs[CANTT_IO_BATCH];
+    struct iovec iov[CANTT_IO_BATCH];
+    uint8_t count = 0;
+    int n;
+
+    if (!this->batched) {
+        return CANTransport::readBatch(msgs, max);
+    }
+
+    if (this->sock < 0 || max == 0) {
+        return 0;
+    }
+
+    if (this->pending) {
+        msgs[count++] = this->lookahead;
+        this->pending = false;
+    }
+
+    if (max - count > CANTT_IO_BATCH) {
+        max = count + CANTT_IO_BATCH;
+    }
+
+    if (count == max) {
+        return count;
+    }
+
+    memset(hdrs, 0, sizeof(hdrs));
+    for (uint8_t i = 0; i < max - count; i++) {
+        iov[i].iov_base = &frames[i];
+        iov[i].iov_len = sizeof(frames[i]);
+        hdrs[i].msg_hdr.msg_iov = &iov[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    do {
+        n = recvmmsg(this->sock, hdrs, max - count, MSG_DONTWAIT, NULL);
+        this->syscalls++;
+    } while (n < 0 && errno == EINTR);
+
+    for (int i = 0; i < n; i++) {
+        if (validSize(hdrs[i].msg_len, this->fdFrames)) {
+            fromFrame(frames[i], msgs[count++]);
+            this->framesReceived++;
+        }
+    }
+
+    return count;
+}
+
+/**
+    Sends frames with a single sendmmsg()
+
+    @param msgs the frames to send
+    @param count number of frames
+    @return number of frames sent, fewer when the interface queue is full
+*/
+uint8_t SocketCANTransport::sendBatch(const CANMessage *msgs, uint8_t count) {
+    struct canfd_frame frames[CANTT_IO_BATCH];
+    struct mmsghdr hdrs[CANTT_IO_BATCH];
+    struct iovec iov[CANTT_IO_BATCH];
+    size_t mtu = this->fdFrames ? CANFD_MTU : CAN_MTU;
+    int n;
+
+    if (!this->batched) {
+        return CANTransport::sendBatch(msgs, count);
+    }
+
+    if (this->sock < 0) {
+        return 0;
+    }
+
+    if (count > CANTT_IO_BATCH) {
+        count = CANTT_IO_BATCH;
+    }
+
+    memset(hdrs, 0, sizeof(hdrs));
+    for (uint8_t i = 0; i < count; i++) {
+        if (!this->fdFrames && msgs[i].len > CAN_MAX_DLEN) {
+            count = i;
+            break;
+        }
+        toFrame(msgs[i], frames[i]);
+        iov[i].iov_base = &frames[i];
+        iov[i].iov_len = mtu;
+        hdrs[i].msg_hdr.msg_iov = &iov[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    do {
+        n = sendmmsg(this->sock, hdrs, count, 0);
+        this->syscalls++;
+    } while (n < 0 && errno == EINTR);
+
+    if (count == 0 || n <= 0) {
+        // EAGAIN/ENOBUFS: the interface queue is full, CANTT retries later
+        return 0;
+    }
+
+    this->framesSent += n;
+
+    return n;
+}
+
+uint8_t SocketCANTransport::filters() { return CANTT_MAX_HW_FILTERS; }
+
+uint8_t SocketCANTransport::setFilter(uint8_t index, uint32_t id,
+                                      uint32_t mask, bool extended) {
+    if (index >= CANTT_MAX_HW_FILTERS) {
+        return 1;
+    }
+
+    // Only the frame format selected by the filter passes, an empty mask
+    // accepts everything
+    this->filterId[index] = id | (extended ? CAN_EFF_FLAG : 0);
+    this->filterMask[index] = mask != 0 ? mask | CAN_EFF_FLAG : 0;
+    if (index >= this->filterCount) {
+        this->filterCount = index + 1;
+    }
+
+    return this->applyFilters() == 0 ? 0 : 1;
+}
+
+/**
+    Installs the filters on the socket, the kernel drops all other frames
+
+    @return error code
+*/
+int SocketCANTransport::applyFilters() {
+    struct can_filter rfilter[CANTT_MAX_HW_FILTERS];
+
+    if (this->sock < 0 || this->filterCount == 0) {
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < this->filterCount; i++) {
+        rfilter[i].can_id = this->filterId[i];
+        rfilter[i].can_mask = this->filterMask[i];
+    }
+
+    if (setsockopt(this->sock, SOL_CAN_RAW, CAN_RAW_FILTER, rfilter,
+                   this->filterCount * sizeof(rfilter[0])) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef __CANTT_SOCKETCAN_H__
+#define __CANTT_SOCKETCAN_H__
+
+#include "cantt.h"
+
+/*
+ * SocketCAN backend for CANTT on Linux hosts.
+ *
+ * The socket is non-blocking; available() reads ahead one frame so that a
+ * frame costs a single syscall. readBatch()/sendBatch() move up to
+ * CANTT_IO_BATCH frames per recvmmsg()/sendmmsg() call. Opened with fd set
+ * (builds with CANTT_CANFD), the socket carries CAN FD frames as well; the
+ * interface needs an MTU of 72 for that.
+ */
+
+class SocketCANTransport : public CANTransport {
+  public:
+    SocketCANTransport();
+    ~SocketCANTransport();
+
+    int open(const char *ifname, bool fd = false);
+    int adopt(int socket, bool fd = false);
+    void close();
+    int fd() const { return this->sock; }
+    bool buffered() const { return this->pending; }
+
+    uint8_t available();
+    uint8_t receive(CANMessage &msg);
+    uint8_t transmit(const CANMessage &msg);
+    uint8_t readBatch(CANMessage *msgs, uint8_t max);
+    uint8_t sendBatch(const CANMessage *msgs, uint8_t count);
+    uint8_t filters();
+    uint8_t setFilter(uint8_t index, uint32_t id, uint32_t mask,
+                      bool extended);
+
+    uint32_t framesReceived;
+    uint32_t framesSent;
+    uint32_t syscalls; // reads and writes on the socket
+    bool batched;      // false to move one frame per syscall
+
+  private:
+    int readFrame();
+
+    int applyFilters();
+
+    int sock;
+    bool fdFrames;
+    bool pending;
+    CANMessage lookahead;
+    uint32_t filterId[CANTT_MAX_HW_FILTERS];
+    uint32_t filterMask[CANTT_MAX_HW_FILTERS];
+    uint8_t filterCount;
+};
+
+#endif // cantt_socketcan.h
@@ -0,0 +1,341 @@
+/**
+    CANTT Library
+    cantt_thread.cpp
+    Purpose: Runs a CANTT instance on an I/O thread of its own, with
+    lock-free queues to and from the application threads.
+*/
+
+#include "cantt_thread.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+CANTTQueue::CANTTQueue() {
+    for (uint32_t i = 0; i < CANTT_THREAD_QUEUE_SIZE; i++) {
+        this->cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    this->enqueuePos.store(0, std::memory_order_relaxed);
+    this->dequeuePos.store(0, std::memory_order_relaxed);
+}
+
+/**
+    Copies a message into the queue. Safe from any thread.
+
+    @param addr address/priority
+    @param topic the topic
+    @param topicLen length of the topic
+    @param payload the payload
+    @param payloadLen length of the payload
+    @return false if the queue is full or the message too large
+*/
+bool CANTTQueue::push(uint32_t addr, const uint8_t *topic, uint16_t topicLen,
+                      const uint8_t *payload, uint16_t payloadLen) {
+    struct Cell *cell;
+    uint32_t pos;
+
+    if ((uint32_t)topicLen + payloadLen > CANTT_THREAD_MAX_MESSAGE) {
+        return false;
+    }
+
+    pos = this->enqueuePos.load(std::memory_order_relaxed);
+    for (;;) {
+        int32_t diff;
+
+        cell = &this->cells[pos & (CANTT_THREAD_QUEUE_SIZE - 1)];
+        diff = (int32_t)(cell->sequence.load(std::memory_order_acquire) - pos);
+
+        if (diff == 0) {
+            // Our turn for this cell, if no other producer takes it first
+            if (this->enqueuePos.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false; // The consumers are a lap behind, full
+        } else {
+            pos = this->enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->msg.addr = addr;
+    cell->msg.topicLen = topicLen;
+    cell->msg.payloadLen = payloadLen;
+    memcpy(cell->msg.data, topic, topicLen);
+    memcpy(&cell->msg.data[topicLen], payload, payloadLen);
+
+    // Hand the cell to the consumers
+    cell->sequence.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+/**
+    Takes the oldest message out of the queue. Safe from any thread.
+
+    @param msg the message to fill in
+    @return false if the queue is empty
+*/
+bool CANTTQueue::pop(struct CANTTThreadMessage &msg) {
+    struct Cell *cell;
+    uint32_t pos;
+
+    pos = this->dequeuePos.load(std::memory_order_relaxed);
+    for (;;) {
+        int32_t diff;
+
+        cell = &this->cells[pos & (CANTT_THREAD_QUEUE_SIZE - 1)];
+        diff = (int32_t)(cell->sequence.load(std::memory_order_acquire) -
+                         (pos + 1));
+
+        if (diff == 0) {
+            if (this->dequeuePos.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false; // Not written yet, empty
+        } else {
+            pos = this->dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    msg.addr = cell->msg.addr;
+    msg.topicLen = cell->msg.topicLen;
+    msg.payloadLen = cell->msg.payloadLen;
+    memcpy(msg.data, cell->msg.data, msg.topicLen + msg.payloadLen);
+
+    // Hand the cell back to the producers, for their next lap
+    cell->sequence.store(pos + CANTT_THREAD_QUEUE_SIZE,
+                         std::memory_order_release);
+
+    return true;
+}
+
+CANTTThread::CANTTThread() {
+    this->cantt = NULL;
+    this->holding = false;
+    this->wakePending.store(false);
+    this->rxDropped.store(0);
+    this->rxReady = -1;
+    this->running.store(false);
+    this->started = false;
+}
+
+CANTTThread::~CANTTThread() { this->stop(); }
+
+/**
+    Hands a CANTT instance to a new I/O thread. The handler of the instance
+    is replaced by one that queues the messages for receive(); from now on
+    the instance must only be used through this object.
+
+    @param cantt the instance, begin() already called
+    @param transport its transport, already open
+    @return error code
+*/
+int CANTTThread::start(CANTTBase &cantt, SocketCANTransport &transport) {
+    if (this->started) {
+        return -1;
+    }
+
+    this->rxReady = eventfd(0, EFD_SEMAPHORE | EFD_CLOEXEC);
+    if (this->rxReady < 0) {
+        return -1;
+    }
+
+    if (this->poller.open() != 0 || this->poller.add(cantt, transport) != 0) {
+        this->poller.close();
+        ::close(this->rxReady);
+        this->rxReady = -1;
+        return -1;
+    }
+
+    this->cantt = &cantt;
+    cantt.setHandler(CANTTThread::handler, this);
+
+    this->running.store(true);
+    if (pthread_create(&this->thread, NULL, CANTTThread::main, this) != 0) {
+        this->running.store(false);
+        cantt.setHandler(NULL, NULL);
+        this->poller.close();
+        ::close(this->rxReady);
+        this->rxReady = -1;
+        return -1;
+    }
+
+    this->started = true;
+
+    return 0;
+}
+
+/**
+    Stops the I/O thread and waits for it. Messages still queued for
+    sending are dropped.
+*/
+void CANTTThread::stop() {
+    if (!this->started) {
+        return;
+    }
+
+    this->running.store(false);
+    this->poller.wake();
+    pthread_join(this->thread, NULL);
+    this->started = false;
+
+    this->cantt->setHandler(NULL, NULL);
+    this->poller.close();
+    ::close(this->rxReady);
+    this->rxReady = -1;
+}
+
+/**
+    Publish a message on a topic, from any thread
+
+    @param topic the topic
+    @param payload the payload
+    @return error code, see publish(priority, ...)
+*/
+int CANTTThread::publish(char *topic, char *payload) {
+    if (this->cantt == NULL) {
+        return -1;
+    }
+
+    return this->publish(this->cantt->address(), (uint8_t *)topic,
+                         strlen(topic), (uint8_t *)payload, strlen(payload));
+}
+
+/**
+    Publish a message on a topic, from any thread. The message is copied,
+    the I/O thread queues it in CANTT.
+
+    @param priority address/priority of the message
+    @param topic the topic
+    @param topic_len the length of the topic
+    @param payload the payload
+    @param payload_len the length of the payload
+    @return CANTT_OK, CANTT_ERR_QUEUE_FULL if the queue to the I/O thread is
+   full, -1 if the message is too large for it or for CANTT
+*/
+int CANTTThread::publish(uint32_t priority, const uint8_t *topic,
+                         uint16_t topic_len, const uint8_t *payload,
+                         uint16_t payload_len) {
+    // Checked here, the I/O thread has no way to report it
+    if (this->cantt == NULL ||
+        (uint32_t)topic_len + payload_len > CANTT_THREAD_MAX_MESSAGE ||
+        (uint32_t)topic_len + payload_len + 5 > this->cantt->maxMessageSize()) {
+        return -1;
+    }
+
+    if (!this->txQueue.push(priority, topic, topic_len, payload,
+                            payload_len)) {
+        return CANTT_ERR_QUEUE_FULL;
+    }
+
+    // One wake-up per batch: the I/O thread clears the flag before it
+    // empties the queue
+    if (!this->wakePending.exchange(true)) {
+        this->poller.wake();
+    }
+
+    return CANTT_OK;
+}
+
+/**
+    Takes a received message, from any thread
+
+    @param msg the message to fill in
+    @param timeout time in ms to wait for one, -1 to wait forever, 0 not
+   to wait
+    @return false if there was none in time
+*/
+bool CANTTThread::receive(struct CANTTThreadMessage &msg, int timeout) {
+    struct pollfd pfd;
+    uint64_t count;
+
+    for (;;) {
+        if (this->rxQueue.pop(msg)) {
+            return true;
+        }
+
+        if (timeout == 0 || this->rxReady < 0) {
+            return false;
+        }
+
+        // The count may be ahead of the queue, a spurious wake-up only
+        // costs another try
+        pfd.fd = this->rxReady;
+        pfd.events = POLLIN;
+        if (::poll(&pfd, 1, timeout) <= 0) {
+            return this->rxQueue.pop(msg);
+        }
+
+        if (read(this->rxReady, &count, sizeof(count)) < 0 &&
+            errno != EAGAIN) {
+            return false;
+        }
+    }
+}
+
+/**
+    Queues a decoded message for receive(), on the I/O thread
+*/
+void CANTTThread::handler(void *context, uint32_t addr, CANTTspan topic,
+                          CANTTspan payload) {
+    CANTTThread *self = (CANTTThread *)context;
+    uint64_t one = 1;
+
+    if (!self->rxQueue.push(addr, topic.data, topic.len, payload.data,
+                            payload.len)) {
+        // Nothing can hold off the bus, the message is lost
+        self->rxDropped++;
+        return;
+    }
+
+    if (write(self->rxReady, &one, sizeof(one)) < 0) {
+        // The counter is full, the workers are awake anyway
+    }
+}
+
+/**
+    Moves published messages into the TX queue of CANTT until it is full,
+    on the I/O thread
+*/
+void CANTTThread::flush() {
+    this->wakePending.store(false);
+
+    for (;;) {
+        if (!this->holding && !this->txQueue.pop(this->held)) {
+            return;
+        }
+
+        this->holding = this->cantt->publish(
+                            this->held.addr, this->held.data,
+                            this->held.topicLen,
+                            &this->held.data[this->held.topicLen],
+                            this->held.payloadLen) == CANTT_ERR_QUEUE_FULL;
+
+        if (this->holding) {
+            // Retried once loop() has sent something
+            return;
+        }
+    }
+}
+
+/**
+    The I/O thread
+*/
+void *CANTTThread::main(void *arg) {
+    CANTTThread *self = (CANTTThread *)arg;
+
+    while (self->running.load()) {
+        self->flush();
+
+        if (self->poller.poll(-1) < 0) {
+            break;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,102 @@
+#ifndef __CANTT_THREAD_H__
+#define __CANTT_THREAD_H__
+
+#include "cantt.h"
+#include "cantt_poller.h"
+#include "cantt_socketcan.h"
+
+#include <atomic>
+#include <pthread.h>
+
+/*
+ * Threaded host mode.
+ *
+ * One I/O thread owns a CANTT instance and runs it from a CANTTPoller;
+ * nothing else touches the instance once start() returned. Any thread can
+ * publish(): the message is copied into a lock-free queue that the I/O
+ * thread empties into the TX queue of CANTT. Received messages go the
+ * other way, into a second queue that worker threads take them from with
+ * receive().
+ */
+
+// Messages each queue holds, a power of two
+#ifndef CANTT_THREAD_QUEUE_SIZE
+#define CANTT_THREAD_QUEUE_SIZE 128
+#endif
+
+// Largest topic + payload that fits a queued message
+#ifndef CANTT_THREAD_MAX_MESSAGE
+#define CANTT_THREAD_MAX_MESSAGE 256
+#endif
+
+#if (CANTT_THREAD_QUEUE_SIZE & (CANTT_THREAD_QUEUE_SIZE - 1)) != 0
+#error "CANTT_THREAD_QUEUE_SIZE must be a power of two"
+#endif
+
+// A message on its way to or from the I/O thread
+struct CANTTThreadMessage {
+    uint32_t addr;
+    uint16_t topicLen;
+    uint16_t payloadLen;
+    uint8_t data[CANTT_THREAD_MAX_MESSAGE]; // topic, then payload
+};
+
+/*
+ * Bounded multi-producer/multi-consumer queue (D. Vyukov). Every cell has a
+ * sequence number telling whose turn it is, so producers and consumers only
+ * contend on their own position counter.
+ */
+class CANTTQueue {
+  public:
+    CANTTQueue();
+
+    bool push(uint32_t addr, const uint8_t *topic, uint16_t topicLen,
+              const uint8_t *payload, uint16_t payloadLen);
+    bool pop(struct CANTTThreadMessage &msg);
+
+  private:
+    struct Cell {
+        std::atomic<uint32_t> sequence;
+        struct CANTTThreadMessage msg;
+    };
+
+    struct Cell cells[CANTT_THREAD_QUEUE_SIZE];
+    alignas(64) std::atomic<uint32_t> enqueuePos;
+    alignas(64) std::atomic<uint32_t> dequeuePos;
+};
+
+class CANTTThread {
+  public:
+    CANTTThread();
+    ~CANTTThread();
+
+    int start(CANTTBase &cantt, SocketCANTransport &transport);
+    void stop();
+
+    int publish(char *topic, char *payload);
+    int publish(uint32_t priority, const uint8_t *topic, uint16_t topic_len,
+                const uint8_t *payload, uint16_t payload_len);
+    bool receive(struct CANTTThreadMessage &msg, int timeout);
+
+    std::atomic<uint32_t> rxDropped; // received with the RX queue full
+
+  private:
+    static void *main(void *arg);
+    static void handler(void *context, uint32_t addr, CANTTspan topic,
+                        CANTTspan payload);
+    void flush();
+
+    CANTTBase *cantt;
+    CANTTPoller poller;
+    CANTTQueue txQueue;
+    CANTTQueue rxQueue;
+    struct CANTTThreadMessage held; // popped, CANTT had no room yet
+    bool holding;
+    std::atomic<bool> wakePending;
+    int rxReady; // eventfd semaphore, one count per received message
+    pthread_t thread;
+    std::atomic<bool> running;
+    bool started;
+};
+
+#endif // cantt_thread.h
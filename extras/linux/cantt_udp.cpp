@@ -0,0 +1,497 @@
+/**
+    CANTT Library
+    cantt_udp.cpp
+    Purpose: Gateway between CANTT on SocketCAN buses and UDP, batching
+    datagrams with sendmmsg()/recvmmsg().
+*/
+
+#include "cantt_udp.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+    Writes a value little-endian
+
+    @param buf where to write it
+    @param value the value
+    @param bytes size of the value
+*/
+static void putLE(uint8_t *buf, uint32_t value, uint8_t bytes) {
+    for (uint8_t i = 0; i < bytes; i++) {
+        buf[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+/**
+    Reads a little-endian value
+
+    @param buf where to read it
+    @param bytes size of the value
+    @return the value
+*/
+static uint32_t getLE(const uint8_t *buf, uint8_t bytes) {
+    uint32_t value = 0;
+
+    for (uint8_t i = bytes; i > 0; i--) {
+        value = value << 8 | buf[i - 1];
+    }
+
+    return value;
+}
+
+CANTTUdpGateway::CANTTUdpGateway() {
+    this->sock = -1;
+    this->running = false;
+    this->busCount = 0;
+    this->txCount = 0;
+    this->rxCount = 0;
+    this->rxIndex = 0;
+    this->rxPos = 0;
+    this->rxDone = 0;
+    this->rxPaused = false;
+    this->messagesForwarded = 0;
+    this->datagramsSent = 0;
+    this->datagramsDropped = 0;
+    this->oversize = 0;
+    this->datagramsReceived = 0;
+    this->messagesInjected = 0;
+    this->malformed = 0;
+    this->rejected = 0;
+    this->stalls = 0;
+    memset(&this->peer, 0, sizeof(this->peer));
+    memset(this->buses, 0, sizeof(this->buses));
+}
+
+CANTTUdpGateway::~CANTTUdpGateway() { this->close(); }
+
+/**
+    Opens the UDP socket and the event loop
+
+    @param port local port datagrams towards CAN are received on, 0 for
+   none in particular
+    @param peer IPv4 address datagrams from CAN are sent to, a broadcast
+   address is fine
+    @param peerPort port on the peer
+    @return error code
+*/
+int CANTTUdpGateway::open(uint16_t port, const char *peer,
+                          uint16_t peerPort) {
+    struct sockaddr_in local;
+    int enable = 1;
+
+    this->close();
+
+    memset(&this->peer, 0, sizeof(this->peer));
+    this->peer.sin_family = AF_INET;
+    this->peer.sin_port = htons(peerPort);
+    if (inet_pton(AF_INET, peer, &this->peer.sin_addr) != 1) {
+        return -1;
+    }
+
+    this->sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (this->sock < 0) {
+        return -1;
+    }
+    setsockopt(this->sock, SOL_SOCKET, SO_BROADCAST, &enable,
+               sizeof(enable));
+
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons(port);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if (bind(this->sock, (struct sockaddr *)&local, sizeof(local)) < 0 ||
+        this->poller.open() != 0 ||
+        this->poller.addFd(this->sock, EPOLLIN, CANTTUdpGateway::readable,
+                           this) != 0) {
+        this->close();
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+    Closes the socket and the event loop, the buses have to be added again
+*/
+void CANTTUdpGateway::close() {
+    this->poller.close();
+
+    if (this->sock >= 0) {
+        ::close(this->sock);
+    }
+    this->sock = -1;
+    this->busCount = 0;
+    this->txCount = 0;
+    this->rxCount = 0;
+    this->rxIndex = 0;
+    this->rxPaused = false;
+    memset(this->buses, 0, sizeof(this->buses));
+}
+
+/**
+    Gives the local port, the one the system picked if open() was given 0
+
+    @return the port, 0 before open()
+*/
+uint16_t CANTTUdpGateway::port() {
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+
+    if (this->sock < 0 ||
+        getsockname(this->sock, (struct sockaddr *)&local, &len) < 0) {
+        return 0;
+    }
+
+    return ntohs(local.sin_port);
+}
+
+/**
+    Adds a bus. The gateway becomes the handler of the instance, and the
+    instance runs in drain mode from now on.
+
+    @param cantt the instance, begin() called already
+    @param transport its transport, already open
+    @return error code, -1 as well before open()
+*/
+int CANTTUdpGateway::addBus(CANTTBase &cantt, SocketCANTransport &transport) {
+    struct CANTTUdpBus *bus;
+
+    if (this->sock < 0 || this->busCount >= CANTT_POLLER_MAX_BUSES ||
+        this->poller.add(cantt, transport) != 0) {
+        return -1;
+    }
+
+    bus = &this->buses[this->busCount];
+    bus->cantt = &cantt;
+    bus->gateway = this;
+    bus->index = this->busCount;
+    this->busCount++;
+
+    cantt.setHandler(CANTTUdpGateway::handler, bus);
+
+    return 0;
+}
+
+void CANTTUdpGateway::handler(void *context, uint32_t addr, CANTTspan topic,
+                              CANTTspan payload) {
+    struct CANTTUdpBus *bus = (struct CANTTUdpBus *)context;
+
+    bus->gateway->forward(bus, addr, topic, payload);
+}
+
+void CANTTUdpGateway::readable(void *context, uint32_t events) {
+    ((CANTTUdpGateway *)context)->receive();
+}
+
+/**
+    Adds a message decoded on a bus to the datagrams to send. The datagrams
+    go out with the next flush(), or right away when every one is full.
+
+    @param bus the bus
+    @param addr address of the sender
+    @param topic the topic
+    @param payload the payload
+*/
+void CANTTUdpGateway::forward(struct CANTTUdpBus *bus, uint32_t addr,
+                              CANTTspan topic, CANTTspan payload) {
+    uint32_t size = CANTT_UDP_RECORD + topic.len + payload.len;
+    uint8_t *record;
+
+    if (size + 1 > CANTT_UDP_DATAGRAM) {
+        this->oversize++;
+        return;
+    }
+
+    if (this->txCount == 0 ||
+        this->txLen[this->txCount - 1] + size > CANTT_UDP_DATAGRAM) {
+        if (this->txCount == CANTT_UDP_BATCH) {
+            this->flush();
+        }
+
+        this->txBuf[this->txCount][0] = CANTT_UDP_VERSION;
+        this->txLen[this->txCount] = 1;
+        this->txCount++;
+    }
+
+    record = &this->txBuf[this->txCount - 1][this->txLen[this->txCount - 1]];
+    record[0] = bus->index;
+    putLE(&record[1], addr, 4);
+    putLE(&record[5], topic.len, 2);
+    memcpy(&record[7], topic.data, topic.len);
+    putLE(&record[7 + topic.len], payload.len, 2);
+    memcpy(&record[9 + topic.len], payload.data, payload.len);
+
+    this->txLen[this->txCount - 1] += size;
+    this->messagesForwarded++;
+}
+
+/**
+    Sends the datagrams filled so far with sendmmsg()
+
+    @return number of datagrams sent, -1 if the socket did not take them
+   all; those are dropped
+*/
+int CANTTUdpGateway::flush() {
+    struct mmsghdr hdrs[CANTT_UDP_BATCH];
+    struct iovec iov[CANTT_UDP_BATCH];
+    uint8_t sent = 0;
+    int n;
+
+    if (this->txCount == 0) {
+        return 0;
+    }
+
+    memset(hdrs, 0, sizeof(hdrs));
+    for (uint8_t i = 0; i < this->txCount; i++) {
+        iov[i].iov_base = this->txBuf[i];
+        iov[i].iov_len = this->txLen[i];
+        hdrs[i].msg_hdr.msg_name = &this->peer;
+        hdrs[i].msg_hdr.msg_namelen = sizeof(this->peer);
+        hdrs[i].msg_hdr.msg_iov = &iov[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (sent < this->txCount) {
+        n = sendmmsg(this->sock, &hdrs[sent], this->txCount - sent, 0);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            // EAGAIN/ENOBUFS: the socket buffer is full. Waiting would
+            // stall every bus, UDP may lose datagrams anyway.
+            break;
+        }
+
+        sent += n;
+    }
+
+    this->datagramsSent += sent;
+    this->datagramsDropped += this->txCount - sent;
+    n = sent == this->txCount ? sent : -1;
+    this->txCount = 0;
+
+    return n;
+}
+
+/**
+    Publishes a message from UDP on a bus
+
+    @param bus index of the bus
+    @param addr priority to publish with, 0 for the address of the gateway
+    @param topic the topic
+    @param topicLen its length
+    @param payload the payload
+    @param payloadLen its length
+    @return send()/publish() status
+*/
+int CANTTUdpGateway::publish(uint8_t bus, uint32_t addr, uint8_t *topic,
+                             uint16_t topicLen, uint8_t *payload,
+                             uint16_t payloadLen) {
+    CANTTBase *cantt = this->buses[bus].cantt;
+
+    if (addr == 0) {
+        return cantt->publish(topic, topicLen, payload, payloadLen);
+    }
+
+    return cantt->publish(addr, topic, topicLen, payload, payloadLen);
+}
+
+/**
+    Publishes the records of the datagrams received, from where the last
+    call stopped
+
+    @return false if a bus queue is full, the record is tried again by the
+   next call
+*/
+bool CANTTUdpGateway::inject() {
+    while (this->rxIndex < this->rxCount) {
+        uint8_t *buf = this->rxBuf[this->rxIndex];
+        uint16_t len = this->rxLen[this->rxIndex];
+
+        if (this->rxPos == 0) {
+            if (len == 0 || buf[0] != CANTT_UDP_VERSION) {
+                this->malformed++;
+                this->rxIndex++;
+                continue;
+            }
+            this->rxPos = 1;
+            this->rxDone = 0;
+        }
+
+        while (this->rxPos < len) {
+            uint8_t *record = &buf[this->rxPos];
+            uint16_t left = len - this->rxPos;
+            uint16_t topicLen;
+            uint16_t payloadLen;
+            uint8_t bus;
+            uint32_t addr;
+
+            if (left < CANTT_UDP_RECORD ||
+                (topicLen = getLE(&record[5], 2)) > left - CANTT_UDP_RECORD ||
+                (payloadLen = getLE(&record[7 + topicLen], 2)) >
+                    left - CANTT_UDP_RECORD - topicLen) {
+                // The rest of the datagram can not be trusted
+                this->malformed++;
+                break;
+            }
+
+            bus = record[0];
+            addr = getLE(&record[1], 4);
+
+            if (bus != CANTT_UDP_ALL_BUSES && bus >= this->busCount) {
+                this->rejected++;
+            }
+
+            for (uint8_t b = 0; b < this->busCount; b++) {
+                int status;
+
+                if ((bus != CANTT_UDP_ALL_BUSES && bus != b) ||
+                    (this->rxDone & (1UL << b))) {
+                    continue;
+                }
+
+                status = this->publish(b, addr, &record[7], topicLen,
+                                       &record[9 + topicLen], payloadLen);
+                if (status == CANTT_ERR_QUEUE_FULL) {
+                    return false;
+                }
+
+                if (status == CANTT_OK) {
+                    this->messagesInjected++;
+                } else {
+                    this->rejected++;
+                }
+                this->rxDone |= 1UL << b;
+            }
+
+            this->rxPos += CANTT_UDP_RECORD + topicLen + payloadLen;
+            this->rxDone = 0;
+        }
+
+        this->rxIndex++;
+        this->rxPos = 0;
+    }
+
+    return true;
+}
+
+/**
+    Stops or resumes reading the UDP socket
+
+    @param paused true to stop
+*/
+void CANTTUdpGateway::pause(bool paused) {
+    if (paused == this->rxPaused) {
+        return;
+    }
+
+    if (paused) {
+        this->stalls++;
+    }
+
+    this->poller.modifyFd(this->sock, paused ? 0 : EPOLLIN);
+    this->rxPaused = paused;
+}
+
+/**
+    Reads a batch of datagrams with recvmmsg() and publishes them. Reading
+    pauses while a bus queue is full.
+*/
+void CANTTUdpGateway::receive() {
+    struct mmsghdr hdrs[CANTT_UDP_BATCH];
+    struct iovec iov[CANTT_UDP_BATCH];
+    int n;
+
+    if (!this->inject()) {
+        this->pause(true);
+        return;
+    }
+
+    memset(hdrs, 0, sizeof(hdrs));
+    for (uint8_t i = 0; i < CANTT_UDP_BATCH; i++) {
+        iov[i].iov_base = this->rxBuf[i];
+        iov[i].iov_len = CANTT_UDP_DATAGRAM;
+        hdrs[i].msg_hdr.msg_iov = &iov[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    do {
+        n = recvmmsg(this->sock, hdrs, CANTT_UDP_BATCH, MSG_DONTWAIT, NULL);
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        // A truncated datagram is skipped as a whole
+        this->rxLen[i] =
+            (hdrs[i].msg_hdr.msg_flags & MSG_TRUNC) ? 0 : hdrs[i].msg_len;
+    }
+
+    this->datagramsReceived += n;
+    this->rxCount = n;
+    this->rxIndex = 0;
+    this->rxPos = 0;
+
+    if (!this->inject()) {
+        this->pause(true);
+    }
+}
+
+/**
+    Waits for work, runs the buses, publishes what was held back by a full
+    queue and sends the datagrams filled on the way
+
+    @param maxWait longest time to wait in ms, -1 to wait for an event
+    @return number of frames received and sent, -1 on error
+*/
+int CANTTUdpGateway::poll(int maxWait) {
+    int work = this->poller.poll(maxWait);
+
+    if (work < 0) {
+        return -1;
+    }
+
+    // The buses sent frames, their queues may have room again
+    if (this->rxPaused && this->inject()) {
+        this->pause(false);
+    }
+
+    this->flush();
+
+    return work;
+}
+
+/**
+    Runs the gateway until stop() is called
+
+    @return 0 when stopped, -1 on error
+*/
+int CANTTUdpGateway::run() {
+    this->running = true;
+
+    while (this->running) {
+        if (this->poll(-1) < 0) {
+            this->running = false;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+    Ends run(), from a handler, another thread or a signal handler
+*/
+void CANTTUdpGateway::stop() {
+    this->running = false;
+    this->poller.wake();
+}
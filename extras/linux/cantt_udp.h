@@ -0,0 +1,126 @@
+#ifndef __CANTT_UDP_H__
+#define __CANTT_UDP_H__
+
+#include <netinet/in.h>
+
+#include "cantt.h"
+#include "cantt_poller.h"
+#include "cantt_socketcan.h"
+
+/*
+ * Gateway between CANTT on SocketCAN buses and UDP.
+ *
+ * Every message decoded on any of the buses becomes a record in a UDP
+ * datagram to the peer. Records are packed into datagrams of up to
+ * CANTT_UDP_DATAGRAM bytes, and everything one wake-up of the event loop
+ * decoded goes out with a single sendmmsg(). Datagrams received on the
+ * local port are read with recvmmsg() and their records published on the
+ * bus they name.
+ *
+ * A datagram is a version byte (CANTT_UDP_VERSION) and records, all
+ * little-endian:
+ *
+ *     uint8_t   bus, the order addBus() was called in; towards CAN,
+ *               CANTT_UDP_ALL_BUSES for every bus
+ *     uint32_t  address of the sender; towards CAN the priority to publish
+ *               with, 0 for the address of the gateway
+ *     uint16_t  topic length, then the topic
+ *     uint16_t  payload length, then the payload
+ *
+ * When a bus can not queue more messages the gateway stops reading the
+ * UDP socket until the bus caught up, so a burst waits in the socket
+ * buffer instead of being thrown away message by message.
+ */
+
+#define CANTT_UDP_VERSION 1
+#define CANTT_UDP_ALL_BUSES 0xFF
+#define CANTT_UDP_RECORD 9 // record without topic and payload
+
+// Largest datagram sent or received, one Ethernet frame by default
+#ifndef CANTT_UDP_DATAGRAM
+#define CANTT_UDP_DATAGRAM 1472
+#endif
+
+// Datagrams moved per sendmmsg()/recvmmsg()
+#ifndef CANTT_UDP_BATCH
+#define CANTT_UDP_BATCH 16
+#endif
+
+// The buses a record was published on are kept in a 32-bit mask
+#if CANTT_POLLER_MAX_BUSES > 32
+#error "CANTTUdpGateway handles up to 32 buses"
+#endif
+
+class CANTTUdpGateway;
+
+struct CANTTUdpBus {
+    CANTTBase *cantt;
+    CANTTUdpGateway *gateway;
+    uint8_t index;
+};
+
+class CANTTUdpGateway {
+  public:
+    CANTTUdpGateway();
+    ~CANTTUdpGateway();
+
+    int open(uint16_t port, const char *peer, uint16_t peerPort);
+    void close();
+
+    int addBus(CANTTBase &cantt, SocketCANTransport &transport);
+    uint16_t port();
+
+    int poll(int maxWait);
+    int run();
+    void stop();
+    int flush();
+
+    bool paused() const { return this->rxPaused; }
+
+    uint32_t messagesForwarded; // CAN to UDP
+    uint32_t datagramsSent;
+    uint32_t datagramsDropped; // the socket did not take them
+    uint32_t oversize;         // messages larger than a datagram
+    uint32_t datagramsReceived;
+    uint32_t messagesInjected; // UDP to CAN
+    uint32_t malformed;        // datagrams or records that were skipped
+    uint32_t rejected;         // records no bus could take
+    uint32_t stalls;           // reading paused for a full queue
+
+  private:
+    static void handler(void *context, uint32_t addr, CANTTspan topic,
+                        CANTTspan payload);
+    static void readable(void *context, uint32_t events);
+
+    void forward(struct CANTTUdpBus *bus, uint32_t addr, CANTTspan topic,
+                 CANTTspan payload);
+    void receive();
+    bool inject();
+    int publish(uint8_t bus, uint32_t addr, uint8_t *topic,
+                uint16_t topicLen, uint8_t *payload, uint16_t payloadLen);
+    void pause(bool paused);
+
+    CANTTPoller poller;
+    int sock;
+    struct sockaddr_in peer;
+    volatile bool running;
+
+    struct CANTTUdpBus buses[CANTT_POLLER_MAX_BUSES];
+    uint8_t busCount;
+
+    // Datagrams being filled, the last one may take more records
+    uint8_t txBuf[CANTT_UDP_BATCH][CANTT_UDP_DATAGRAM];
+    uint16_t txLen[CANTT_UDP_BATCH];
+    uint8_t txCount;
+
+    // Datagrams of the last recvmmsg(), and how far they were published
+    uint8_t rxBuf[CANTT_UDP_BATCH][CANTT_UDP_DATAGRAM];
+    uint16_t rxLen[CANTT_UDP_BATCH];
+    uint8_t rxCount;
+    uint8_t rxIndex;
+    uint16_t rxPos;
+    uint32_t rxDone; // buses the current record was published on
+    bool rxPaused;
+};
+
+#endif // cantt_udp.h
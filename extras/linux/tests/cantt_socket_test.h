@@ -0,0 +1,125 @@
+#ifndef __CANTT_SOCKET_TEST_H__
+#define __CANTT_SOCKET_TEST_H__
+
+#include "cantt_socketcan.h"
+#include "cantt_test.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * Tests of the host tools on real sockets
+ *
+ * A bus is a vcan interface when the host has one, otherwise the two ends
+ * of a socketpair() carrying the same kernel frames between two
+ * transports. UDP and TCP go over 127.0.0.1. These tests run on the host
+ * clock, so they wait for things to happen with a time limit instead of
+ * running for a fixed simulated time.
+ */
+
+// ms a test waits for something to happen before it checks
+#define TEST_SOCKET_WAIT 1000
+
+/*
+ * A transport that can hold back its frames, as if the bus were taken by
+ * other nodes, so that a CANTT queue fills up
+ */
+class TestSocketTransport : public SocketCANTransport {
+  public:
+    TestSocketTransport() : held(false) {}
+
+    uint8_t transmit(const CANMessage &msg) {
+        return this->held ? 1 : SocketCANTransport::transmit(msg);
+    }
+
+    uint8_t sendBatch(const CANMessage *msgs, uint8_t count) {
+        return this->held ? 0 : SocketCANTransport::sendBatch(msgs, count);
+    }
+
+    bool held;
+};
+
+/**
+    Puts two transports on a bus of their own: a vcan interface if the
+    host has it, otherwise a socketpair()
+
+    @param ifname the vcan interface
+    @param a one transport
+    @param b the other one
+    @param fd true for CAN FD frames
+    @return true if OK
+*/
+static bool testBus(const char *ifname, SocketCANTransport &a,
+                    SocketCANTransport &b, bool fd = false) {
+    int pair[2];
+
+    if (a.open(ifname, fd) == 0 && b.open(ifname, fd) == 0) {
+        return true;
+    }
+    a.close();
+    b.close();
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) < 0) {
+        return false;
+    }
+
+    if (a.adopt(pair[0], fd) != 0 || b.adopt(pair[1], fd) != 0) {
+        a.close();
+        b.close();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+    Address of a port on 127.0.0.1
+
+    @param port the port
+    @return the address
+*/
+static struct sockaddr_in testAddr(uint16_t port) {
+    struct sockaddr_in addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    return addr;
+}
+
+/**
+    Handler that keeps the messages in the vector given as context
+*/
+static void testCollect(void *context, uint32_t addr, CANTTspan topic,
+                        CANTTspan payload) {
+    std::vector<TestMessage> *received = (std::vector<TestMessage> *)context;
+    TestMessage msg;
+
+    msg.addr = addr;
+    msg.topic.assign((const char *)topic.data, topic.len);
+    msg.payload.assign((const char *)payload.data, payload.len);
+    msg.at = (uint64_t)cantt_micros() * 1000;
+    received->push_back(msg);
+}
+
+/**
+    Topics of the messages received, in order, separated by spaces
+
+    @param received the messages
+    @return the topics
+*/
+static std::string testTopics(const std::vector<TestMessage> &received) {
+    std::string topics;
+
+    for (size_t i = 0; i < received.size(); i++) {
+        topics += (i > 0 ? " " : "") + received[i].topic;
+    }
+
+    return topics;
+}
+
+#endif // cantt_socket_test.h
@@ -0,0 +1,200 @@
+#ifndef __CANTT_TEST_H__
+#define __CANTT_TEST_H__
+
+#include "cantt.h"
+#include "cantt_platform.h"
+#include "cantt_sim.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/*
+ * Behaviour tests of CANTT on a simulated bus
+ *
+ * A test builds a TestNet of a few nodes on a CANTTSimBus, drives them on
+ * the simulated clock and checks what each node received. The bus and the
+ * clock are simulated, so a run gives the same result on any host, and a
+ * failure repeats. CHECK() reports a failed condition and lets the test
+ * go on; testResult() gives the exit status of the test program.
+ */
+
+#define TEST_MAX_MESSAGE 512
+
+// Enough RX slots for every sender of a test to be reassembled at once
+typedef BasicCANTT<TEST_MAX_MESSAGE, 8, 8> TestCANTT;
+
+// loop() calls per node between two frames on the bus
+#define TEST_ROUNDS 8
+
+static int testChecks = 0;
+static int testFailures = 0;
+
+#define CHECK(cond) testCheck((cond), #cond, __FILE__, __LINE__)
+
+static void testCheck(bool ok, const char *what, const char *file,
+                      int line) {
+    testChecks++;
+
+    if (!ok) {
+        testFailures++;
+        printf("%s:%d: check failed: %s\n", file, line, what);
+    }
+}
+
+/**
+    Prints the summary of a test program
+
+    @param name of the test program
+    @return exit status, 1 if a check failed
+*/
+static int testResult(const char *name) {
+    printf("%-20s %d checks, %d failed\n", name, testChecks, testFailures);
+
+    return testFailures > 0 ? 1 : 0;
+}
+
+// A message as the handler of a node got it
+struct TestMessage {
+    uint32_t addr;
+    std::string topic;
+    std::string payload;
+    uint64_t at; // ns, simulated time of delivery
+};
+
+struct TestNode {
+    CANTTSimTransport transport;
+    TestCANTT *cantt;
+    std::vector<TestMessage> received;
+};
+
+/*
+ * Nodes on a simulated 500 kbit/s bus. The bus is installed as the clock
+ * before any node is constructed.
+ */
+class TestNet {
+  public:
+    TestNet() : bus(500000, 0) { this->bus.install(); }
+
+    ~TestNet() {
+        for (size_t i = 0; i < this->nodes.size(); i++) {
+            delete this->nodes[i]->cantt;
+            delete this->nodes[i];
+        }
+        this->bus.uninstall();
+    }
+
+    /**
+        Adds a node in drain mode, or driving the state machine one step
+        per loop()
+
+        @param addr CANTT address of the node
+        @param drain true for setBudget(), false for the state machine
+        @return the node
+    */
+    TestCANTT &add(uint32_t addr, bool drain = true) {
+        TestNode *node = new TestNode();
+
+        this->bus.attach(node->transport);
+        node->cantt =
+            new TestCANTT(addr, node->transport, TestNet::handler, node);
+        node->cantt->begin();
+        if (drain) {
+            node->cantt->setBudget(64, 64);
+        }
+        this->nodes.push_back(node);
+
+        return *node->cantt;
+    }
+
+    TestCANTT &cantt(size_t index) { return *this->nodes[index]->cantt; }
+
+    std::vector<TestMessage> &received(size_t index) {
+        return this->nodes[index]->received;
+    }
+
+    /**
+        Runs every node and the bus. Idle time passes in steps of at most
+        1 ms, so the timers of the nodes fire on time.
+
+        @param ms simulated time to run
+    */
+    void run(uint32_t ms) {
+        uint64_t end = this->bus.now() + (uint64_t)ms * 1000000;
+
+        while (this->bus.now() < end) {
+            for (int round = 0; round < TEST_ROUNDS; round++) {
+                for (size_t i = 0; i < this->nodes.size(); i++) {
+                    this->nodes[i]->cantt->loop();
+                }
+            }
+
+            if (!this->bus.transfer()) {
+                uint64_t idle = end - this->bus.now();
+
+                this->bus.advance(idle < 1000000 ? idle : 1000000);
+            }
+        }
+    }
+
+    /**
+        Publishes a message of a given size, its payload is a pattern that
+        shows where it came from
+
+        @param index node that publishes
+        @param topic of the message
+        @param size payload size
+        @param priority CAN id, 0 for the address of the node
+        @return publish() status
+    */
+    int publish(size_t index, const char *topic, uint16_t size,
+                uint32_t priority = 0) {
+        std::string payload = TestNet::pattern(index, size);
+        TestCANTT &c = this->cantt(index);
+
+        if (priority == 0) {
+            return c.publish((uint8_t *)topic, strlen(topic),
+                             (uint8_t *)payload.data(), size);
+        }
+
+        return c.publish(priority, (uint8_t *)topic, strlen(topic),
+                         (uint8_t *)payload.data(), size);
+    }
+
+    /**
+        Payload publish() sends for a node
+
+        @param index node that publishes
+        @param size payload size
+        @return the payload
+    */
+    static std::string pattern(size_t index, uint16_t size) {
+        std::string payload(size, '\0');
+
+        for (uint16_t i = 0; i < size; i++) {
+            payload[i] = (char)('A' + index + i % 23);
+        }
+
+        return payload;
+    }
+
+    CANTTSimBus bus;
+
+  private:
+    static void handler(void *context, uint32_t addr, CANTTspan topic,
+                        CANTTspan payload) {
+        TestNode *node = (TestNode *)context;
+        TestMessage msg;
+
+        msg.addr = addr;
+        msg.topic.assign((const char *)topic.data, topic.len);
+        msg.payload.assign((const char *)payload.data, payload.len);
+        msg.at = (uint64_t)cantt_micros() * 1000;
+        node->received.push_back(msg);
+    }
+
+    std::vector<TestNode *> nodes;
+};
+
+#endif // cantt_test.h
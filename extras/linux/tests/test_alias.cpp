@@ -0,0 +1,285 @@
+/**
+    CANTT Library
+    test_alias.cpp
+    Purpose: Topic aliases: the table on its own, and announcing and using
+    aliases on a simulated bus.
+*/
+
+#include "cantt_test.h"
+
+#define SENSOR_TOPIC "sensors/temperature"
+
+/**
+    Finds the topic of an alias
+
+    @param aliases the table
+    @param address CAN id of the sender
+    @param alias the alias
+    @return the topic, empty if the alias is not known
+*/
+static std::string topicOf(CANTTAliases &aliases, uint32_t address,
+                           uint16_t alias) {
+    struct CANTTalias *e = aliases.find(address, alias);
+
+    return e == NULL ? "" : std::string((const char *)e->topic, e->topicLen);
+}
+
+/**
+    Learns an alias
+
+    @param aliases the table
+    @param address CAN id of the sender
+    @param alias the alias
+    @param topic its topic
+    @return the entry
+*/
+static struct CANTTalias *learn(CANTTAliases &aliases, uint32_t address,
+                                uint16_t alias, const char *topic) {
+    return aliases.learn(address, alias, (const uint8_t *)topic,
+                         strlen(topic));
+}
+
+/**
+    Our own aliases: one per topic and CAN id, due for announcement, and
+    no more than the table holds
+*/
+static void own() {
+    CANTTAliases aliases;
+    struct CANTTalias *a;
+    struct CANTTalias *b;
+    char topic[8];
+
+    a = aliases.add(0x100, (const uint8_t *)"a", 1);
+    b = aliases.add(0x100, (const uint8_t *)"b", 1);
+    CHECK(a != NULL && b != NULL && a->alias != b->alias);
+    CHECK(a->flags == CANTT_ALIAS_DUE);
+    CHECK(aliases.add(0x100, (const uint8_t *)"a", 1) == a);
+    CHECK(aliases.lookup(0x100, (const uint8_t *)"a", 1) == a);
+    CHECK(aliases.lookup(0x200, (const uint8_t *)"a", 1) == NULL);
+
+    for (int i = aliases.count(); i < CANTT_MAX_ALIASES; i++) {
+        snprintf(topic, sizeof(topic), "t%d", i);
+        CHECK(aliases.add(0x100, (const uint8_t *)topic, strlen(topic)) !=
+              NULL);
+    }
+    CHECK(aliases.add(0x100, (const uint8_t *)"full", 4) == NULL);
+    CHECK(aliases.evictions == 0);
+
+    std::string tooLong(CANTT_ALIAS_TOPIC_SIZE + 1, 'x');
+    aliases.clear();
+    CHECK(aliases.add(0x100, (const uint8_t *)tooLong.data(),
+                      tooLong.size()) == NULL);
+}
+
+/**
+    Aliases of other nodes: unknown ones are misses, a new announcement of
+    an alias replaces the old one, and the least recently used alias makes
+    room when the table is full
+*/
+static void announced() {
+    CANTTAliases aliases;
+    struct CANTTalias *e;
+
+    CHECK(aliases.find(0x100, 7) == NULL);
+    CHECK(aliases.misses == 1);
+
+    e = learn(aliases, 0x100, 7, "x/y");
+    CHECK(e != NULL && topicOf(aliases, 0x100, 7) == "x/y");
+
+    // The same alias of another sender is another topic
+    CHECK(learn(aliases, 0x200, 7, "z") != NULL);
+    CHECK(topicOf(aliases, 0x100, 7) == "x/y");
+    CHECK(topicOf(aliases, 0x200, 7) == "z");
+    CHECK(aliases.count() == 2);
+
+    // Announced again, the cached match is kept
+    e->match = CANTT_MATCH_ACCEPT;
+    CHECK(learn(aliases, 0x100, 7, "x/y") == e);
+    CHECK(e->match == CANTT_MATCH_ACCEPT);
+
+    // The sender restarted and gave the alias to another topic
+    CHECK(learn(aliases, 0x100, 7, "other") == e);
+    CHECK(e->match == CANTT_MATCH_PENDING);
+    CHECK(topicOf(aliases, 0x100, 7) == "other");
+    CHECK(aliases.count() == 2);
+    CHECK(aliases.evictions == 0);
+
+    // Full: alias 1 of 0x300 is the least recently used
+    for (uint16_t alias = 0; aliases.count() < CANTT_MAX_ALIASES; alias++) {
+        CHECK(learn(aliases, 0x300, alias, "t") != NULL);
+    }
+    CHECK(aliases.find(0x100, 7) != NULL && aliases.find(0x200, 7) != NULL &&
+          aliases.find(0x300, 0) != NULL);
+    CHECK(learn(aliases, 0x300, 100, "new") != NULL);
+    CHECK(aliases.evictions == 1);
+    CHECK(topicOf(aliases, 0x300, 100) == "new");
+    CHECK(topicOf(aliases, 0x100, 7) == "other");
+    CHECK(aliases.count() == CANTT_MAX_ALIASES);
+    CHECK(aliases.misses == 1);
+    CHECK(aliases.find(0x300, 1) == NULL);
+    CHECK(aliases.misses == 2);
+}
+
+/**
+    Publishes a message and counts the frames it took
+
+    @param net the nodes
+    @param index node that publishes
+    @param topic of the message
+    @param priority CAN id, 0 for the address of the node
+    @return frames sent
+*/
+static uint32_t framesOf(TestNet &net, size_t index, const char *topic,
+                         uint32_t priority = 0) {
+    uint32_t frames = net.cantt(index).stats().framesSent;
+
+    CHECK(net.publish(index, topic, 4, priority) == CANTT_OK);
+    net.run(20);
+
+    return net.cantt(index).stats().framesSent - frames;
+}
+
+/**
+    A topic is sent as it is until the announcement of its alias is on the
+    bus, then as the alias
+*/
+static void announcement() {
+    TestNet net;
+
+    net.add(0x100);
+    net.add(0x200);
+
+    CHECK(net.cantt(0).addAlias((char *)SENSOR_TOPIC) == 0);
+
+    // Published before the announcement went out: the topic, then the
+    // announcement behind it
+    CHECK(net.publish(0, SENSOR_TOPIC, 4) == CANTT_OK);
+    net.run(20);
+    CHECK(net.received(1).size() == 1);
+    CHECK(net.cantt(1).aliases().count() == 1);
+
+    // HDR byte, alias and payload in one frame
+    CHECK(framesOf(net, 0, SENSOR_TOPIC) == 1);
+    CHECK(net.received(1).size() == 2);
+    for (size_t i = 0; i < net.received(1).size(); i++) {
+        CHECK(net.received(1)[i].topic == SENSOR_TOPIC &&
+              net.received(1)[i].payload == TestNet::pattern(0, 4));
+    }
+    CHECK(net.cantt(1).aliases().misses == 0);
+
+    // Topics without an alias and the alias from another CAN id
+    CHECK(framesOf(net, 0, "other") > 1);
+    CHECK(framesOf(net, 0, SENSOR_TOPIC, 0x101) > 1);
+    CHECK(net.received(1).size() == 4);
+    CHECK(net.received(1)[3].topic == SENSOR_TOPIC);
+}
+
+/**
+    A node that joined after the announcement drops the aliased messages,
+    until the alias is announced again
+*/
+static void unknown() {
+    TestNet net;
+
+    net.add(0x100);
+    net.add(0x200);
+    CHECK(net.cantt(0).addAlias((char *)SENSOR_TOPIC) == 0);
+    net.run(20);
+
+    net.add(0x300);
+    CHECK(framesOf(net, 0, SENSOR_TOPIC) == 1);
+    CHECK(net.received(1).size() == 1);
+    CHECK(net.received(2).empty());
+    CHECK(net.cantt(2).aliases().misses == 1);
+    CHECK(net.cantt(2).aliases().count() == 0);
+
+    net.run(CANTT_ALIAS_INTERVAL);
+    CHECK(net.cantt(2).aliases().count() == 1);
+    CHECK(framesOf(net, 0, SENSOR_TOPIC) == 1);
+    CHECK(net.received(2).size() == 1 &&
+          net.received(2)[0].topic == SENSOR_TOPIC);
+    CHECK(net.cantt(2).aliases().misses == 1);
+    CHECK(net.received(1).size() == 2);
+}
+
+/**
+    A sender restarts and gives its first alias to another topic: the
+    receivers replace the alias, and match the new topic against their
+    subscriptions again
+*/
+static void restart() {
+    TestNet net;
+
+    net.add(0x100);
+    net.add(0x200);
+    net.add(0x300);
+    CHECK(net.cantt(2).subscribe("sensors/#") == 0);
+
+    CHECK(net.cantt(0).addAlias((char *)SENSOR_TOPIC) == 0);
+    net.run(20);
+    CHECK(framesOf(net, 0, SENSOR_TOPIC) == 1);
+    CHECK(net.received(1).size() == 1 && net.received(2).size() == 1);
+
+    // The same CAN id, starting over with a table of its own
+    net.cantt(0).clearAliases();
+    net.add(0x100);
+    CHECK(net.cantt(3).addAlias((char *)"other/topic") == 0);
+    net.run(20);
+
+    CHECK(framesOf(net, 3, "other/topic") == 1);
+    CHECK(net.received(1).size() == 2 &&
+          net.received(1)[1].topic == "other/topic" &&
+          net.received(1)[1].payload == TestNet::pattern(3, 4));
+    CHECK(net.received(2).size() == 1);
+    CHECK(net.cantt(1).aliases().count() == 1);
+    CHECK(net.cantt(1).aliases().evictions == 0);
+    CHECK(net.cantt(2).aliases().misses == 0);
+}
+
+/**
+    With 29-bit ids a sender keys its aliases on the priority, and
+    receivers on the priority and the node: two nodes of the same priority
+    can use the same alias for different topics
+*/
+static void extended() {
+    TestNet net;
+    const char *topics[3] = {"", "left", "right"};
+
+    for (uint8_t i = 0; i < 3; i++) {
+        CHECK(net.add(0x300).setAddr(CANTT_EXT_ADDR(0x300, i + 1), true,
+                                     false) == 0);
+    }
+    CHECK(net.cantt(1).addAlias((char *)topics[1]) == 0);
+    CHECK(net.cantt(2).addAlias((char *)topics[2]) == 0);
+    net.run(20);
+    CHECK(net.cantt(0).aliases().count() == 2);
+
+    CHECK(framesOf(net, 1, topics[1]) == 1);
+    CHECK(framesOf(net, 2, topics[2]) == 1);
+    CHECK(framesOf(net, 1, topics[1], 0x300) == 1);
+
+    // Another priority is another CAN id, without the alias
+    CHECK(framesOf(net, 1, topics[1], 0x301) > 1);
+
+    std::vector<TestMessage> &got = net.received(0);
+    CHECK(got.size() == 4);
+    for (size_t i = 0; i < got.size(); i++) {
+        uint8_t node = CANTT_EXT_NODE(got[i].addr);
+
+        // Node 1 receives, nodes 2 and 3 send
+        CHECK(node == 2 || node == 3);
+        CHECK(got[i].topic == topics[node == 3 ? 2 : 1]);
+    }
+    CHECK(net.cantt(0).aliases().misses == 0);
+}
+
+int main() {
+    own();
+    announced();
+    announcement();
+    unknown();
+    restart();
+    extended();
+
+    return testResult("test_alias");
+}
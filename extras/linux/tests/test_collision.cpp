@@ -0,0 +1,135 @@
+/**
+    CANTT Library
+    test_collision.cpp
+    Purpose: Transfers that meet frames of other nodes, and the holdoff,
+    on a simulated bus.
+*/
+
+#include "cantt_test.h"
+
+/**
+    Runs a node that publishes 2 bytes every period ms, until ms have
+    passed
+
+    @param net the nodes
+    @param node index of the publishing node
+    @param period ms between two publishes, 0 for none
+    @param ms time to run
+    @return number of messages published
+*/
+static size_t alarms(TestNet &net, size_t node, int period, int ms) {
+    size_t count = 0;
+
+    for (int t = 0; t < ms; t++) {
+        if (period > 0 && t % period == 0 &&
+            net.publish(node, "alarm", 2) == CANTT_OK) {
+            count++;
+        }
+        net.run(1);
+    }
+
+    return count;
+}
+
+/**
+    A more important node publishes every 3 ms while a long message is on
+    the bus. The message resumes after each of them, without sending a
+    frame twice, and the alarms are not delayed by it.
+
+    @param period ms between two alarms, 0 for none
+    @return frames the long message took
+*/
+static uint32_t resumed(int period) {
+    TestNet net;
+    uint32_t frames;
+    size_t published;
+
+    net.add(0x100);
+    net.add(0x200);
+    net.add(0x300);
+
+    CHECK(net.publish(1, "blob", 200) == CANTT_OK);
+    published = alarms(net, 0, period, 200);
+
+    frames = net.cantt(1).stats().framesSent;
+
+    std::vector<TestMessage> &got = net.received(2);
+    size_t blobs = 0;
+
+    for (size_t i = 0; i < got.size(); i++) {
+        if (got[i].topic == "blob") {
+            blobs++;
+            CHECK(got[i].payload == TestNet::pattern(1, 200));
+
+            // Not held back until the alarms stop
+            CHECK(got[i].at < 20000000ULL);
+        } else {
+            CHECK(got[i].addr == 0x100);
+        }
+    }
+    CHECK(blobs == 1);
+    CHECK(got.size() == 1 + published);
+    CHECK(net.cantt(2).reassembly().misses == 0);
+    CHECK(net.cantt(2).reassembly().timeouts == 0);
+
+    return frames;
+}
+
+static void resume() {
+    uint32_t alone = resumed(0);
+
+    // Every frame went on the bus once
+    CHECK(resumed(3) == alone);
+}
+
+/**
+    A node with two messages queued gets a frame of a more important node
+    that publishes every 10 ms, so the second message is held off again and
+    again. It waits for the holdoff limit at most.
+
+    @param delay holdoff delay
+    @param limit holdoff limit
+    @return ms from publish to delivery of the second message, 0 if it was
+   not delivered
+*/
+static uint32_t heldOff(uint16_t delay, uint16_t limit) {
+    TestNet net;
+
+    net.add(0x100);
+    net.add(0x600).setHoldoff(delay, limit);
+    net.add(0x700);
+
+    CHECK(net.publish(1, "first", 100) == CANTT_OK);
+    CHECK(net.publish(1, "second", 100) == CANTT_OK);
+    alarms(net, 0, 10, 1000);
+
+    for (size_t i = 0; i < net.received(2).size(); i++) {
+        if (net.received(2)[i].topic == "second") {
+            return net.received(2)[i].at / 1000000;
+        }
+    }
+
+    return 0;
+}
+
+static void holdoffLimit() {
+    uint32_t latency = heldOff(CANTT_DEFAULT_HOLDOFF_DELAY,
+                               CANTT_DEFAULT_HOLDOFF_LIMIT);
+
+    CHECK(latency >= CANTT_DEFAULT_HOLDOFF_LIMIT);
+    CHECK(latency < CANTT_DEFAULT_HOLDOFF_LIMIT + 20);
+
+    // Without a limit the alarms starve it, without a holdoff it follows
+    // the first message
+    CHECK(heldOff(CANTT_DEFAULT_HOLDOFF_DELAY, 0) == 0);
+    latency = heldOff(0, 0);
+    CHECK(latency > 0);
+    CHECK(latency < 10);
+}
+
+int main() {
+    resume();
+    holdoffLimit();
+
+    return testResult("test_collision");
+}
@@ -0,0 +1,134 @@
+/**
+    CANTT Library
+    test_extended.cpp
+    Purpose: Transfers with 29-bit ids, on a simulated bus.
+*/
+
+#include "cantt_test.h"
+
+/**
+    Adds a node with 29-bit ids
+
+    @param net the nodes
+    @param priority 11-bit priority of the node
+    @param node node number
+    @param drain run the node in drain mode, or one step per loop()
+    @return the node
+*/
+static TestCANTT &addExt(TestNet &net, uint32_t priority, uint8_t node,
+                         bool drain = true) {
+    TestCANTT &c = net.add(priority, drain);
+
+    CHECK(c.setAddr(CANTT_EXT_ADDR(priority, node), true, false) == 0);
+
+    return c;
+}
+
+/**
+    A more important node publishes every 10 ms while a less important one
+    sends a long message. The long message keeps going under the holdoff
+    and a third node gets it whole.
+
+    @param drain run the nodes in drain mode, or one step per loop()
+*/
+static void heldTransfer(bool drain) {
+    TestNet net;
+
+    addExt(net, 0x100, 1, drain);
+    addExt(net, 0x200, 2, drain);
+    addExt(net, 0x300, 3, drain);
+
+    CHECK(net.publish(1, "blob", 300) == CANTT_OK);
+    for (int ms = 0; ms < 200; ms++) {
+        if (ms % 10 == 0) {
+            net.publish(0, "alarm", 2);
+        }
+        net.run(1);
+    }
+
+    std::vector<TestMessage> &got = net.received(2);
+    size_t blobs = 0;
+    size_t alarms = 0;
+
+    for (size_t i = 0; i < got.size(); i++) {
+        if (got[i].topic == "blob") {
+            blobs++;
+            CHECK(got[i].addr == CANTT_EXT_ADDR(0x200, 2));
+            CHECK(got[i].payload == TestNet::pattern(1, 300));
+            CHECK(got[i].at < 20000000ULL);
+        } else if (got[i].topic == "alarm") {
+            alarms++;
+            CHECK(got[i].addr == CANTT_EXT_ADDR(0x100, 1));
+        }
+    }
+
+    CHECK(blobs == 1);
+    CHECK(alarms == 20);
+    CHECK(net.cantt(2).reassembly().timeouts == 0);
+    CHECK(net.cantt(2).reassembly().misses == 0);
+    CHECK(net.cantt(1).stats().messagesSent == 1);
+    CHECK(net.bus.conflicts == 0);
+}
+
+/**
+    A node starts a message while it receives one of another node with the
+    same priority. With 29-bit ids both are on the bus at once and the
+    short one arrives first; with 11-bit ids it waits for the long one.
+
+    @param extended 29-bit ids
+*/
+static void interleaved(bool extended) {
+    TestNet net;
+
+    if (extended) {
+        addExt(net, 0x400, 1).setPacing(0, 1, 0);
+        addExt(net, 0x200, 2);
+        addExt(net, 0x200, 3);
+    } else {
+        net.add(0x400).setPacing(0, 1, 0);
+        net.add(0x200);
+        net.add(0x201);
+    }
+    net.run(10);
+
+    CHECK(net.publish(1, "long", 300) == CANTT_OK);
+    net.run(5);
+    CHECK(net.cantt(2).reassembly().active() == 1);
+    CHECK(net.publish(2, "short", 50) == CANTT_OK);
+    net.run(500);
+
+    std::vector<TestMessage> &got = net.received(0);
+
+    CHECK(got.size() == 2);
+    if (got.size() == 2) {
+        CHECK(got[0].topic == (extended ? "short" : "long"));
+        CHECK(got[0].payload == (extended ? TestNet::pattern(2, 50)
+                                          : TestNet::pattern(1, 300)));
+        CHECK(got[1].topic == (extended ? "long" : "short"));
+        CHECK(got[1].payload == (extended ? TestNet::pattern(1, 300)
+                                          : TestNet::pattern(2, 50)));
+    }
+    CHECK(net.cantt(0).reassembly().misses == 0);
+    CHECK(net.bus.conflicts == 0);
+}
+
+static void setAddr() {
+    TestNet net;
+    TestCANTT &c = net.add(0x100);
+
+    CHECK(c.setAddr(CANTT_EXT_ADDR(0x100, 1), true, true) == -1);
+    CHECK(!c.extended());
+    CHECK(c.setAddr(CANTT_EXT_ADDR(0x100, 1), true, false) == 0);
+    CHECK(c.extended());
+    CHECK(c.address() == CANTT_EXT_ADDR(0x100, 1));
+}
+
+int main() {
+    heldTransfer(true);
+    heldTransfer(false);
+    interleaved(true);
+    interleaved(false);
+    setAddr();
+
+    return testResult("test_extended");
+}
@@ -0,0 +1,162 @@
+/**
+    CANTT Library
+    test_fd.cpp
+    Purpose: CAN FD frames on a simulated bus, around every length a DLC
+    can express.
+*/
+
+#include "cantt_test.h"
+
+// Data lengths of CAN FD frames above 8 bytes
+static const uint8_t steps[] = {12, 16, 20, 24, 32, 48, 64};
+
+/**
+    Length of the frame that carries some bytes, the next one a DLC can
+    express
+
+    @param bytes bytes to carry
+    @return frame length
+*/
+static uint8_t dlcLength(uint8_t bytes) {
+    if (bytes <= CANTT_CAN_DATASIZE) {
+        return bytes;
+    }
+
+    for (size_t i = 0; i < sizeof(steps); i++) {
+        if (bytes <= steps[i]) {
+            return steps[i];
+        }
+    }
+
+    return 0;
+}
+
+/**
+    Runs the bus and keeps the frames a node without CANTT sees
+
+    @param net the nodes
+    @param spy transport of the node that only listens
+    @param frames the frames seen
+    @param ms time to run
+*/
+static void watch(TestNet &net, CANTTSimTransport &spy,
+                  std::vector<CANMessage> &frames, uint32_t ms) {
+    CANMessage frame;
+
+    for (uint32_t i = 0; i < ms; i++) {
+        net.run(1);
+        while (spy.available() && spy.receive(frame) == 0) {
+            frames.push_back(frame);
+        }
+    }
+}
+
+/**
+    Checks that the bytes of a frame after its content are zero
+
+    @param frame the frame
+    @param content bytes of content
+    @return true if the padding is zero
+*/
+static bool padded(const CANMessage &frame, uint8_t content) {
+    for (uint8_t i = content; i < frame.len; i++) {
+        if (frame.data[i] != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+    Sends a message of a given size from one FD node to another, and
+    checks its frames and what arrives
+
+    @param net the nodes
+    @param spy transport of the node that only listens
+    @param size bytes of the message: HDR, topic "t", payload
+*/
+static void transfer(TestNet &net, CANTTSimTransport &spy, uint16_t size) {
+    uint16_t payload = size - 6;
+    std::vector<CANMessage> frames;
+    size_t before = net.received(1).size();
+
+    CHECK(net.publish(0, "t", payload) == CANTT_OK);
+    watch(net, spy, frames, 20);
+
+    CHECK(net.received(1).size() == before + 1);
+    if (net.received(1).size() == before + 1) {
+        CHECK(net.received(1).back().payload == TestNet::pattern(0, payload));
+    }
+
+    if (frames.empty()) {
+        CHECK(!frames.empty());
+        return;
+    }
+
+    if (size <= CANTT_CANFD_DATASIZE - 2) {
+        // Single frame: type, size, message
+        CHECK(frames.size() == 1);
+        CHECK(frames[0].len == dlcLength(2 + size));
+        CHECK(frames[0].data[1] == size);
+        CHECK(padded(frames[0], 2 + size));
+        return;
+    }
+
+    // First frame with 62 bytes, Consecutive frames with up to 63
+    uint16_t rest = size - (CANTT_CANFD_DATASIZE - 2);
+    size_t count = 1 + (rest + CANTT_CANFD_DATASIZE - 2) /
+                           (CANTT_CANFD_DATASIZE - 1);
+    uint8_t last = rest - (count - 2) * (CANTT_CANFD_DATASIZE - 1);
+
+    CHECK(frames.size() == count);
+    CHECK(frames[0].len == CANTT_CANFD_DATASIZE);
+    for (size_t i = 1; i + 1 < frames.size(); i++) {
+        CHECK(frames[i].len == CANTT_CANFD_DATASIZE);
+    }
+    CHECK(frames.back().len == dlcLength(1 + last));
+    CHECK(padded(frames.back(), 1 + last));
+}
+
+/**
+    Messages one byte below, at and above every step, in a Single frame
+    and in the last Consecutive frame of a longer message
+*/
+static void dlcSteps() {
+    TestNet net;
+    CANTTSimTransport spy;
+
+    net.add(0x100);
+    net.add(0x200);
+    net.bus.attach(spy);
+    CHECK(net.cantt(0).setFD(true) == 0);
+    CHECK(net.cantt(1).setFD(true) == 0);
+
+    for (size_t i = 0; i < sizeof(steps); i++) {
+        for (int delta = -1; delta <= 1; delta++) {
+            // Single frame: type and size byte, then the message
+            if (steps[i] + delta - 2 <= CANTT_CANFD_DATASIZE - 2) {
+                transfer(net, spy, steps[i] + delta - 2);
+            }
+
+            // First frame, then a Consecutive frame of this length
+            transfer(net, spy, CANTT_CANFD_DATASIZE - 2 + steps[i] + delta - 1);
+        }
+    }
+
+    // Messages from a classic node are still received
+    CHECK(net.cantt(0).setFD(false) == 0);
+    CHECK(net.publish(0, "t", 100) == CANTT_OK);
+    net.run(50);
+    CHECK(net.received(1).back().payload == TestNet::pattern(0, 100));
+
+    CHECK(net.cantt(1).reassembly().misses == 0);
+    CHECK(net.cantt(1).stats().rejected == 0);
+    CHECK(net.bus.conflicts == 0);
+}
+
+int main() {
+    dlcSteps();
+
+    return testResult("test_fd");
+}
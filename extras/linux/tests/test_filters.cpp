@@ -0,0 +1,191 @@
+/**
+    CANTT Library
+    test_filters.cpp
+    Purpose: The id/mask filters acceptRange() programs, and how ranges
+    are merged when the controller has too few filters.
+*/
+
+#include "cantt_test.h"
+
+// What the controller was programmed with
+static uint32_t filterId[CANTT_MAX_HW_FILTERS];
+static uint32_t filterMask[CANTT_MAX_HW_FILTERS];
+static bool filterExtended[CANTT_MAX_HW_FILTERS];
+static uint8_t filterCalls;
+
+static uint8_t noFrame() { return 0; }
+static uint8_t noRead(CANMessage &msg) { return 1; }
+static uint8_t noSend(const CANMessage &msg) { return 1; }
+
+static uint8_t setFilter(uint8_t index, uint32_t id, uint32_t mask,
+                         bool extended) {
+    filterId[index] = id;
+    filterMask[index] = mask;
+    filterExtended[index] = extended;
+    filterCalls++;
+
+    return 0;
+}
+
+/**
+    Whether the programmed filters let an 11-bit id through
+
+    @param id the id
+    @param count filters the controller has
+    @return true if a filter accepts it
+*/
+static bool accepted(uint32_t id, uint8_t count) {
+    for (uint8_t i = 0; i < count; i++) {
+        if (((id ^ filterId[i]) & filterMask[i]) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+    Ids the programmed filters let through
+
+    @param count filters the controller has
+    @return number of ids
+*/
+static uint32_t acceptedIds(uint8_t count) {
+    uint32_t n = 0;
+
+    for (uint32_t id = 0; id <= CANTT_MAX_ADDR; id++) {
+        n += accepted(id, count) ? 1 : 0;
+    }
+
+    return n;
+}
+
+/**
+    Checks that every id of a range gets through
+
+    @param first lowest id
+    @param last highest id
+    @param count filters the controller has
+    @return true if all do
+*/
+static bool covers(uint32_t first, uint32_t last, uint8_t count) {
+    for (uint32_t id = first; id <= last; id++) {
+        if (!accepted(id, count)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+    Ranges that split into aligned blocks fit exactly with enough filters
+*/
+static void exact() {
+    CANTransport transport(noFrame, noRead, noSend);
+    TestCANTT c(0x150, transport, NULL, NULL);
+
+    transport.setFilterHook(setFilter, 8);
+
+    // One aligned block
+    filterCalls = 0;
+    CHECK(c.acceptRange(0x100, 0x1FF) == 1);
+    CHECK(filterCalls == 8);
+    CHECK(filterId[0] == 0x100 && filterMask[0] == 0x700);
+    CHECK(!filterExtended[0]);
+    CHECK(acceptedIds(8) == 0x100);
+
+    // Unused filters repeat the first, none is left accepting everything
+    for (uint8_t i = 1; i < 8; i++) {
+        CHECK(filterId[i] == filterId[0] && filterMask[i] == filterMask[0]);
+    }
+
+    // 0x101, 0x102-0x103, 0x104-0x107, 0x108-0x10B, 0x10C-0x10D, 0x10E
+    CHECK(c.acceptAll() == 1);
+    CHECK(c.acceptRange(0x101, 0x10E) == 6);
+    CHECK(covers(0x101, 0x10E, 8));
+    CHECK(acceptedIds(8) == 0x0E);
+
+    CHECK(c.acceptRange(0x400, 0x400) == 7);
+    CHECK(covers(0x101, 0x10E, 8) && covers(0x400, 0x400, 8));
+    CHECK(acceptedIds(8) == 0x0F);
+}
+
+/**
+    With too few filters blocks are merged, cheapest merge first: every
+    id of the ranges still gets through, and as few others as possible
+*/
+static void merged() {
+    CANTransport transport(noFrame, noRead, noSend);
+    TestCANTT c(0x150, transport, NULL, NULL);
+
+    // Neighbours merge for free, the far one keeps its filter
+    transport.setFilterHook(setFilter, 2);
+    CHECK(c.acceptRange(0x100, 0x100) == 1);
+    CHECK(c.acceptRange(0x101, 0x101) == 2);
+    CHECK(c.acceptRange(0x700, 0x700) == 2);
+    CHECK(covers(0x100, 0x101, 2) && covers(0x700, 0x700, 2));
+    CHECK(acceptedIds(2) == 3);
+
+    // Six blocks into two filters
+    CHECK(c.acceptAll() == 1);
+    CHECK(c.acceptRange(0x101, 0x10E) == 2);
+    CHECK(covers(0x101, 0x10E, 2));
+    CHECK(acceptedIds(2) <= 0x10);
+    CHECK(!accepted(0x000, 2) && !accepted(0x200, 2) && !accepted(0x7FF, 2));
+
+    // Two ranges in one filter
+    transport.setFilterHook(setFilter, 1);
+    CHECK(c.acceptAll() == 1);
+    CHECK(c.acceptRange(0x100, 0x10F) == 1);
+    CHECK(c.acceptRange(0x120, 0x12F) == 1);
+    CHECK(covers(0x100, 0x10F, 1) && covers(0x120, 0x12F, 1));
+    CHECK(acceptedIds(1) == 0x20);
+    CHECK(filterId[0] == 0x100 && filterMask[0] == 0x7D0);
+}
+
+/**
+    With 29-bit ids the ranges are priorities: the filters are shifted to
+    the priority bits and leave node and transfer bits open
+*/
+static void extended() {
+    CANTransport transport(noFrame, noRead, noSend);
+    TestCANTT c(0x150, transport, NULL, NULL);
+
+    transport.setFilterHook(setFilter, 4);
+    CHECK(c.acceptRange(0x100, 0x1FF) == 1);
+    CHECK(!filterExtended[0]);
+
+    // Programmed again for the new format
+    CHECK(c.setAddr(CANTT_EXT_ADDR(0x150, 3), true, false) == 0);
+    CHECK(filterExtended[0]);
+    CHECK(filterId[0] == (0x100UL << CANTT_EXT_PRIORITY_SHIFT));
+    CHECK(filterMask[0] == (0x700UL << CANTT_EXT_PRIORITY_SHIFT));
+}
+
+static void invalid() {
+    CANTransport transport(noFrame, noRead, noSend);
+    TestCANTT c(0x150, transport, NULL, NULL);
+
+    // No filters to program
+    CHECK(c.acceptRange(0x100, 0x1FF) == -1);
+
+    transport.setFilterHook(setFilter, 4);
+    CHECK(c.acceptAll() == 1);
+    CHECK(c.acceptRange(0x200, 0x100) == -1);
+    CHECK(c.acceptRange(0x100, CANTT_MAX_ADDR + 1) == -1);
+
+    for (uint8_t i = 0; i < CANTT_MAX_ACCEPT_RANGES; i++) {
+        CHECK(c.acceptRange(0x100 * i, 0x100 * i) > 0);
+    }
+    CHECK(c.acceptRange(0x7FF, 0x7FF) == -1);
+}
+
+int main() {
+    exact();
+    merged();
+    extended();
+    invalid();
+
+    return testResult("test_filters");
+}
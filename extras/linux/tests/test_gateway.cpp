@@ -0,0 +1,451 @@
+/**
+    CANTT Library
+    test_gateway.cpp
+    Purpose: The CAN to UDP gateway end to end, on two buses and
+    127.0.0.1.
+*/
+
+#include "cantt_socket_test.h"
+#include "cantt_udp.h"
+
+// Room for a message larger than a datagram
+typedef BasicCANTT<2048, 4, 16> NodeCANTT;
+
+// A short queue, so that a burst from UDP fills it
+typedef BasicCANTT<2048, 4, 4> GatewayCANTT;
+
+#define GATEWAY_ADDR 0x700
+#define NODE_ADDR 0x100
+
+// A record as the peer gets it
+struct UdpRecord {
+    uint8_t bus;
+    uint32_t addr;
+    std::string topic;
+    std::string payload;
+};
+
+/*
+ * A gateway between two buses with a node each, and a UDP peer
+ */
+struct Rig {
+    Rig() : gateway(), node(), peer(-1) {}
+
+    TestSocketTransport gatewayBus[2];
+    SocketCANTransport nodeBus[2];
+    GatewayCANTT *gateway[2];
+    NodeCANTT *node[2];
+    std::vector<TestMessage> received[2];
+    CANTTUdpGateway udp;
+    int peer;
+    std::vector<std::string> datagrams; // what the peer got
+};
+
+/**
+    Opens a non-blocking UDP socket on 127.0.0.1, on a port the system
+    picks
+
+    @param port set to the port
+    @return the socket, -1 on error
+*/
+static int testUdp(uint16_t &port) {
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (sock < 0 || bind(sock, (struct sockaddr *)&local, len) < 0 ||
+        getsockname(sock, (struct sockaddr *)&local, &len) < 0) {
+        if (sock >= 0) {
+            close(sock);
+        }
+        return -1;
+    }
+
+    port = ntohs(local.sin_port);
+
+    return sock;
+}
+
+/**
+    Sets up the gateway, the nodes and the peer
+
+    @param rig to set up
+    @return true if OK
+*/
+static bool setUp(Rig &rig) {
+    const char *ifnames[2] = {"vcan0", "vcan1"};
+    uint16_t peerPort;
+
+    rig.peer = testUdp(peerPort);
+    if (rig.peer < 0 || rig.udp.open(0, "127.0.0.1", peerPort) != 0) {
+        return false;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (!testBus(ifnames[i], rig.gatewayBus[i], rig.nodeBus[i], true)) {
+            return false;
+        }
+
+        rig.gateway[i] =
+            new GatewayCANTT(GATEWAY_ADDR + i, rig.gatewayBus[i], NULL, NULL);
+        rig.gateway[i]->begin();
+        rig.gateway[i]->setFD(true);
+        if (rig.udp.addBus(*rig.gateway[i], rig.gatewayBus[i]) != 0) {
+            return false;
+        }
+
+        rig.node[i] = new NodeCANTT(NODE_ADDR + i, rig.nodeBus[i], testCollect,
+                                    &rig.received[i]);
+        rig.node[i]->begin();
+        rig.node[i]->setFD(true);
+        rig.node[i]->setBudget(64, 64);
+    }
+
+    return true;
+}
+
+static void tearDown(Rig &rig) {
+    rig.udp.close();
+    for (int i = 0; i < 2; i++) {
+        delete rig.gateway[i];
+        delete rig.node[i];
+    }
+    close(rig.peer);
+}
+
+/**
+    Runs the nodes until their queues are empty, so that everything they
+    publish waits on the bus before the gateway runs
+*/
+static void runNodes(Rig &rig) {
+    for (int round = 0; round < 100; round++) {
+        for (int i = 0; i < 2; i++) {
+            rig.node[i]->loop();
+        }
+    }
+}
+
+/**
+    Runs the gateway and the nodes, and collects what the peer gets
+
+    @param rig the gateway
+    @param ms time to run
+*/
+static void run(Rig &rig, uint32_t ms) {
+    uint32_t start = cantt_millis();
+    uint8_t buf[2048];
+    ssize_t n;
+
+    do {
+        rig.udp.poll(1);
+        runNodes(rig);
+
+        while ((n = recv(rig.peer, buf, sizeof(buf), 0)) >= 0) {
+            rig.datagrams.push_back(std::string((char *)buf, n));
+        }
+    } while (cantt_millis() - start < ms);
+}
+
+/**
+    Splits a datagram into its records
+
+    @param datagram the datagram
+    @param records to append the records to
+    @return false if it is not well formed
+*/
+static bool parse(const std::string &datagram,
+                  std::vector<UdpRecord> &records) {
+    const uint8_t *buf = (const uint8_t *)datagram.data();
+    size_t pos = 1;
+
+    if (datagram.empty() || buf[0] != CANTT_UDP_VERSION) {
+        return false;
+    }
+
+    while (pos < datagram.size()) {
+        UdpRecord record;
+        uint16_t topicLen;
+        uint16_t payloadLen;
+
+        if (datagram.size() - pos < CANTT_UDP_RECORD) {
+            return false;
+        }
+        topicLen = buf[pos + 5] | buf[pos + 6] << 8;
+        if (datagram.size() - pos < (size_t)CANTT_UDP_RECORD + topicLen) {
+            return false;
+        }
+        payloadLen = buf[pos + 7 + topicLen] | buf[pos + 8 + topicLen] << 8;
+        if (datagram.size() - pos <
+            (size_t)CANTT_UDP_RECORD + topicLen + payloadLen) {
+            return false;
+        }
+
+        record.bus = buf[pos];
+        record.addr = buf[pos + 1] | buf[pos + 2] << 8 | buf[pos + 3] << 16 |
+                      (uint32_t)buf[pos + 4] << 24;
+        record.topic = datagram.substr(pos + 7, topicLen);
+        record.payload = datagram.substr(pos + 9 + topicLen, payloadLen);
+        records.push_back(record);
+
+        pos += CANTT_UDP_RECORD + topicLen + payloadLen;
+    }
+
+    return true;
+}
+
+/**
+    Appends a record to a datagram towards CAN
+
+    @param datagram the datagram
+    @param bus bus index, or CANTT_UDP_ALL_BUSES
+    @param topic the topic
+    @param payload the payload
+*/
+static void addRecord(std::string &datagram, uint8_t bus, const char *topic,
+                      const std::string &payload) {
+    uint16_t topicLen = strlen(topic);
+
+    datagram += (char)bus;
+    datagram += std::string(4, '\0');
+    datagram += (char)(topicLen & 0xFF);
+    datagram += (char)(topicLen >> 8);
+    datagram += topic;
+    datagram += (char)(payload.size() & 0xFF);
+    datagram += (char)(payload.size() >> 8);
+    datagram += payload;
+}
+
+/**
+    Sends a datagram to the gateway
+
+    @param rig the gateway
+    @param datagram the datagram
+*/
+static void sendDatagram(Rig &rig, const std::string &datagram) {
+    struct sockaddr_in addr = testAddr(rig.udp.port());
+
+    CHECK(sendto(rig.peer, datagram.data(), datagram.size(), 0,
+                 (struct sockaddr *)&addr, sizeof(addr)) ==
+          (ssize_t)datagram.size());
+}
+
+/**
+    Messages decoded in one wake-up are packed into as few datagrams as
+    they fit, and a record that does not fit starts the next datagram
+    instead of being split
+*/
+static void packing() {
+    Rig rig;
+    std::vector<UdpRecord> records;
+    size_t full = 0;
+
+    CHECK(setUp(rig));
+
+    // 313-byte records: four fit a datagram
+    for (int i = 0; i < 12; i++) {
+        std::string payload = TestNet::pattern(i, 300);
+
+        CHECK(rig.node[0]->publish((uint8_t *)"pack", 4,
+                                   (uint8_t *)payload.data(), 300) == CANTT_OK);
+    }
+    runNodes(rig);
+    run(rig, 50);
+
+    CHECK(rig.udp.messagesForwarded == 12);
+    CHECK(rig.udp.datagramsSent == rig.datagrams.size());
+    CHECK(rig.udp.datagramsDropped == 0);
+    CHECK(rig.datagrams.size() == 3);
+
+    for (size_t d = 0; d < rig.datagrams.size(); d++) {
+        size_t before = records.size();
+
+        CHECK(rig.datagrams[d].size() <= CANTT_UDP_DATAGRAM);
+        CHECK(parse(rig.datagrams[d], records));
+
+        // The next record would not have fit
+        if (d + 1 < rig.datagrams.size() && records.size() > before &&
+            rig.datagrams[d].size() + CANTT_UDP_RECORD + 4 + 300 >
+                CANTT_UDP_DATAGRAM) {
+            full++;
+        }
+    }
+    CHECK(full == 2);
+
+    CHECK(records.size() == 12);
+    for (size_t i = 0; i < records.size(); i++) {
+        CHECK(records[i].bus == 0);
+        CHECK(records[i].addr == NODE_ADDR);
+        CHECK(records[i].topic == "pack");
+        CHECK(records[i].payload == TestNet::pattern(i, 300));
+    }
+
+    tearDown(rig);
+}
+
+/**
+    A message whose record is larger than a datagram is counted and left
+    out; the next one, from the other bus, goes through
+*/
+static void oversize() {
+    Rig rig;
+    std::vector<UdpRecord> records;
+    std::string big = TestNet::pattern(0, 1470);
+
+    CHECK(setUp(rig));
+
+    CHECK(rig.node[0]->publish((uint8_t *)"big", 3, (uint8_t *)big.data(),
+                               big.size()) == CANTT_OK);
+    runNodes(rig);
+    run(rig, 20);
+    CHECK(rig.node[1]->publish((uint8_t *)"small", 5, (uint8_t *)"x", 1) ==
+          CANTT_OK);
+    run(rig, 20);
+
+    CHECK(rig.udp.oversize == 1);
+    CHECK(rig.udp.messagesForwarded == 1);
+    CHECK(rig.datagrams.size() == 1);
+    for (size_t d = 0; d < rig.datagrams.size(); d++) {
+        CHECK(parse(rig.datagrams[d], records));
+    }
+    CHECK(records.size() == 1 && records[0].topic == "small" &&
+          records[0].bus == 1 && records[0].addr == NODE_ADDR + 1);
+
+    tearDown(rig);
+}
+
+/**
+    Datagrams with a wrong version, records cut short and a datagram too
+    large for the buffer are skipped; the records before a bad one and the
+    datagrams after it are published
+*/
+static void malformed() {
+    Rig rig;
+    std::string datagram;
+
+    CHECK(setUp(rig));
+
+    // Wrong version
+    datagram = std::string(1, (char)(CANTT_UDP_VERSION + 1));
+    addRecord(datagram, 0, "version", "v");
+    sendDatagram(rig, datagram);
+
+    // A good record, then a topic longer than the datagram
+    datagram = std::string(1, (char)CANTT_UDP_VERSION);
+    addRecord(datagram, 0, "first", "1");
+    addRecord(datagram, 0, "topic", "t");
+    datagram.resize(datagram.size() - 4);
+    sendDatagram(rig, datagram);
+
+    // A payload longer than the datagram
+    datagram = std::string(1, (char)CANTT_UDP_VERSION);
+    addRecord(datagram, 0, "payload", "abc");
+    datagram.resize(datagram.size() - 1);
+    sendDatagram(rig, datagram);
+
+    // Less than a record header
+    datagram = std::string(1, (char)CANTT_UDP_VERSION);
+    addRecord(datagram, 0, "header", "h");
+    datagram.resize(1 + CANTT_UDP_RECORD - 1);
+    sendDatagram(rig, datagram);
+
+    // Truncated by recvmmsg()
+    datagram = std::string(1, (char)CANTT_UDP_VERSION);
+    addRecord(datagram, 0, "huge", std::string(1600, 'h'));
+    sendDatagram(rig, datagram);
+
+    // No such bus
+    datagram = std::string(1, (char)CANTT_UDP_VERSION);
+    addRecord(datagram, 7, "nobus", "n");
+    sendDatagram(rig, datagram);
+
+    datagram = std::string(1, (char)CANTT_UDP_VERSION);
+    addRecord(datagram, 0, "last", "2");
+    sendDatagram(rig, datagram);
+
+    run(rig, 50);
+
+    CHECK(rig.udp.datagramsReceived == 7);
+    CHECK(rig.udp.malformed == 5);
+    CHECK(rig.udp.rejected == 1);
+    CHECK(rig.udp.messagesInjected == 2);
+    CHECK(testTopics(rig.received[0]) == "first last");
+    CHECK(rig.received[0].size() == 2 &&
+          rig.received[0][0].addr == GATEWAY_ADDR &&
+          rig.received[0][0].payload == "1");
+    CHECK(rig.received[1].empty());
+
+    tearDown(rig);
+}
+
+/**
+    A record for every bus while one bus queue is full: it goes out on the
+    other bus at once, reading pauses with the rest of the burst in the
+    socket, and when the queue has room the record goes out on the full
+    bus only, followed by everything held back
+*/
+static void fanOut() {
+    Rig rig;
+    std::string datagram;
+    uint32_t received;
+
+    CHECK(setUp(rig));
+
+    rig.gatewayBus[1].held = true;
+
+    // Four records fill the queue of bus 1
+    datagram = std::string(1, (char)CANTT_UDP_VERSION);
+    for (int i = 0; i < 4; i++) {
+        std::string topic = "fill" + std::to_string(i);
+
+        addRecord(datagram, 1, topic.c_str(), "f");
+    }
+    addRecord(datagram, CANTT_UDP_ALL_BUSES, "all", "everyone");
+    addRecord(datagram, 0, "after", "a");
+    sendDatagram(rig, datagram);
+    run(rig, 50);
+
+    CHECK(rig.udp.paused());
+    CHECK(rig.udp.stalls == 1);
+    CHECK(rig.udp.messagesInjected == 5);
+    CHECK(testTopics(rig.received[0]) == "all");
+    CHECK(rig.received[1].empty());
+
+    // Waits in the socket while reading is paused
+    received = rig.udp.datagramsReceived;
+    datagram = std::string(1, (char)CANTT_UDP_VERSION);
+    addRecord(datagram, 0, "late", "l");
+    sendDatagram(rig, datagram);
+    run(rig, 50);
+
+    CHECK(rig.udp.paused());
+    CHECK(rig.udp.datagramsReceived == received);
+    CHECK(testTopics(rig.received[0]) == "all");
+
+    rig.gatewayBus[1].held = false;
+    run(rig, 100);
+
+    CHECK(!rig.udp.paused());
+    CHECK(rig.udp.stalls == 1);
+    CHECK(rig.udp.datagramsReceived == received + 1);
+    CHECK(rig.udp.messagesInjected == 4 + 2 + 1 + 1);
+    CHECK(rig.udp.rejected == 0);
+    CHECK(testTopics(rig.received[0]) == "all after late");
+    CHECK(testTopics(rig.received[1]) == "fill0 fill1 fill2 fill3 all");
+    CHECK(rig.received[1].size() == 5 &&
+          rig.received[1][4].payload == "everyone");
+
+    tearDown(rig);
+}
+
+int main() {
+    packing();
+    oversize();
+    malformed();
+    fanOut();
+
+    return testResult("test_gateway");
+}
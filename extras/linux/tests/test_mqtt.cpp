@@ -0,0 +1,455 @@
+/**
+    CANTT Library
+    test_mqtt.cpp
+    Purpose: The MQTT bridge against a stand-in broker on 127.0.0.1.
+*/
+
+#include "cantt_mqtt.h"
+#include "cantt_socket_test.h"
+
+#include <fcntl.h>
+#include <netinet/tcp.h>
+
+typedef BasicCANTT<2048, 4, 16> NodeCANTT;
+
+// A short queue, so that a burst from the broker fills it
+typedef BasicCANTT<2048, 4, 4> BridgeCANTT;
+
+#define BRIDGE_ADDR 0x700
+#define NODE_ADDR 0x100
+#define CLIENT_ID "cantt-test"
+#define KEEP_ALIVE 60
+
+// A packet as the broker gets it
+struct MqttPacket {
+    uint8_t type;
+    std::string body; // after the fixed header
+};
+
+/*
+ * A bridge and a node on a bus, and the broker end of the TCP connection
+ */
+struct Rig {
+    Rig() : bridgeCANTT(), node(), listener(-1), broker(-1) {}
+
+    TestSocketTransport bridgeBus;
+    SocketCANTransport nodeBus;
+    BridgeCANTT *bridgeCANTT;
+    NodeCANTT *node;
+    std::vector<TestMessage> received;
+    CANTTMqttBridge bridge;
+    int listener;
+    int broker;     // accepted connection
+    std::string in; // bytes from the bridge not taken yet
+};
+
+/**
+    Sets up the bus, the listening socket and the bridge, which starts
+    to connect
+
+    @param rig to set up
+    @return true if OK
+*/
+static bool setUp(Rig &rig) {
+    struct sockaddr_in addr = testAddr(0);
+    socklen_t len = sizeof(addr);
+    int enable = 1;
+
+    rig.listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (rig.listener < 0 ||
+        setsockopt(rig.listener, SOL_SOCKET, SO_REUSEADDR, &enable,
+                   sizeof(enable)) < 0 ||
+        bind(rig.listener, (struct sockaddr *)&addr, len) < 0 ||
+        listen(rig.listener, 1) < 0 ||
+        getsockname(rig.listener, (struct sockaddr *)&addr, &len) < 0) {
+        return false;
+    }
+
+    if (!testBus("vcan0", rig.bridgeBus, rig.nodeBus)) {
+        return false;
+    }
+
+    rig.bridgeCANTT = new BridgeCANTT(BRIDGE_ADDR, rig.bridgeBus, NULL, NULL);
+    rig.bridgeCANTT->begin();
+    rig.node =
+        new NodeCANTT(NODE_ADDR, rig.nodeBus, testCollect, &rig.received);
+    rig.node->begin();
+    rig.node->setBudget(64, 64);
+
+    return rig.bridge.open("127.0.0.1", ntohs(addr.sin_port), CLIENT_ID,
+                           KEEP_ALIVE) == 0 &&
+           rig.bridge.attach(*rig.bridgeCANTT, rig.bridgeBus) == 0;
+}
+
+static void tearDown(Rig &rig) {
+    rig.bridge.close();
+    delete rig.bridgeCANTT;
+    delete rig.node;
+    if (rig.broker >= 0) {
+        close(rig.broker);
+    }
+    close(rig.listener);
+}
+
+/**
+    Runs the node until its queue is empty, so that everything it
+    publishes waits on the bus before the bridge runs
+*/
+static void runNode(Rig &rig) {
+    for (int round = 0; round < 100; round++) {
+        rig.node->loop();
+    }
+}
+
+/**
+    Runs the bridge and the node, accepts the connection of the bridge
+    and reads what it sends
+
+    @param rig the bridge
+    @param ms time to run
+*/
+static void run(Rig &rig, uint32_t ms) {
+    uint32_t start = cantt_millis();
+    char buf[4096];
+    ssize_t n;
+
+    do {
+        rig.bridge.poll(1);
+        runNode(rig);
+
+        if (rig.broker < 0) {
+            rig.broker = accept(rig.listener, NULL, NULL);
+            if (rig.broker >= 0) {
+                int enable = 1;
+
+                // Every write is a segment of its own
+                setsockopt(rig.broker, IPPROTO_TCP, TCP_NODELAY, &enable,
+                           sizeof(enable));
+                fcntl(rig.broker, F_SETFL,
+                      fcntl(rig.broker, F_GETFL) | O_NONBLOCK);
+            }
+        }
+
+        while (rig.broker >= 0 &&
+               (n = recv(rig.broker, buf, sizeof(buf), 0)) > 0) {
+            rig.in.append(buf, n);
+        }
+    } while (cantt_millis() - start < ms);
+}
+
+/**
+    Runs the bridge until a condition holds, at most TEST_SOCKET_WAIT ms
+
+    @param rig the bridge
+    @param done the condition
+*/
+static void runUntil(Rig &rig, bool (*done)(Rig &)) {
+    uint32_t start = cantt_millis();
+
+    while (!done(rig) && cantt_millis() - start < TEST_SOCKET_WAIT) {
+        run(rig, 1);
+    }
+}
+
+static bool accepted(Rig &rig) { return rig.broker >= 0 && !rig.in.empty(); }
+
+/**
+    Takes the next complete packet the bridge sent
+
+    @param rig the bridge
+    @param packet set to the packet
+    @return false if there is no complete packet
+*/
+static bool takePacket(Rig &rig, MqttPacket &packet) {
+    uint32_t remaining = 0;
+    size_t header = 1;
+
+    do {
+        if (header >= rig.in.size() || header > 4) {
+            return false;
+        }
+        remaining |= (uint32_t)(rig.in[header] & 0x7F) << (7 * (header - 1));
+    } while (rig.in[header++] & 0x80);
+
+    if (rig.in.size() < header + remaining) {
+        return false;
+    }
+
+    packet.type = rig.in[0];
+    packet.body = rig.in.substr(header, remaining);
+    rig.in.erase(0, header + remaining);
+
+    return true;
+}
+
+/**
+    Encodes a packet the broker sends
+
+    @param type first byte of the packet
+    @param body the packet after its fixed header
+    @return the packet
+*/
+static std::string encode(uint8_t type, const std::string &body) {
+    std::string packet(1, (char)type);
+    uint32_t remaining = body.size();
+
+    do {
+        packet += (char)((remaining & 0x7F) | (remaining > 0x7F ? 0x80 : 0));
+        remaining >>= 7;
+    } while (remaining > 0);
+
+    return packet + body;
+}
+
+/**
+    Encodes a QoS 0 PUBLISH
+
+    @param topic the MQTT topic
+    @param payload the payload
+    @return the packet
+*/
+static std::string publish(const std::string &topic,
+                           const std::string &payload) {
+    std::string body;
+
+    body += (char)(topic.size() >> 8);
+    body += (char)(topic.size() & 0xFF);
+
+    return encode(0x30, body + topic + payload);
+}
+
+/**
+    Writes bytes as the broker
+
+    @param rig the bridge
+    @param bytes what to write
+*/
+static void brokerSend(Rig &rig, const std::string &bytes) {
+    CHECK(send(rig.broker, bytes.data(), bytes.size(), MSG_NOSIGNAL) ==
+          (ssize_t)bytes.size());
+}
+
+/**
+    Checks CONNECT and SUBSCRIBE from the bridge, and accepts the
+    connection
+
+    @param rig the bridge
+*/
+static void connect(Rig &rig) {
+    std::string connect("\0\4MQTT\4\2\0\0\0\12" CLIENT_ID, 22);
+    std::string subscribe("\0\1\0\13cantt/cmd/#\0", 16);
+    MqttPacket packet;
+
+    connect[8] = KEEP_ALIVE >> 8;
+    connect[9] = KEEP_ALIVE & 0xFF;
+
+    runUntil(rig, accepted);
+    CHECK(rig.bridge.state() == CANTT_MQTT_CONNECTED);
+
+    CHECK(takePacket(rig, packet));
+    CHECK(packet.type == 0x10);
+    CHECK(packet.body == connect);
+
+    CHECK(takePacket(rig, packet));
+    CHECK(packet.type == 0x82);
+    CHECK(packet.body == subscribe);
+
+    brokerSend(rig, encode(0x20, std::string("\0\0", 2)));
+    brokerSend(rig, encode(0x90, std::string("\0\1\0", 3))); // SUBACK
+    run(rig, 20);
+    CHECK(rig.bridge.state() == CANTT_MQTT_READY);
+}
+
+/**
+    A refused CONNACK drops the connection, and the bridge connects again
+    CANTT_MQTT_RECONNECT ms later
+*/
+static void refused() {
+    Rig rig;
+    MqttPacket packet;
+
+    CHECK(setUp(rig));
+
+    runUntil(rig, accepted);
+    CHECK(takePacket(rig, packet) && packet.type == 0x10);
+
+    // Identifier rejected
+    brokerSend(rig, encode(0x20, std::string("\0\2", 2)));
+    run(rig, 20);
+    CHECK(rig.bridge.state() == CANTT_MQTT_CLOSED);
+    CHECK(rig.bridge.disconnects == 1);
+    CHECK(rig.bridge.connects == 0);
+
+    close(rig.broker);
+    rig.broker = -1;
+    rig.in.clear();
+
+    run(rig, CANTT_MQTT_RECONNECT - 100);
+    CHECK(rig.broker < 0);
+
+    connect(rig);
+    CHECK(rig.bridge.connects == 1);
+    CHECK(rig.bridge.disconnects == 1);
+
+    tearDown(rig);
+}
+
+/**
+    Messages decoded in one wake-up leave in one send(); topics a broker
+    would refuse are not sent
+*/
+static void coalesced() {
+    Rig rig;
+    MqttPacket packet;
+    uint32_t writes;
+    const char *bad[2] = {"bad\xC3\x28", "bad\0nul"};
+    uint16_t badLen[2] = {5, 7};
+
+    CHECK(setUp(rig));
+    connect(rig);
+
+    writes = rig.bridge.writes;
+    for (int i = 0; i < 8; i++) {
+        std::string topic = "t" + std::to_string(i);
+        std::string payload = TestNet::pattern(i, 20);
+
+        CHECK(rig.node->publish((uint8_t *)topic.data(), topic.size(),
+                                (uint8_t *)payload.data(), 20) == CANTT_OK);
+    }
+    runNode(rig);
+    run(rig, 50);
+
+    CHECK(rig.bridge.published == 8);
+    CHECK(rig.bridge.writes - writes < rig.bridge.published);
+    CHECK(rig.bridge.writes - writes == 1);
+
+    for (int i = 0; i < 8; i++) {
+        std::string topic = "cantt/bus/t" + std::to_string(i);
+
+        CHECK(takePacket(rig, packet));
+        CHECK(packet.type == 0x30);
+        CHECK(packet.body.substr(0, 2) == std::string("\0\14", 2));
+        CHECK(packet.body.substr(2, 12) == topic);
+        CHECK(packet.body.substr(14) == TestNet::pattern(i, 20));
+    }
+    CHECK(!takePacket(rig, packet));
+
+    // Not UTF-8, and U+0000
+    for (int i = 0; i < 2; i++) {
+        CHECK(rig.node->publish((uint8_t *)bad[i], badLen[i], (uint8_t *)"x", 1) ==
+              CANTT_OK);
+    }
+    CHECK(rig.node->publish((uint8_t *)"caf\xC3\xA9", 5, (uint8_t *)"x", 1) ==
+          CANTT_OK);
+    runNode(rig);
+    run(rig, 50);
+
+    CHECK(rig.bridge.rejected == 2);
+    CHECK(rig.bridge.published == 9);
+    CHECK(takePacket(rig, packet) &&
+          packet.body.substr(2, 15) == "cantt/bus/caf\xC3\xA9");
+    CHECK(rig.bridge.state() == CANTT_MQTT_READY);
+
+    tearDown(rig);
+}
+
+/**
+    A PUBLISH whose remaining length is split across two reads, and one
+    larger than the receive buffer, which is skipped
+*/
+static void framing() {
+    Rig rig;
+    std::string split = publish("cantt/cmd/split", TestNet::pattern(1, 200));
+    std::string big = publish("cantt/cmd/big",
+                              std::string(CANTT_MQTT_RX_BUFFER + 1000, 'b'));
+
+    CHECK(setUp(rig));
+    connect(rig);
+
+    // Two bytes of remaining length, the first one alone
+    CHECK((uint8_t)split[1] & 0x80);
+    brokerSend(rig, split.substr(0, 2));
+    run(rig, 20);
+    CHECK(rig.received.empty());
+    brokerSend(rig, split.substr(2));
+    run(rig, 50);
+
+    CHECK(testTopics(rig.received) == "split");
+    CHECK(rig.received.size() == 1 &&
+          rig.received[0].payload == TestNet::pattern(1, 200) &&
+          rig.received[0].addr == BRIDGE_ADDR);
+
+    brokerSend(rig, big + publish("cantt/cmd/after", "a"));
+    run(rig, 50);
+
+    CHECK(rig.bridge.oversize == 1);
+    CHECK(testTopics(rig.received) == "split after");
+    CHECK(rig.bridge.received == 2);
+    CHECK(rig.bridge.state() == CANTT_MQTT_READY);
+
+    tearDown(rig);
+}
+
+static bool closed(Rig &rig) {
+    return rig.bridge.state() == CANTT_MQTT_CLOSED;
+}
+
+/**
+    A burst from the broker fills the queue of the bus: reading pauses and
+    resumes when the bus caught up, nothing is lost. A connection reset
+    while reading is paused is noticed at once.
+*/
+static void stall() {
+    Rig rig;
+    std::string burst;
+    struct linger reset = {1, 0};
+
+    CHECK(setUp(rig));
+    connect(rig);
+
+    rig.bridgeBus.held = true;
+    for (int i = 0; i < 10; i++) {
+        burst += publish("cantt/cmd/m" + std::to_string(i), "p");
+    }
+    brokerSend(rig, burst);
+    run(rig, 50);
+
+    CHECK(rig.bridge.paused());
+    CHECK(rig.bridge.stalls == 1);
+    CHECK(rig.bridge.received == 4);
+    CHECK(rig.received.empty());
+
+    rig.bridgeBus.held = false;
+    run(rig, 100);
+
+    CHECK(!rig.bridge.paused());
+    CHECK(rig.bridge.received == 10);
+    CHECK(testTopics(rig.received) == "m0 m1 m2 m3 m4 m5 m6 m7 m8 m9");
+
+    // Paused again, then the broker resets the connection
+    rig.bridgeBus.held = true;
+    brokerSend(rig, burst);
+    run(rig, 50);
+    CHECK(rig.bridge.paused());
+    CHECK(rig.bridge.stalls == 2);
+
+    setsockopt(rig.broker, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    close(rig.broker);
+    rig.broker = -1;
+
+    runUntil(rig, closed);
+    CHECK(rig.bridge.state() == CANTT_MQTT_CLOSED);
+    CHECK(rig.bridge.disconnects == 1);
+    CHECK(!rig.bridge.paused());
+
+    tearDown(rig);
+}
+
+int main() {
+    refused();
+    coalesced();
+    framing();
+    stall();
+
+    return testResult("test_mqtt");
+}
@@ -0,0 +1,194 @@
+/**
+    CANTT Library
+    test_multi.cpp
+    Purpose: Small publishes coalesced into MULTI messages, and how
+    receivers take a batch apart.
+*/
+
+#include "cantt_test.h"
+
+/**
+    A PUBLISH message
+
+    @param topic the topic
+    @param payload the payload
+    @return the message
+*/
+static std::string publishMessage(const std::string &topic,
+                                  const std::string &payload) {
+    std::string msg(1, (char)CANTT_MSG_PUBLISH);
+
+    msg += (char)(topic.size() & 0xFF);
+    msg += (char)(topic.size() >> 8);
+    msg += topic;
+    msg += (char)(payload.size() & 0xFF);
+    msg += (char)(payload.size() >> 8);
+    msg += payload;
+
+    return msg;
+}
+
+/**
+    Appends a record to a MULTI message
+
+    @param multi the MULTI message
+    @param msg message of the record
+    @param len record length to write, the length of the message if -1
+*/
+static void addRecord(std::string &multi, const std::string &msg,
+                      int len = -1) {
+    if (len < 0) {
+        len = msg.size();
+    }
+
+    multi += (char)(len & 0xFF);
+    multi += (char)(len >> 8);
+    multi += msg;
+}
+
+/**
+    Topics of the messages received, in order, separated by spaces
+
+    @param received the messages
+    @return the topics
+*/
+static std::string topics(const std::vector<TestMessage> &received) {
+    std::string list;
+
+    for (size_t i = 0; i < received.size(); i++) {
+        list += (i > 0 ? " " : "") + received[i].topic;
+    }
+
+    return list;
+}
+
+/**
+    Sends a message as it is and runs the bus
+
+    @param net the nodes
+    @param msg the message
+*/
+static void sendRaw(TestNet &net, const std::string &msg) {
+    CHECK(net.cantt(0).send((uint8_t *)msg.data(), msg.size()) == CANTT_OK);
+    net.run(50);
+}
+
+/**
+    Several small publishes go out as one MULTI message, and every record
+    reaches the handler in the order it was published
+*/
+static void batched() {
+    TestNet net;
+    CANTTSimTransport spy;
+    CANMessage frame;
+    std::vector<CANMessage> frames;
+    char topic[8];
+
+    net.add(0x100);
+    net.add(0x200);
+    net.add(0x300);
+    net.bus.attach(spy);
+    CHECK(net.cantt(2).subscribe("m/1") == 0);
+
+    // HDR byte and 4 records of a length and 12 bytes: 57 bytes
+    net.cantt(0).setCoalescing(64, 20);
+    for (int i = 0; i < 4; i++) {
+        snprintf(topic, sizeof(topic), "m/%d", i);
+        CHECK(net.publish(0, topic, 4) == CANTT_OK);
+    }
+    CHECK(net.cantt(0).pending() == 1);
+
+    for (int ms = 0; ms < 50; ms++) {
+        net.run(1);
+        while (spy.available() && spy.receive(frame) == 0) {
+            frames.push_back(frame);
+        }
+    }
+
+    CHECK(net.cantt(0).stats().messagesSent == 1);
+    CHECK(net.cantt(1).stats().messagesReceived == 1);
+    CHECK(!frames.empty() &&
+          (frames[0].data[0] >> 4) == CANTT_FIRST_FRAME &&
+          frames[0].data[1] == 57 && frames[0].data[2] == CANTT_MSG_MULTI);
+
+    std::vector<TestMessage> &got = net.received(1);
+    CHECK(got.size() == 4);
+    for (size_t i = 0; i < got.size(); i++) {
+        snprintf(topic, sizeof(topic), "m/%d", (int)i);
+        CHECK(got[i].topic == topic);
+        CHECK(got[i].payload == TestNet::pattern(0, 4));
+    }
+
+    // Not sent before the batch was 20 ms old
+    CHECK(!got.empty() && got[0].at >= 20000000);
+
+    // Each record is matched on its own
+    CHECK(net.received(2).size() == 1 && net.received(2)[0].topic == "m/1");
+
+    // A batch of one goes out as the message itself
+    CHECK(net.publish(0, "single", 4) == CANTT_OK);
+    net.run(50);
+    CHECK(net.cantt(1).stats().messagesReceived == 2);
+    CHECK(got.size() == 5 && got[4].topic == "single");
+}
+
+/**
+    A batch with a record that does not fit is dropped whole: none of the
+    records before it reach the handler
+*/
+static void damaged() {
+    TestNet net;
+    std::string first = publishMessage("a", "1234");
+    std::string second = publishMessage("b", "5678");
+    std::string multi(1, (char)CANTT_MSG_MULTI);
+    std::string bad;
+
+    net.add(0x100);
+    net.add(0x200);
+
+    // Both records fit: the crafted batch is fine
+    addRecord(multi, first);
+    addRecord(multi, second);
+    sendRaw(net, multi);
+    CHECK(net.received(1).size() == 2);
+    CHECK(topics(net.received(1)) == "a b");
+
+    // The last record is cut short
+    bad = multi.substr(0, multi.size() - 3);
+    sendRaw(net, bad);
+
+    // A record that claims more than is left
+    bad = std::string(1, (char)CANTT_MSG_MULTI);
+    addRecord(bad, first);
+    addRecord(bad, second, second.size() + 1);
+    sendRaw(net, bad);
+
+    // Half a record length at the end
+    bad = multi + '\x01';
+    sendRaw(net, bad);
+
+    // Empty and nested records
+    bad = std::string(1, (char)CANTT_MSG_MULTI);
+    addRecord(bad, first);
+    addRecord(bad, "");
+    sendRaw(net, bad);
+
+    bad = std::string(1, (char)CANTT_MSG_MULTI);
+    addRecord(bad, first);
+    addRecord(bad, multi);
+    sendRaw(net, bad);
+
+    CHECK(net.cantt(1).stats().messagesReceived == 6);
+    CHECK(net.received(1).size() == 2);
+
+    // Nothing left behind
+    sendRaw(net, multi);
+    CHECK(topics(net.received(1)) == "a b a b");
+}
+
+int main() {
+    batched();
+    damaged();
+
+    return testResult("test_multi");
+}
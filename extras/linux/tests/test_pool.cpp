@@ -0,0 +1,171 @@
+/**
+    CANTT Library
+    test_pool.cpp
+    Purpose: Reassembly buffers in the block pool: growing in place,
+    moving, and running out of blocks.
+*/
+
+#include "cantt_test.h"
+
+#define POOL_BLOCKS 8
+
+static uint8_t arena[POOL_BLOCKS * CANTT_BLOCK_SIZE];
+static uint8_t blockMap[(POOL_BLOCKS + 7) / 8];
+
+/**
+    Block number of a buffer
+
+    @param run the buffer
+    @return its first block
+*/
+static int block(const uint8_t *run) {
+    return (run - arena) / CANTT_BLOCK_SIZE;
+}
+
+/**
+    A buffer grows in place while the blocks behind it are free, and is
+    moved, contents and all, when they are not
+*/
+static void growth() {
+    CANTTBlockPool pool;
+    uint8_t *a;
+    uint8_t *b;
+    uint8_t *grown;
+
+    pool.attach(arena, blockMap, POOL_BLOCKS);
+    CHECK(pool.capacity() == POOL_BLOCKS);
+    CHECK(pool.inUse() == 0);
+
+    a = pool.grow(NULL, 0, 1, 0);
+    CHECK(a == arena);
+    memset(a, 'a', CANTT_BLOCK_SIZE);
+
+    // In place: block 1 is free
+    grown = pool.grow(a, 1, 2, CANTT_BLOCK_SIZE);
+    CHECK(grown == a);
+    CHECK(pool.moves == 0);
+    CHECK(pool.inUse() == 2);
+
+    // Already large enough
+    CHECK(pool.grow(a, 2, 2, 0) == a);
+    CHECK(pool.inUse() == 2);
+
+    b = pool.grow(NULL, 0, 1, 0);
+    CHECK(block(b) == 2);
+
+    // Block 2 is taken: moved to blocks 3-5, the first 100 bytes copied
+    memset(&a[CANTT_BLOCK_SIZE], 'A', CANTT_BLOCK_SIZE);
+    grown = pool.grow(a, 2, 3, 100);
+    CHECK(block(grown) == 3);
+    CHECK(pool.moves == 1);
+    CHECK(pool.inUse() == 4);
+    CHECK(grown[0] == 'a' && grown[CANTT_BLOCK_SIZE - 1] == 'a' &&
+          grown[CANTT_BLOCK_SIZE] == 'A' && grown[99] == 'A');
+    a = grown;
+
+    // The old blocks are free again, a new buffer gets them
+    CHECK(pool.grow(NULL, 0, 2, 0) == arena);
+    CHECK(pool.inUse() == 6);
+    CHECK(pool.highWater == 6);
+
+    pool.release(a, 3);
+    pool.release(b, 1);
+    pool.release(NULL, 4);
+    CHECK(pool.inUse() == 2);
+    CHECK(pool.highWater == 6);
+    CHECK(pool.failures == 0);
+}
+
+/**
+    With no free run long enough a request fails, and a buffer that could
+    not grow is left as it was
+*/
+static void exhausted() {
+    CANTTBlockPool pool;
+    uint8_t *a;
+    uint8_t *b;
+    uint8_t *c;
+
+    pool.attach(arena, blockMap, POOL_BLOCKS);
+
+    // Blocks 0-2, 3-4, 5-7
+    a = pool.grow(NULL, 0, 3, 0);
+    b = pool.grow(NULL, 0, 2, 0);
+    c = pool.grow(NULL, 0, 3, 0);
+    CHECK(block(a) == 0 && block(b) == 3 && block(c) == 5);
+    CHECK(pool.inUse() == POOL_BLOCKS);
+    CHECK(pool.highWater == POOL_BLOCKS);
+
+    CHECK(pool.grow(NULL, 0, 1, 0) == NULL);
+    CHECK(pool.failures == 1);
+
+    // Past the end of the pool
+    CHECK(pool.grow(c, 3, 4, 0) == NULL);
+    CHECK(pool.failures == 2);
+
+    // Six free blocks, but not in one run
+    pool.release(a, 3);
+    pool.release(c, 3);
+    memset(b, 'b', 2 * CANTT_BLOCK_SIZE);
+    CHECK(pool.grow(b, 2, 6, 2 * CANTT_BLOCK_SIZE) == NULL);
+    CHECK(pool.failures == 3);
+    CHECK(pool.moves == 0);
+    CHECK(pool.inUse() == 2);
+    CHECK(b[0] == 'b' && b[2 * CANTT_BLOCK_SIZE - 1] == 'b');
+
+    // The run behind it is long enough
+    CHECK(pool.grow(b, 2, 5, 0) == b);
+    CHECK(pool.inUse() == 5);
+    CHECK(pool.moves == 0);
+
+    pool.clear();
+    CHECK(pool.inUse() == 0);
+    CHECK(pool.grow(NULL, 0, POOL_BLOCKS, 0) == arena);
+}
+
+/**
+    Two messages reassembled side by side on a bus, as 29-bit ids allow:
+    the second one takes the blocks behind the first, which has to move to
+    grow. Every block comes back once both are delivered.
+*/
+static void onTheBus() {
+    TestNet net;
+    uint32_t priorities[3] = {0x400, 0x200, 0x200};
+
+    for (uint8_t i = 0; i < 3; i++) {
+        CHECK(net.add(priorities[i])
+                  .setAddr(CANTT_EXT_ADDR(priorities[i], i + 1), true,
+                           false) == 0);
+    }
+
+    // Frames 1 ms apart leave room for the other sender
+    CHECK(net.cantt(0).setPacing(0, 1, 0) == 0);
+    net.run(10);
+
+    CHECK(net.publish(1, "long", 300) == CANTT_OK);
+    net.run(5);
+    CHECK(net.publish(2, "short", 150) == CANTT_OK);
+    net.run(500);
+
+    const CANTTBlockPool &pool = net.cantt(0).reassembly().pool();
+    std::vector<TestMessage> &got = net.received(0);
+
+    CHECK(got.size() == 2);
+    for (size_t i = 0; i < got.size(); i++) {
+        CHECK(got[i].payload == (got[i].topic == "long"
+                                     ? TestNet::pattern(1, 300)
+                                     : TestNet::pattern(2, 150)));
+    }
+    CHECK(pool.moves >= 1);
+    CHECK(pool.highWater > CANTT_BLOCKS(300));
+    CHECK(pool.failures == 0);
+    CHECK(pool.inUse() == 0);
+}
+
+int main() {
+    growth();
+    exhausted();
+    onTheBus();
+
+    return testResult("test_pool");
+}
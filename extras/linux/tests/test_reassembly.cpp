@@ -0,0 +1,80 @@
+/**
+    CANTT Library
+    test_reassembly.cpp
+    Purpose: Reassembly of multi-frame messages from several senders at
+    once, on a simulated bus.
+*/
+
+#include "cantt_test.h"
+
+/**
+    Three senders publish at the same time to a receiver that paces them to
+    one frame per ms, so their frames alternate on the bus
+
+    @param drain run the nodes in drain mode, or one step per loop()
+*/
+static void interleavedSenders(bool drain) {
+    TestNet net;
+
+    net.add(0x400, drain).setPacing(0, 1, 0);
+    net.add(0x100, drain);
+    net.add(0x200, drain);
+    net.add(0x300, drain);
+    net.run(10); // the pacing reaches the senders
+
+    for (size_t i = 1; i <= 3; i++) {
+        CHECK(net.publish(i, "sensor/bulk", 150) == CANTT_OK);
+    }
+    net.run(500);
+
+    std::vector<TestMessage> &got = net.received(0);
+
+    CHECK(got.size() == 3);
+    for (size_t i = 0; i < got.size(); i++) {
+        size_t sender = got[i].addr >> 8;
+
+        CHECK(got[i].addr == 0x100 || got[i].addr == 0x200 ||
+              got[i].addr == 0x300);
+        CHECK(got[i].topic == "sensor/bulk");
+        CHECK(got[i].payload == TestNet::pattern(sender, 150));
+    }
+
+    // Every consecutive frame found its transfer
+    CHECK(net.cantt(0).reassembly().misses == 0);
+    CHECK(net.cantt(0).reassembly().evictions == 0);
+    CHECK(net.cantt(0).reassembly().timeouts == 0);
+    CHECK(net.cantt(0).reassembly().active() == 0);
+}
+
+/**
+    More concurrent senders than RX slots: the stalest transfer is evicted,
+    the others complete
+*/
+static void fullTable() {
+    TestNet net;
+
+    // Slow enough for the First frames of all senders to go out together
+    net.add(0x400).setPacing(0, 5, 0);
+    for (uint32_t i = 0; i < 9; i++) {
+        net.add(0x100 + i);
+    }
+    net.run(10);
+
+    for (size_t i = 1; i <= 9; i++) {
+        CHECK(net.publish(i, "t", 100) == CANTT_OK);
+    }
+    net.run(500);
+
+    CHECK(net.received(0).size() == 8);
+    CHECK(net.cantt(0).reassembly().evictions == 1);
+    CHECK(net.cantt(0).reassembly().misses > 0);
+    CHECK(net.cantt(0).reassembly().active() == 0);
+}
+
+int main() {
+    interleavedSenders(true);
+    interleavedSenders(false);
+    fullTable();
+
+    return testResult("test_reassembly");
+}
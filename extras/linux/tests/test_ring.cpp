@@ -0,0 +1,229 @@
+/**
+    CANTT Library
+    test_ring.cpp
+    Purpose: The receive ring between a CAN interrupt and loop(): claim
+    and commit, what a full ring drops and counts, and a producer thread
+    racing the consumer.
+*/
+
+#include "cantt_ring.h"
+#include "cantt_test.h"
+
+#include <atomic>
+#include <thread>
+
+// Frames the producer thread pushes
+#define RING_STRESS_FRAMES 200000
+
+static uint8_t noSend(const CANMessage &msg) { return 1; }
+
+/**
+    A frame with a number in its data
+
+    @param n the number
+    @return the frame
+*/
+static CANMessage numbered(uint32_t n) {
+    CANMessage msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.id = n & CANTT_MAX_ADDR;
+    msg.len = 4;
+    memcpy(msg.data, &n, 4);
+
+    return msg;
+}
+
+/**
+    Number of a frame
+
+    @param msg the frame
+    @return the number
+*/
+static uint32_t numberOf(const CANMessage &msg) {
+    uint32_t n;
+
+    memcpy(&n, msg.data, 4);
+
+    return n;
+}
+
+/**
+    A claimed frame is only seen once committed, and the slot is handed
+    out again until it is
+*/
+static void claimCommit() {
+    CANTTRing ring;
+    CANMessage *slot;
+    CANMessage out[2];
+
+    slot = ring.claim();
+    CHECK(slot != NULL);
+    *slot = numbered(1);
+    CHECK(ring.count() == 0);
+    CHECK(ring.pop(out, 2) == 0);
+
+    // Left uncommitted, as if the handler gave up on the frame
+    CHECK(ring.claim() == slot);
+
+    *slot = numbered(2);
+    ring.commit();
+    CHECK(ring.count() == 1);
+    CHECK(ring.highWater == 1);
+    CHECK(ring.claim() != slot);
+
+    CHECK(ring.pop(out, 2) == 1);
+    CHECK(numberOf(out[0]) == 2);
+    CHECK(ring.count() == 0);
+    CHECK(ring.overruns == 0);
+}
+
+/**
+    A full ring drops what arrives and counts it; a frame popped makes
+    room for exactly one more
+*/
+static void overflow() {
+    CANTTRing ring;
+    CANMessage out[CANTT_RING_SIZE];
+    uint32_t n = 0;
+
+    while (ring.push(numbered(n))) {
+        n++;
+    }
+    CHECK(n == CANTT_RING_SIZE);
+    CHECK(ring.count() == CANTT_RING_SIZE);
+    CHECK(ring.overruns == 1);
+    CHECK(ring.highWater == CANTT_RING_SIZE);
+
+    CHECK(ring.claim() == NULL);
+    CHECK(!ring.push(numbered(n)));
+    CHECK(ring.overruns == 3);
+
+    CHECK(ring.pop(out, 1) == 1 && numberOf(out[0]) == 0);
+    CHECK(ring.push(numbered(n++)));
+    CHECK(!ring.push(numbered(n)));
+    CHECK(ring.overruns == 4);
+
+    // The oldest frames first, the dropped ones are gone
+    CHECK(ring.pop(out, CANTT_RING_SIZE) == CANTT_RING_SIZE);
+    for (uint32_t i = 0; i < CANTT_RING_SIZE; i++) {
+        CHECK(numberOf(out[i]) == i + 1);
+    }
+    CHECK(ring.count() == 0);
+    CHECK(ring.highWater == CANTT_RING_SIZE);
+}
+
+/**
+    The indices run freely and wrap: frames keep their order across many
+    laps, popped in batches of any size
+*/
+static void laps() {
+    CANTTRing ring;
+    CANMessage out[CANTT_RING_SIZE];
+    uint32_t pushed = 0;
+    uint32_t popped = 0;
+    uint32_t next = 0;
+    uint8_t got;
+    bool ordered = true;
+
+    for (int round = 0; round < 1000; round++) {
+        for (int i = 0; i < 1 + round % 7; i++) {
+            ring.push(numbered(pushed++));
+        }
+
+        // Batches of 1 to 5 fall behind, and the ring fills up
+        do {
+            got = ring.pop(out, 1 + round % 5);
+            for (uint8_t i = 0; i < got; i++) {
+                ordered = ordered && numberOf(out[i]) >= next;
+                next = numberOf(out[i]) + 1;
+                popped++;
+            }
+        } while (round % 100 == 99 && got > 0);
+    }
+
+    CHECK(ordered);
+    CHECK(popped + ring.overruns + ring.count() == pushed);
+    CHECK(ring.overruns > 0);
+    CHECK(ring.highWater == CANTT_RING_SIZE);
+}
+
+/**
+    A producer thread pushes as fast as it can while the consumer pops:
+    every frame is either popped, in order, or counted as an overrun
+*/
+static void race() {
+    static CANTTRing ring;
+    CANMessage out[8];
+    std::atomic<bool> finished(false);
+    uint32_t dropped = 0;
+    uint32_t popped = 0;
+    uint32_t last = 0;
+    bool ordered = true;
+    bool done;
+    uint8_t got;
+
+    std::thread producer([&dropped, &finished]() {
+        for (uint32_t n = 1; n <= RING_STRESS_FRAMES; n++) {
+            if (!ring.push(numbered(n))) {
+                dropped++;
+            }
+        }
+        finished = true;
+    });
+
+    // Until the ring is empty after the producer was done
+    do {
+        done = finished;
+        got = ring.pop(out, 8);
+        for (uint8_t i = 0; i < got; i++) {
+            ordered = ordered && numberOf(out[i]) > last;
+            last = numberOf(out[i]);
+            popped++;
+        }
+    } while (got > 0 || !done);
+    producer.join();
+
+    CHECK(ordered);
+    CHECK(ring.overruns == dropped);
+    CHECK(popped + dropped == RING_STRESS_FRAMES);
+    CHECK(ring.count() == 0);
+    CHECK(ring.highWater <= CANTT_RING_SIZE);
+}
+
+/**
+    CANTT reads what the interrupt handler left in the ring
+*/
+static void transport() {
+    static const uint8_t message[] = {CANTT_MSG_PUBLISH, 1, 0, 't', 1, 0, 'x'};
+    CANRingTransport ring(noSend);
+    TestCANTT c(0x200, ring, NULL, NULL);
+    CANMessage msg;
+
+    c.begin();
+    c.setBudget(64, 64);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.id = 0x100;
+    msg.len = 1 + sizeof(message);
+    msg.data[0] = sizeof(message);
+    memcpy(&msg.data[1], message, sizeof(message));
+    for (int i = 0; i < 5; i++) {
+        CHECK(ring.ring.push(msg));
+    }
+
+    c.loop();
+    CHECK(ring.ring.count() == 0);
+    CHECK(c.stats().framesReceived == 5);
+    CHECK(c.stats().messagesReceived == 5);
+}
+
+int main() {
+    claimCommit();
+    overflow();
+    laps();
+    race();
+    transport();
+
+    return testResult("test_ring");
+}
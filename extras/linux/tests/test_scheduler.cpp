@@ -0,0 +1,90 @@
+/**
+    CANTT Library
+    test_scheduler.cpp
+    Purpose: Order of the TX queue, and deadlines of the priority classes,
+    on a simulated bus.
+*/
+
+#include "cantt_test.h"
+
+/**
+    Queued messages go out lowest CAN id first, in publish order within
+    an id
+*/
+static void priorityOrder() {
+    TestNet net;
+
+    net.add(0x100);
+    net.add(0x400);
+
+    // Queued before the sender gets to run
+    CHECK(net.publish(0, "c", 20, 0x300) == CANTT_OK);
+    CHECK(net.publish(0, "a", 20, 0x200) == CANTT_OK);
+    CHECK(net.publish(0, "b", 20, 0x200) == CANTT_OK);
+    CHECK(net.publish(0, "d", 2, 0x050) == CANTT_OK);
+    net.run(100);
+
+    std::vector<TestMessage> &got = net.received(1);
+
+    CHECK(got.size() == 4);
+    if (got.size() == 4) {
+        CHECK(got[0].addr == 0x050 && got[0].topic == "d");
+        CHECK(got[1].addr == 0x200 && got[1].topic == "a");
+        CHECK(got[2].addr == 0x200 && got[2].topic == "b");
+        CHECK(got[3].addr == 0x300 && got[3].topic == "c");
+    }
+}
+
+/**
+    A node with two messages queued gets a frame of a more important node
+    that publishes every 10 ms, which renews the holdoff of the second
+    message. Without a holdoff limit only the deadline of its priority
+    class gets it out.
+
+    @param deadline of the class of the held off messages, 0 for none
+    @return ms from publish to delivery of the second message, 0 if it was
+   not delivered
+*/
+static uint32_t overdue(uint16_t deadline) {
+    TestNet net;
+
+    net.add(0x100);
+    net.add(0x600).setHoldoff(CANTT_DEFAULT_HOLDOFF_DELAY, 0);
+    net.cantt(1).setDeadline(0x600 >> CANTT_PRIORITY_CLASS_SHIFT, deadline);
+    net.add(0x700);
+
+    CHECK(net.publish(1, "first", 100) == CANTT_OK);
+    CHECK(net.publish(1, "second", 100) == CANTT_OK);
+
+    for (int ms = 0; ms < 1000; ms++) {
+        if (ms % 10 == 0) {
+            net.publish(0, "alarm", 2);
+        }
+        net.run(1);
+    }
+
+    for (size_t i = 0; i < net.received(2).size(); i++) {
+        if (net.received(2)[i].topic == "second") {
+            CHECK(net.received(2)[i].payload == TestNet::pattern(1, 100));
+            return net.received(2)[i].at / 1000000;
+        }
+    }
+
+    return 0;
+}
+
+static void deadlines() {
+    uint32_t latency = overdue(50);
+
+    // Due after 50 ms, then about 15 frames and an alarm
+    CHECK(latency >= 50);
+    CHECK(latency < 60);
+    CHECK(overdue(0) == 0);
+}
+
+int main() {
+    priorityOrder();
+    deadlines();
+
+    return testResult("test_scheduler");
+}
@@ -0,0 +1,98 @@
+/**
+    CANTT Library
+    test_stats.cpp
+    Purpose: The statistics snapshot, and publishing it on a simulated
+    bus.
+*/
+
+#include "cantt_test.h"
+
+static uint8_t noFrame() { return 0; }
+static uint8_t noRead(CANMessage &msg) { return 1; }
+static uint8_t noSend(const CANMessage &msg) { return 1; }
+
+/**
+    Reads a little-endian uint32_t of a snapshot
+
+    @param snapshot the snapshot
+    @param pos offset of the value
+    @return the value
+*/
+static uint32_t get32(const std::string &snapshot, size_t pos) {
+    const uint8_t *p = (const uint8_t *)snapshot.data() + pos;
+
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/**
+    Version and flags first, then the counters and the histograms
+*/
+static void layout() {
+    CANTTStats stats;
+    uint8_t buf[CANTT_STATS_SIZE + 1];
+    std::string snapshot;
+
+    stats.framesReceived = 0x01020304;
+    stats.rejected = 7;
+    CANTTStats::record(stats.send, 100);
+    CANTTStats::record(stats.send, 3000);
+
+    CHECK(stats.encode(buf, CANTT_STATS_SIZE - 1) == 0);
+    CHECK(stats.encode(buf, sizeof(buf)) == CANTT_STATS_SIZE);
+    snapshot.assign((const char *)buf, CANTT_STATS_SIZE);
+
+    CHECK(buf[0] == CANTT_STATS_VERSION);
+    CHECK(buf[1] == CANTT_STATS_PERCENTILES);
+    CHECK(get32(snapshot, 2) == 0x01020304);
+    CHECK(get32(snapshot, 2 + 7 * 4) == 7);
+
+    // Reassembly, then send: count, p50, p99, max
+    size_t send = 2 + CANTT_STATS_COUNTERS * 4 + 16;
+    CHECK(get32(snapshot, send) == 2);
+    CHECK(get32(snapshot, send + 4) == CANTTStats::percentile(stats.send, 50));
+    CHECK(get32(snapshot, send + 8) != 0);
+    CHECK(get32(snapshot, send + 12) == 3000);
+}
+
+/**
+    The snapshot does not fit in a message of CANTT, it does in a larger
+    instance, which sends it every interval
+*/
+static void publishing() {
+    CANTransport transport(noFrame, noRead, noSend);
+    CANTT small(0x100, transport, NULL, NULL);
+    TestNet net;
+
+    CHECK(small.setStatsPublish("s", 1000) == -1);
+
+    net.add(0x100);
+    net.add(0x200);
+    CHECK(net.cantt(0).setStatsPublish("stats/n0", 100) == 0);
+    net.run(250);
+
+    std::vector<TestMessage> &got = net.received(1);
+    CHECK(got.size() == 2);
+    if (got.empty()) {
+        return;
+    }
+
+    CHECK(got[0].topic == "stats/n0");
+    CHECK(got[0].payload.size() == CANTT_STATS_SIZE);
+    CHECK((uint8_t)got[0].payload[0] == CANTT_STATS_VERSION);
+    CHECK((uint8_t)got[0].payload[1] == CANTT_STATS_PERCENTILES);
+
+    // messagesSent: the first snapshot is counted in the second
+    CHECK(get32(got[0].payload, 2 + 3 * 4) == 0);
+    CHECK(got.size() < 2 || get32(got[1].payload, 2 + 3 * 4) == 1);
+
+    CHECK(net.cantt(0).setStatsPublish(NULL, 0) == 0);
+    net.run(250);
+    CHECK(got.size() == 2);
+}
+
+int main() {
+    layout();
+    publishing();
+
+    return testResult("test_stats");
+}
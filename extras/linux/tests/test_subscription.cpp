@@ -0,0 +1,208 @@
+/**
+    CANTT Library
+    test_subscription.cpp
+    Purpose: Topic filters with '+' and '#', matched as the topic arrives,
+    on their own and on a simulated bus.
+*/
+
+#include "cantt_test.h"
+
+/**
+    Matches a topic against the subscriptions
+
+    @param subs the subscriptions
+    @param topic the topic
+    @return true if it matches
+*/
+static bool match(const CANTTSubscriptions &subs, const char *topic) {
+    return subs.matches((const uint8_t *)topic, strlen(topic));
+}
+
+/**
+    Feeds a topic one byte at a time
+
+    @param subs the subscriptions
+    @param topic the topic
+    @param decided set to the number of bytes fed when the result was
+   known, the length of the topic if only finish() knew it
+    @return CANTT_MATCH_ACCEPT or CANTT_MATCH_REJECT
+*/
+static uint8_t feed(const CANTTSubscriptions &subs, const char *topic,
+                    size_t &decided) {
+    struct CANTTmatch m;
+    size_t len = strlen(topic);
+
+    subs.begin(m);
+    decided = 0;
+    while (m.state == CANTT_MATCH_PENDING && decided < len) {
+        subs.feed(m, (const uint8_t *)&topic[decided++], 1);
+    }
+
+    return subs.finish(m);
+}
+
+static void singleLevel() {
+    CANTTSubscriptions subs;
+    size_t decided;
+
+    CHECK(subs.subscribe("a/+/c") == 0);
+
+    CHECK(match(subs, "a/b/c"));
+    CHECK(match(subs, "a/long level/c"));
+    CHECK(match(subs, "a//c"));
+    CHECK(!match(subs, "a/b"));
+    CHECK(!match(subs, "a/b/"));
+    CHECK(!match(subs, "a/b/c/d"));
+    CHECK(!match(subs, "a/b/cc"));
+    CHECK(!match(subs, "a/b/d"));
+    CHECK(!match(subs, "b/b/c"));
+    CHECK(!match(subs, "ab/c"));
+
+    // Only the end of the topic decides a match, a mismatch is known early
+    CHECK(feed(subs, "a/b/c", decided) == CANTT_MATCH_ACCEPT);
+    CHECK(decided == 5);
+    CHECK(feed(subs, "x/b/c", decided) == CANTT_MATCH_REJECT);
+    CHECK(decided == 1);
+    CHECK(feed(subs, "a/b/d", decided) == CANTT_MATCH_REJECT);
+    CHECK(decided == 5);
+}
+
+static void multiLevel() {
+    CANTTSubscriptions subs;
+    size_t decided;
+
+    CHECK(subs.subscribe("a/#") == 0);
+
+    CHECK(match(subs, "a"));
+    CHECK(match(subs, "a/b"));
+    CHECK(match(subs, "a/b/c/d"));
+    CHECK(match(subs, "a/"));
+    CHECK(!match(subs, "ab"));
+    CHECK(!match(subs, "b/a"));
+    CHECK(!match(subs, ""));
+
+    // Accepted at the '/', whatever follows
+    CHECK(feed(subs, "a/b/c/d", decided) == CANTT_MATCH_ACCEPT);
+    CHECK(decided == 2);
+
+    // Only as the last level
+    CHECK(subs.subscribe("a/#/c") == -1);
+    CHECK(subs.subscribe("a/b#") == -1);
+    CHECK(subs.subscribe("a/b+/c") == -1);
+}
+
+static void everything() {
+    CANTTSubscriptions subs;
+    size_t decided;
+
+    CHECK(subs.subscribe("a/b") == 0);
+    CHECK(!match(subs, "x"));
+
+    CHECK(subs.subscribe("#") == 0);
+    CHECK(match(subs, "x"));
+    CHECK(match(subs, "a/b/c"));
+    CHECK(match(subs, ""));
+    CHECK(feed(subs, "x/y", decided) == CANTT_MATCH_ACCEPT);
+    CHECK(decided == 0);
+
+    CHECK(subs.unsubscribe("#") == 0);
+    CHECK(!match(subs, "x"));
+    CHECK(match(subs, "a/b"));
+
+    subs.clear();
+    CHECK(subs.empty());
+    CHECK(match(subs, "x"));
+}
+
+/**
+    Every trie node in use: one filter more fails and leaves the others
+    working. With CANTT_SUB_MAX_NODES at 32 this uses the top bit of the
+    node masks.
+*/
+static void full() {
+    CANTTSubscriptions subs;
+    char filter[8];
+
+    for (int i = 0; i < CANTT_SUB_MAX_NODES; i++) {
+        snprintf(filter, sizeof(filter), "n%d", i);
+        CHECK(subs.subscribe(filter) == 0);
+    }
+
+    CHECK(subs.subscribe("one/more") == -1);
+    CHECK(subs.subscribe("+") == -1);
+
+    // Filters with no new node still fit
+    CHECK(subs.subscribe("n0/#") == 0);
+    CHECK(subs.subscribe("#") == 0);
+    CHECK(subs.unsubscribe("#") == 0);
+
+    for (int i = 0; i < CANTT_SUB_MAX_NODES; i++) {
+        snprintf(filter, sizeof(filter), "n%d", i);
+        CHECK(match(subs, filter));
+    }
+    CHECK(!match(subs, "one/more"));
+    CHECK(match(subs, "n0/x/y"));
+    CHECK(!match(subs, "n1/x"));
+}
+
+/**
+    Topics long enough to span First and Consecutive frames. A topic that
+    matches is delivered whole; one that can not match is dropped as soon
+    as that is known, and the rest of its frames are not reassembled.
+*/
+static void onTheBus() {
+    TestNet net;
+    std::string middle(20, 'x');
+    std::string wanted = "a/" + middle + "/c";
+    std::string late = "a/" + middle + "/d";
+    std::string early = "z/" + middle + "/c";
+    uint32_t frames;
+    uint32_t misses;
+    uint32_t lateMisses;
+
+    net.add(0x100);
+    net.add(0x200);
+    CHECK(net.cantt(1).subscribe("a/+/c") == 0);
+    CHECK(net.cantt(1).subscribe("b/#") == 0);
+
+    CHECK(net.publish(0, wanted.c_str(), 40) == CANTT_OK);
+    net.run(20);
+    CHECK(net.received(1).size() == 1 && net.received(1)[0].topic == wanted &&
+          net.received(1)[0].payload == TestNet::pattern(0, 40));
+    CHECK(net.cantt(1).reassembly().misses == 0);
+
+    // Rejected with the last level, the payload frames are left out
+    frames = net.cantt(0).stats().framesSent;
+    CHECK(net.publish(0, late.c_str(), 40) == CANTT_OK);
+    net.run(20);
+    frames = net.cantt(0).stats().framesSent - frames;
+    lateMisses = net.cantt(1).reassembly().misses;
+    CHECK(lateMisses > 0);
+    CHECK(lateMisses < frames - 1);
+
+    // Rejected with its first byte, in the First frame
+    frames = net.cantt(0).stats().framesSent;
+    CHECK(net.publish(0, early.c_str(), 40) == CANTT_OK);
+    net.run(20);
+    frames = net.cantt(0).stats().framesSent - frames;
+    misses = net.cantt(1).reassembly().misses - lateMisses;
+    CHECK(misses == frames - 1);
+
+    CHECK(net.publish(0, "b/any/depth", 40) == CANTT_OK);
+    net.run(20);
+
+    CHECK(net.received(1).size() == 2 &&
+          net.received(1)[1].topic == "b/any/depth");
+    CHECK(net.cantt(1).stats().messagesReceived == 2);
+    CHECK(net.cantt(1).reassembly().active() == 0);
+}
+
+int main() {
+    singleLevel();
+    multiLevel();
+    everything();
+    full();
+    onTheBus();
+
+    return testResult("test_subscription");
+}
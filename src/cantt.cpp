@@ -46,10 +46,14 @@ void loop() {
 */
 
 #include "cantt.h"
-#include "Arduino.h"
+#include "cantt_platform.h"
 
 #include <stdio.h>
 
+#ifdef CANTT_HOST
+uint64_t (*cantt_host_clock)() = NULL;
+#endif
+
 /**
     Constructor for the class object.
 
@@ -70,6 +74,10 @@ CANTransport::CANTransport(uint8_t (*canAvailable)(),
     this->canRead = canRead;
     this->canSend = canSend;
     this->canCallback = canCallback;
+    this->canReadBatch = NULL;
+    this->canSendBatch = NULL;
+    this->canFilter = NULL;
+    this->canFilterCount = 0;
 };
 
 /**
@@ -89,11 +97,480 @@ CANTransport::CANTransport(uint8_t (*canAvailable)(),
     this->canRead = canRead;
     this->canSend = canSend;
     this->canCallback = NULL;
+    this->canReadBatch = NULL;
+    this->canSendBatch = NULL;
+    this->canFilter = NULL;
+    this->canFilterCount = 0;
 };
 
 /**
-    Constructor for the class object.
+    Constructor for subclasses that implement available(), receive() and
+    transmit() themselves instead of supplying function pointers.
+*/
+CANTransport::CANTransport() {
+    this->canAvailable = NULL;
+    this->canRead = NULL;
+    this->canSend = NULL;
+    this->canCallback = NULL;
+    this->canReadBatch = NULL;
+    this->canSendBatch = NULL;
+    this->canFilter = NULL;
+    this->canFilterCount = 0;
+};
+
+/**
+    Checks if a frame is waiting to be read
+
+    @return non-zero if a frame is available
+*/
+uint8_t CANTransport::available() {
+    if (this->canAvailable == NULL) {
+        return 0;
+    }
+
+    return this->canAvailable();
+}
+
+/**
+    Reads one frame from the CAN bus
+
+    @param msg the frame to fill in
+    @return error code
+*/
+uint8_t CANTransport::receive(CANMessage &msg) {
+    if (this->canRead == NULL) {
+        return 1;
+    }
+
+    return this->canRead(msg);
+}
+
+/**
+    Sends one frame out on the CAN bus
+
+    @param msg the frame to send
+    @return error code
+*/
+uint8_t CANTransport::transmit(const CANMessage &msg) {
+    if (this->canSend == NULL) {
+        return 1;
+    }
+
+    return this->canSend(msg);
+}
+
+/**
+    Reads as many frames as are available, up to max, from the CAN bus
+
+    @param msgs array of at least max frames to fill in
+    @param max number of frames to read at most
+    @return number of frames read
+*/
+uint8_t CANTransport::readBatch(CANMessage *msgs, uint8_t max) {
+    uint8_t count = 0;
+
+    if (this->canReadBatch != NULL) {
+        return this->canReadBatch(msgs, max);
+    }
+
+    while (count < max && this->available()) {
+        msgs[count].extended = false;
+        msgs[count].rtr = false;
+
+        if (this->receive(msgs[count]) != 0) {
+            break;
+        }
+        count++;
+    }
+
+    return count;
+}
+
+/**
+    Sends frames out on the CAN bus in order, stopping at the first one
+    that can not be sent
+
+    @param msgs the frames to send
+    @param count number of frames
+    @return number of frames sent
+*/
+uint8_t CANTransport::sendBatch(const CANMessage *msgs, uint8_t count) {
+    uint8_t sent = 0;
+
+    if (this->canSendBatch != NULL) {
+        return this->canSendBatch(msgs, count);
+    }
+
+    while (sent < count && this->transmit(msgs[sent]) == 0) {
+        sent++;
+    }
+
+    return sent;
+}
+
+/**
+    Installs functions that move several frames per call, for drivers
+    where each call is expensive (a syscall, a bus transaction)
+
+    @param canReadBatch pointer to function that reads up to max frames and
+   returns the number read, NULL to use canRead
+    @param canSendBatch pointer to function that sends frames in order and
+   returns the number sent, NULL to use canSend
+*/
+void CANTransport::setBatchHooks(uint8_t (*canReadBatch)(CANMessage *,
+                                                         uint8_t),
+                                 uint8_t (*canSendBatch)(const CANMessage *,
+                                                         uint8_t)) {
+    this->canReadBatch = canReadBatch;
+    this->canSendBatch = canSendBatch;
+}
+
+/**
+    Installs a function that programs the acceptance filters of the CAN
+    controller
+
+    @param canFilter pointer to function that sets filter number index to
+   accept frames where (frame id & mask) == id
+    @param count number of independent id/mask filters the controller has
+*/
+void CANTransport::setFilterHook(uint8_t (*canFilter)(uint8_t, uint32_t,
+                                                      uint32_t, bool),
+                                 uint8_t count) {
+    this->canFilter = canFilter;
+    this->canFilterCount = canFilter != NULL ? count : 0;
+}
+
+/**
+    Number of acceptance filters that can be programmed
+
+    @return number of filters, 0 if the controller can not filter
+*/
+uint8_t CANTransport::filters() { return this->canFilterCount; }
+
+/**
+    Programs one acceptance filter
+
+    @param index filter number, below filters()
+    @param id accepted id bits
+    @param mask id bits that have to match
+    @param extended filter 29-bit instead of 11-bit ids
+    @return error code
+*/
+uint8_t CANTransport::setFilter(uint8_t index, uint32_t id, uint32_t mask,
+                                bool extended) {
+    if (this->canFilter == NULL) {
+        return 1;
+    }
+
+    return this->canFilter(index, id, mask, extended);
+}
+
+/**
+    Constructor for the reassembly table.
+*/
+CANTTReassembly::CANTTReassembly() {
+    this->hits = 0;
+    this->misses = 0;
+    this->evictions = 0;
+    this->timeouts = 0;
+
+    this->slots = NULL;
+    this->slotCount = 0;
+    this->clear();
+}
+
+/**
+    Hands the table its slots and the blocks for their buffers
+
+    @param slots array of capacity slots
+    @param capacity number of slots
+    @param blocks blockCount blocks of CANTT_BLOCK_SIZE bytes
+    @param blockMap (blockCount + 7) / 8 bytes for the pool bitmap
+    @param blockCount number of blocks
+*/
+void CANTTReassembly::attach(struct CANTTslot *slots, uint8_t capacity,
+                             uint8_t *blocks, uint8_t *blockMap,
+                             uint16_t blockCount) {
+    this->slots = slots;
+    this->slotCount = capacity;
+
+    for (uint8_t i = 0; i < capacity; i++) {
+        this->slots[i].message = NULL;
+        this->slots[i].blocks = 0;
+    }
+
+    this->blockPool.attach(blocks, blockMap, blockCount);
+    this->clear();
+}
+
+/**
+    Drops every transfer in the table
+*/
+void CANTTReassembly::clear() {
+    for (uint8_t i = 0; i < CANTT_RX_HASH_SIZE; i++) {
+        this->buckets[i] = CANTT_RX_NONE;
+    }
+
+    this->blockPool.clear();
+
+    for (uint8_t i = 0; i < this->slotCount; i++) {
+        this->slots[i].address = 0;
+        this->slots[i].size = 0;
+        this->slots[i].message_pos = 0;
+        this->slots[i].frameCounter = 0;
+        this->slots[i].lastActive = 0;
+        this->slots[i].message = NULL;
+        this->slots[i].blocks = 0;
+        this->slots[i].next = (i + 1 < this->slotCount) ? i + 1 : CANTT_RX_NONE;
+        this->slots[i].newer = CANTT_RX_NONE;
+        this->slots[i].older = CANTT_RX_NONE;
+    }
+
+    this->freeList = this->slotCount > 0 ? 0 : CANTT_RX_NONE;
+    this->newest = CANTT_RX_NONE;
+    this->oldest = CANTT_RX_NONE;
+    this->used = 0;
+}
+
+/**
+    Maps a CAN id onto a bucket
+
+    @param address CAN id of the sender
+    @return bucket index
+*/
+uint8_t CANTTReassembly::hash(uint32_t address) const {
+    // Folds in the sequence number, node and priority of 29-bit ids too
+    return (address ^ (address >> CANTT_EXT_SEQ_SHIFT) ^
+            (address >> CANTT_EXT_NODE_SHIFT) ^
+            (address >> CANTT_EXT_PRIORITY_SHIFT)) &
+           (CANTT_RX_HASH_SIZE - 1);
+}
+
+/**
+    Finds the slot of a sender without touching the counters
+
+    @param address CAN id of the sender
+    @return slot index or CANTT_RX_NONE
+*/
+uint8_t CANTTReassembly::lookup(uint32_t address) const {
+    uint8_t i = this->buckets[this->hash(address)];
+
+    while (i != CANTT_RX_NONE && this->slots[i].address != address) {
+        i = this->slots[i].next;
+    }
+
+    return i;
+}
+
+/**
+    Finds the transfer of a sender
+
+    @param address CAN id of the sender
+    @return the slot or NULL if the sender has no transfer in progress
+*/
+struct CANTTslot *CANTTReassembly::find(uint32_t address) {
+    uint8_t i = this->lookup(address);
+
+    if (i == CANTT_RX_NONE) {
+        this->misses++;
+        return NULL;
+    }
+
+    this->hits++;
+
+    return &this->slots[i];
+}
+
+/**
+    Gets a slot for a new transfer. A sender that restarts reuses its slot,
+    otherwise a free slot is taken or the least recently used transfer is
+    evicted.
+
+    @param address CAN id of the sender
+    @param now current time in ms
+    @return the slot
+*/
+struct CANTTslot *CANTTReassembly::acquire(uint32_t address, uint32_t now) {
+    uint8_t i = this->lookup(address);
+    uint8_t b;
+
+    if (i != CANTT_RX_NONE) {
+        this->touch(&this->slots[i], now);
+        return &this->slots[i];
+    }
+
+    if (this->freeList == CANTT_RX_NONE) {
+        this->evictions++;
+        this->release(&this->slots[this->oldest]);
+    }
+
+    i = this->freeList;
+    this->freeList = this->slots[i].next;
+
+    b = this->hash(address);
+    this->slots[i].address = address;
+    this->slots[i].next = this->buckets[b];
+    this->buckets[b] = i;
+
+    this->slots[i].older = this->newest;
+    this->slots[i].newer = CANTT_RX_NONE;
+    if (this->newest != CANTT_RX_NONE) {
+        this->slots[this->newest].newer = i;
+    } else {
+        this->oldest = i;
+    }
+    this->newest = i;
+
+    this->slots[i].lastActive = now;
+    this->used++;
+
+    return &this->slots[i];
+}
+
+/**
+    Removes a slot from the LRU list
+
+    @param index slot index
+*/
+void CANTTReassembly::unlink(uint8_t index) {
+    struct CANTTslot *slot = &this->slots[index];
+
+    if (slot->newer != CANTT_RX_NONE) {
+        this->slots[slot->newer].older = slot->older;
+    } else {
+        this->newest = slot->older;
+    }
+
+    if (slot->older != CANTT_RX_NONE) {
+        this->slots[slot->older].newer = slot->newer;
+    } else {
+        this->oldest = slot->newer;
+    }
+
+    slot->newer = CANTT_RX_NONE;
+    slot->older = CANTT_RX_NONE;
+}
+
+/**
+    Ends a transfer and returns its slot to the free list
+
+    @param slot the slot to release
+*/
+void CANTTReassembly::release(struct CANTTslot *slot) {
+    uint8_t index = slot - this->slots;
+    uint8_t *link = &this->buckets[this->hash(slot->address)];
+
+    while (*link != index) {
+        link = &this->slots[*link].next;
+    }
+    *link = slot->next;
+
+    this->unlink(index);
+
+    this->blockPool.release(slot->message, slot->blocks);
+    slot->message = NULL;
+    slot->blocks = 0;
+    slot->size = 0;
+    slot->message_pos = 0;
+    slot->frameCounter = 0;
+    slot->next = this->freeList;
+    this->freeList = index;
+    this->used--;
+}
+
+/**
+    Marks a transfer as the most recently active one
+
+    @param slot the slot
+    @param now current time in ms
+*/
+void CANTTReassembly::touch(struct CANTTslot *slot, uint32_t now) {
+    uint8_t index = slot - this->slots;
+
+    slot->lastActive = now;
+
+    if (this->newest == index) {
+        return;
+    }
+
+    this->unlink(index);
 
+    slot->older = this->newest;
+    this->slots[this->newest].newer = index;
+    this->newest = index;
+}
+
+/**
+    Time until the oldest transfer times out
+
+    @param now current time in ms
+    @param timeout maximum time in ms between two frames of a transfer
+    @return time in ms, CANTT_NO_TIMEOUT if there are no transfers
+*/
+uint32_t CANTTReassembly::nextExpiry(uint32_t now, uint32_t timeout) const {
+    uint32_t silent;
+
+    if (this->oldest == CANTT_RX_NONE) {
+        return CANTT_NO_TIMEOUT;
+    }
+
+    silent = now - this->slots[this->oldest].lastActive;
+
+    return silent > timeout ? 0 : timeout - silent + 1;
+}
+
+/**
+    Makes sure the buffer of a transfer can hold a number of bytes, taking
+    more blocks from the pool as the message arrives
+
+    @param slot the slot
+    @param length bytes the buffer has to hold
+    @return false if the pool has no room left
+*/
+bool CANTTReassembly::reserve(struct CANTTslot *slot, uint16_t length) {
+    uint16_t wanted = CANTT_BLOCKS(length);
+    uint8_t *run;
+
+    if (wanted <= slot->blocks) {
+        return true;
+    }
+
+    run = this->blockPool.grow(slot->message, slot->blocks, wanted,
+                               slot->message_pos);
+    if (run == NULL) {
+        return false;
+    }
+
+    slot->message = run;
+    slot->blocks = wanted;
+
+    return true;
+}
+
+/**
+    Drops transfers that have been silent for too long
+
+    @param now current time in ms
+    @param timeout maximum time in ms between two frames of a transfer
+    @return number of dropped transfers
+*/
+uint8_t CANTTReassembly::expire(uint32_t now, uint32_t timeout) {
+    uint8_t count = 0;
+
+    while (this->oldest != CANTT_RX_NONE &&
+           now - this->slots[this->oldest].lastActive > timeout) {
+        this->release(&this->slots[this->oldest]);
+        this->timeouts++;
+        count++;
+    }
+
+    return count;
+}
+
+/**
+    Constructor for the class object, called by BasicCANTT.
+
+    @param memory buffers owned by the BasicCANTT
     @param canAddr CAN bus address/priority
     @param timeout value to configure internal timeouts
     @param CANTransport reference to a CANTransport instance
@@ -101,32 +578,57 @@ CANTransport::CANTransport(uint8_t (*canAvailable)(),
    been received
 */
 
-CANTT::CANTT(uint32_t canAddr, CANTransport &cantr,
-             void (*callback)(uint32_t, uint8_t *, uint16_t, 
-                              uint8_t *, uint16_t)) {
-    this->initialize(canAddr, CANTT_STATE_TIMEOUT, cantr, callback);
+CANTTBase::CANTTBase(const struct CANTTmemory &memory, uint32_t canAddr,
+                     uint32_t timeout, CANTransport &cantr,
+                     void (*callback)(uint32_t, uint8_t *, uint16_t,
+                                      uint8_t *, uint16_t)) {
+    this->initialize(memory, canAddr, timeout, cantr, callback);
 };
 
 /**
-    Constructor for the class object.
+    Constructor for the class object, called by BasicCANTT.
 
+    @param memory buffers owned by the BasicCANTT
     @param canAddr CAN bus address/priority
     @param timeout value to configure internal timeouts
     @param CANTransport reference to a CANTransport instance
     @param callback pointer to callback function once a complete message has
-   been received
+   been received, topic and payload point straight into the receive buffer
+   and are only valid during the call
+*/
+
+CANTTBase::CANTTBase(const struct CANTTmemory &memory, uint32_t canAddr,
+                     uint32_t timeout, CANTransport &cantr,
+                     void (*callback)(uint32_t, CANTTspan, CANTTspan)) {
+    this->initialize(memory, canAddr, timeout, cantr, NULL);
+    this->spanCallback = callback;
+};
+
+/**
+    Constructor for the class object, called by BasicCANTT.
+
+    @param memory buffers owned by the BasicCANTT
+    @param canAddr CAN bus address/priority
+    @param timeout value to configure internal timeouts
+    @param CANTransport reference to a CANTransport instance
+    @param handler pointer to function called with context once a complete
+   message has been received, topic and payload are only valid during the
+   call
+    @param context passed to the handler as is
 */
 
-CANTT::CANTT(uint32_t canAddr, uint32_t timeout,
-             CANTransport &cantr,
-             void (*callback)(uint32_t, uint8_t *, uint16_t, 
-                              uint8_t *, uint16_t)) {
-    this->initialize(canAddr, timeout, cantr, callback);
+CANTTBase::CANTTBase(const struct CANTTmemory &memory, uint32_t canAddr,
+                     uint32_t timeout, CANTransport &cantr,
+                     void (*handler)(void *, uint32_t, CANTTspan, CANTTspan),
+                     void *context) {
+    this->initialize(memory, canAddr, timeout, cantr, NULL);
+    this->setHandler(handler, context);
 };
 
 /**
     Initialises the class object.
 
+    @param memory buffers owned by the BasicCANTT
     @param canAddr CAN bus address/priority
     @param timeout value to configure internal timeouts
     @param canAvailable pointer to function that indicates the availibility of a
@@ -138,538 +640,2420 @@ CANTT::CANTT(uint32_t canAddr, uint32_t timeout,
     @param callback pointer to callback function once a complete message has
    been received
 */
-void CANTT::initialize(uint32_t canAddr, uint32_t timeout,
-                       CANTransport &cantr,
-                       void (*callback)(uint32_t, uint8_t *, uint16_t, 
-                                        uint8_t *, uint16_t)) {
+void CANTTBase::initialize(const struct CANTTmemory &memory, uint32_t canAddr,
+                           uint32_t timeout, CANTransport &cantr,
+                           void (*callback)(uint32_t, uint8_t *, uint16_t, 
+                                            uint8_t *, uint16_t)) {
     this->cantr = &cantr;
     this->callback = callback;
+    this->spanCallback = NULL;
+    this->handler = NULL;
+    this->handlerContext = NULL;
+    this->prefiltered = false;
+    this->acceptCount = 0;
 
     // Device CAN address/priority
     this->canAddr = canAddr;
+    this->extendedIds = false;
 
     // TX Buffer
-    this->tx.address = 0;
-    this->tx.can.id = 0;
-    this->tx.can.extended = false;
-    this->tx.can.rtr = false;
-    memset(this->tx.can.data, 0, CANTT_CAN_DATASIZE);
-    this->tx.size = 0;
-    this->tx.message_pos = 0;
-    memset(this->tx.message, 0, CANTT_MAX_RECV_BUFFER);
-    this->tx.frameCounter = 0;
-
-    // RX Buffer
-    this->rx.address = 0;
-    this->rx.can.id = 0;
-    this->rx.can.extended = false;
-    this->rx.can.rtr = false;
-    memset(this->rx.can.data, 0, CANTT_CAN_DATASIZE);
-    this->rx.size = 0;
-    this->rx.message_pos = 0;
-    memset(this->rx.message, 0, CANTT_MAX_RECV_BUFFER);
-    this->rx.frameCounter = 0;
+    this->txFrame.id = 0;
+    this->txFrame.extended = false;
+    this->txFrame.rtr = false;
+    this->txFrame.len = 0;
+    memset(this->txFrame.data, 0, CANTT_FRAME_DATASIZE);
+    this->frameLength = CANTT_CAN_DATASIZE;
+
+    this->maxMessage = memory.maxMessage;
+
+    // TX Queue
+    this->txQueue = memory.txQueue;
+    this->txQueueSize = memory.txQueueSize;
+    for (uint8_t i = 0; i < this->txQueueSize; i++) {
+        this->txQueue[i].message = memory.txBuffers + i * memory.maxMessage;
+        this->txQueue[i].address = 0;
+        this->txQueue[i].size = 0;
+        this->txQueue[i].message_pos = 0;
+        this->txQueue[i].frameCounter = 0;
+        this->txQueue[i].enqueued = 0;
+        this->txQueue[i].queued = 0;
+        this->txQueue[i].sequence = 0;
+        this->txQueue[i].transfer = CANTT_EXT_SEQ_NONE;
+    }
+    this->txCount = 0;
+    this->txSequence = 0;
+    this->txTransfer = 0;
+    this->txLast = 0;
+    this->tx = &this->txQueue[0];
+
+    this->holdoff = false;
+    this->holdoffAddr = 0;
+    this->holdoffStart = 0;
+    this->holdoffDelay = CANTT_DEFAULT_HOLDOFF_DELAY;
+    this->holdoffLimit = CANTT_DEFAULT_HOLDOFF_LIMIT;
+
+    // No deadlines, strict priority order
+    for (uint8_t i = 0; i < CANTT_PRIORITY_CLASSES; i++) {
+        this->deadlines[i] = 0;
+    }
+
+    // RX Reassembly
+    this->rxTable.attach(memory.rxSlots, memory.rxSlotCount, memory.rxBlocks,
+                         memory.rxBlockMap, memory.rxBlockCount);
+
+    // RX Frame
+    this->rxFrame.id = 0;
+    this->rxFrame.extended = false;
+    this->rxFrame.rtr = false;
+    this->rxFrame.len = 0;
+    memset(this->rxFrame.data, 0, CANTT_FRAME_DATASIZE);
 
     this->wait_time = CANTT_DEFAULT_WAIT_TIME;
-    this->timeOutTimer = millis();
+    this->timeOutTimer = cantt_millis();
     this->timeout = timeout;
 
     this->stateMachine = DISABLED;
 
-    /* Flow Control (not implemented)
-    this->block_size = 0;
-    this->flowExpected = -1; // Never
-    */
+    // One state machine step per loop()
+    this->rxBudget = 0;
+    this->txBudget = 0;
+
+    // Flow control, no pacing asked for nor honoured
+    this->flowBlockSize = 0;
+    this->flowSeparation = 0;
+    this->flowPause = 0;
+    this->flowDue = false;
+    this->flowAnnounced = 0;
+    for (uint8_t i = 0; i < CANTT_MAX_PEERS; i++) {
+        this->peers[i].active = false;
+    }
+    this->paceCount = 0;
+    this->paceLast = 0;
+    this->paceDelay = 0;
+    this->applyPacing();
+
+    this->aliasAnnounced = 0;
+
+    // No coalescing, every publish is a message of its own
+    this->coalesceBytes = 0;
+    this->coalesceTime = 0;
+    this->batch = NULL;
+    this->batchRecords = 0;
+    this->batchOpened = 0;
+
+    // Statistics are kept, but not published
+    this->statsTopic = NULL;
+    this->statsInterval = 0;
+    this->statsPublished = 0;
 }
 
-void CANTT::setAddr(uint32_t addr, bool isExt, bool isRTR) {
-    // FIXME: EXT RTR
-    this->canAddr = addr;
+/**
+    Changes our address, and switches between 11-bit and 29-bit ids.
+
+    With 11-bit ids the id of a message is its priority, and nodes may
+    share it, so a multi-frame message is only started while no other is
+    being received. With 29-bit ids every message goes out as
+    CANTT_EXT_ADDR(priority, node) plus a 4-bit sequence number, which
+    makes each transfer unique on the bus: messages are started while
+    others are being received, and a node can interleave several of its
+    own. Priorities given to publish()/send() stay 11-bit, the node is
+    ours. Receivers hand the address without the sequence number to the
+    callback.
+
+    @param addr 11-bit address, or CANTT_EXT_ADDR(priority, node)
+    @param isExt true for 29-bit ids
+    @param isRTR must be false, CANTT messages need data frames
+    @return error code, -1 for an invalid address, RTR or while messages
+   are queued
+*/
+int CANTTBase::setAddr(uint32_t addr, bool isExt, bool isRTR) {
+    if (isRTR || addr > (isExt ? CANTT_MAX_EXT_ADDR : CANTT_MAX_ADDR) ||
+        this->txCount > 0) {
+        return -1;
+    }
+
+    if (isExt != this->extendedIds) {
+        // Frames of the other format are ignored from now on
+        this->clearRX();
+    }
+
+    this->canAddr = isExt ? addr & CANTT_EXT_ADDR_MASK : addr;
+    this->extendedIds = isExt;
+    this->txFrame.extended = isExt;
+
+    if (this->acceptCount > 0) {
+        // Program the ranges again, for the new id format
+        this->applyFilters();
+    }
+
+    return 0;
 }
 
 /**
-    Sets the state machine into IDLE state
+    Switches the messages we send between classic CAN frames and CAN FD
+    frames of 64 bytes. Received messages are parsed in either format.
+
+    @param enabled true for CAN FD
+    @return error code, -1 if built without CANTT_CANFD or while a message
+   is being sent
 */
-void CANTT::begin() { this->changeState(IDLE); }
+int CANTTBase::setFD(bool enabled) {
+    for (uint8_t i = 0; i < this->txQueueSize; i++) {
+        if (this->txQueue[i].size > 0 && this->txQueue[i].message_pos > 0) {
+            return -1;
+        }
+    }
+
+#ifdef CANTT_CANFD
+    this->frameLength = enabled ? CANTT_CANFD_DATASIZE : CANTT_CAN_DATASIZE;
+
+    return 0;
+#else
+    return enabled ? -1 : 0;
+#endif
+}
 
 /**
-    Empties the RX queue
+    Asks the senders on the bus to pace their frames for us. The values
+    are announced in a FLOWCTRL frame right away and every
+    CANTT_FLOW_INTERVAL ms after that, senders honour the most restrictive
+    announcement they have heard. All zero withdraws the request.
+
+    @param blockSize frames a sender may send back to back, 0 for no limit
+    @param separation minimum time between two frames (STmin), 0x00-0x7F
+   ms or 0xF1-0xF9 for 100-900 us
+    @param pause time in ms a sender waits after blockSize frames
+    @return error code, -1 for a reserved separation value
 */
-void CANTT::clearRX() {
-    memset(this->rx.message, 0, CANTT_MAX_RECV_BUFFER);
-    this->rx.size = 0;
-    this->rx.message_pos = 0;
-    this->rx.address = 0;
-    this->rx.frameCounter = 0;
+int CANTTBase::setPacing(uint8_t blockSize, uint8_t separation,
+                         uint8_t pause) {
+    if (separation > 0x7F && (separation < 0xF1 || separation > 0xF9)) {
+        return -1;
+    }
+
+    this->flowBlockSize = blockSize;
+    this->flowSeparation = separation;
+    this->flowPause = pause;
+    this->flowDue = true;
+
+    return 0;
 }
 
 /**
-    Empties the TX queue
+    Sets the state machine into IDLE state
 */
-void CANTT::clearTX() {
-    memset(this->tx.message, 0, CANTT_MAX_RECV_BUFFER);
-    this->tx.message_pos = 0;
-    this->tx.size = 0;
-    this->tx.address = 0;
-    this->tx.frameCounter = 0;
-};
+void CANTTBase::begin() { this->changeState(IDLE); }
+
+/**
+    Drops every message that is being reassembled
+*/
+void CANTTBase::clearRX() { this->rxTable.clear(); }
 
 /**
-    Positions the TX buffer back to the beginning
+    Removes the message that has just been sent from the TX queue
 */
-void CANTT::rewindTX() {
-    this->tx.message_pos = 0;
-    this->tx.frameCounter = 1;
+void CANTTBase::clearTX() {
+    if (this->tx->size > 0) {
+        this->txCount--;
+
+        this->statistics.messagesSent++;
+        CANTTStats::record(this->statistics.send,
+                           cantt_micros() - this->tx->queued);
+
+        if (this->tx->message[0] == CANTT_MSG_ALIAS) {
+            // Receivers know the alias now, publish() may use it
+            struct CANTTalias *alias = this->txAliases.lookup(
+                this->tx->address, &this->tx->message[3], this->tx->size - 3);
+
+            if (alias != NULL) {
+                alias->flags |= CANTT_ALIAS_ANNOUNCED;
+            }
+        }
+    }
+
+    this->tx->message_pos = 0;
+    this->tx->size = 0;
+    this->tx->address = 0;
+    this->tx->frameCounter = 0;
 };
 
 /**
-    Anything in the RX (receive) buffer
-*/
-bool CANTT::inReception() { return this->rx.size > 0; }
+    Sets the maximum time a message of a priority class may wait in the
+    TX queue. Once a message is overdue it is sent ahead of any message
+    with a lower CAN id, and no longer held off for other senders, so bulk
+    traffic cannot be starved forever.
+
+    @param priorityClass CAN id >> CANTT_PRIORITY_CLASS_SHIFT
+    @param deadline time in ms, 0 to disable
+*/
+void CANTTBase::setDeadline(uint8_t priorityClass, uint16_t deadline) {
+    if (priorityClass < CANTT_PRIORITY_CLASSES) {
+        this->deadlines[priorityClass] = deadline;
+    }
+}
+
+/**
+    Sets how long frames of a more important sender keep our messages
+    back. A message is not started until such a sender has been quiet for
+    delay ms, unless it has been queued for limit ms already, so a sender
+    that never pauses can not starve us. Messages already started always
+    continue.
+
+    @param delay time in ms, 0 to never hold off
+    @param limit time in ms, 0 to hold off for as long as the sender talks
+*/
+void CANTTBase::setHoldoff(uint16_t delay, uint16_t limit) {
+    this->holdoffDelay = delay;
+    this->holdoffLimit = limit;
+    if (delay == 0) {
+        this->holdoff = false;
+    }
+}
+
+/**
+    Number of ids accepted by an id/mask filter
+
+    @param mask id bits that have to match
+    @param bits id width
+    @return number of ids, as a power of two
+*/
+static uint8_t filterBits(uint32_t mask, uint8_t bits) {
+    uint8_t free = bits;
+
+    for (; mask != 0; mask &= mask - 1) {
+        free--;
+    }
+
+    return free;
+}
+
+/**
+    Adds an id/mask filter to a set, merging the two filters whose merge
+    accepts the fewest extra ids whenever the set is over its size
+
+    @param ids filter ids
+    @param masks filter masks
+    @param count filters in the set
+    @param max size of the set
+    @param bits id width
+    @param id id of the new filter
+    @param mask mask of the new filter
+*/
+static void addFilter(uint32_t *ids, uint32_t *masks, uint8_t *count,
+                      uint8_t max, uint8_t bits, uint32_t id, uint32_t mask) {
+    uint8_t bestA = 0;
+    uint8_t bestB = 0;
+    uint32_t bestCost = 0xFFFFFFFF;
+
+    ids[*count] = id;
+    masks[*count] = mask;
+    (*count)++;
+
+    if (*count <= max) {
+        return;
+    }
+
+    for (uint8_t a = 0; a < *count; a++) {
+        for (uint8_t b = a + 1; b < *count; b++) {
+            uint32_t m = masks[a] & masks[b] & ~(ids[a] ^ ids[b]);
+            uint32_t merged = 1UL << filterBits(m, bits);
+            uint32_t covered = (1UL << filterBits(masks[a], bits)) +
+                               (1UL << filterBits(masks[b], bits));
+
+            // Extra ids let through by the merge, overlapping filters are free
+            uint32_t cost = merged > covered ? merged - covered : 0;
+
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestA = a;
+                bestB = b;
+            }
+        }
+    }
+
+    masks[bestA] = masks[bestA] & masks[bestB] & ~(ids[bestA] ^ ids[bestB]);
+    ids[bestA] &= masks[bestA];
+
+    (*count)--;
+    ids[bestB] = ids[*count];
+    masks[bestB] = masks[*count];
+}
+
+/**
+    Accepts frames from a range of sender addresses (priority band). Once
+    at least one range is declared, the CAN controller is programmed to
+    drop every other frame in hardware, as far as its filters allow.
+    Frames of more important senders are no longer seen, so they can not
+    hold off our own transmissions. With 29-bit ids the range is one of
+    priorities, from any node.
+
+    @param first lowest address (priority) of the range
+    @param last highest address (priority) of the range
+    @return number of filters programmed, -1 on error
+*/
+int CANTTBase::acceptRange(uint32_t first, uint32_t last) {
+    if (first > last || last > CANTT_MAX_ADDR ||
+        this->acceptCount >= CANTT_MAX_ACCEPT_RANGES) {
+        return -1;
+    }
+
+    this->acceptRanges[this->acceptCount].first = first;
+    this->acceptRanges[this->acceptCount].last = last;
+    this->acceptCount++;
+
+    return this->applyFilters();
+}
+
+/**
+    Removes all address ranges, every frame is accepted again
+
+    @return number of filters programmed, -1 on error
+*/
+int CANTTBase::acceptAll() {
+    this->acceptCount = 0;
+
+    return this->applyFilters();
+}
+
+/**
+    Computes the smallest set of id/mask filters that covers the declared
+    address ranges and programs the CAN controller with it. Each range is
+    split into aligned power-of-two blocks, then the blocks are merged
+    until they fit in the filters the controller has.
+
+    @return number of filters programmed, -1 on error
+*/
+int CANTTBase::applyFilters() {
+    uint32_t ids[CANTT_MAX_HW_FILTERS + 1];
+    uint32_t masks[CANTT_MAX_HW_FILTERS + 1];
+    uint8_t count = 0;
+    uint8_t max = this->cantr->filters();
+    uint8_t bits = 11;
+    uint32_t full = CANTT_MAX_ADDR;
+    uint8_t shift = this->extendedIds ? CANTT_EXT_PRIORITY_SHIFT : 0;
+
+    if (max == 0) {
+        return -1;
+    }
+
+    if (max > CANTT_MAX_HW_FILTERS) {
+        max = CANTT_MAX_HW_FILTERS;
+    }
+
+    if (this->acceptCount == 0) {
+        // Accept everything
+        ids[0] = 0;
+        masks[0] = 0;
+        count = 1;
+    }
+
+    for (uint8_t r = 0; r < this->acceptCount; r++) {
+        uint32_t id = this->acceptRanges[r].first;
+        uint32_t last = this->acceptRanges[r].last;
+
+        for (;;) {
+            uint8_t size = 0;
+
+            // Largest aligned block starting at id that stays in range
+            while (size < bits && (id & (1UL << size)) == 0 &&
+                   id + (1UL << (size + 1)) - 1 <= last) {
+                size++;
+            }
+
+            addFilter(ids, masks, &count, max, bits, id,
+                      full & ~((1UL << size) - 1));
+
+            if (id + (1UL << size) - 1 >= last) {
+                break;
+            }
+            id += 1UL << size;
+        }
+    }
+
+    // Unused filters repeat the first, an unset filter would accept all
+    for (uint8_t i = 0; i < max; i++) {
+        uint8_t f = i < count ? i : 0;
+
+        if (this->cantr->setFilter(i, ids[f] << shift, masks[f] << shift,
+                                   this->extendedIds) != 0) {
+            return -1;
+        }
+    }
+
+    return count;
+}
+
+/**
+    Subscribes to a topic filter. Once there is at least one subscription,
+    messages on other topics are dropped as soon as the First frame, or
+    the first frames, show that their topic can not match.
+
+    @param filter topic filter, '+' matches one level and a trailing '#'
+   any number of levels
+    @return 0 on success, -1 if the filter is invalid or does not fit, or
+   if built without CANTT_SUBSCRIPTIONS
+*/
+int CANTTBase::subscribe(const char *filter) {
+    this->rxAliases.invalidate();
+
+    return this->subscriptions.subscribe(filter);
+}
+
+/**
+    Removes a subscription
+
+    @param filter the filter as given to subscribe()
+    @return 0 on success, -1 if there was no such subscription
+*/
+int CANTTBase::unsubscribe(const char *filter) {
+    this->rxAliases.invalidate();
+
+    return this->subscriptions.unsubscribe(filter);
+}
+
+/**
+    Removes every subscription, all topics are received again
+*/
+void CANTTBase::unsubscribeAll() {
+    this->rxAliases.invalidate();
+    this->subscriptions.clear();
+}
+
+/**
+    Gives a topic we publish on our own address an alias
+
+    @param topic the topic
+    @return error code, see addAlias(priority, topic, topic_len)
+*/
+int CANTTBase::addAlias(char *topic) {
+    return this->addAlias(this->ownPriority(), (uint8_t *)topic,
+                          strlen(topic));
+}
+
+/**
+    Gives a topic an alias, so that publish() sends a 16-bit alias instead
+    of the topic. The alias is announced through the TX queue and used
+    once the announcement is on the bus; it is announced again every
+    CANTT_ALIAS_INTERVAL ms for nodes that join later.
+
+    @param priority address/priority the topic is published with, aliases
+   belong to a CAN id
+    @param topic the topic
+    @param topic_len the length of the topic
+    @return error code, -1 if the topic is longer than
+   CANTT_ALIAS_TOPIC_SIZE, if CANTT_MAX_ALIASES topics have an alias or if
+   built without CANTT_ALIASES
+*/
+int CANTTBase::addAlias(uint32_t priority, uint8_t *topic,
+                        uint16_t topic_len) {
+    // HDR byte + alias, then the topic
+    if ((uint32_t)topic_len + 3 > this->maxMessage ||
+        this->txAliases.add(priority, topic, topic_len) == NULL) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+    Forgets the aliases of our topics, publish() sends the topics again
+*/
+void CANTTBase::clearAliases() { this->txAliases.clear(); }
+
+/**
+    Lets publish() pack small messages into one MULTI message. A batch is
+    sent once it holds bytes bytes or ms after its first message, whichever
+    comes first; a batch of one message goes out as a plain message.
+
+    @param bytes size of a batch, up to the largest message, 0 to disable
+    @param ms longest time a message waits in a batch
+*/
+void CANTTBase::setCoalescing(uint16_t bytes, uint16_t ms) {
+    if (bytes > this->maxMessage) {
+        bytes = this->maxMessage;
+    }
+
+    this->closeBatch();
+    this->coalesceBytes = bytes;
+    this->coalesceTime = ms;
+}
+
+/**
+    Makes room for a message in the open batch, opening a batch if there
+    is none. The record length is filled in, the message is up to the
+    caller.
+
+    @param priority address/priority of the message
+    @param length length of the message
+    @return where to build the message, NULL to send it on its own
+*/
+uint8_t *CANTTBase::coalesce(uint32_t priority, uint16_t length) {
+    struct CANTTbuf *entry;
+    uint8_t *record;
+
+    // HDR byte + uint16_t record length + message
+    if (this->coalesceBytes == 0 || 3 + length > this->coalesceBytes) {
+        return NULL;
+    }
+
+    if (this->batch != NULL &&
+        (this->batch->address != priority ||
+         this->batch->size + 2 + length > this->coalesceBytes)) {
+        this->closeBatch();
+    }
+
+    if (this->batch == NULL) {
+        if (this->reserve(priority, 1, &entry) != CANTT_OK) {
+            return NULL;
+        }
+
+        entry->message[0] = CANTT_MSG_MULTI;
+        this->batch = entry;
+        this->batchRecords = 0;
+        this->batchOpened = cantt_millis();
+    }
+
+    record = &this->batch->message[this->batch->size];
+    record[0] = (length & 0xFF);
+    record[1] = (length >> 8);
+    this->batch->size += 2 + length;
+    this->batchRecords++;
+
+    return &record[2];
+}
+
+/**
+    Hands the open batch to the TX queue
+*/
+void CANTTBase::closeBatch() {
+    struct CANTTbuf *entry = this->batch;
+
+    if (entry == NULL) {
+        return;
+    }
+
+    if (this->batchRecords == 1) {
+        // Not worth the MULTI header, send the message as it is
+        entry->size -= 3;
+        memmove(entry->message, &entry->message[3], entry->size);
+    }
+
+    this->batch = NULL;
+}
+
+/**
+    Closes the open batch when its time is up or the smallest message no
+    longer fits
+
+    @param now time in ms
+*/
+void CANTTBase::updateBatch(uint32_t now) {
+    if (this->batch == NULL) {
+        return;
+    }
+
+    // uint16_t record length + PUBLISH_ALIAS without payload
+    if (now - this->batchOpened >= this->coalesceTime ||
+        this->batch->size + 2 + 3 > this->coalesceBytes) {
+        this->closeBatch();
+    }
+}
+
+/**
+    Queues the announcements of our aliases that are due
+
+    @param now time in ms
+*/
+void CANTTBase::updateAliases(uint32_t now) {
+    struct CANTTalias *alias;
+    struct CANTTbuf *entry;
+    uint8_t i;
+
+    if (this->txAliases.count() == 0) {
+        return;
+    }
+
+    if (now - this->aliasAnnounced >= CANTT_ALIAS_INTERVAL) {
+        for (i = 0; i < CANTT_MAX_ALIASES; i++) {
+            alias = this->txAliases.entry(i);
+            if (alias != NULL) {
+                alias->flags |= CANTT_ALIAS_DUE;
+            }
+        }
+        this->aliasAnnounced = now;
+    }
+
+    for (i = 0; i < CANTT_MAX_ALIASES; i++) {
+        alias = this->txAliases.entry(i);
+        if (alias == NULL || !(alias->flags & CANTT_ALIAS_DUE)) {
+            continue;
+        }
+
+        if (this->reserve(alias->address, 3 + alias->topicLen, &entry) !=
+            CANTT_OK) {
+            return; // The queue is full, try again next loop()
+        }
+
+        entry->message[0] = CANTT_MSG_ALIAS;
+        entry->message[1] = (alias->alias & 0xFF);
+        entry->message[2] = (alias->alias >> 8);
+        memcpy(&entry->message[3], alias->topic, alias->topicLen);
+
+        alias->flags &= ~CANTT_ALIAS_DUE;
+    }
+}
+
+/**
+    Matches the topic of an alias against the subscriptions, once
+
+    @param alias an alias announced by another node
+    @return CANTT_MATCH_ACCEPT or CANTT_MATCH_REJECT
+*/
+uint8_t CANTTBase::aliasMatch(struct CANTTalias *alias) {
+    if (alias->match == CANTT_MATCH_PENDING) {
+        alias->match = this->subscriptions.matches(alias->topic,
+                                                   alias->topicLen)
+                           ? CANTT_MATCH_ACCEPT
+                           : CANTT_MATCH_REJECT;
+    }
+
+    return alias->match;
+}
+
+/**
+    Sets every counter and histogram of stats() back to zero
+*/
+void CANTTBase::resetStats() { this->statistics.clear(); }
+
+/**
+    Publishes a snapshot of stats() every interval ms, see
+    CANTTStats::encode() for its layout. The snapshot goes through the TX
+    queue with our CAN id; when the queue is full it is tried again at the
+    next loop().
+
+    The message takes CANTT_STATS_SIZE + 5 bytes plus the topic, more than
+    the 64 bytes of CANTT: use a BasicCANTT with a larger MaxMessage, such
+    as BasicCANTT<128, 4, 4>.
+
+    @param topic the topic, kept as a pointer so it must stay valid. NULL
+   stops publishing.
+    @param interval time in ms between two snapshots
+    @return error code, -1 if the snapshot and topic do not fit in a
+   message
+*/
+int CANTTBase::setStatsPublish(const char *topic, uint16_t interval) {
+    if (topic == NULL || interval == 0) {
+        this->statsTopic = NULL;
+        return 0;
+    }
+
+    // HDR byte + topic length + payload length, the topic and the snapshot
+    if (5 + strlen(topic) + CANTT_STATS_SIZE > this->maxMessage) {
+        return -1;
+    }
+
+    this->statsTopic = topic;
+    this->statsInterval = interval;
+    this->statsPublished = cantt_millis();
+
+    return 0;
+}
+
+/**
+    Queues the snapshot of the statistics once it is due
+
+    @param now current time in ms
+*/
+void CANTTBase::updateStats(uint32_t now) {
+    uint8_t snapshot[CANTT_STATS_SIZE];
+    uint16_t len;
+
+    if (this->statsTopic == NULL ||
+        now - this->statsPublished < this->statsInterval) {
+        return;
+    }
+
+    len = this->statistics.encode(snapshot, sizeof(snapshot));
+
+    if (this->publish(this->ownPriority(), (uint8_t *)this->statsTopic,
+                      strlen(this->statsTopic), snapshot,
+                      len) == CANTT_ERR_QUEUE_FULL) {
+        return; // Try again next loop()
+    }
+
+    this->statsPublished = now;
+}
+
+/**
+    Picks the next message to put a frame of on the bus: the overdue
+    message with the earliest deadline, otherwise the one with the lowest
+    CAN id, oldest first.
+
+    A message is not started while we are receiving a multi-frame message,
+    nor while another message with the same CAN id is partly sent, as
+    receivers could not tell their frames apart. With 29-bit ids the node
+    tells senders apart, and receptions no longer hold messages back.
+    Messages less important than a sender we are holding off for are not
+    started either, see heldOff(). Messages already started always
+    continue: receivers reassemble per sender, and a transfer stopped
+    halfway would only keep their slots busy until it times out.
+
+    @return true if a message was selected into tx
+*/
+bool CANTTBase::selectTX() {
+    struct CANTTbuf *best = NULL;
+    uint32_t bestDue = 0;
+    uint32_t now = cantt_millis();
+    bool receiving = !this->extendedIds && this->inReception();
+
+    // Slow receivers on the bus asked us to wait
+    if (this->paceWait() > 0) {
+        return false;
+    }
+
+    if (this->holdoff && now - this->holdoffStart >= this->holdoffDelay) {
+        this->holdoff = false;
+    }
+
+    for (uint8_t i = 0; i < this->txQueueSize; i++) {
+        struct CANTTbuf *e = &this->txQueue[i];
+        uint16_t deadline;
+        uint32_t due = 0;
+
+        if (e->size == 0 || e == this->batch) {
+            continue;
+        }
+
+        if (this->heldOff(e, now)) {
+            // A more important sender is active
+            continue;
+        }
+
+        if (e->message_pos == 0) {
+            bool busy = receiving;
+
+            for (uint8_t j = 0; j < this->txQueueSize; j++) {
+                if (j != i && this->txQueue[j].size > 0 &&
+                    this->txQueue[j].message_pos > 0 &&
+                    this->txQueue[j].address == e->address) {
+                    busy = true;
+                    break;
+                }
+            }
+
+            if (busy) {
+                continue;
+            }
+        }
+
+        deadline = this->deadlineOf(e);
+        if (deadline > 0 && now - e->enqueued >= deadline) {
+            // Overdue, remember how long ago it was due (+1 so 0 means not due)
+            due = now - e->enqueued - deadline + 1;
+        }
+
+        if (best == NULL) {
+            best = e;
+            bestDue = due;
+        } else if (due > 0 || bestDue > 0) {
+            // Overdue beats on time, then the one that was due first
+            if (due > bestDue) {
+                best = e;
+                bestDue = due;
+            }
+        } else if (e->address < best->address ||
+                   (e->address == best->address &&
+                    (int16_t)(e->sequence - best->sequence) < 0)) {
+            best = e;
+            bestDue = due;
+        }
+    }
+
+    if (best == NULL) {
+        return false;
+    }
+
+    this->tx = best;
+
+    return true;
+}
+
+/**
+    Deadline of the priority class of a message, see setDeadline()
+
+    @param entry the message
+    @return time in ms, 0 for none
+*/
+uint16_t CANTTBase::deadlineOf(const struct CANTTbuf *entry) {
+    uint32_t cls = entry->address >> CANTT_PRIORITY_CLASS_SHIFT;
+
+    if (cls >= CANTT_PRIORITY_CLASSES) {
+        cls = CANTT_PRIORITY_CLASSES - 1;
+    }
+
+    return this->deadlines[cls];
+}
+
+/**
+    Time a message may be held off for since it was queued: the holdoff
+    limit, or the deadline of its class if that comes first
+
+    @param entry the message
+    @return time in ms, 0 for as long as the holdoff lasts
+*/
+uint32_t CANTTBase::holdoffRelease(const struct CANTTbuf *entry) {
+    uint16_t deadline = this->deadlineOf(entry);
+
+    if (deadline > 0 &&
+        (this->holdoffLimit == 0 || deadline < this->holdoffLimit)) {
+        return deadline;
+    }
+
+    return this->holdoffLimit;
+}
+
+/**
+    Checks whether the holdoff keeps a message back: it has not been
+    started, is less important than the sender we hold off for and is
+    neither overdue nor past the holdoff limit
+
+    @param entry the message
+    @param now time in ms
+    @return true if the message may not be started
+*/
+bool CANTTBase::heldOff(const struct CANTTbuf *entry, uint32_t now) {
+    uint32_t release = this->holdoffRelease(entry);
+
+    return this->holdoff && entry->message_pos == 0 &&
+           entry->address > this->holdoffAddr &&
+           (release == 0 || now - entry->enqueued < release);
+}
+
+/**
+    Time until the holdoff no longer keeps any of the queued messages back,
+    because it ends or a message reaches the holdoff limit or its deadline
+
+    @param now time in ms
+    @return time in ms, CANTT_NO_TIMEOUT if no message is held off
+*/
+uint32_t CANTTBase::holdoffWait(uint32_t now) {
+    uint32_t held = now - this->holdoffStart;
+    uint32_t wait;
+
+    if (!this->holdoff || !this->hasOutgoingMessage()) {
+        return CANTT_NO_TIMEOUT;
+    }
+
+    wait = held >= this->holdoffDelay ? 0 : this->holdoffDelay - held;
+
+    for (uint8_t i = 0; i < this->txQueueSize && wait > 0; i++) {
+        const struct CANTTbuf *e = &this->txQueue[i];
+
+        uint32_t release = this->holdoffRelease(e);
+
+        if (e->size > 0 && this->heldOff(e, now) && release > 0 &&
+            release - (now - e->enqueued) < wait) {
+            wait = release - (now - e->enqueued);
+        }
+    }
+
+    return wait;
+}
+
+/**
+    Priority of the messages we send without one given
+
+    @return our address, or its priority with 29-bit ids
+*/
+uint32_t CANTTBase::ownPriority() {
+    return this->extendedIds ? CANTT_EXT_PRIORITY(this->canAddr)
+                             : this->canAddr;
+}
+
+/**
+    CAN id of the frames of a message
+
+    @param entry the message
+    @return its priority, or with 29-bit ids the priority, our node and
+   the sequence number of the message
+*/
+uint32_t CANTTBase::frameId(const struct CANTTbuf *entry) {
+    if (!this->extendedIds) {
+        return entry->address;
+    }
+
+    return CANTT_EXT_ADDR(entry->address, CANTT_EXT_NODE(this->canAddr)) |
+           ((uint32_t)(entry->transfer & 0x0F) << CANTT_EXT_SEQ_SHIFT);
+}
+
+/**
+    Gives the selected message the sequence number of its transfer, before
+    its first frame.
+
+    The number does not have to tell our concurrent transfers apart: they
+    differ in priority, as selectTX() never starts a message while another
+    one with the same priority is partly sent. It separates consecutive
+    transfers of one priority, whose frames can both wait in the
+    controller, and it must never make the id of a new transfer lower
+    than that of an older one. A controller sends its lowest id first, so
+    the new transfer would overtake the last frames of the older one, and
+    every transfer after it would too until the queue runs dry, which
+    lost messages on a loaded simulated bus. Numbers therefore go up while
+    frames keep going out and stay at 15, where consecutive transfers
+    share an id as they do with 11-bit ids, still in order. After
+    CANTT_EXT_SEQ_RESTART ms without a frame sent, the controller is empty
+    and numbering starts over.
+*/
+void CANTTBase::numberTX() {
+    if (!this->extendedIds || this->tx->transfer != CANTT_EXT_SEQ_NONE) {
+        return;
+    }
+
+    if (cantt_millis() - this->txLast >= CANTT_EXT_SEQ_RESTART) {
+        this->txTransfer = 0;
+    }
+
+    this->tx->transfer = this->txTransfer;
+    if (this->txTransfer < 0x0F) {
+        this->txTransfer++;
+    }
+}
+
+/**
+    Address of the sender of a frame, as handed to the callback
+
+    @param id CAN id of the frame
+    @return the id, without the sequence number with 29-bit ids
+*/
+uint32_t CANTTBase::sender(uint32_t id) {
+    return this->extendedIds ? id & CANTT_EXT_ADDR_MASK : id;
+}
+
+/**
+    Checks whether the frame in rxFrame is not one of ours to parse: a
+    remote frame, or an id of the format we do not use
+
+    @return true to ignore the frame
+*/
+bool CANTTBase::foreign() {
+    return this->rxFrame.rtr || this->rxFrame.extended != this->extendedIds;
+}
+
+/**
+    Any multi-frame message being reassembled
+*/
+bool CANTTBase::inReception() { return this->rxTable.active() > 0; }
+
+/**
+    Is the TX (transmission) buffer beeing sent
+*/
+bool CANTTBase::inTransmission() { return this->tx->message_pos > 0; }
+
+/**
+    Anything in the TX (transmission) queue
+*/
+bool CANTTBase::hasOutgoingMessage() { return this->txCount > 0; }
+
+/**
+    Number of messages waiting in the TX queue, including the one
+    being sent
+
+    @return number of queued messages
+*/
+uint8_t CANTTBase::pending() { return this->txCount; }
+
+/**
+    Switches the state machine to another state
+
+    @param the new state for the machine
+*/
+void CANTTBase::changeState(enum state_m s) {
+    this->stateMachine = s;
+
+    if (this->stateMachine == IDLE) {
+        this->timeOutTimer = 0;
+    } else {
+        this->timeOutTimer = cantt_millis();
+    }
+}
+
+/**
+    Waits in a loop for the state machine to return to IDLE state
+    while still running the internal loop.
+
+    @return error code
+*/
+int CANTTBase::waitUntilIdle() {
+    uint32_t now = cantt_millis();
+
+    // Busy block until any operation is done and the output buffer is available
+    while (this->stateMachine != IDLE) {
+        // Bail after TIMEOUT time
+        if (now + CANTT_SEND_TIMEOUT < cantt_millis() ||
+            cantt_millis() < now /* fail if millis wraps around to 0 */) {
+            return -1;
+        }
+
+        this->loop();
+    }
+
+    return 0;
+}
+
+/**
+    Parses a SINGLE_FRAME message and calls the callback function
+*/
+void CANTTBase::parseSingle() {
+    uint8_t frameSize = this->rxFrame.data[0] & CANTT_SINGLE_SIZE_MASK;
+    uint8_t offset = 1;
+    bool valid;
+
+    if (frameSize == 0 && this->rxFrame.len > CANTT_CAN_DATASIZE) {
+        // CAN FD, the size follows in the next byte
+        frameSize = this->rxFrame.data[1];
+        offset = 2;
+        valid = frameSize > 7 && frameSize <= this->rxFrame.len - 2;
+    } else {
+        // Ensure that the frame has the correct size
+        valid = frameSize == this->rxFrame.len - 1 && frameSize > 0 &&
+                frameSize < 8;
+    }
+
+    if (valid) {
+        this->statistics.messagesReceived++;
+
+        if(this->cantr->canCallback != NULL) {
+            // Use the data directly from the can buffer, no need to use the message
+            // buffer
+            this->cantr->canCallback(this->sender(this->rxFrame.id),
+                                     &this->rxFrame.data[offset], frameSize);
+        }
+
+        this->decode(this->sender(this->rxFrame.id),
+                     &this->rxFrame.data[offset], frameSize);
+    }
+}
+
+/**
+    Parses the FIRST_FRAME in a long message and opens a transfer for
+    its sender
+*/
+void CANTTBase::parseFirst() {
+    struct CANTTslot *slot;
+    uint16_t frameSize =
+        ((this->rxFrame.data[0] & CANTT_SINGLE_SIZE_MASK) << 8) |
+        this->rxFrame.data[1];
+
+    // A CAN FD sender fills its First frame, which tells the frame size
+    // it uses for the rest of the message
+    uint8_t chunk = this->rxFrame.len - 2;
+
+    if (frameSize < 8 || frameSize > this->maxMessage ||
+        this->rxFrame.len < CANTT_CAN_DATASIZE || frameSize <= chunk) {
+        if (frameSize > this->maxMessage) {
+            this->statistics.rejected++;
+        }
+
+        // Too large for us, drop whatever this sender had in progress
+        slot = this->rxTable.find(this->rxFrame.id);
+        if (slot != NULL) {
+            this->rxTable.release(slot);
+        }
+        return;
+    }
+
+    slot = this->rxTable.acquire(this->rxFrame.id, cantt_millis());
+    slot->size = frameSize;
+    slot->message_pos = 0;
+    slot->started = cantt_micros();
+
+    if (!this->rxTable.reserve(slot, chunk)) {
+        this->rxTable.release(slot);
+        return;
+    }
+
+    memcpy(slot->message, &this->rxFrame.data[2],
+           chunk); // All of the remaining data in this frame
+    slot->message_pos = chunk;
+    slot->frameCounter = 1;
+    slot->chunk = chunk + 1;
+
+    if (slot->message[0] == CANTT_MSG_PUBLISH) {
+        this->subscriptions.begin(slot->match);
+    } else if (slot->message[0] == CANTT_MSG_PUBLISH_ALIAS) {
+        // The topic is known already, or the message can not be delivered
+        struct CANTTalias *alias =
+            this->rxAliases.find(this->sender(this->rxFrame.id),
+                                 slot->message[1] | slot->message[2] << 8);
+
+        slot->match.state =
+            alias == NULL ? CANTT_MATCH_REJECT : this->aliasMatch(alias);
+    } else {
+        slot->match.state = CANTT_MATCH_ACCEPT;
+    }
+
+    if (!this->filterTopic(slot, 0)) {
+        // Nobody here wants this topic, skip the rest of the message
+        this->rxTable.release(slot);
+    }
+}
+
+/**
+    Runs the subscription filter over the topic bytes that just arrived
+    in a transfer
+
+    @param slot the transfer
+    @param from offset in the message of the first new byte
+    @return false if the message does not match any subscription
+*/
+bool CANTTBase::filterTopic(struct CANTTslot *slot, uint16_t from) {
+    uint16_t topicEnd;
+    uint16_t to;
+
+    if (slot->match.state != CANTT_MATCH_PENDING) {
+        return slot->match.state == CANTT_MATCH_ACCEPT;
+    }
+
+    // HDR byte + topic length, then the topic
+    topicEnd = 3 + (slot->message[1] | slot->message[2] << 8);
+
+    if (from < 3) {
+        from = 3;
+    }
+    to = slot->message_pos < topicEnd ? slot->message_pos : topicEnd;
+
+    if (to > from) {
+        this->subscriptions.feed(slot->match, &slot->message[from], to - from);
+    }
+
+    if (slot->message_pos >= topicEnd) {
+        this->subscriptions.finish(slot->match);
+    }
+
+    return slot->match.state != CANTT_MATCH_REJECT;
+}
+
+/**
+    Parses the CONSECUTIVE_FRAME(s) in a long message
+    executes callback once the message is complete
+
+    @param slot the transfer this frame belongs to
+    @return remaining length of message
+*/
+int CANTTBase::parseConsecutive(struct CANTTslot *slot) {
+    uint16_t remaining = slot->size - slot->message_pos;
+    uint8_t frameIndex = this->rxFrame.data[0] & CANTT_CONSECUTIVE_INDEX_MASK;
+    uint8_t chunk = slot->chunk;
+
+    if (frameIndex != (slot->frameCounter & CANTT_CONSECUTIVE_INDEX_MASK) ||
+        this->rxFrame.len < 1 + (remaining > chunk ? chunk : remaining)) {
+        // A frame went missing, the message can not be completed
+        this->rxTable.release(slot);
+        return 0;
+    }
+
+    if (!this->rxTable.reserve(slot, slot->message_pos + (remaining > chunk
+                                                              ? chunk
+                                                              : remaining))) {
+        // Out of blocks, drop this transfer rather than stall the others
+        this->rxTable.release(slot);
+        return 0;
+    }
+
+    if (remaining > chunk) {
+        // not the last frame
+        memcpy(&slot->message[slot->message_pos], &this->rxFrame.data[1],
+               chunk);
+        slot->message_pos += chunk;
+        slot->frameCounter++;
+
+        if (!this->filterTopic(slot, slot->message_pos - chunk)) {
+            this->rxTable.release(slot);
+            return 0;
+        }
+
+        this->rxTable.touch(slot, cantt_millis());
+
+        return slot->size - slot->message_pos;
+    }
+
+    // this (should be) the last frame
+    memcpy(&slot->message[slot->message_pos], &this->rxFrame.data[1],
+           remaining);
+    slot->message_pos = slot->size;
+
+    this->statistics.messagesReceived++;
+    CANTTStats::record(this->statistics.reassembly,
+                       cantt_micros() - slot->started);
+
+    if(this->cantr->canCallback != NULL) {
+        this->cantr->canCallback(this->sender(slot->address), slot->message,
+                                 slot->size);
+    }
+
+    if (this->filterTopic(slot, slot->size - remaining)) {
+        this->prefiltered = true;
+        this->decode(this->sender(slot->address), slot->message, slot->size);
+        this->prefiltered = false;
+    }
+
+    this->rxTable.release(slot);
+
+    return 0;
+}
+
+/**
+    Rounds a CAN FD frame length up to one a DLC can express
+
+    @param len bytes of data
+    @return length of the frame, padded with zeros
+*/
+static uint8_t padLength(uint8_t len) {
+    if (len <= CANTT_CAN_DATASIZE) {
+        return len;
+    } else if (len <= 24) {
+        return (len + 3) & ~3; // 12, 16, 20, 24
+    } else if (len <= 32) {
+        return 32;
+    } else if (len <= 48) {
+        return 48;
+    }
+
+    return CANTT_CANFD_DATASIZE;
+}
+
+/**
+    Builds the next frame of a message without sending it, the extended
+    and RTR flags of the frame are left as they are
+
+    @param entry the message
+    @param pos bytes of the message already sent
+    @param counter frames of the message already sent
+    @param frame the frame to fill in
+    @return number of message bytes carried by the frame
+*/
+uint8_t CANTTBase::buildFrame(const struct CANTTbuf *entry, uint16_t pos,
+                              uint16_t counter, struct CANMessage &frame) {
+    uint8_t dl = this->frameLength;
+    uint8_t length;
+
+    memset(frame.data, 0, dl);
+    frame.id = this->frameId(entry);
+
+    if (entry->size <= 7) {
+        frame.data[0] = (CANTT_SINGLE_FRAME << 4) | entry->size;
+        memcpy(&frame.data[1], entry->message, entry->size);
+        frame.len = 1 + entry->size;
+
+        return entry->size;
+    }
+
+    if (entry->size <= dl - 2) {
+        // CAN FD, size 0 escapes to the size in the next byte
+        frame.data[0] = CANTT_SINGLE_FRAME << 4;
+        frame.data[1] = entry->size;
+        memcpy(&frame.data[2], entry->message, entry->size);
+        frame.len = padLength(2 + entry->size);
+
+        return entry->size;
+    }
+
+    if (pos == 0) {
+        frame.data[0] = (CANTT_FIRST_FRAME << 4) | (entry->size >> 8);
+        frame.data[1] = entry->size & CANTT_FIRST_SIZE_MASK_BYTE1;
+        memcpy(&frame.data[2], entry->message, dl - 2);
+        frame.len = dl;
+
+        return dl - 2;
+    }
+
+    // Some or the remaining data, after the frame type and counter
+    length = entry->size - pos < dl - 1 ? entry->size - pos : dl - 1;
+    frame.data[0] = (CANTT_CONSECUTIVE_FRAME << 4) |
+                    (counter & CANTT_CONSECUTIVE_INDEX_MASK);
+    memcpy(&frame.data[1], &entry->message[pos], length);
+    frame.len = padLength(1 + length); // HDR + data
+
+    return length;
+}
+
+/**
+    Checks whether a message fits in a single frame
+
+    @param entry the message
+    @return true for a SINGLE_FRAME message
+*/
+bool CANTTBase::isSingle(const struct CANTTbuf *entry) {
+    return entry->size <= 7 || entry->size <= this->frameLength - 2;
+}
+
+/**
+    Sends a SINGLE_FRAME message
+
+    @return error code
+*/
+int CANTTBase::sendSingle() {
+    this->numberTX();
+    this->buildFrame(this->tx, 0, 0, this->txFrame);
+
+    return this->sendMessage();
+}
+
+/**
+    Sends the FIRST_FRAME in a long message
+
+    @return error code
+*/
+int CANTTBase::sendFirst() {
+    uint8_t length;
+
+    this->numberTX();
+    length = this->buildFrame(this->tx, 0, 0, this->txFrame);
+
+    if (this->sendMessage() != 0) {
+        this->changeState(IDLE);
+        return 1;
+    } else {
+        this->tx->message_pos = length;
+        this->tx->frameCounter = 1;
+    }
+
+    return 0;
+}
+
+/**
+    Sends the CONSECUTIVE_FRAME(s) in a long message
+
+    @return the remaining amount of data to transmit
+*/
+int CANTTBase::sendConsecutive() {
+    uint8_t maxSend = this->buildFrame(this->tx, this->tx->message_pos,
+                                       this->tx->frameCounter, this->txFrame);
+
+    if (this->sendMessage() != 0) {
+        this->changeState(IDLE);
+    } else {
+        this->tx->message_pos += maxSend;
+        this->tx->frameCounter++;
+    }
+
+    if (this->tx->size <= this->tx->message_pos) {
+        this->changeState(IDLE);
+    }
+
+    return this->tx->size - this->tx->message_pos;
+}
+
+/**
+    Wrapper for the external function pointed to by canRead
+
+    @return error code
+*/
+int CANTTBase::recvMessage() {
+    this->rxFrame.extended = false;
+    this->rxFrame.rtr = false;
+
+    if (this->cantr->receive(this->rxFrame) != 0) {
+        return 1;
+    }
+
+    this->statistics.framesReceived++;
+
+    return 0;
+}
+
+/**
+    Wrapper for the external function pointed to by canSend
+
+    @return error code
+*/
+int CANTTBase::sendMessage() {
+    this->txFrame.id = this->frameId(this->tx);
+
+    if (this->cantr->transmit(this->txFrame) != 0) {
+        return 1;
+    }
+
+    this->statistics.framesSent++;
+    this->txLast = cantt_millis();
+    this->paced(1);
+
+    return 0;
+}
+
+/**
+    Publish a message on a topic
+
+    @param priority address/priority of the message
+    @param topic the topic
+    @param topic_len the length of the topic
+    @param payload the payload
+    @param payload_len the length of the payload
+    @return CANTT_OK, CANTT_ERR_QUEUE_FULL, or -1 if the message is too large
+*/
+int CANTTBase::publish(uint32_t priority, uint8_t *topic, uint16_t topic_len,
+                   uint8_t *payload, uint16_t payload_len) {
+    struct CANTTbuf *entry;
+    struct CANTTalias *alias;
+    uint8_t *buffer;
+    uint32_t length;
+    int status;
+
+    alias = this->txAliases.lookup(priority, topic, topic_len);
+    if (alias != NULL && !(alias->flags & CANTT_ALIAS_ANNOUNCED)) {
+        alias = NULL;
+    }
+
+    if (alias != NULL) {
+        // HDR byte + alias, the payload runs to the end of the message
+        length = (uint32_t)payload_len + 3;
+    } else {
+        // (HDR byte + 2 * uint16_t) + topic_len + payload_len
+        length = (uint32_t)topic_len + payload_len + 5;
+    }
+
+    if (length > this->maxMessage) {
+        this->statistics.rejected++;
+        return -1;
+    }
+
+    // Build the message straight into the queue, or into the open batch
+    buffer = this->coalesce(priority, length);
+    if (buffer == NULL) {
+        status = this->reserve(priority, length, &entry);
+        if (status != CANTT_OK) {
+            return status;
+        }
+        buffer = entry->message;
+    }
+
+    if (alias != NULL) {
+        buffer[0] = CANTT_MSG_PUBLISH_ALIAS;
+        buffer[1] = (alias->alias & 0xFF);
+        buffer[2] = (alias->alias >> 8);
+        memcpy(&buffer[3], payload, payload_len);
+
+        return CANTT_OK;
+    }
+
+    buffer[0] = CANTT_MSG_PUBLISH;
+    buffer[1] = (topic_len & 0xFF);
+    buffer[2] = (topic_len >> 8);
+    memcpy(&buffer[3], topic, topic_len);
+    buffer[3 + topic_len + 0] = (payload_len & 0xFF);
+    buffer[3 + topic_len + 1] = (payload_len >> 8);
+    memcpy(&buffer[3 + topic_len + 2], payload, payload_len);
+
+    return CANTT_OK;
+}
+
+/**
+    Publish a message on a topic
+
+    @param priority address/priority of the message
+    @param topic the topic as a null terminated string
+    @param payload the payload as a null terminated string
+    @return error code
+*/
+int CANTTBase::publish(uint32_t priority, char *topic, char *payload) {
+    uint16_t topic_len = strlen(topic);
+    uint16_t payload_len = strlen(payload);
+
+    return this->publish(priority, (uint8_t *)topic, topic_len,
+                         (uint8_t *)payload, payload_len);
+}
+
+/**
+    Publish a message on a topic
+
+    @param topic the topic
+    @param topic_len the length of the topic
+    @param payload the payload
+    @param payload_len the length of the payload
+    @return error code
+*/
+int CANTTBase::publish(uint8_t *topic, uint16_t topic_len, uint8_t *payload,
+                   uint16_t payload_len) {
+    return this->publish(this->ownPriority(), topic, topic_len, payload,
+                         payload_len);
+}
+
+/**
+    Publish a message on a topic
+
+    @param topic the topic as a null terminated string
+    @param payload the payload as a null terminated string
+    @return error code
+*/
+int CANTTBase::publish(char *topic, char *payload) {
+    uint16_t topic_len = strlen(topic);
+    uint16_t payload_len = strlen(payload);
+
+    return publish((uint8_t *)topic, topic_len, (uint8_t *)payload,
+                   payload_len);
+}
+
+/**
+    Sends any long message
+
+    @param payload the data to be sent
+    @param length length of the data
+    @return error code
+*/
+int CANTTBase::send(uint8_t *payload, uint16_t length) {
+    return this->send(this->ownPriority(), payload, length);
+}
+
+/**
+    Queues any long message for transmission. Returns immediately, the
+    message is sent by loop() in priority order.
+
+    @param addr address/priority
+    @param payload the data to be sent
+    @param length length of the data
+    @return CANTT_OK, CANTT_ERR_INVALID or CANTT_ERR_QUEUE_FULL
+*/
+int CANTTBase::send(uint32_t addr, uint8_t *payload, uint16_t length) {
+    struct CANTTbuf *entry;
+    int status;
+
+    if (payload == NULL) {
+        return CANTT_ERR_INVALID;
+    }
+
+    status = this->reserve(addr, length, &entry);
+    if (status == CANTT_OK) {
+        memcpy(entry->message, payload, length);
+    }
+
+    return status;
+}
+
+/**
+    Takes a free TX queue entry for a message, the caller fills in its
+    content before the next loop()
+
+    @param addr address/priority
+    @param length length of the message
+    @param entry set to the queue entry
+    @return CANTT_OK, CANTT_ERR_INVALID or CANTT_ERR_QUEUE_FULL
+*/
+int CANTTBase::reserve(uint32_t addr, uint16_t length,
+                       struct CANTTbuf **entry) {
+    struct CANTTbuf *slot;
+
+    // With 29-bit ids the address is a priority, the node is ours
+    if (length == 0 || (this->extendedIds && addr > CANTT_MAX_ADDR)) {
+        return CANTT_ERR_INVALID;
+    }
+
+    if (length > this->maxMessage) {
+        this->statistics.rejected++;
+        return CANTT_ERR_INVALID;
+    }
+
+    if (this->txCount >= this->txQueueSize) {
+        return CANTT_ERR_QUEUE_FULL;
+    }
+
+    for (slot = this->txQueue; slot->size > 0; slot++)
+        ; // There is a free entry as the queue is not full
+
+    slot->address = addr;
+    slot->size = length;
+    slot->message_pos = 0;
+    slot->frameCounter = 0;
+    slot->enqueued = cantt_millis();
+    slot->queued = cantt_micros();
+    slot->sequence = this->txSequence++;
+    slot->transfer = CANTT_EXT_SEQ_NONE;
+
+    this->txCount++;
+    *entry = slot;
+
+    return CANTT_OK;
+}
+
+/**
+    Decodes a message and calls the internal callback
+
+    @param addr address/priority
+    @param data the data we received
+    @param length the length of the data
+    @return error code
+*/
+int CANTTBase::decode(uint32_t addr, const uint8_t *data, uint16_t len) {
+    struct CANTTspan topic;
+    struct CANTTspan payload;
+
+    if(len == 0) {
+        return -1;
+    }
+
+    switch(data[0]) {
+    case CANTT_MSG_PUBLISH:
+        // HDR byte + 2 * uint16_t
+        if (len < 5) {
+            return -1;
+        }
+
+        topic.len = data[1] | data[2] << 8;
+        if (topic.len > len - 5) {
+            return -1;
+        }
+        topic.data = &data[3];
+
+        payload.len = data[3 + topic.len] | data[4 + topic.len] << 8;
+        if (payload.len > len - 5 - topic.len) {
+            return -1;
+        }
+        payload.data = &data[5 + topic.len];
+
+        return this->dispatch(addr, topic, payload);
+
+    case CANTT_MSG_MULTI: {
+        // HDR byte, then records of uint16_t length and a message each
+        bool prefiltered = this->prefiltered;
+        uint16_t pos = 1;
+        uint16_t recordLen;
+
+        // Check every record first, a damaged batch delivers none of them
+        while (pos < len) {
+            if (len - pos < 2) {
+                return -1;
+            }
+
+            recordLen = data[pos] | data[pos + 1] << 8;
+            pos += 2;
+
+            if (recordLen == 0 || recordLen > len - pos ||
+                data[pos] == CANTT_MSG_MULTI) {
+                return -1;
+            }
+
+            pos += recordLen;
+        }
+
+        // The records have topics of their own to match
+        this->prefiltered = false;
+
+        for (pos = 1; pos < len; pos += recordLen) {
+            recordLen = data[pos] | data[pos + 1] << 8;
+            pos += 2;
+
+            this->decode(addr, &data[pos], recordLen);
+        }
+
+        this->prefiltered = prefiltered;
+
+        return 0;
+    }
+
+    case CANTT_MSG_ALIAS:
+        // HDR byte + alias, then the topic
+        if (len < 4 ||
+            this->rxAliases.learn(addr, data[1] | data[2] << 8, &data[3],
+                                  len - 3) == NULL) {
+            return -1;
+        }
+
+        return 0;
+
+    case CANTT_MSG_PUBLISH_ALIAS: {
+        struct CANTTalias *alias;
+        int status;
+
+        if (len < 3) {
+            return -1;
+        }
+
+        // Missed the announcement, wait for the next one
+        alias = this->rxAliases.find(addr, data[1] | data[2] << 8);
+        if (alias == NULL) {
+            return -1;
+        }
+
+        if (this->aliasMatch(alias) == CANTT_MATCH_REJECT) {
+            return 0;
+        }
+
+        topic.data = alias->topic;
+        topic.len = alias->topicLen;
+        payload.data = &data[3];
+        payload.len = len - 3;
+
+        this->prefiltered = true;
+        status = this->dispatch(addr, topic, payload);
+        this->prefiltered = false;
+
+        return status;
+    }
+    }
+
+    return 0;
+}
+
+/**
+    Hands a decoded message to the application. The span callback gets
+    views into the receive buffer, the classic callback gets NUL terminated
+    copies.
+
+    @param addr address/priority
+    @param topic the topic
+    @param payload the payload
+    @return error code
+*/
+int CANTTBase::dispatch(uint32_t addr, struct CANTTspan topic,
+                    struct CANTTspan payload) {
+    uint32_t start;
+    int status = 0;
+
+    if (!this->prefiltered &&
+        !this->subscriptions.matches(topic.data, topic.len)) {
+        return 0;
+    }
+
+    start = cantt_micros();
+
+    if (this->spanCallback != NULL) {
+        this->spanCallback(addr, topic, payload);
+    }
+
+    if (this->handler != NULL) {
+        this->handler(this->handlerContext, addr, topic, payload);
+    }
+
+    if (this->callback != NULL) {
+        uint8_t topicCopy[CANTT_MAX_TOPIC_SIZE + 1];
+        uint8_t payloadCopy[CANTT_MAX_PAYLOAD_SIZE + 1];
+
+        if (topic.len > CANTT_MAX_TOPIC_SIZE ||
+            payload.len > CANTT_MAX_PAYLOAD_SIZE) {
+            status = -1;
+        } else {
+            memcpy(topicCopy, topic.data, topic.len);
+            topicCopy[topic.len] = '\0';
+            memcpy(payloadCopy, payload.data, payload.len);
+            payloadCopy[payload.len] = '\0';
+
+            this->callback(addr, topicCopy, topic.len, payloadCopy,
+                           payload.len);
+        }
+    }
+
+    CANTTStats::record(this->statistics.callback, cantt_micros() - start);
+
+    return status;
+}
+
+/**
+    Handles a frame from another node received while we have something to
+    send. Frames we already put on the bus stay valid, as receivers
+    reassemble per sender, so our transfers simply resume where they are.
+    A sender with a lower CAN id (more important) arms a holdoff timer that
+    keeps our less important messages from starting until it has been
+    quiet for the holdoff delay, see setHoldoff().
+*/
+void CANTTBase::collision() {
+    uint32_t priority = this->extendedIds
+                            ? CANTT_EXT_PRIORITY(this->rxFrame.id)
+                            : this->rxFrame.id;
+
+    // Announcements are not transfers, nothing to make way for
+    if (!this->hasOutgoingMessage() || this->foreign() ||
+        FRAME_TYPE(this->rxFrame.data[0]) == CANTT_FLOWCTRL_FRAME) {
+        return;
+    }
+
+    this->statistics.collisions++;
+
+    if (this->holdoffDelay == 0) {
+        return;
+    }
+
+    if (!this->holdoff ||
+        cantt_millis() - this->holdoffStart >= this->holdoffDelay) {
+        this->statistics.holdoffs++;
+    }
+
+    if (!this->holdoff || priority < this->holdoffAddr) {
+        this->holdoffAddr = priority;
+    }
+
+    this->holdoff = true;
+    this->holdoffStart = cantt_millis();
+}
+
+/**
+    Converts an STmin value to microseconds
 
-/**
-    Is the TX (transmission) buffer beeing sent
+    @param separation STmin, ISO 15765-2 encoding
+    @return time in us, reserved values count as the 127 ms maximum
 */
-bool CANTT::inTransmission() { return this->tx.message_pos > 0; }
+static uint32_t separationMicros(uint8_t separation) {
+    if (separation <= 0x7F) {
+        return separation * 1000UL;
+    } else if (separation >= 0xF1 && separation <= 0xF9) {
+        return (separation - 0xF0) * 100UL;
+    }
 
-/**
-    Anything in the TX (transmission) buffer
-*/
-bool CANTT::hasOutgoingMessage() { return this->tx.size > 0; }
+    return 127000UL;
+}
 
 /**
-    Switches the state machine to another state
+    Announces our pacing when it is due and forgets the pacing of
+    receivers that have gone silent
 
-    @param the new state for the machine
+    @param now time in ms
 */
-void CANTT::changeState(enum state_m s) {
-    this->stateMachine = s;
+void CANTTBase::updateFlow(uint32_t now) {
+    bool changed = false;
 
-    if (this->stateMachine == IDLE) {
-        this->timeOutTimer = 0;
-    } else {
-        this->timeOutTimer = millis();
+    if (this->flowBlockSize > 0 || this->flowSeparation > 0 ||
+        this->flowPause > 0) {
+        if (now - this->flowAnnounced >= CANTT_FLOW_INTERVAL) {
+            this->flowDue = true;
+        }
+    }
+
+    if (this->flowDue && this->announceFlow() == 0) {
+        this->flowDue = false;
+        this->flowAnnounced = now;
+    }
+
+    for (uint8_t i = 0; i < CANTT_MAX_PEERS; i++) {
+        if (this->peers[i].active &&
+            now - this->peers[i].seen >= CANTT_FLOW_PEER_TIMEOUT) {
+            this->peers[i].active = false;
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        this->applyPacing();
     }
 }
 
 /**
-    Waits in a loop for the state machine to return to IDLE state
-    while still running the internal loop.
+    Puts a FLOWCTRL frame with our pacing on the bus, it is sent outside
+    the TX queue as it belongs to no message
 
     @return error code
 */
-int CANTT::waitUntilIdle() {
-    uint32_t now = millis();
-
-    // Busy block until any operation is done and the output buffer is available
-    while (this->stateMachine != IDLE) {
-        // Bail after TIMEOUT time
-        if (now + CANTT_SEND_TIMEOUT < millis() ||
-            millis() < now /* fail if millis wraps around to 0 */) {
-            return -1;
-        }
-
-        this->loop();
+int CANTTBase::announceFlow() {
+    struct CANMessage frame = this->txFrame;
+
+    memset(frame.data, 0, CANTT_CAN_DATASIZE);
+    frame.id = this->canAddr;
+    frame.data[0] = (CANTT_FLOWCTRL_FRAME << 4) | CANTT_FLOW_CLEAR;
+    frame.data[1] = this->flowBlockSize;
+    frame.data[2] = this->flowSeparation;
+    frame.data[3] = this->flowPause;
+    frame.len = 4;
+
+    if (this->cantr->transmit(frame) != 0) {
+        return 1;
     }
 
+    this->statistics.framesSent++;
+
     return 0;
 }
 
 /**
-    Parses a SINGLE_FRAME message and calls the callback function
+    Records the pacing announced in the FLOWCTRL frame in rxFrame. A full
+    table replaces the peer heard from least recently.
 */
-void CANTT::parseSingle() {
-    uint8_t frameSize = this->rx.can.data[0] & CANTT_SINGLE_SIZE_MASK;
+void CANTTBase::parseFlow() {
+    struct CANTTpeer *peer = NULL;
+    uint8_t i;
 
-    // Ensure that the frame has the correct size
-    if (frameSize == this->rx.can.len - 1 && frameSize > 0 && frameSize < 8) {
+    if (this->rxFrame.len < 4 ||
+        (this->rxFrame.data[0] & 0x0F) != CANTT_FLOW_CLEAR) {
+        return;
+    }
 
-        if(this->cantr->canCallback != NULL) {
-            // Use the data directly from the can buffer, no need to use the message
-            // buffer
-            this->cantr->canCallback(this->rx.can.id, &this->rx.can.data[1], frameSize);    
+    for (i = 0; i < CANTT_MAX_PEERS; i++) {
+        if (this->peers[i].active &&
+            this->peers[i].address == this->sender(this->rxFrame.id)) {
+            peer = &this->peers[i];
+            break;
         }
+    }
 
-        this->decode(this->rx.can.id, &this->rx.can.data[1], frameSize);
-        
-        // Use the data directly from the can buffer, no need to use the message
-        // buffer
-        
-
-        this->clearRX();
+    for (i = 0; peer == NULL && i < CANTT_MAX_PEERS; i++) {
+        if (!this->peers[i].active) {
+            peer = &this->peers[i];
+        }
     }
-}
 
-/**
-    Parses the FIRST_FRAME in a long message
-*/
-void CANTT::parseFirst() {
-    uint16_t frameSize =
-        ((this->rx.can.data[0] & CANTT_SINGLE_SIZE_MASK) << 8) |
-        this->rx.can.data[1];
+    if (peer == NULL) {
+        peer = &this->peers[0];
+        for (i = 1; i < CANTT_MAX_PEERS; i++) {
+            if ((int32_t)(this->peers[i].seen - peer->seen) < 0) {
+                peer = &this->peers[i];
+            }
+        }
+    }
 
-    memset(this->rx.message, 0, CANTT_MAX_RECV_BUFFER);
+    peer->address = this->sender(this->rxFrame.id);
+    peer->seen = cantt_millis();
+    peer->blockSize = this->rxFrame.data[1];
+    peer->separation = this->rxFrame.data[2];
+    peer->pause = this->rxFrame.data[3];
 
-    if (frameSize >= 8 && frameSize <= CANTT_MAX_DATASIZE) {
-        this->rx.size = frameSize;
+    // A withdrawn request frees the entry
+    peer->active =
+        peer->blockSize > 0 || peer->separation > 0 || peer->pause > 0;
 
-        memcpy(this->rx.message, &this->rx.can.data[2],
-               6); // All of the remaining data in this frame
-        this->rx.message_pos = 6;
-    }
+    this->applyPacing();
 }
 
 /**
-    Parses the CONSECUTIVE_FRAME(s) in a long message
-    executes callback once the message is complete
-
-    @return remaining length of message
+    Combines the pacing of all peers: the smallest block size, the longest
+    separation and the longest pause
 */
-int CANTT::parseConsecutive() {
-    uint16_t frameIndex = this->rx.can.data[0] & CANTT_CONSECUTIVE_INDEX_MASK;
-
-    if (this->rx.size - this->rx.message_pos > 7) {
-        // not the last frame
-        memcpy(&this->rx.message[this->rx.message_pos], &this->rx.can.data[1],
-               7);
-        this->rx.message_pos += 7;
+void CANTTBase::applyPacing() {
+    this->paceBlockSize = 0;
+    this->paceSeparation = 0;
+    this->pacePause = 0;
 
-    } else {
-        // this (should be) the last frame
-        memcpy(&this->rx.message[this->rx.message_pos], &this->rx.can.data[1],
-               this->rx.size - this->rx.message_pos);
-        this->rx.message_pos = this->rx.size;
+    for (uint8_t i = 0; i < CANTT_MAX_PEERS; i++) {
+        const struct CANTTpeer *peer = &this->peers[i];
+        uint32_t separation = separationMicros(peer->separation);
 
-        if(this->cantr->canCallback != NULL) {
-            this->cantr->canCallback(this->rx.address, this->rx.message, this->rx.size);
+        if (!peer->active) {
+            continue;
         }
-        
-        this->decode(this->rx.address, this->rx.message, this->rx.size);
 
-        this->clearRX();
+        if (peer->blockSize > 0 && peer->pause > 0 &&
+            (this->paceBlockSize == 0 ||
+             peer->blockSize < this->paceBlockSize)) {
+            this->paceBlockSize = peer->blockSize;
+        }
+        if (separation > this->paceSeparation) {
+            this->paceSeparation = separation;
+        }
+        if (peer->pause * 1000UL > this->pacePause) {
+            this->pacePause = peer->pause * 1000UL;
+        }
     }
-
-    return this->rx.size - this->rx.message_pos;
 }
 
 /**
-    Sends a SINGLE_FRAME message
+    Starts the wait before our next frame, after frames have been sent
 
-    @return error code
+    @param frames number of frames sent
 */
-int CANTT::sendSingle() {
-    memset(this->tx.can.data, 0, CANTT_CAN_DATASIZE);
+void CANTTBase::paced(uint8_t frames) {
+    if (this->paceBlockSize == 0 && this->paceSeparation == 0) {
+        this->paceDelay = 0;
+        return;
+    }
 
-    this->tx.can.data[0] = (CANTT_SINGLE_FRAME << 4) | this->tx.size;
-    memcpy(&this->tx.can.data[1], this->tx.message, 7);
-    this->tx.can.len = 1 + this->tx.size;
-    this->tx.can.id = this->tx.address;
+    this->paceLast = cantt_micros();
+    this->paceDelay = this->paceSeparation;
 
-    return this->sendMessage();
+    if (this->paceBlockSize > 0) {
+        this->paceCount += frames;
+
+        if (this->paceCount >= this->paceBlockSize) {
+            this->paceCount = 0;
+            if (this->pacePause > this->paceDelay) {
+                this->paceDelay = this->pacePause;
+            }
+        }
+    }
 }
 
 /**
-    Sends the FIRST_FRAME in a long message
+    Time left before the peers allow our next frame
 
-    @return error code
+    @return time in us
 */
-int CANTT::sendFirst() {
-    memset(this->tx.can.data, 0, CANTT_CAN_DATASIZE);
+uint32_t CANTTBase::paceWait() {
+    uint32_t elapsed;
 
-    this->tx.can.data[0] = (CANTT_FIRST_FRAME << 4) | (this->tx.size >> 8);
-    this->tx.can.data[1] = this->tx.size & CANTT_FIRST_SIZE_MASK_BYTE1;
-    memcpy(&this->tx.can.data[2], this->tx.message, 6);
-    this->tx.can.len = CANTT_CAN_DATASIZE;
+    if (this->paceDelay == 0) {
+        return 0;
+    }
 
-    if (this->sendMessage() != 0) {
-        this->changeState(IDLE);
-        return 1;
-    } else {
-        this->tx.message_pos = 6;
-        this->tx.frameCounter = 1;
+    elapsed = cantt_micros() - this->paceLast;
+    if (elapsed >= this->paceDelay) {
+        this->paceDelay = 0;
+        return 0;
     }
 
-    return 0;
+    return this->paceDelay - elapsed;
 }
 
 /**
-    Sends the CONSECUTIVE_FRAME(s) in a long message
+    Parses the frame in rxFrame according to its type
 
-    @return the remaining amount of data to transmit
+    @return the state to continue in
 */
-int CANTT::sendConsecutive() {
-    uint8_t maxSend = 7;
+enum state_m CANTTBase::parseFrame() {
+    struct CANTTslot *slot;
 
-    memset(this->tx.can.data, 0, CANTT_CAN_DATASIZE);
+    if (this->foreign()) {
+        return CHECKREAD;
+    }
 
-    // Set frame type and counter
-    this->tx.can.data[0] =
-        (CANTT_CONSECUTIVE_FRAME << 4) | (this->tx.frameCounter % 0x0F);
+    if (FRAME_TYPE(this->rxFrame.data[0]) == CANTT_SINGLE_FRAME) {
+        this->parseSingle();
+        return IDLE;
 
-    // Copy some or remaining data
-    if (this->tx.size - this->tx.message_pos <= 7) {
-        maxSend = this->tx.size - this->tx.message_pos;
-    }
-    memcpy(&this->tx.can.data[1], &this->tx.message[this->tx.message_pos],
-           maxSend);
+    } else if (FRAME_TYPE(this->rxFrame.data[0]) == CANTT_FIRST_FRAME) {
+        this->parseFirst();
+        return CHECKREAD;
 
-    // FIXME: change to properly handle RTX & Extended
-    this->tx.can.len = 1 + maxSend; // HDR + data
-    this->tx.can.id = this->tx.address;
+    } else if (FRAME_TYPE(this->rxFrame.data[0]) == CANTT_CONSECUTIVE_FRAME) {
+        slot = this->rxTable.find(this->rxFrame.id);
 
-    if (this->sendMessage() != 0) {
-        this->changeState(IDLE);
-    } else {
-        this->tx.message_pos += maxSend;
-        this->tx.frameCounter++;
-    }
+        if (slot == NULL) {
+            // Not part of any transfer we know about
+            return CHECKREAD;
+        } else if (this->parseConsecutive(slot) == 0) {
+            return IDLE;
+        }
 
-    if (this->tx.size <= this->tx.message_pos) {
-        this->changeState(IDLE);
+        return CHECKREAD; // Fetch a new frame
+
+    } else if (FRAME_TYPE(this->rxFrame.data[0]) == CANTT_FLOWCTRL_FRAME) {
+        this->parseFlow();
     }
 
-    return this->tx.size - this->tx.message_pos;
+    // Ignore frame and switch to CHECKREAD state
+    return CHECKREAD;
 }
 
 /**
-    Wrapper for the external function pointed to by canRead
+    Puts the next frame of the selected message on the bus
 
     @return error code
 */
-int CANTT::recvMessage() {
-    this->rx.can.extended = false;
-    this->rx.can.rtr = false;
-    memset(this->rx.can.data, 0, CANTT_CAN_DATASIZE);
+int CANTTBase::sendNext() {
+    uint16_t pos = this->tx->message_pos;
 
-    if (this->cantr->canRead == NULL) {
-        return 1;
-    }
+    if (this->isSingle(this->tx)) {
+        if (this->sendSingle() != 0) {
+            return 1;
+        }
+        this->clearTX();
 
-    if (this->cantr->canRead(this->rx.can) != 0) {
+    } else if (pos == 0) {
+        return this->sendFirst();
+
+    } else if (this->sendConsecutive() == 0) {
+        this->clearTX();
+
+    } else if (this->tx->message_pos == pos) {
         return 1;
     }
 
-    this->rx.address = this->rx.can.id;
-
     return 0;
 }
 
 /**
-    Wrapper for the external function pointed to by canSend
+    Sets how much work a single call to loop() may do. With a non-zero
+    budget loop() reads every frame the transport has available, up to
+    rxBudget, and sends up to txBudget frames, instead of advancing the
+    state machine by one step.
 
-    @return error code
+    @param rxBudget maximum number of frames to receive per loop()
+    @param txBudget maximum number of frames to send per loop()
 */
-int CANTT::sendMessage() {
-    if (this->cantr->canSend == NULL) {
-        return 1;
-    }
-
-    this->tx.can.id = this->tx.address;
+void CANTTBase::setBudget(uint16_t rxBudget, uint16_t txBudget) {
+    this->rxBudget = rxBudget;
+    this->txBudget = txBudget;
+    this->changeState(IDLE);
+}
 
-    if (this->cantr->canSend(this->tx.can) != 0) {
-        return 1;
-    }
+/**
+    Installs a handler that gets a context pointer with every message, so
+    one function can serve several instances (buses)
 
-    return 0;
+    @param handler pointer to function called once a complete message has
+   been received, NULL to remove it
+    @param context passed to the handler as is
+*/
+void CANTTBase::setHandler(void (*handler)(void *, uint32_t, CANTTspan,
+                                           CANTTspan),
+                           void *context) {
+    this->handler = handler;
+    this->handlerContext = context;
 }
 
 /**
-    Publish a message on a topic
-
-    @param priority address/priority of the message
-    @param topic the topic
-    @param topic_len the length of the topic
-    @param payload the payload
-    @param payload_len the length of the payload
-    @return error code
+    Time until loop() has work to do that does not come with a received
+    frame: a holdoff that ends, a transfer that times out, the pacing of a
+    slow receiver that allows our next frame, a batch of publishes to close
+    or an announcement of pacing, aliases or statistics. An event driven
+    caller can sleep until a frame arrives, the transport can take a frame
+    while txReady() or this much time has passed.
+
+    @return time in ms, CANTT_NO_TIMEOUT if there is nothing to wait for
 */
-int CANTT::publish(uint32_t priority, uint8_t *topic, uint16_t topic_len,
-                   uint8_t *payload, uint16_t payload_len) {
-    uint8_t buffer[CANTT_MAX_MESSAGE_SIZE];
+uint32_t CANTTBase::nextTimeout() {
+    uint32_t now = cantt_millis();
+    uint32_t next = CANTT_NO_TIMEOUT;
+    uint32_t expiry;
 
-    // (HDR byte + 2 * uint16_t) + topic_len + payload_len
-    if (topic_len + payload_len + 5 > CANTT_MAX_MESSAGE_SIZE) {
-        return -1;
+    next = this->holdoffWait(now);
+
+    expiry = this->rxTable.nextExpiry(now, this->timeout);
+    if (expiry < next) {
+        next = expiry;
     }
 
-    buffer[0] = CANTT_MSG_PUBLISH;
-    buffer[1] = (topic_len & 0xFF);
-    buffer[2] = (topic_len >> 8);
-    memcpy(&buffer[3], topic, topic_len);
-    buffer[3 + topic_len + 0] = (payload_len & 0xFF);
-    buffer[3 + topic_len + 1] = (payload_len >> 8);
-    memcpy(&buffer[3 + topic_len + 2], payload, payload_len);
+    if (this->hasOutgoingMessage()) {
+        // Rounded up, waking early would find the frame still held back
+        expiry = (this->paceWait() + 999) / 1000;
+        if (expiry > 0 && expiry < next) {
+            next = expiry;
+        }
+    }
 
-    return this->send(priority, buffer, topic_len + payload_len + 5);
-}
+    if (this->flowDue) {
+        next = 0;
+    } else if (this->flowBlockSize > 0 || this->flowSeparation > 0 ||
+               this->flowPause > 0) {
+        expiry = now - this->flowAnnounced >= CANTT_FLOW_INTERVAL
+                     ? 0
+                     : CANTT_FLOW_INTERVAL - (now - this->flowAnnounced);
+        if (expiry < next) {
+            next = expiry;
+        }
+    }
 
-/**
-    Publish a message on a topic
+    if (this->batch != NULL) {
+        expiry = now - this->batchOpened >= this->coalesceTime
+                     ? 0
+                     : this->coalesceTime - (now - this->batchOpened);
+        if (expiry < next) {
+            next = expiry;
+        }
+    }
 
-    @param priority address/priority of the message
-    @param topic the topic as a null terminated string
-    @param payload the payload as a null terminated string
-    @return error code
-*/
-int CANTT::publish(uint32_t priority, char *topic, char *payload) {
-    uint16_t topic_len = strlen(topic);
-    uint16_t payload_len = strlen(payload);
+    if (this->txAliases.count() > 0) {
+        expiry = now - this->aliasAnnounced >= CANTT_ALIAS_INTERVAL
+                     ? 0
+                     : CANTT_ALIAS_INTERVAL - (now - this->aliasAnnounced);
+        if (expiry < next) {
+            next = expiry;
+        }
+    }
 
-    return this->publish(priority, (uint8_t *)topic, topic_len,
-                         (uint8_t *)payload, payload_len);
+    if (this->statsTopic != NULL) {
+        expiry = now - this->statsPublished >= this->statsInterval
+                     ? 0
+                     : this->statsInterval - (now - this->statsPublished);
+        if (expiry < next) {
+            next = expiry;
+        }
+    }
+
+    return next;
 }
 
 /**
-    Publish a message on a topic
+    Checks whether loop() would put a frame on the bus right now, i.e. a
+    message is queued and neither held off nor waiting for a reception
 
-    @param topic the topic
-    @param topic_len the length of the topic
-    @param payload the payload
-    @param payload_len the length of the payload
-    @return error code
+    @return true if a frame is ready to be sent
 */
-int CANTT::publish(uint8_t *topic, uint16_t topic_len, uint8_t *payload,
-                   uint16_t payload_len) {
-    return this->publish(this->canAddr, topic, topic_len, payload, payload_len);
+bool CANTTBase::txReady() {
+    struct CANTTbuf *selected = this->tx;
+    bool ready = this->hasOutgoingMessage() && this->selectTX();
+
+    // Leave the message being sent by the state machine alone
+    this->tx = selected;
+
+    return ready;
 }
 
 /**
-    Publish a message on a topic
+    Receives and sends frames until the budgets are used up or there is
+    nothing left to do
 
-    @param topic the topic as a null terminated string
-    @param payload the payload as a null terminated string
-    @return error code
+    @return number of frames received and sent
 */
-int CANTT::publish(char *topic, char *payload) {
-    uint16_t topic_len = strlen(topic);
-    uint16_t payload_len = strlen(payload);
+int CANTTBase::drain() {
+    uint16_t rxLeft = this->rxBudget;
+    uint16_t txLeft = this->txBudget;
+    bool progress = true;
+    bool rxIdle;
+    int work = 0;
+
+    uint16_t asked;
+    int count;
+
+    while (progress) {
+        progress = false;
+        rxIdle = false;
+
+        while (rxLeft > 0) {
+            asked = rxLeft < CANTT_IO_BATCH ? rxLeft : CANTT_IO_BATCH;
+            count = this->receiveFrames(asked);
+
+            rxLeft -= count;
+            work += count;
+            progress = progress || count > 0;
+
+            if (count < asked) {
+                rxIdle = true;
+                break;
+            }
+        }
 
-    return publish((uint8_t *)topic, topic_len, (uint8_t *)payload,
-                   payload_len);
-}
+        // A frame waiting to be read is a collision to handle first. When
+        // the last read came back short there is none, no need to ask.
+        if (txLeft > 0 && (rxIdle || !this->cantr->available()) &&
+            this->selectTX()) {
+            count = this->sendFrames(txLeft);
 
-/**
-    Sends any long message
+            txLeft -= count;
+            work += count;
+            progress = progress || count > 0;
+        }
+    }
 
-    @param payload the data to be sent
-    @param length length of the data
-    @return error code
-*/
-int CANTT::send(uint8_t *payload, uint16_t length) {
-    return this->send(this->canAddr, payload, length);
+    return work;
 }
 
 /**
-    Sends any long message
+    Reads a batch of frames from the transport and parses them
 
-    @param addr address/priority
-    @param payload the data to be sent
-    @param length length of the data
-    @return error code
+    @param max number of frames to read at most, up to CANTT_IO_BATCH
+    @return number of frames read, less than max when no more are available
 */
-int CANTT::send(uint32_t addr, uint8_t *payload, uint16_t length) {
-    if (length > CANTT_MAX_DATASIZE || payload == NULL) {
-        return 1;
-    }
+int CANTTBase::receiveFrames(uint16_t max) {
+    struct CANMessage frames[CANTT_IO_BATCH];
+    uint8_t count;
 
-    // TX buffer only supports one message
-    while(this->hasOutgoingMessage()) {
-        this->loop();
-    }
+    count = this->cantr->readBatch(frames, max);
+    this->statistics.framesReceived += count;
 
-    this->tx.address = addr;
-    this->tx.size = length;
-    this->tx.message_pos = 0;
-    memset(this->tx.message, 0, CANTT_MAX_RECV_BUFFER);
-    memcpy(this->tx.message, payload, length);
+    for (uint8_t i = 0; i < count; i++) {
+        this->rxFrame = frames[i];
+        this->collision();
+        this->parseFrame();
+    }
 
-    return 0;
+    return count;
 }
 
 /**
-    Decodes a message and calls the internal callback
+    Sends a batch of frames of the selected message. The frames are built
+    ahead and only those the transport accepted advance the message.
 
-    @param addr address/priority
-    @param data the data we received
-    @param length the length of the data
-    @return error code
+    @param max number of frames to send at most
+    @return number of frames sent
 */
-int CANTT::decode(uint32_t addr, uint8_t *data, uint16_t len) {
-    uint8_t topic[CANTT_MAX_TOPIC_SIZE];
-    uint8_t payload[CANTT_MAX_PAYLOAD_SIZE];
-    uint16_t topic_len = 0;
-    uint16_t payload_len = 0;
-    uint8_t *dptr = data;
+int CANTTBase::sendFrames(uint16_t max) {
+    struct CANMessage frames[CANTT_IO_BATCH];
+    uint16_t ends[CANTT_IO_BATCH]; // message position after each frame
+    uint16_t pos = this->tx->message_pos;
+    uint16_t counter = this->tx->frameCounter;
+    uint8_t count = 0;
+    uint8_t sent;
+
+    if (max > CANTT_IO_BATCH) {
+        max = CANTT_IO_BATCH;
+    }
 
-    if(len == 0) {
-        return -1;
+    // Paced by a receiver: one frame at a time, or the rest of the block
+    if (this->paceSeparation > 0) {
+        max = 1;
+    } else if (this->paceBlockSize > 0 &&
+               max > this->paceBlockSize - this->paceCount) {
+        max = this->paceBlockSize - this->paceCount;
     }
 
-    switch(data[0]) {
-    case 0x03: // Publish
-        dptr++;
+    this->numberTX();
 
-        topic_len = dptr[0] | dptr[1] << 8;
-        if (topic_len > (len - 5) || topic_len > CANTT_MAX_TOPIC_SIZE) {
-            return -1;
-        }
-        dptr += 2;
-        memcpy(topic, dptr, topic_len);
-        topic[topic_len] = '\0';
-        dptr += topic_len;
+    do {
+        frames[count] = this->txFrame;
+        pos += this->buildFrame(this->tx, pos, counter, frames[count]);
+        ends[count] = pos;
+        counter++;
+        count++;
+    } while (count < max && pos < this->tx->size);
 
-        payload_len = dptr[0] | dptr[1] << 8;
-        if (payload_len + topic_len > (len - 5) || payload_len > CANTT_MAX_PAYLOAD_SIZE) {
-            return -1;
-        }
-        dptr += 2;
-        memcpy(payload, dptr, payload_len);
-        payload[payload_len] = '\0';
+    sent = this->cantr->sendBatch(frames, count);
+    if (sent == 0) {
+        return 0;
+    }
 
-        if(this->callback != NULL) {
-            this->callback(addr, topic, topic_len, payload, payload_len);
-        }
-        break;
+    this->statistics.framesSent += sent;
+    this->txLast = cantt_millis();
+    this->paced(sent);
+
+    if (ends[sent - 1] >= this->tx->size) {
+        this->clearTX();
+        this->changeState(IDLE);
+        return sent;
     }
 
-    return 0;
+    // Frames after the first one that failed are built again next time
+    this->tx->message_pos = ends[sent - 1];
+    this->tx->frameCounter += sent;
+
+    return sent;
 }
 
 /**
     Loop to run the internal state machine
+
+    @return number of frames received and sent
 */
-void CANTT::loop() {
-    if (this->timeOutTimer > millis()) { // overflow after ~50days;
-        this->timeOutTimer = millis();
+int CANTTBase::loop() {
+    int work = 0;
+
+    if (this->stateMachine == DISABLED) {
+        return 0;
+    }
+
+    if (this->timeOutTimer > cantt_millis()) { // overflow after ~50days;
+        this->timeOutTimer = cantt_millis();
     }
 
     if (this->timeOutTimer > 0 &&
-        this->timeOutTimer + CANTT_STATE_TIMEOUT < millis()) {
+        this->timeOutTimer + CANTT_STATE_TIMEOUT < cantt_millis()) {
+        this->statistics.stateTimeouts++;
         this->changeState(IDLE);
-        clearRX(); // TEST
+    }
+
+    // Drop transfers whose sender went silent
+    this->rxTable.expire(cantt_millis(), this->timeout);
+    this->updateFlow(cantt_millis());
+    this->updateAliases(cantt_millis());
+    this->updateBatch(cantt_millis());
+    this->updateStats(cantt_millis());
+
+    if (this->rxBudget > 0 || this->txBudget > 0) {
+        return this->drain();
     }
 
     switch (stateMachine) {
     case IDLE: // FIXME: not the correct name for this state
     case CHECKREAD:
-        if (this->cantr->canAvailable()) {
+        if (this->cantr->available()) {
             this->changeState(READ);
 
-        } else if (this->inReception() == false) { // We can only send if we are
-                                                   // not currently receiving...
-            // As long as we ensure to not send anything when we are still
-            // receiving,
-            // there should not be any issues...
+        } else {
+            // selectTX() makes sure nothing new is started while we are
+            // still receiving
             this->changeState(CHECKSEND);
         }
         break;
 
     case CHECKSEND:
-        if (this->hasOutgoingMessage()) {
-            if (this->tx.size <= 7) {
+        if (this->selectTX()) {
+            if (this->isSingle(this->tx)) {
                 this->changeState(SEND_SINGLE);
 
-            } else if (this->tx.message_pos == 0) {
+            } else if (this->tx->message_pos == 0) {
                 this->changeState(SEND_FIRST);
 
             } else if (this->inTransmission()) {
@@ -682,67 +3066,22 @@ void CANTT::loop() {
 
     case READ:
         if (this->recvMessage() == 0) {
-            this->changeState(PARSE_WHICH);
-
-            if (this->hasOutgoingMessage()) {
-                // We need to resend the current outgoing message
-                // as it will have collided on the bus with this new message
-
-                this->rewindTX();
-
-                if (this->rx.address >
-                    this->canAddr) { // lower is more important
-                    this->clearRX();
-                } else {
-                    delay(CANTT_DEFAULT_HOLDOFF_DELAY);
-                }
+            work++;
 
-                this->changeState(CHECKREAD);
-            }
+            this->collision();
+            this->changeState(PARSE_WHICH);
         } else {
             this->changeState(CHECKREAD);
         }
         break;
 
     case PARSE_WHICH:
-        if (FRAME_TYPE(this->rx.can.data[0]) == CANTT_SINGLE_FRAME) {
-            this->parseSingle();
-            this->changeState(IDLE);
-
-        } else if (FRAME_TYPE(this->rx.can.data[0]) == CANTT_FIRST_FRAME) {
-            this->parseFirst();
-            this->changeState(CHECKREAD);
-
-        } else if (FRAME_TYPE(this->rx.can.data[0]) ==
-                   CANTT_CONSECUTIVE_FRAME) {
-            if (this->parseConsecutive() == 0) {
-                this->changeState(IDLE);
-            } else {
-                this->changeState(CHECKREAD); // Fetch a new frame
-            }
-
-        } /* else if (FRAME_TYPE(this->canBuf[0]) == CANTT_FLOWCTRL_FRAME) {
-
-                if(this->canBuf[0] & 0x0F == CANTT_FLOW_CLEAR) { // mask for 0000 1111
-                    if(this->canBuf[1] >= this->block_size) {
-                        this->block_size = this->canBuf[1];
-                    }
-
-                    if(this->canBuf[2] >= this->wait_time) {
-                        this->wait_time = this->canBuf[2];
-                    }
-                } else {
-                    // Some other kind of Flow Ctrl Frame
-                }
-
-            } */ else {
-            // Ignore frame and switch to CHECKREAD state
-            this->changeState(CHECKREAD);
-        }
+        this->changeState(this->parseFrame());
         break;
 
     case SEND_SINGLE:
         if (this->sendSingle() == 0) {
+            work++;
             this->clearTX();
             this->changeState(IDLE);
         }
@@ -750,69 +3089,36 @@ void CANTT::loop() {
 
     case SEND_FIRST:
         if (this->sendFirst() == 0) {
+            work++;
             this->changeState(CHECKREAD); // To check for collision
         }
         break;
 
-    case SEND_CONSECUTIVE:
+    case SEND_CONSECUTIVE: {
+        uint16_t pos = this->tx->message_pos;
+
         if (this->sendConsecutive() == 0) { // Done with sending the multiframe
             this->clearTX();
             this->changeState(IDLE);
         } else {
             this->changeState(CHECKREAD); // To check for collision
         }
+
+        if (this->tx->message_pos != pos) { // frame went out
+            work++;
+        }
         break;
-        /*
-        case SEND_FLOW:
-            // FIXME: Where should the reply go? It can't be a fixed location.
-            // The easiest way that I see, is to use the inverse of that
-        address.
-            // 0x000 <-> 0x7FF, 0x100 <-> 0x6FF, 0x160 <-> 0x69F etc.
-
-            this->sendFlowFrame(this->canAddr,
-                                CANTT_FLOW_CLEAR,
-                                this->block_size, this->wait_time);
-
-            this->changeState(BUSY);  // Fetch a new frame
-        break;
-        */
-        /*
-        case RECV_FLOW:
-            this->recvMessage();
-            if (FRAME_TYPE(this->canBuf[0]) == CANTT_FLOWCTRL_FRAME) {
-                this->parseFlow();
-                this->changeState(SEND_CONSECUTIVE);
-            } else {
-                // Someone else is speaking right now.
-                // Abort
-            }
-        break;
-        */
     }
-}
-
-/*
 
-int CANTT::sendFlowFrame(long unsigned int arbId, uint8_t fc_flag, uint8_t
-block_size, uint8_t separation_time) {
-    uint8_t data[3] = {
-        (uint8_t)((CANTT_FLOWCTRL_FRAME << 4) | fc_flag),
-        block_size,
-        separation_time
-    };
+    case SEND_FLOW: // announced by updateFlow()
+    case RECV_FLOW: // FLOWCTRL frames are parsed with the others
+    case CHECK_COLLISION: // collisions are handled as each frame is read
+        this->changeState(IDLE);
+        break;
 
-    uint8_t sndStat = this->bus->sendMsgBuf(arbId, sizeof(data), data);
-    if (sndStat == 0) {
-        return 0;
+    case DISABLED: // returned above
+        break;
     }
 
-    return 1;
+    return work;
 }
-
-void CANTT::parseFlow() {
-    this->flowExpected = this->canBuf[1];
-    if(this->flowExpected == 0) {
-        this->flowExpected = -1; // Disable
-    }
-}
-*/
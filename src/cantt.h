@@ -1,24 +1,118 @@
 #ifndef __CANTT_H__
+#define __CANTT_H__
 
 #include <stdint.h>
 
+#include "cantt_alias.h"
+#include "cantt_pool.h"
+#include "cantt_stats.h"
+#include "cantt_subscription.h"
+
 /*
  * CANTT library by Mikael Ganehag Brorsson
  */
 
+/*
+ * Defaults for the CANTT typedef, BasicCANTT sizes each instance on its own
+ */
+
 #ifndef CANTT_MAX_RECV_BUFFER
 #define CANTT_MAX_RECV_BUFFER 64
 #endif
 
 #define CANTT_MAX_MESSAGE_SIZE CANTT_MAX_RECV_BUFFER
 
+// Number of multi-frame messages that can be reassembled concurrently
+#ifndef CANTT_RX_SLOTS
+#define CANTT_RX_SLOTS 4
+#endif
+
+// Buckets in the sender lookup table, must be a power of two
+#ifndef CANTT_RX_HASH_SIZE
+#define CANTT_RX_HASH_SIZE 8
+#endif
+
+#if (CANTT_RX_HASH_SIZE & (CANTT_RX_HASH_SIZE - 1)) != 0
+#error "CANTT_RX_HASH_SIZE must be a power of two"
+#endif
+
+#define CANTT_RX_NONE 0xFF
+
+// Number of outgoing messages that can be queued by send()/publish()
+#ifndef CANTT_TX_QUEUE_SIZE
+#define CANTT_TX_QUEUE_SIZE 4
+#endif
+
+// Priority classes for TX deadlines, class = CAN id >> shift
+#ifndef CANTT_PRIORITY_CLASSES
+#define CANTT_PRIORITY_CLASSES 8
+#endif
+
+#ifndef CANTT_PRIORITY_CLASS_SHIFT
+#define CANTT_PRIORITY_CLASS_SHIFT 8
+#endif
+
 #define CANTT_MAX_DATASIZE 4095
 #define CANTT_MAX_TOPIC_SIZE 64
 #define CANTT_MAX_PAYLOAD_SIZE 64
 
 #define CANTT_CAN_DATASIZE 8
+#define CANTT_CANFD_DATASIZE 64
+
+// CAN FD frames of up to 64 bytes need CANTT_CANFD, setFD() selects them
+#ifdef CANTT_CANFD
+#define CANTT_FRAME_DATASIZE CANTT_CANFD_DATASIZE
+#else
+#define CANTT_FRAME_DATASIZE CANTT_CAN_DATASIZE
+#endif
+
+// Frames moved per readBatch()/sendBatch() call in drain mode
+#ifndef CANTT_IO_BATCH
+#define CANTT_IO_BATCH 8
+#endif
+
+#if CANTT_IO_BATCH < 1 || CANTT_IO_BATCH > 255
+#error "CANTT_IO_BATCH must be between 1 and 255"
+#endif
 
 #define CANTT_MAX_ADDR 0x7FF
+#define CANTT_MAX_EXT_ADDR 0x1FFFFFFF
+
+/*
+ * 29-bit ids, see setAddr(): priority [28:18], node [17:10] and the
+ * sequence number of the transfer [9:6], bits [5:0] are zero. Receivers
+ * reassemble per id, so every node can have several transfers on the bus
+ * at once, one per priority.
+ */
+#define CANTT_EXT_PRIORITY_SHIFT 18
+#define CANTT_EXT_NODE_SHIFT 10
+#define CANTT_EXT_SEQ_SHIFT 6
+#define CANTT_EXT_SEQ_MASK (0x0FUL << CANTT_EXT_SEQ_SHIFT)
+#define CANTT_EXT_ADDR_MASK 0x1FFFFC00UL // priority and node
+#define CANTT_EXT_SEQ_NONE 0xFF            // transfer not started yet
+
+// ms without a frame sent after which transfers are numbered from 0 again
+#ifndef CANTT_EXT_SEQ_RESTART
+#define CANTT_EXT_SEQ_RESTART 20
+#endif
+
+#define CANTT_EXT_ADDR(priority, node)                                         \
+    ((((uint32_t)(priority)&CANTT_MAX_ADDR) << CANTT_EXT_PRIORITY_SHIFT) |     \
+     (((uint32_t)(node)&0xFF) << CANTT_EXT_NODE_SHIFT))
+#define CANTT_EXT_PRIORITY(id)                                                 \
+    (((id) >> CANTT_EXT_PRIORITY_SHIFT) & CANTT_MAX_ADDR)
+#define CANTT_EXT_NODE(id) (((id) >> CANTT_EXT_NODE_SHIFT) & 0xFF)
+#define CANTT_EXT_SEQ(id) (((id) >> CANTT_EXT_SEQ_SHIFT) & 0x0F)
+
+// Sender address ranges that can be declared for acceptance filtering
+#ifndef CANTT_MAX_ACCEPT_RANGES
+#define CANTT_MAX_ACCEPT_RANGES 4
+#endif
+
+// Upper bound on id/mask filters used of a CAN controller
+#ifndef CANTT_MAX_HW_FILTERS
+#define CANTT_MAX_HW_FILTERS 8
+#endif
 
 #define CANTT_SINGLE_SIZE_MASK 0x0F       // 00001111
 #define CANTT_FIRST_SIZE_MASK_BYTE0 0x0F  // 00001111
@@ -29,8 +123,28 @@
 #define CANTT_FLOW_WAIT 1
 #define CANTT_FLOW_ABORT 2
 
+// Receivers whose pacing announcements are honoured at the same time
+#ifndef CANTT_MAX_PEERS
+#define CANTT_MAX_PEERS 4
+#endif
+
+// ms between two pacing announcements, a peer is forgotten after three
+#ifndef CANTT_FLOW_INTERVAL
+#define CANTT_FLOW_INTERVAL 1000
+#endif
+#define CANTT_FLOW_PEER_TIMEOUT (3 * CANTT_FLOW_INTERVAL)
+
 #define CANTT_DEFAULT_WAIT_TIME 20
+
+// ms a more important sender must be quiet before we start a message
+#ifndef CANTT_DEFAULT_HOLDOFF_DELAY
 #define CANTT_DEFAULT_HOLDOFF_DELAY 20
+#endif
+
+// ms a queued message is held off at most, see setHoldoff()
+#ifndef CANTT_DEFAULT_HOLDOFF_LIMIT
+#define CANTT_DEFAULT_HOLDOFF_LIMIT CANTT_DEFAULT_HOLDOFF_DELAY
+#endif
 #define CANTT_STATE_TIMEOUT 100
 
 #define CANTT_SINGLE_FRAME (0)
@@ -39,9 +153,20 @@
 #define CANTT_FLOWCTRL_FRAME (3)
 
 #define CANTT_MSG_PUBLISH 0x03
+#define CANTT_MSG_ALIAS 0x04         // alias announcement
+#define CANTT_MSG_PUBLISH_ALIAS 0x05 // publish with the alias of the topic
+#define CANTT_MSG_MULTI 0x06         // several messages, see setCoalescing()
 
 #define CANTT_SEND_TIMEOUT 5000
 
+// nextTimeout() when there is nothing to wait for
+#define CANTT_NO_TIMEOUT 0xFFFFFFFF
+
+// send()/publish() status
+#define CANTT_OK 0
+#define CANTT_ERR_INVALID 1
+#define CANTT_ERR_QUEUE_FULL 2
+
 #define FRAME_TYPE(x) (x >> 4)
 
 #if (PLATFORM_ID == 0)
@@ -51,18 +176,118 @@ struct CANMessage {
     bool extended;
     bool rtr;
     uint8_t len;
-    uint8_t data[8];
+    uint8_t data[CANTT_FRAME_DATASIZE];
 };
 
 #endif
 
+// Inclusive range of CAN ids
+struct CANTTrange {
+    uint32_t first;
+    uint32_t last;
+};
+
+// Pacing a receiver asked for in its flow control announcement
+struct CANTTpeer {
+    uint32_t address;
+    uint32_t seen;      // ms, last announcement
+    uint8_t blockSize;  // frames sent back to back, 0 for no limit
+    uint8_t separation; // STmin between two frames, ISO 15765-2 encoding
+    uint8_t pause;      // ms to wait after blockSize frames
+    bool active;
+};
+
+// View into a receive buffer, not NUL terminated
+struct CANTTspan {
+    const uint8_t *data;
+    uint16_t len;
+};
+
 struct CANTTbuf {
     uint32_t address;
-    struct CANMessage can;
     uint16_t size;
     uint16_t message_pos;
-    uint8_t message[CANTT_MAX_RECV_BUFFER];
+    uint8_t *message;
+    uint16_t frameCounter;
+    uint32_t enqueued;
+    uint32_t queued; // us, for the send histogram
+    uint16_t sequence; // queue order, see selectTX()
+    uint8_t transfer; // 29-bit ids, sequence number of the transfer
+};
+
+struct CANTTslot {
+    uint32_t address;
+    uint16_t size;
+    uint16_t message_pos;
     uint16_t frameCounter;
+    uint8_t chunk; // data bytes per consecutive frame
+    uint32_t lastActive;
+    uint32_t started; // us, First frame
+    struct CANTTmatch match; // subscription filter on the topic
+    uint8_t next;  // hash chain, or free list
+    uint8_t newer; // LRU list
+    uint8_t older;
+    uint16_t blocks; // pool blocks held by message
+    uint8_t *message;
+};
+
+// Storage handed to CANTTBase by BasicCANTT
+struct CANTTmemory {
+    struct CANTTslot *rxSlots;
+    uint8_t rxSlotCount;
+    uint8_t *rxBlocks; // rxBlockCount blocks of CANTT_BLOCK_SIZE bytes
+    uint8_t *rxBlockMap;
+    uint16_t rxBlockCount;
+    struct CANTTbuf *txQueue;
+    uint8_t *txBuffers; // txQueueSize buffers of maxMessage bytes
+    uint8_t txQueueSize;
+    uint16_t maxMessage;
+};
+
+/*
+ * Fixed-capacity table of in-flight multi-frame messages, keyed by the CAN
+ * id of the sender. Lookups go through a small hash table, the slots are
+ * kept in least-recently-used order so that a full table evicts the
+ * stalest transfer and timeouts only ever need to look at the oldest slot.
+ */
+class CANTTReassembly {
+  public:
+    CANTTReassembly();
+
+    void attach(struct CANTTslot *slots, uint8_t capacity, uint8_t *blocks,
+                uint8_t *blockMap, uint16_t blockCount);
+    void clear();
+
+    struct CANTTslot *find(uint32_t address);
+    struct CANTTslot *acquire(uint32_t address, uint32_t now);
+    void release(struct CANTTslot *slot);
+    void touch(struct CANTTslot *slot, uint32_t now);
+    bool reserve(struct CANTTslot *slot, uint16_t length);
+    uint8_t expire(uint32_t now, uint32_t timeout);
+    uint32_t nextExpiry(uint32_t now, uint32_t timeout) const;
+
+    uint8_t active() const { return this->used; }
+    uint8_t capacity() const { return this->slotCount; }
+    const CANTTBlockPool &pool() const { return this->blockPool; }
+
+    uint32_t hits;      // frames that found their transfer
+    uint32_t misses;    // consecutive frames without a transfer
+    uint32_t evictions; // transfers dropped to make room
+    uint32_t timeouts;  // transfers dropped after going silent
+
+  private:
+    uint8_t hash(uint32_t address) const;
+    uint8_t lookup(uint32_t address) const;
+    void unlink(uint8_t index);
+
+    struct CANTTslot *slots;
+    uint8_t slotCount;
+    uint8_t buckets[CANTT_RX_HASH_SIZE];
+    CANTTBlockPool blockPool;
+    uint8_t freeList;
+    uint8_t newest;
+    uint8_t oldest;
+    uint8_t used;
 };
 
 enum state_m {
@@ -89,22 +314,81 @@ class CANTransport {
     CANTransport(uint8_t (*canAvailable)(),
           uint8_t (*canRead)(CANMessage &msg),
           uint8_t (*canSend)(const CANMessage &msg));
+    virtual ~CANTransport() {}
+
+    void setFilterHook(uint8_t (*canFilter)(uint8_t, uint32_t, uint32_t, bool),
+                       uint8_t count);
+    void setBatchHooks(uint8_t (*canReadBatch)(CANMessage *, uint8_t),
+                       uint8_t (*canSendBatch)(const CANMessage *, uint8_t));
+
+    // Backends that need per-instance state (sockets, drivers) override
+    // these instead of supplying function pointers.
+    virtual uint8_t available();
+    virtual uint8_t receive(CANMessage &msg);
+    virtual uint8_t transmit(const CANMessage &msg);
+    virtual uint8_t readBatch(CANMessage *msgs, uint8_t max);
+    virtual uint8_t sendBatch(const CANMessage *msgs, uint8_t count);
+    virtual uint8_t filters();
+    virtual uint8_t setFilter(uint8_t index, uint32_t id, uint32_t mask,
+                              bool extended);
 
     uint8_t (*canAvailable)();
     uint8_t (*canRead)(CANMessage &msg);
     uint8_t (*canSend)(const CANMessage &msg);
-    void (*canCallback)(uint32_t, uint8_t *, unsigned int);
+    void (*canCallback)(uint32_t, uint8_t *, uint16_t);
+    uint8_t (*canReadBatch)(CANMessage *msgs, uint8_t max);
+    uint8_t (*canSendBatch)(const CANMessage *msgs, uint8_t count);
+    uint8_t (*canFilter)(uint8_t index, uint32_t id, uint32_t mask,
+                         bool extended);
+    uint8_t canFilterCount;
+
+  protected:
+    CANTransport();
 };
 
-class CANTT {
+/*
+ * The protocol engine. It works on storage owned by BasicCANTT, so the code
+ * is shared by every instance whatever its sizing.
+ */
+class CANTTBase {
   public:
-    CANTT(uint32_t canAddr, CANTransport &cantr, void (*callback)(uint32_t, uint8_t *, uint16_t, uint8_t *, uint16_t));
-    CANTT(uint32_t canAddr, uint32_t timeout, CANTransport &cantr, void (*callback)(uint32_t, uint8_t *, uint16_t, uint8_t *, uint16_t));
-
     void begin();
-    void loop();
-
-    void setAddr(uint32_t addr, bool isExt, bool isRTR);
+    int loop();
+    void setBudget(uint16_t rxBudget, uint16_t txBudget);
+    void setHandler(void (*handler)(void *, uint32_t, CANTTspan, CANTTspan),
+                    void *context);
+
+    uint32_t nextTimeout();
+    bool txReady();
+
+    const CANTTReassembly &reassembly() const { return this->rxTable; }
+    const CANTTAliases &aliases() const { return this->rxAliases; }
+    uint16_t maxMessageSize() const { return this->maxMessage; }
+    uint32_t address() const { return this->canAddr; }
+    bool extended() const { return this->extendedIds; }
+    const CANTTStats &stats() const { return this->statistics; }
+    void resetStats();
+    int setStatsPublish(const char *topic, uint16_t interval);
+    uint8_t pending();
+    void setDeadline(uint8_t priorityClass, uint16_t deadline);
+    void setHoldoff(uint16_t delay, uint16_t limit);
+
+    int acceptRange(uint32_t first, uint32_t last);
+    int acceptAll();
+
+    int subscribe(const char *filter);
+    int unsubscribe(const char *filter);
+    void unsubscribeAll();
+
+    int addAlias(char *topic);
+    int addAlias(uint32_t priority, uint8_t *topic, uint16_t topic_len);
+    void clearAliases();
+
+    void setCoalescing(uint16_t bytes, uint16_t ms);
+
+    int setAddr(uint32_t addr, bool isExt, bool isRTR);
+    int setFD(bool enabled);
+    int setPacing(uint8_t blockSize, uint8_t separation, uint8_t pause);
 
     int send(uint8_t *payload, uint16_t length);
     int send(uint32_t addr, uint8_t *payload, uint16_t length);
@@ -116,19 +400,56 @@ class CANTT {
                 uint8_t *payload, uint16_t payload_len);
     int publish(uint32_t priority, char *topic, char *payload);
 
+  protected:
+    CANTTBase(const struct CANTTmemory &memory, uint32_t canAddr,
+              uint32_t timeout, CANTransport &cantr,
+              void (*callback)(uint32_t, uint8_t *, uint16_t, uint8_t *,
+                               uint16_t));
+    CANTTBase(const struct CANTTmemory &memory, uint32_t canAddr,
+              uint32_t timeout, CANTransport &cantr,
+              void (*callback)(uint32_t, CANTTspan, CANTTspan));
+    CANTTBase(const struct CANTTmemory &memory, uint32_t canAddr,
+              uint32_t timeout, CANTransport &cantr,
+              void (*handler)(void *, uint32_t, CANTTspan, CANTTspan),
+              void *context);
+
   private:
     enum state_m stateMachine;
 
     void
-    initialize(uint32_t canAddr, uint32_t timeout,
-               CANTransport &cantr,
+    initialize(const struct CANTTmemory &memory, uint32_t canAddr,
+               uint32_t timeout, CANTransport &cantr,
                void (*callback)(uint32_t, uint8_t *, uint16_t, 
                                 uint8_t *, uint16_t));
 
+    int reserve(uint32_t addr, uint16_t length, struct CANTTbuf **entry);
+
+    int drain();
+    int receiveFrames(uint16_t max);
+    int sendFrames(uint16_t max);
+    void collision();
+    enum state_m parseFrame();
+    int sendNext();
+
+    bool filterTopic(struct CANTTslot *slot, uint16_t from);
+    int applyFilters();
+
+    void updateAliases(uint32_t now);
+    uint8_t aliasMatch(struct CANTTalias *alias);
+
+    void updateStats(uint32_t now);
+
+    uint8_t *coalesce(uint32_t priority, uint16_t length);
+    void closeBatch();
+    void updateBatch(uint32_t now);
+
     void parseSingle();
     void parseFirst();
-    int parseConsecutive();
+    int parseConsecutive(struct CANTTslot *slot);
 
+    uint8_t buildFrame(const struct CANTTbuf *entry, uint16_t pos,
+                       uint16_t counter, struct CANMessage &frame);
+    bool isSingle(const struct CANTTbuf *entry);
     int sendSingle();
     int sendFirst();
     int sendConsecutive();
@@ -136,35 +457,102 @@ class CANTT {
     int recvMessage();
     int sendMessage();
 
+    void updateFlow(uint32_t now);
+    int announceFlow();
+    void parseFlow();
+    void applyPacing();
+    void paced(uint8_t frames);
+    uint32_t paceWait();
+
+    uint32_t ownPriority();
+    uint32_t frameId(const struct CANTTbuf *entry);
+    void numberTX();
+    uint32_t sender(uint32_t id);
+    bool foreign();
+
+    bool selectTX();
+    uint16_t deadlineOf(const struct CANTTbuf *entry);
+    uint32_t holdoffRelease(const struct CANTTbuf *entry);
+    bool heldOff(const struct CANTTbuf *entry, uint32_t now);
+    uint32_t holdoffWait(uint32_t now);
     bool hasOutgoingMessage();
     bool inReception();
     bool inTransmission();
     void clearRX();
     void clearTX();
-    void rewindTX();
 
-    int decode(uint32_t addr, uint8_t *data, uint16_t len);
+    int decode(uint32_t addr, const uint8_t *data, uint16_t len);
+    int dispatch(uint32_t addr, struct CANTTspan topic,
+                 struct CANTTspan payload);
 
     void changeState(enum state_m s);
 
     int waitUntilIdle();
 
     uint32_t canAddr;
-
-    // FIXME: need a specific buffer for single message,
-    // to allow single messages to be sent without overwriting the
-    // long message buffer.
-    struct CANTTbuf rx;
-    struct CANTTbuf tx;
-
-    /*
-      void parseFlow();
-      int sendFlowFrame(long unsigned int arbId, uint8_t fc_flag, uint8_t
-      block_size, uint8_t separation_time);
-
-      uint8_t block_size;
-      int16_t flowExpected;
-    */
+    bool extendedIds; // 29-bit ids, see setAddr()
+
+    struct CANMessage rxFrame;
+    CANTTReassembly rxTable;
+    CANTTSubscriptions subscriptions;
+    struct CANTTrange acceptRanges[CANTT_MAX_ACCEPT_RANGES];
+    uint8_t acceptCount;
+    bool prefiltered; // topic of the message being decoded already matched
+
+    struct CANMessage txFrame;
+    uint8_t frameLength; // data bytes of the frames we send, 8 or 64
+    struct CANTTbuf *txQueue;
+    struct CANTTbuf *tx; // the message being sent
+    uint8_t txQueueSize;
+    uint8_t txCount;
+    uint16_t txSequence;
+    uint8_t txTransfer; // next sequence number of a 29-bit id
+    uint32_t txLast; // ms, last frame handed to the transport
+    uint16_t deadlines[CANTT_PRIORITY_CLASSES];
+
+    bool holdoff;
+    uint32_t holdoffAddr;
+    uint32_t holdoffStart;
+    uint16_t holdoffDelay; // ms, 0 to never hold off
+    uint16_t holdoffLimit; // ms, 0 for no limit
+
+    // What we announce to senders, see setPacing()
+    uint8_t flowBlockSize;
+    uint8_t flowSeparation;
+    uint8_t flowPause;
+    bool flowDue;          // announce at the next loop()
+    uint32_t flowAnnounced; // ms
+
+    // What we honour as a sender, the most restrictive of the peers
+    struct CANTTpeer peers[CANTT_MAX_PEERS];
+    uint8_t paceBlockSize;
+    uint32_t paceSeparation; // us
+    uint32_t pacePause;      // us
+    uint8_t paceCount;       // frames sent in the current block
+    uint32_t paceLast;       // us, last frame sent
+    uint32_t paceDelay;      // us to wait after it
+
+    CANTTAliases rxAliases; // announced by other nodes
+    CANTTAliases txAliases; // of our own topics
+    uint32_t aliasAnnounced; // ms
+
+    // publish() coalescing, see setCoalescing()
+    uint16_t coalesceBytes;
+    uint16_t coalesceTime;
+    struct CANTTbuf *batch; // queued, but not sent before it is closed
+    uint8_t batchRecords;
+    uint32_t batchOpened; // ms
+
+    // Statistics, and their publishing, see setStatsPublish()
+    CANTTStats statistics;
+    const char *statsTopic;
+    uint16_t statsInterval;
+    uint32_t statsPublished; // ms
+
+    uint16_t rxBudget;
+    uint16_t txBudget;
+
+    uint16_t maxMessage;
 
     uint8_t wait_time;
     uint32_t timeOutTimer;
@@ -172,6 +560,98 @@ class CANTT {
 
     CANTransport *cantr;
     void (*callback)(uint32_t, uint8_t *, uint16_t, uint8_t *, uint16_t);
+    void (*spanCallback)(uint32_t, CANTTspan, CANTTspan);
+    void (*handler)(void *, uint32_t, CANTTspan, CANTTspan);
+    void *handlerContext;
 };
 
+/*
+ * Buffers of a BasicCANTT. A base class of it rather than a member, so that
+ * it exists before CANTTBase is constructed on top of it.
+ */
+template <uint32_t MaxMessage, uint32_t RxSlots, uint32_t TxDepth,
+          uint32_t RxBlocks>
+class CANTTStorage {
+  protected:
+    struct CANTTmemory memory() {
+        struct CANTTmemory m;
+
+        m.rxSlots = this->rxSlots;
+        m.rxSlotCount = RxSlots;
+        m.rxBlocks = this->rxBlocks;
+        m.rxBlockMap = this->rxBlockMap;
+        m.rxBlockCount = RxBlocks;
+        m.txQueue = this->txQueue;
+        m.txBuffers = &this->txBuffers[0][0];
+        m.txQueueSize = TxDepth;
+        m.maxMessage = MaxMessage;
+
+        return m;
+    }
+
+    struct CANTTslot rxSlots[RxSlots];
+    uint8_t rxBlocks[RxBlocks * CANTT_BLOCK_SIZE];
+    uint8_t rxBlockMap[(RxBlocks + 7) / 8];
+    struct CANTTbuf txQueue[TxDepth];
+    uint8_t txBuffers[TxDepth][MaxMessage];
+};
+
+/*
+ * A CANTT instance sized at compile time.
+ *
+ * MaxMessage is the largest message that can be sent or received, RxSlots
+ * the number of multi-frame messages reassembled at the same time and
+ * TxDepth the number of messages send()/publish() can queue. Reassembly
+ * buffers come from a pool of RxBlocks blocks of CANTT_BLOCK_SIZE bytes,
+ * by default enough for every slot to hold a message of MaxMessage bytes.
+ */
+template <uint32_t MaxMessage, uint32_t RxSlots, uint32_t TxDepth,
+          uint32_t RxBlocks = RxSlots * CANTT_BLOCKS(MaxMessage)>
+class BasicCANTT
+    : private CANTTStorage<MaxMessage, RxSlots, TxDepth, RxBlocks>,
+      public CANTTBase {
+    static_assert(MaxMessage >= CANTT_CAN_DATASIZE,
+                  "MaxMessage must hold at least one CAN frame");
+    static_assert(MaxMessage <= CANTT_MAX_DATASIZE,
+                  "MaxMessage exceeds the 12-bit CANTT length field");
+    static_assert(RxSlots >= 1 && RxSlots < CANTT_RX_NONE,
+                  "RxSlots must be between 1 and 254");
+    static_assert(TxDepth >= 1 && TxDepth <= 255,
+                  "TxDepth must be between 1 and 255");
+    static_assert(RxBlocks >= CANTT_BLOCKS(MaxMessage),
+                  "RxBlocks must hold at least one message of MaxMessage");
+    static_assert(RxBlocks <= 0xFFFF, "RxBlocks must be at most 65535");
+
+  public:
+    BasicCANTT(uint32_t canAddr, CANTransport &cantr,
+               void (*callback)(uint32_t, uint8_t *, uint16_t, uint8_t *,
+                                uint16_t))
+        : CANTTBase(this->memory(), canAddr, CANTT_STATE_TIMEOUT, cantr,
+                    callback) {}
+    BasicCANTT(uint32_t canAddr, uint32_t timeout, CANTransport &cantr,
+               void (*callback)(uint32_t, uint8_t *, uint16_t, uint8_t *,
+                                uint16_t))
+        : CANTTBase(this->memory(), canAddr, timeout, cantr, callback) {}
+    BasicCANTT(uint32_t canAddr, CANTransport &cantr,
+               void (*callback)(uint32_t, CANTTspan, CANTTspan))
+        : CANTTBase(this->memory(), canAddr, CANTT_STATE_TIMEOUT, cantr,
+                    callback) {}
+    BasicCANTT(uint32_t canAddr, uint32_t timeout, CANTransport &cantr,
+               void (*callback)(uint32_t, CANTTspan, CANTTspan))
+        : CANTTBase(this->memory(), canAddr, timeout, cantr, callback) {}
+    BasicCANTT(uint32_t canAddr, CANTransport &cantr,
+               void (*handler)(void *, uint32_t, CANTTspan, CANTTspan),
+               void *context)
+        : CANTTBase(this->memory(), canAddr, CANTT_STATE_TIMEOUT, cantr,
+                    handler, context) {}
+    BasicCANTT(uint32_t canAddr, uint32_t timeout, CANTransport &cantr,
+               void (*handler)(void *, uint32_t, CANTTspan, CANTTspan),
+               void *context)
+        : CANTTBase(this->memory(), canAddr, timeout, cantr, handler,
+                    context) {}
+};
+
+typedef BasicCANTT<CANTT_MAX_RECV_BUFFER, CANTT_RX_SLOTS, CANTT_TX_QUEUE_SIZE>
+    CANTT;
+
 #endif // cantt.h
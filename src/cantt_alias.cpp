@@ -0,0 +1,233 @@
+/**
+    CANTT Library
+    cantt_alias.cpp
+    Purpose: Table of topic aliases, of our own topics or of those
+    announced by other nodes.
+*/
+
+#include "cantt_alias.h"
+#include "cantt_subscription.h"
+
+#include <string.h>
+
+#ifdef CANTT_ALIASES
+
+/**
+    Constructor for the class object.
+*/
+CANTTAliases::CANTTAliases() {
+    this->nextAlias = 0;
+    this->clear();
+}
+
+/**
+    Forgets every alias
+*/
+void CANTTAliases::clear() {
+    for (uint8_t i = 0; i < CANTT_MAX_ALIASES; i++) {
+        this->entries[i].topicLen = 0;
+    }
+    this->tick = 0;
+    this->used = 0;
+    this->misses = 0;
+    this->evictions = 0;
+}
+
+/**
+    Finds the topic of an alias
+
+    @param address CAN id of the sender
+    @param alias the alias
+    @return the entry, or NULL if the alias is not known
+*/
+struct CANTTalias *CANTTAliases::find(uint32_t address, uint16_t alias) {
+    struct CANTTalias *e = this->search(address, alias);
+
+    if (e == NULL) {
+        this->misses++;
+        return NULL;
+    }
+
+    e->used = ++this->tick;
+
+    return e;
+}
+
+/**
+    Finds an alias without counting it as a use
+
+    @param address CAN id the alias belongs to
+    @param alias the alias
+    @return the entry, or NULL
+*/
+struct CANTTalias *CANTTAliases::search(uint32_t address, uint16_t alias) {
+    for (uint8_t i = 0; i < CANTT_MAX_ALIASES; i++) {
+        struct CANTTalias *e = &this->entries[i];
+
+        if (e->topicLen > 0 && e->address == address && e->alias == alias) {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+    Finds the alias of a topic
+
+    @param address CAN id the topic is sent on
+    @param topic the topic
+    @param len length of the topic
+    @return the entry, or NULL if the topic has no alias
+*/
+struct CANTTalias *CANTTAliases::lookup(uint32_t address, const uint8_t *topic,
+                                        uint16_t len) {
+    for (uint8_t i = 0; i < CANTT_MAX_ALIASES; i++) {
+        struct CANTTalias *e = &this->entries[i];
+
+        if (e->topicLen == len && e->address == address &&
+            memcmp(e->topic, topic, len) == 0) {
+            e->used = ++this->tick;
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+    Picks the entry for a new alias
+
+    @param evict true to replace the least recently used alias when full
+    @return a free entry, or NULL
+*/
+struct CANTTalias *CANTTAliases::slot(bool evict) {
+    struct CANTTalias *oldest = NULL;
+
+    for (uint8_t i = 0; i < CANTT_MAX_ALIASES; i++) {
+        struct CANTTalias *e = &this->entries[i];
+
+        if (e->topicLen == 0) {
+            this->used++;
+            return e;
+        }
+
+        if (oldest == NULL || (int32_t)(e->used - oldest->used) < 0) {
+            oldest = e;
+        }
+    }
+
+    if (!evict) {
+        return NULL;
+    }
+
+    this->evictions++;
+
+    return oldest;
+}
+
+/**
+    Gives one of our topics an alias. The entry is marked due for
+    announcement; it is not announced yet.
+
+    @param address CAN id the topic is sent on
+    @param topic the topic
+    @param len length of the topic
+    @return the entry, or NULL if the topic is too long or the table full
+*/
+struct CANTTalias *CANTTAliases::add(uint32_t address, const uint8_t *topic,
+                                     uint16_t len) {
+    struct CANTTalias *e;
+
+    if (len == 0 || len > CANTT_ALIAS_TOPIC_SIZE) {
+        return NULL;
+    }
+
+    e = this->lookup(address, topic, len);
+    if (e != NULL) {
+        return e;
+    }
+
+    e = this->slot(false);
+    if (e == NULL) {
+        return NULL;
+    }
+
+    // Skip numbers still in use after the counter wrapped
+    while (this->search(address, this->nextAlias) != NULL) {
+        this->nextAlias++;
+    }
+
+    e->address = address;
+    e->used = ++this->tick;
+    e->alias = this->nextAlias++;
+    e->topicLen = len;
+    e->match = CANTT_MATCH_PENDING;
+    e->flags = CANTT_ALIAS_DUE;
+    memcpy(e->topic, topic, len);
+
+    return e;
+}
+
+/**
+    Records an alias announced by another node, replacing an earlier
+    announcement of the same alias
+
+    @param address CAN id of the sender
+    @param alias the alias
+    @param topic the topic
+    @param len length of the topic
+    @return the entry, or NULL if the topic is too long
+*/
+struct CANTTalias *CANTTAliases::learn(uint32_t address, uint16_t alias,
+                                       const uint8_t *topic, uint16_t len) {
+    struct CANTTalias *e;
+
+    if (len == 0 || len > CANTT_ALIAS_TOPIC_SIZE) {
+        return NULL;
+    }
+
+    e = this->search(address, alias);
+    if (e == NULL) {
+        e = this->slot(true);
+    } else if (e->topicLen == len && memcmp(e->topic, topic, len) == 0) {
+        // Repeated announcement, keep the cached match
+        e->used = ++this->tick;
+        return e;
+    }
+
+    e->address = address;
+    e->used = ++this->tick;
+    e->alias = alias;
+    e->topicLen = len;
+    e->match = CANTT_MATCH_PENDING;
+    e->flags = 0;
+    memcpy(e->topic, topic, len);
+
+    return e;
+}
+
+/**
+    Drops the cached subscription matches, after the subscriptions changed
+*/
+void CANTTAliases::invalidate() {
+    for (uint8_t i = 0; i < CANTT_MAX_ALIASES; i++) {
+        this->entries[i].match = CANTT_MATCH_PENDING;
+    }
+}
+
+/**
+    Entry by position, to walk the table
+
+    @param index position, 0 to CANTT_MAX_ALIASES - 1
+    @return the entry, or NULL if it is free
+*/
+struct CANTTalias *CANTTAliases::entry(uint8_t index) {
+    if (index >= CANTT_MAX_ALIASES || this->entries[index].topicLen == 0) {
+        return NULL;
+    }
+
+    return &this->entries[index];
+}
+
+#endif // CANTT_ALIASES
@@ -0,0 +1,128 @@
+#ifndef __CANTT_ALIAS_H__
+#define __CANTT_ALIAS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Topic aliases
+ *
+ * A sender announces a 16-bit alias for a topic it publishes often and
+ * from then on sends the alias instead of the topic. Aliases belong to the
+ * CAN id they were announced on, so receivers key them by sender and
+ * alias. The same table serves both sides: a sender's entries remember
+ * whether the announcement went out, a receiver's entries cache whether
+ * the topic matches the subscriptions.
+ */
+
+/*
+ * Built with CANTT_ALIASES only. Without it the tables hold no alias:
+ * addAlias() fails, announcements of other nodes are ignored and their
+ * aliased messages are counted as misses and dropped.
+ */
+
+// Aliases a table holds, on each side
+#ifndef CANTT_MAX_ALIASES
+#define CANTT_MAX_ALIASES 4
+#endif
+
+// Longest topic that can be given an alias
+#ifndef CANTT_ALIAS_TOPIC_SIZE
+#define CANTT_ALIAS_TOPIC_SIZE 32
+#endif
+
+// ms between two announcements of the same alias, for late joiners
+#ifndef CANTT_ALIAS_INTERVAL
+#define CANTT_ALIAS_INTERVAL 10000
+#endif
+
+#if CANTT_MAX_ALIASES < 1 || CANTT_MAX_ALIASES > 255
+#error "CANTT_MAX_ALIASES must be between 1 and 255"
+#endif
+
+#if CANTT_ALIAS_TOPIC_SIZE < 1 || CANTT_ALIAS_TOPIC_SIZE > 255
+#error "CANTT_ALIAS_TOPIC_SIZE must be between 1 and 255"
+#endif
+
+#define CANTT_ALIAS_ANNOUNCED 0x01 // receivers have been told
+#define CANTT_ALIAS_DUE 0x02       // announcement waiting for the TX queue
+
+struct CANTTalias {
+    uint32_t address; // CAN id the alias was announced on
+    uint32_t used;    // last use, the least recent one is replaced
+    uint16_t alias;
+    uint8_t topicLen; // 0 for a free entry
+    uint8_t match;    // receiver: cached CANTT_MATCH_* of the topic
+    uint8_t flags;    // sender: CANTT_ALIAS_*
+    uint8_t topic[CANTT_ALIAS_TOPIC_SIZE];
+};
+
+#ifdef CANTT_ALIASES
+
+class CANTTAliases {
+  public:
+    CANTTAliases();
+
+    void clear();
+
+    struct CANTTalias *find(uint32_t address, uint16_t alias);
+    struct CANTTalias *lookup(uint32_t address, const uint8_t *topic,
+                              uint16_t len);
+    struct CANTTalias *add(uint32_t address, const uint8_t *topic,
+                           uint16_t len);
+    struct CANTTalias *learn(uint32_t address, uint16_t alias,
+                             const uint8_t *topic, uint16_t len);
+    void invalidate();
+
+    struct CANTTalias *entry(uint8_t index);
+    uint8_t count() const { return this->used; }
+
+    uint32_t misses;    // aliases looked up before they were announced
+    uint32_t evictions; // aliases forgotten to make room
+
+  private:
+    struct CANTTalias *search(uint32_t address, uint16_t alias);
+    struct CANTTalias *slot(bool evict);
+
+    struct CANTTalias entries[CANTT_MAX_ALIASES];
+    uint32_t tick;
+    uint16_t nextAlias;
+    uint8_t used;
+};
+
+#else
+
+class CANTTAliases {
+  public:
+    CANTTAliases() { this->clear(); }
+
+    void clear() {
+        this->misses = 0;
+        this->evictions = 0;
+    }
+
+    struct CANTTalias *find(uint32_t, uint16_t) {
+        this->misses++;
+        return NULL;
+    }
+    struct CANTTalias *lookup(uint32_t, const uint8_t *, uint16_t) {
+        return NULL;
+    }
+    struct CANTTalias *add(uint32_t, const uint8_t *, uint16_t) {
+        return NULL;
+    }
+    struct CANTTalias *learn(uint32_t, uint16_t, const uint8_t *, uint16_t) {
+        return NULL;
+    }
+    void invalidate() {}
+
+    struct CANTTalias *entry(uint8_t) { return NULL; }
+    uint8_t count() const { return 0; }
+
+    uint32_t misses;    // aliased messages dropped
+    uint32_t evictions; // always 0
+};
+
+#endif // CANTT_ALIASES
+
+#endif // cantt_alias.h
@@ -0,0 +1,77 @@
+#ifndef __CANTT_PLATFORM_H__
+#define __CANTT_PLATFORM_H__
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * CANTT platform layer
+ *
+ * Everything CANTT needs from the environment besides the CAN transport:
+ * a millisecond/microsecond clock, a blocking delay and a memory barrier.
+ * Arduino and Particle builds map these onto millis()/micros()/delay(),
+ * POSIX hosts (Linux gateways, benchmarks) use CLOCK_MONOTONIC, or the
+ * clock installed in cantt_host_clock, e.g. by a simulated bus.
+ */
+
+#if !defined(CANTT_HOST) && !defined(ARDUINO) && !defined(SPARK) &&           \
+    (defined(__unix__) || defined(__APPLE__))
+#define CANTT_HOST
+#endif
+
+#ifdef CANTT_HOST
+
+#include <time.h>
+
+// Replaces CLOCK_MONOTONIC when set, returns the time in us
+extern uint64_t (*cantt_host_clock)();
+
+static inline uint32_t cantt_micros() {
+    struct timespec ts;
+
+    if (cantt_host_clock != NULL) {
+        return (uint32_t)cantt_host_clock();
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+static inline uint32_t cantt_millis() {
+    struct timespec ts;
+
+    if (cantt_host_clock != NULL) {
+        return (uint32_t)(cantt_host_clock() / 1000);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static inline void cantt_delay(uint32_t ms) {
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+}
+
+// Other threads may run on other cores
+static inline void cantt_barrier() { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+
+#else
+
+#include "Arduino.h"
+
+static inline uint32_t cantt_micros() { return micros(); }
+static inline uint32_t cantt_millis() { return millis(); }
+static inline void cantt_delay(uint32_t ms) { delay(ms); }
+
+// Single core, an interrupt only needs the compiler to keep the order
+static inline void cantt_barrier() { __asm__ __volatile__("" ::: "memory"); }
+
+#endif
+
+#endif // cantt_platform.h
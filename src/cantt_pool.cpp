@@ -0,0 +1,170 @@
+/**
+    CANTT Library
+    cantt_pool.cpp
+    Purpose: Fixed-size block pool that backs the reassembly buffers, so
+    memory follows the bytes in flight instead of the largest message.
+*/
+
+#include "cantt_pool.h"
+
+#include <string.h>
+
+/**
+    Constructor for the class object.
+*/
+CANTTBlockPool::CANTTBlockPool() {
+    this->arena = NULL;
+    this->map = NULL;
+    this->blockCount = 0;
+    this->highWater = 0;
+    this->failures = 0;
+    this->moves = 0;
+    this->clear();
+}
+
+/**
+    Hands the pool its memory
+
+    @param arena blocks * CANTT_BLOCK_SIZE bytes
+    @param map (blocks + 7) / 8 bytes for the allocation bitmap
+    @param blocks number of blocks
+*/
+void CANTTBlockPool::attach(uint8_t *arena, uint8_t *map, uint16_t blocks) {
+    this->arena = arena;
+    this->map = map;
+    this->blockCount = blocks;
+    this->clear();
+}
+
+/**
+    Returns every block to the pool
+*/
+void CANTTBlockPool::clear() {
+    if (this->map != NULL) {
+        memset(this->map, 0, (this->blockCount + 7) / 8);
+    }
+    this->used = 0;
+}
+
+/**
+    Checks whether a block is allocated
+
+    @param block block number
+    @return true if in use
+*/
+bool CANTTBlockPool::isUsed(uint16_t block) const {
+    return (this->map[block >> 3] & (1 << (block & 7))) != 0;
+}
+
+/**
+    Allocates or frees a run of blocks
+
+    @param first first block of the run
+    @param count number of blocks
+    @param used true to allocate, false to free
+*/
+void CANTTBlockPool::mark(uint16_t first, uint16_t count, bool used) {
+    for (uint16_t b = first; b < first + count; b++) {
+        if (used) {
+            this->map[b >> 3] |= 1 << (b & 7);
+        } else {
+            this->map[b >> 3] &= ~(1 << (b & 7));
+        }
+    }
+
+    if (used) {
+        this->used += count;
+        if (this->used > this->highWater) {
+            this->highWater = this->used;
+        }
+    } else {
+        this->used -= count;
+    }
+}
+
+/**
+    Finds the first run of free blocks of a given length
+
+    @param count number of blocks
+    @return first block of the run, blockCount if there is none
+*/
+uint16_t CANTTBlockPool::findRun(uint16_t count) const {
+    uint16_t length = 0;
+
+    for (uint16_t b = 0; b < this->blockCount; b++) {
+        length = this->isUsed(b) ? 0 : length + 1;
+        if (length == count) {
+            return b + 1 - count;
+        }
+    }
+
+    return this->blockCount;
+}
+
+/**
+    Allocates a buffer or makes it larger
+
+    @param run the buffer, NULL for a new one
+    @param blocks blocks the buffer has now
+    @param wanted blocks the buffer needs
+    @param keep bytes of the buffer to preserve when it has to move
+    @return the buffer, which may have moved, or NULL if the pool has no
+   room left, the old buffer is then left as it was
+*/
+uint8_t *CANTTBlockPool::grow(uint8_t *run, uint16_t blocks, uint16_t wanted,
+                              uint16_t keep) {
+    uint16_t first = 0;
+    uint16_t b;
+    uint8_t *moved;
+
+    if (wanted <= blocks) {
+        return run;
+    }
+
+    if (run != NULL) {
+        first = (run - this->arena) / CANTT_BLOCK_SIZE;
+
+        // Grow in place if the blocks behind the buffer are free
+        for (b = first + blocks; b < first + wanted; b++) {
+            if (b >= this->blockCount || this->isUsed(b)) {
+                break;
+            }
+        }
+
+        if (b == first + wanted) {
+            this->mark(first + blocks, wanted - blocks, true);
+            return run;
+        }
+    }
+
+    b = this->findRun(wanted);
+    if (b == this->blockCount) {
+        this->failures++;
+        return NULL;
+    }
+
+    this->mark(b, wanted, true);
+    moved = this->arena + (uint32_t)b * CANTT_BLOCK_SIZE;
+
+    if (run != NULL) {
+        memcpy(moved, run, keep);
+        this->mark(first, blocks, false);
+        this->moves++;
+    }
+
+    return moved;
+}
+
+/**
+    Returns a buffer to the pool
+
+    @param run the buffer, may be NULL
+    @param blocks blocks the buffer has
+*/
+void CANTTBlockPool::release(uint8_t *run, uint16_t blocks) {
+    if (run == NULL || blocks == 0) {
+        return;
+    }
+
+    this->mark((run - this->arena) / CANTT_BLOCK_SIZE, blocks, false);
+}
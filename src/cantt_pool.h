@@ -0,0 +1,55 @@
+#ifndef __CANTT_POOL_H__
+#define __CANTT_POOL_H__
+
+#include <stdint.h>
+
+/*
+ * Pool of fixed-size blocks for reassembly buffers
+ *
+ * A buffer is a run of adjacent blocks, so a message is always contiguous
+ * and can be handed to the callback without copying. A buffer grows in
+ * place while the next block is free and is moved to a larger free run
+ * when it is not.
+ */
+
+#ifndef CANTT_BLOCK_SIZE
+#define CANTT_BLOCK_SIZE 64
+#endif
+
+#if CANTT_BLOCK_SIZE < 8
+#error "CANTT_BLOCK_SIZE must be at least 8"
+#endif
+
+// Blocks needed for a buffer of the given size
+#define CANTT_BLOCKS(bytes) (((bytes) + CANTT_BLOCK_SIZE - 1) / CANTT_BLOCK_SIZE)
+
+class CANTTBlockPool {
+  public:
+    CANTTBlockPool();
+
+    void attach(uint8_t *arena, uint8_t *map, uint16_t blocks);
+    void clear();
+
+    uint8_t *grow(uint8_t *run, uint16_t blocks, uint16_t wanted,
+                  uint16_t keep);
+    void release(uint8_t *run, uint16_t blocks);
+
+    uint16_t capacity() const { return this->blockCount; }
+    uint16_t inUse() const { return this->used; }
+
+    uint16_t highWater; // most blocks ever in use at once
+    uint32_t failures;  // requests that found no free run
+    uint32_t moves;     // buffers copied to grow
+
+  private:
+    bool isUsed(uint16_t block) const;
+    void mark(uint16_t first, uint16_t count, bool used);
+    uint16_t findRun(uint16_t count) const;
+
+    uint8_t *arena;
+    uint8_t *map; // one bit per block, set when in use
+    uint16_t blockCount;
+    uint16_t used;
+};
+
+#endif // cantt_pool.h
@@ -0,0 +1,129 @@
+/**
+    CANTT Library
+    cantt_ring.cpp
+    Purpose: Single-producer/single-consumer ring of CAN frames, filled
+    from the CAN interrupt and emptied by loop().
+*/
+
+#include "cantt_ring.h"
+#include "cantt_platform.h"
+
+/**
+    Constructor for the class object.
+*/
+CANTTRing::CANTTRing() {
+    this->head = 0;
+    this->tail = 0;
+    this->overruns = 0;
+    this->highWater = 0;
+}
+
+/**
+    Gets the slot for the next frame. Producer side: fill it in and
+    commit() it, or leave it and the frame is never seen.
+
+    @return the slot, or NULL when the ring is full
+*/
+CANMessage *CANTTRing::claim() {
+    cantt_ring_index head = this->head;
+
+    if ((cantt_ring_index)(head - this->tail) >= CANTT_RING_SIZE) {
+        this->overruns++;
+        return NULL;
+    }
+
+    return &this->frames[head & (CANTT_RING_SIZE - 1)];
+}
+
+/**
+    Hands the claimed frame to the consumer. Producer side.
+*/
+void CANTTRing::commit() {
+    cantt_ring_index head = this->head + 1;
+    cantt_ring_index used = head - this->tail;
+
+    // The frame has to be in memory before the consumer can see it
+    cantt_barrier();
+    this->head = head;
+
+    if (used > this->highWater) {
+        this->highWater = used;
+    }
+}
+
+/**
+    Copies a frame into the ring. Producer side.
+
+    @param msg the frame
+    @return false if the ring was full and the frame dropped
+*/
+bool CANTTRing::push(const CANMessage &msg) {
+    CANMessage *slot = this->claim();
+
+    if (slot == NULL) {
+        return false;
+    }
+
+    *slot = msg;
+    this->commit();
+
+    return true;
+}
+
+/**
+    Number of frames waiting. Consumer side.
+
+    @return number of frames
+*/
+cantt_ring_index CANTTRing::count() const {
+    return this->head - this->tail;
+}
+
+/**
+    Takes frames out of the ring. Consumer side.
+
+    @param msgs array of at least max frames to fill in
+    @param max number of frames to take at most
+    @return number of frames taken
+*/
+uint8_t CANTTRing::pop(CANMessage *msgs, uint8_t max) {
+    cantt_ring_index tail = this->tail;
+    cantt_ring_index head = this->head;
+    uint8_t count = 0;
+
+    // Read the frames only after the head that covers them
+    cantt_barrier();
+
+    while (count < max && tail != head) {
+        msgs[count++] = this->frames[tail & (CANTT_RING_SIZE - 1)];
+        tail++;
+    }
+
+    // The frames have to be copied before the producer may reuse the slots
+    cantt_barrier();
+    this->tail = tail;
+
+    return count;
+}
+
+/**
+    Constructor for the class object.
+
+    @param canSend pointer to function that sends a frame
+*/
+CANRingTransport::CANRingTransport(uint8_t (*canSend)(const CANMessage &msg))
+    : CANTransport() {
+    this->canSend = canSend;
+}
+
+uint8_t CANRingTransport::available() {
+    return this->ring.count() > 0 ? 1 : 0;
+}
+
+uint8_t CANRingTransport::receive(CANMessage &msg) {
+    return this->ring.pop(&msg, 1) == 1 ? 0 : 1;
+}
+
+uint8_t CANRingTransport::readBatch(CANMessage *msgs, uint8_t max) {
+    return this->ring.pop(msgs, max);
+}
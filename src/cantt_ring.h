@@ -0,0 +1,78 @@
+#ifndef __CANTT_RING_H__
+#define __CANTT_RING_H__
+
+#include "cantt.h"
+
+/*
+ * Lock-free receive ring between a CAN interrupt and loop()
+ *
+ * One producer (the interrupt handler of the CAN controller) and one
+ * consumer (loop()). Each side only writes its own index, and the frame
+ * is written before the head that makes it visible, so neither side ever
+ * has to disable interrupts. Frames that arrive while the ring is full are
+ * dropped and counted, the controller is still emptied.
+ */
+
+// Frames the ring holds, a power of two. Fewer on AVR, where each takes
+// 15 of the 2 KB of SRAM of an UNO.
+#ifndef CANTT_RING_SIZE
+#if defined(__AVR__)
+#define CANTT_RING_SIZE 16
+#else
+#define CANTT_RING_SIZE 32
+#endif
+#endif
+
+#if CANTT_RING_SIZE < 2 || (CANTT_RING_SIZE & (CANTT_RING_SIZE - 1)) != 0
+#error "CANTT_RING_SIZE must be a power of two"
+#endif
+
+// The indices run freely and must be read in one access, a single byte on
+// 8-bit MCUs
+#if CANTT_RING_SIZE <= 128
+typedef uint8_t cantt_ring_index;
+#elif defined(__AVR__)
+#error "CANTT_RING_SIZE must be at most 128 on AVR"
+#else
+typedef uint16_t cantt_ring_index;
+#endif
+
+class CANTTRing {
+  public:
+    CANTTRing();
+
+    // Producer, called from the interrupt handler
+    CANMessage *claim();
+    void commit();
+    bool push(const CANMessage &msg);
+
+    // Consumer
+    cantt_ring_index count() const;
+    uint8_t pop(CANMessage *msgs, uint8_t max);
+
+    volatile uint32_t overruns;          // frames dropped on a full ring
+    volatile cantt_ring_index highWater; // most frames waiting at once
+
+  private:
+    CANMessage frames[CANTT_RING_SIZE];
+    volatile cantt_ring_index head; // written by the producer only
+    volatile cantt_ring_index tail; // written by the consumer only
+};
+
+/*
+ * CANTransport that receives from a CANTTRing filled by an interrupt
+ * handler and sends through a function pointer. Run CANTT with
+ * setBudget() so that loop() empties the ring in batches.
+ */
+class CANRingTransport : public CANTransport {
+  public:
+    CANRingTransport(uint8_t (*canSend)(const CANMessage &msg));
+
+    uint8_t available();
+    uint8_t receive(CANMessage &msg);
+    uint8_t readBatch(CANMessage *msgs, uint8_t max);
+
+    CANTTRing ring;
+};
+
+#endif // cantt_ring.h
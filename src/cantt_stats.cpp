@@ -0,0 +1,186 @@
+/**
+    CANTT Library
+    cantt_stats.cpp
+    Purpose: Counters and latency histograms of a CANTT instance.
+*/
+
+#include "cantt_stats.h"
+
+#include <string.h>
+
+/**
+    Constructor for the class object.
+*/
+CANTTStats::CANTTStats() { this->clear(); }
+
+/**
+    Sets every counter and histogram back to zero
+*/
+void CANTTStats::clear() {
+    this->framesReceived = 0;
+    this->framesSent = 0;
+    this->messagesReceived = 0;
+    this->messagesSent = 0;
+    this->collisions = 0;
+    this->holdoffs = 0;
+    this->stateTimeouts = 0;
+    this->rejected = 0;
+
+    memset(&this->reassembly, 0, sizeof(this->reassembly));
+    memset(&this->send, 0, sizeof(this->send));
+    memset(&this->callback, 0, sizeof(this->callback));
+}
+
+/**
+    Adds a duration to a histogram
+
+    @param h the histogram
+    @param us the duration in us
+*/
+void CANTTStats::record(struct CANTThistogram &h, uint32_t us) {
+#ifdef CANTT_STATS_HISTOGRAMS
+    uint8_t bucket = 0;
+
+    // Bucket = number of significant bits, capped at the last one
+    for (uint32_t v = us; v > 0 && bucket < CANTT_STATS_BUCKETS - 1; v >>= 1) {
+        bucket++;
+    }
+
+    h.buckets[bucket]++;
+#endif
+    h.count++;
+    if (us > h.max) {
+        h.max = us;
+    }
+}
+
+/**
+    Upper limit of a bucket
+
+    @param bucket the bucket
+    @return the longest duration in us the bucket counts, 0xFFFFFFFF for
+   the last one
+*/
+uint32_t CANTTStats::bucketLimit(uint8_t bucket) {
+    if (bucket >= CANTT_STATS_BUCKETS - 1 || bucket >= 32) {
+        return 0xFFFFFFFF;
+    }
+
+    return ((uint32_t)1 << bucket) - 1;
+}
+
+/**
+    Estimates a percentile of a histogram
+
+    @param h the histogram
+    @param pct the percentile, 0 to 100
+    @return the upper limit in us of the bucket the percentile falls in,
+   never more than the longest duration recorded, 0 for an empty histogram
+   or if built without CANTT_STATS_HISTOGRAMS
+*/
+uint32_t CANTTStats::percentile(const struct CANTThistogram &h, uint8_t pct) {
+#ifdef CANTT_STATS_HISTOGRAMS
+    uint32_t rank;
+    uint32_t seen = 0;
+
+    if (h.count == 0) {
+        return 0;
+    }
+
+    // Rank of the duration asked for, 1-based and rounded up
+    rank = (uint32_t)(((uint64_t)h.count * pct + 99) / 100);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (uint8_t i = 0; i < CANTT_STATS_BUCKETS; i++) {
+        seen += h.buckets[i];
+
+        if (seen >= rank) {
+            uint32_t limit = CANTTStats::bucketLimit(i);
+
+            return limit < h.max ? limit : h.max;
+        }
+    }
+
+    return h.max;
+#else
+    (void)h;
+    (void)pct;
+
+    return 0;
+#endif
+}
+
+/**
+    Writes a value little-endian
+
+    @param buf where to write it
+    @param value the value
+    @return bytes written
+*/
+static uint8_t put32(uint8_t *buf, uint32_t value) {
+    buf[0] = value & 0xFF;
+    buf[1] = (value >> 8) & 0xFF;
+    buf[2] = (value >> 16) & 0xFF;
+    buf[3] = (value >> 24) & 0xFF;
+
+    return 4;
+}
+
+/**
+    Writes the summary of a histogram: count, 50th and 99th percentile and
+    maximum
+
+    @param buf where to write it, 16 bytes
+    @param h the histogram
+    @return bytes written
+*/
+static uint8_t putHistogram(uint8_t *buf, const struct CANTThistogram &h) {
+    uint8_t n = 0;
+
+    n += put32(&buf[n], h.count);
+    n += put32(&buf[n], CANTTStats::percentile(h, 50));
+    n += put32(&buf[n], CANTTStats::percentile(h, 99));
+    n += put32(&buf[n], h.max);
+
+    return n;
+}
+
+/**
+    Writes a snapshot for other nodes: the version and flags bytes, then
+    the counters in the order they are declared and a summary of each
+    histogram, all little-endian uint32_t. Without the buckets the flags
+    leave out CANTT_STATS_PERCENTILES and the percentiles are 0.
+
+    @param buf where to write it
+    @param size room in buf, at least CANTT_STATS_SIZE
+    @return bytes written, 0 if there was not enough room
+*/
+uint16_t CANTTStats::encode(uint8_t *buf, uint16_t size) const {
+    uint16_t n = 0;
+
+    if (size < CANTT_STATS_SIZE) {
+        return 0;
+    }
+
+    buf[n++] = CANTT_STATS_VERSION;
+#ifdef CANTT_STATS_HISTOGRAMS
+    buf[n++] = CANTT_STATS_PERCENTILES;
+#else
+    buf[n++] = 0;
+#endif
+    n += put32(&buf[n], this->framesReceived);
+    n += put32(&buf[n], this->framesSent);
+    n += put32(&buf[n], this->messagesReceived);
+    n += put32(&buf[n], this->messagesSent);
+    n += put32(&buf[n], this->collisions);
+    n += put32(&buf[n], this->holdoffs);
+    n += put32(&buf[n], this->stateTimeouts);
+    n += put32(&buf[n], this->rejected);
+    n += putHistogram(&buf[n], this->reassembly);
+    n += putHistogram(&buf[n], this->send);
+    n += putHistogram(&buf[n], this->callback);
+
+    return n;
+}
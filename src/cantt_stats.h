@@ -0,0 +1,76 @@
+#ifndef __CANTT_STATS_H__
+#define __CANTT_STATS_H__
+
+#include <stdint.h>
+
+/*
+ * Runtime statistics
+ *
+ * Counters of what loop() did, and histograms of how long it took. A
+ * histogram has power-of-two buckets of microseconds: bucket 0 counts
+ * durations under 1 us, bucket i those from 2^(i-1) up to 2^i us, and the
+ * last bucket everything longer, so a few bytes cover anything from a
+ * callback to a transfer that waited seconds for the bus.
+ */
+
+/*
+ * The buckets are built with CANTT_STATS_HISTOGRAMS only. Without it a
+ * histogram keeps its count and longest duration, and percentile() gives 0.
+ */
+
+// Buckets per histogram, the last one takes durations of 2^(n-2) us and up
+#ifndef CANTT_STATS_BUCKETS
+#define CANTT_STATS_BUCKETS 20
+#endif
+
+#if CANTT_STATS_BUCKETS < 2 || CANTT_STATS_BUCKETS > 33
+#error "CANTT_STATS_BUCKETS must be between 2 and 33"
+#endif
+
+// Version of the snapshot written by CANTTStats::encode()
+#define CANTT_STATS_VERSION 2
+
+// Flags byte of a snapshot
+#define CANTT_STATS_PERCENTILES 0x01 // p50 and p99 are set, 0 without
+
+// Counters in a snapshot, 4 bytes each
+#define CANTT_STATS_COUNTERS 8
+
+// Bytes written by CANTTStats::encode()
+#define CANTT_STATS_SIZE (2 + CANTT_STATS_COUNTERS * 4 + 3 * 16)
+
+struct CANTThistogram {
+    uint32_t count;
+    uint32_t max; // us, longest duration recorded
+#ifdef CANTT_STATS_HISTOGRAMS
+    uint32_t buckets[CANTT_STATS_BUCKETS];
+#endif
+};
+
+class CANTTStats {
+  public:
+    CANTTStats();
+
+    void clear();
+
+    static void record(struct CANTThistogram &h, uint32_t us);
+    static uint32_t percentile(const struct CANTThistogram &h, uint8_t pct);
+    static uint32_t bucketLimit(uint8_t bucket);
+
+    uint16_t encode(uint8_t *buf, uint16_t size) const;
+
+    uint32_t framesReceived;
+    uint32_t framesSent;
+    uint32_t messagesReceived; // single frame and reassembled
+    uint32_t messagesSent;
+    uint32_t collisions;    // frames of others while we had one to send
+    uint32_t holdoffs;      // times our transmissions were held off
+    uint32_t stateTimeouts; // state machine reset after CANTT_STATE_TIMEOUT
+    uint32_t rejected;      // messages refused for their size, either way
+
+    struct CANTThistogram reassembly; // First frame to complete message
+    struct CANTThistogram send;       // queued to last frame sent
+    struct CANTThistogram callback;   // time spent in the callbacks
+};
+
+#endif // cantt_stats.h
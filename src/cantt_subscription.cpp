@@ -0,0 +1,374 @@
+/**
+    CANTT Library
+    cantt_subscription.cpp
+    Purpose: Topic subscriptions with MQTT style '+' and '#' wildcards,
+    matched incrementally as the topic arrives.
+*/
+
+#include "cantt_subscription.h"
+
+#include <string.h>
+
+#ifdef CANTT_SUBSCRIPTIONS
+
+/**
+    Constructor for the class object.
+*/
+CANTTSubscriptions::CANTTSubscriptions() { this->clear(); }
+
+/**
+    Removes every subscription. With no subscriptions every topic is
+    accepted.
+*/
+void CANTTSubscriptions::clear() {
+    this->rootMask = 0;
+    this->rootFlags = 0;
+    this->used = 0;
+    this->poolUsed = 0;
+    this->count = 0;
+}
+
+/**
+    Finds the node for a topic level among a set of siblings
+
+    @param mask the siblings
+    @param token the topic level
+    @param len length of the topic level
+    @param flags CANTT_SUB_PLUS for a '+' level, otherwise 0
+    @return node index or -1
+*/
+int8_t CANTTSubscriptions::find(uint32_t mask, const char *token, uint8_t len,
+                                uint8_t flags) const {
+    for (uint8_t i = 0; i < this->used; i++) {
+        const struct CANTTsubnode *n = &this->nodes[i];
+
+        if (!(mask & (1UL << i)) ||
+            (n->flags & CANTT_SUB_PLUS) != (flags & CANTT_SUB_PLUS)) {
+            continue;
+        }
+
+        if ((flags & CANTT_SUB_PLUS) ||
+            (n->tokenLen == len &&
+             memcmp(&this->pool[n->token], token, len) == 0)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+    Checks a filter and splits off its next level
+
+    @param level start of the level
+    @param len set to the length of the level
+    @param flags set to CANTT_SUB_PLUS, CANTT_SUB_HASH or 0
+    @return true if the level is valid
+*/
+static bool nextLevel(const char *level, uint8_t *len, uint8_t *flags) {
+    const char *end = level;
+
+    while (*end != '\0' && *end != '/') {
+        end++;
+    }
+
+    if (end - level > 255) {
+        return false;
+    }
+
+    *len = end - level;
+    *flags = 0;
+
+    if (*len == 1 && level[0] == '+') {
+        *flags = CANTT_SUB_PLUS;
+    } else if (*len == 1 && level[0] == '#') {
+        // Only valid as the last level
+        *flags = CANTT_SUB_HASH;
+        return *end == '\0';
+    } else if (memchr(level, '+', *len) != NULL ||
+               memchr(level, '#', *len) != NULL) {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+    Adds a subscription
+
+    @param filter topic filter, levels separated by '/', '+' matches one
+   level and '#' as the last level matches any number of levels
+    @return 0 on success, -1 if the filter is invalid or does not fit
+*/
+int CANTTSubscriptions::subscribe(const char *filter) {
+    uint32_t *mask = &this->rootMask;
+    uint8_t *parentFlags = &this->rootFlags;
+    const char *level;
+    uint8_t len;
+    uint8_t flags;
+    uint8_t mark;
+
+    if (filter == NULL) {
+        return -1;
+    }
+
+    for (level = filter;; level += len + 1) {
+        if (!nextLevel(level, &len, &flags)) {
+            return -1;
+        }
+        if (level[len] == '\0') {
+            break;
+        }
+    }
+
+    for (level = filter;; level += len + 1) {
+        int8_t n;
+
+        nextLevel(level, &len, &flags);
+
+        if (flags & CANTT_SUB_HASH) {
+            // No node needed, the parent matches its whole subtree
+            mark = CANTT_SUB_HASHCHILD;
+            break;
+        }
+
+        n = this->find(*mask, level, len, flags);
+        if (n < 0) {
+            if (this->used >= CANTT_SUB_MAX_NODES ||
+                (flags == 0 && this->poolUsed + len > CANTT_SUB_POOL_SIZE)) {
+                return -1;
+            }
+
+            n = this->used++;
+            this->nodes[n].childMask = 0;
+            this->nodes[n].token = this->poolUsed;
+            this->nodes[n].tokenLen = flags == 0 ? len : 0;
+            this->nodes[n].flags = flags;
+            if (flags == 0) {
+                memcpy(&this->pool[this->poolUsed], level, len);
+                this->poolUsed += len;
+            }
+            *mask |= 1UL << n;
+        }
+
+        mask = &this->nodes[n].childMask;
+        parentFlags = &this->nodes[n].flags;
+
+        if (level[len] == '\0') {
+            mark = CANTT_SUB_END;
+            break;
+        }
+    }
+
+    if (!(*parentFlags & mark)) {
+        *parentFlags |= mark;
+        this->count++;
+    }
+
+    return 0;
+}
+
+/**
+    Removes a subscription. The trie nodes are only reclaimed by clear().
+
+    @param filter the filter as given to subscribe()
+    @return 0 on success, -1 if there was no such subscription
+*/
+int CANTTSubscriptions::unsubscribe(const char *filter) {
+    uint32_t mask = this->rootMask;
+    uint8_t *parentFlags = &this->rootFlags;
+    const char *level;
+    uint8_t len;
+    uint8_t flags;
+    uint8_t mark;
+
+    if (filter == NULL) {
+        return -1;
+    }
+
+    for (level = filter;; level += len + 1) {
+        int8_t n;
+
+        if (!nextLevel(level, &len, &flags)) {
+            return -1;
+        }
+
+        if (flags & CANTT_SUB_HASH) {
+            mark = CANTT_SUB_HASHCHILD;
+            break;
+        }
+
+        n = this->find(mask, level, len, flags);
+        if (n < 0) {
+            return -1;
+        }
+
+        mask = this->nodes[n].childMask;
+        parentFlags = &this->nodes[n].flags;
+
+        if (level[len] == '\0') {
+            mark = CANTT_SUB_END;
+            break;
+        }
+    }
+
+    if (!(*parentFlags & mark)) {
+        return -1;
+    }
+
+    *parentFlags &= ~mark;
+    this->count--;
+
+    return 0;
+}
+
+/**
+    Whether a node has matched the whole of the current topic level
+
+    @param node node index
+    @param offset bytes seen of the current level
+*/
+bool CANTTSubscriptions::complete(uint8_t node, uint8_t offset) const {
+    return (this->nodes[node].flags & CANTT_SUB_PLUS) ||
+           this->nodes[node].tokenLen == offset;
+}
+
+/**
+    Moves on to the next topic level
+
+    @param active nodes matching the level that just ended
+    @param offset length of the level that just ended
+    @param accept set if a '#' filter matches from here on
+    @return nodes to match the next level against
+*/
+uint32_t CANTTSubscriptions::descend(uint32_t active, uint8_t offset,
+                                     bool *accept) const {
+    uint32_t next = 0;
+
+    for (uint8_t i = 0; i < this->used; i++) {
+        if ((active & (1UL << i)) && this->complete(i, offset)) {
+            next |= this->nodes[i].childMask;
+            if (this->nodes[i].flags & CANTT_SUB_HASHCHILD) {
+                *accept = true;
+            }
+        }
+    }
+
+    return next;
+}
+
+/**
+    Starts matching a topic
+
+    @param m match state
+*/
+void CANTTSubscriptions::begin(struct CANTTmatch &m) const {
+    m.active = this->rootMask;
+    m.offset = 0;
+
+    if (this->count == 0 || (this->rootFlags & CANTT_SUB_HASHCHILD)) {
+        m.state = CANTT_MATCH_ACCEPT;
+    } else if (m.active == 0) {
+        m.state = CANTT_MATCH_REJECT;
+    } else {
+        m.state = CANTT_MATCH_PENDING;
+    }
+}
+
+/**
+    Matches the next bytes of a topic
+
+    @param m match state
+    @param data the bytes
+    @param len number of bytes
+    @return CANTT_MATCH_PENDING until the topic can no longer match
+   (CANTT_MATCH_REJECT) or matches whatever follows (CANTT_MATCH_ACCEPT)
+*/
+uint8_t CANTTSubscriptions::feed(struct CANTTmatch &m, const uint8_t *data,
+                                 uint16_t len) const {
+    for (uint16_t pos = 0; pos < len && m.state == CANTT_MATCH_PENDING;
+         pos++) {
+        uint8_t c = data[pos];
+
+        if (c == '/') {
+            bool accept = false;
+
+            m.active = this->descend(m.active, m.offset, &accept);
+            m.offset = 0;
+
+            if (accept) {
+                m.state = CANTT_MATCH_ACCEPT;
+                break;
+            }
+        } else {
+            uint32_t keep = 0;
+
+            for (uint8_t i = 0; i < this->used; i++) {
+                const struct CANTTsubnode *n = &this->nodes[i];
+
+                if (!(m.active & (1UL << i))) {
+                    continue;
+                }
+
+                if ((n->flags & CANTT_SUB_PLUS) ||
+                    (m.offset < n->tokenLen &&
+                     (uint8_t)this->pool[n->token + m.offset] == c)) {
+                    keep |= 1UL << i;
+                }
+            }
+
+            m.active = keep;
+            if (m.offset < 255) {
+                m.offset++;
+            }
+        }
+
+        if (m.active == 0) {
+            m.state = CANTT_MATCH_REJECT;
+        }
+    }
+
+    return m.state;
+}
+
+/**
+    Ends matching a topic
+
+    @param m match state
+    @return CANTT_MATCH_ACCEPT or CANTT_MATCH_REJECT
+*/
+uint8_t CANTTSubscriptions::finish(struct CANTTmatch &m) const {
+    if (m.state != CANTT_MATCH_PENDING) {
+        return m.state;
+    }
+
+    m.state = CANTT_MATCH_REJECT;
+
+    for (uint8_t i = 0; i < this->used; i++) {
+        if ((m.active & (1UL << i)) && this->complete(i, m.offset) &&
+            (this->nodes[i].flags & (CANTT_SUB_END | CANTT_SUB_HASHCHILD))) {
+            m.state = CANTT_MATCH_ACCEPT;
+            break;
+        }
+    }
+
+    return m.state;
+}
+
+/**
+    Matches a complete topic
+
+    @param topic the topic
+    @param len length of the topic
+    @return true if any subscription matches
+*/
+bool CANTTSubscriptions::matches(const uint8_t *topic, uint16_t len) const {
+    struct CANTTmatch m;
+
+    this->begin(m);
+    this->feed(m, topic, len);
+
+    return this->finish(m) == CANTT_MATCH_ACCEPT;
+}
+
+#endif // CANTT_SUBSCRIPTIONS
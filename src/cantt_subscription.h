@@ -0,0 +1,114 @@
+#ifndef __CANTT_SUBSCRIPTION_H__
+#define __CANTT_SUBSCRIPTION_H__
+
+#include <stdint.h>
+
+/*
+ * Topic subscriptions with MQTT style wildcards
+ *
+ * Filters are compiled into a trie with one node per topic level, shared
+ * between filters with a common prefix. A topic is matched a byte at a
+ * time, so a receiver can give up on a message as soon as the topic
+ * prefix seen so far can not match any filter.
+ */
+
+/*
+ * Built with CANTT_SUBSCRIPTIONS only. Without it CANTTSubscriptions keeps
+ * no state, every topic is accepted and subscribe() fails.
+ */
+
+// Trie nodes, at most 32 as the matcher tracks them in a bit mask
+#ifndef CANTT_SUB_MAX_NODES
+#define CANTT_SUB_MAX_NODES 16
+#endif
+
+// Bytes for the literal topic levels of all filters
+#ifndef CANTT_SUB_POOL_SIZE
+#define CANTT_SUB_POOL_SIZE 96
+#endif
+
+#if CANTT_SUB_MAX_NODES < 1 || CANTT_SUB_MAX_NODES > 32
+#error "CANTT_SUB_MAX_NODES must be between 1 and 32"
+#endif
+
+#if CANTT_SUB_POOL_SIZE > 255
+#error "CANTT_SUB_POOL_SIZE must be at most 255"
+#endif
+
+#define CANTT_SUB_END 0x01       // a filter ends at this level
+#define CANTT_SUB_PLUS 0x02      // '+', any single level
+#define CANTT_SUB_HASH 0x04      // '#', this and all deeper levels
+#define CANTT_SUB_HASHCHILD 0x08 // has a '#' child, matches here and below
+
+#define CANTT_MATCH_PENDING 0
+#define CANTT_MATCH_ACCEPT 1
+#define CANTT_MATCH_REJECT 2
+
+struct CANTTsubnode {
+    uint32_t childMask;
+    uint8_t token; // offset in the pool
+    uint8_t tokenLen;
+    uint8_t flags;
+};
+
+// State of a topic that is being matched a few bytes at a time
+struct CANTTmatch {
+    uint32_t active; // nodes still matching the current level
+    uint8_t offset;  // bytes seen of the current level
+    uint8_t state;
+};
+
+#ifdef CANTT_SUBSCRIPTIONS
+
+class CANTTSubscriptions {
+  public:
+    CANTTSubscriptions();
+
+    int subscribe(const char *filter);
+    int unsubscribe(const char *filter);
+    void clear();
+
+    bool empty() const { return this->count == 0; }
+
+    void begin(struct CANTTmatch &m) const;
+    uint8_t feed(struct CANTTmatch &m, const uint8_t *data,
+                 uint16_t len) const;
+    uint8_t finish(struct CANTTmatch &m) const;
+    bool matches(const uint8_t *topic, uint16_t len) const;
+
+  private:
+    int8_t find(uint32_t mask, const char *token, uint8_t len,
+                uint8_t flags) const;
+    uint32_t descend(uint32_t active, uint8_t offset, bool *accept) const;
+    bool complete(uint8_t node, uint8_t offset) const;
+
+    struct CANTTsubnode nodes[CANTT_SUB_MAX_NODES];
+    char pool[CANTT_SUB_POOL_SIZE];
+    uint32_t rootMask;
+    uint8_t rootFlags;
+    uint8_t used;
+    uint8_t poolUsed;
+    uint8_t count;
+};
+
+#else
+
+class CANTTSubscriptions {
+  public:
+    int subscribe(const char *) { return -1; }
+    int unsubscribe(const char *) { return -1; }
+    void clear() {}
+
+    bool empty() const { return true; }
+
+    void begin(struct CANTTmatch &m) const { m.state = CANTT_MATCH_ACCEPT; }
+    uint8_t feed(struct CANTTmatch &m, const uint8_t *, uint16_t) const {
+        return m.state;
+    }
+    uint8_t finish(struct CANTTmatch &m) const { return m.state; }
+    bool matches(const uint8_t *, uint16_t) const { return true; }
+};
+
+#endif // CANTT_SUBSCRIPTIONS
+
+#endif // cantt_subscription.h